@@ -2,6 +2,7 @@ TEMPLATE = app
 TARGET = 
 DEPENDPATH += .
 INCLUDEPATH += src
+QT += network
 
 OBJECTS_DIR = build
 MOC_DIR = build
@@ -10,13 +11,22 @@ RCC_DIR = build
 QMAKE_LINK_OBJECT_SCRIPT = build/object_script
 
 # Input
-HEADERS += src/fileinfo.h src/frontend.h src/transcoder.h src/qtimespinbox.h src/util.h
+HEADERS += src/fileinfo.h src/frontend.h src/transcoder.h src/qtimespinbox.h src/util.h src/decoder.h src/scheduler.h src/remote.h src/worker.h src/resultcache.h src/benchmark.h src/ogg.h src/skeleton.h src/remux.h src/verifier.h src/trace.h src/rategraph.h src/stager.h src/retag.h src/watchdog.h src/catalog.h src/library.h src/history.h src/preview.h src/sniff.h src/oggmux.h src/segmenter.h src/scenecut.h src/trimdetect.h
 FORMS += src/dialog.ui
-SOURCES += src/fileinfo.cpp src/frontend.cpp src/main.cpp src/transcoder.cpp src/qtimespinbox.cpp src/util.cpp
+SOURCES += src/fileinfo.cpp src/frontend.cpp src/main.cpp src/transcoder.cpp src/qtimespinbox.cpp src/util.cpp src/decoder.cpp src/scheduler.cpp src/remote.cpp src/worker.cpp src/resultcache.cpp src/benchmark.cpp src/ogg.cpp src/skeleton.cpp src/remux.cpp src/verifier.cpp src/trace.cpp src/rategraph.cpp src/stager.cpp src/retag.cpp src/watchdog.cpp src/catalog.cpp src/library.cpp src/history.cpp src/preview.cpp src/sniff.cpp src/oggmux.cpp src/segmenter.cpp src/scenecut.cpp src/trimdetect.cpp
 RESOURCES += src/resources.qrc
 ICON += src/app.icns
 RC_FILE += src/resources.rc
 
+# Built-in libtheora/libvorbis encoder (qmake CONFIG+=internal_encoder)
+internal_encoder {
+	DEFINES += INTERNAL_ENCODER
+	CONFIG += link_pkgconfig
+	PKGCONFIG += theoraenc vorbisenc ogg
+	HEADERS += src/encoder.h src/prefilter.h src/audiofilter.h
+	SOURCES += src/encoder.cpp src/prefilter.cpp src/audiofilter.cpp
+}
+
 # Install
 target.path = $$(PREFIX)/bin
 INSTALLS += target
@@ -0,0 +1,516 @@
+/*
+ * audiofilter.cpp - resampling, mixing and loudness of decoded audio
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QMutexLocker>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "audiofilter.h"
+
+#define MAX_PHASES 1024
+#define BASE_TAPS 32
+#define MAX_TAPS 256
+#define KAISER_BETA 9.0
+#define CUTOFF 0.95 /* of the lower Nyquist frequency */
+#define CHUNK 4096 /* frames */
+#define MAX_QUEUED 2 /* seconds */
+#define PEAK_CEILING -1.0 /* dBFS */
+
+#define LENGTH(x) int(sizeof(x) / sizeof(*x))
+
+enum Speaker {
+	FL, FR, FC, LFE, BL, BR, BC, SL, SR, NONE
+};
+
+static const Speaker layouts[][8] = {
+	{ NONE },
+	{ FC, NONE },
+	{ FL, FR, NONE },
+	{ NONE },
+	{ NONE },
+	{ FL, FR, FC, BL, BR, NONE },
+	{ FL, FR, FC, LFE, BL, BR, NONE },
+	{ FL, FR, FC, LFE, BC, SL, SR, NONE },
+	{ FL, FR, FC, LFE, BL, BR, SL, SR }
+};
+
+static bool
+known_layout(int channels)
+{
+	return channels > 0 && channels < LENGTH(layouts) && layouts[channels][0] != NONE;
+}
+
+bool
+Downmix::supported(int in, int out)
+{
+	return in > 0 && (in == out || ((out == 1 || out == 2) && known_layout(in)));
+}
+
+/* what a speaker contributes to the left and right of a stereo mix */
+
+static void
+stereo_gains(Speaker s, bool mono_source, float *left, float *right)
+{
+	const float c = float(M_SQRT1_2);
+	*left = *right = 0;
+	switch (s) {
+	case FL: *left = 1; break;
+	case FR: *right = 1; break;
+	case FC: *left = *right = mono_source ? 1 : c; break;
+	case BL: case SL: *left = c; break;
+	case BR: case SR: *right = c; break;
+	case BC: *left = *right = c * c; break;
+	default: break;
+	}
+}
+
+Downmix::Downmix(int in, int out)
+	: in_(in), out_(out), matrix_(in * out, 0.0f)
+{
+	if (!supported(in, out))
+		throw std::runtime_error("Unsupported channel mix");
+	if (in == out) {
+		for (int i = 0; i < in; i++)
+			matrix_[i * in + i] = 1;
+		return;
+	}
+	for (int i = 0; i < in; i++) {
+		float left, right;
+		stereo_gains(layouts[in][i], in == 1, &left, &right);
+		if (out == 1)
+			matrix_[i] = left + right;
+		else {
+			matrix_[i] = left;
+			matrix_[in + i] = right;
+		}
+	}
+	for (int o = 0; o < out; o++) {
+		float sum = 0;
+		for (int i = 0; i < in; i++)
+			sum += fabs(matrix_[o * in + i]);
+		if (sum > 1)
+			for (int i = 0; i < in; i++)
+				matrix_[o * in + i] /= sum;
+	}
+}
+
+void
+Downmix::process(const float *in, int frames, QVector<float> *out) const
+{
+	for (int o = 0; o < out_; o++) {
+		out[o].resize(frames);
+		const float *m = matrix_.constData() + o * in_;
+		float *dst = out[o].data();
+		for (int f = 0; f < frames; f++) {
+			const float *frame = in + f * in_;
+			float sum = 0;
+			for (int i = 0; i < in_; i++)
+				sum += m[i] * frame[i];
+			dst[f] = sum;
+		}
+	}
+}
+
+static int
+gcd(int a, int b)
+{
+	while (b) {
+		int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static double
+bessel_i0(double x)
+{
+	double sum = 1, term = 1;
+	for (int k = 1; term > sum * 1e-12; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+bool
+Resampler::supported(int in_rate, int out_rate)
+{
+	return in_rate > 0 && out_rate > 0 && out_rate / gcd(in_rate, out_rate) <= MAX_PHASES;
+}
+
+/* The input is taken as preceded by silence, so that output frame n
+ * lines up with input time n * in_rate / out_rate.
+ */
+
+Resampler::Resampler(int in_rate, int out_rate, int channels)
+	: channels_(channels), up_(1), down_(1), taps_(0), hist_(channels),
+	hist_pos_(0), in_frames_(0), out_frames_(0)
+{
+	if (!supported(in_rate, out_rate))
+		throw std::runtime_error("Unsupported resampling ratio");
+	int g = gcd(in_rate, out_rate);
+	up_ = out_rate / g;
+	down_ = in_rate / g;
+	if (up_ == down_)
+		return;
+
+	double ratio = qMin(1.0, double(up_) / down_);
+	taps_ = qMin(MAX_TAPS, (int(ceil(BASE_TAPS / ratio)) + 3) & ~3);
+	double fc = CUTOFF * ratio, half = taps_ / 2;
+	coef_.resize(up_ * taps_);
+	for (int p = 0; p < up_; p++) {
+		float *c = coef_.data() + p * taps_;
+		double sum = 0;
+		for (int k = 0; k < taps_; k++) {
+			double d = double(p) / up_ + half - 1 - k, x = d / half;
+			double w = fabs(x) < 1 ? bessel_i0(KAISER_BETA * sqrt(1 - x * x)) / bessel_i0(KAISER_BETA) : 0;
+			double s = d == 0 ? 1 : sin(M_PI * fc * d) / (M_PI * fc * d);
+			c[k] = float(fc * s * w);
+			sum += c[k];
+		}
+		for (int k = 0; k < taps_; k++)
+			c[k] = float(c[k] / sum);
+	}
+	hist_pos_ = -(taps_ / 2 - 1);
+	for (int c = 0; c < channels_; c++)
+		hist_[c].fill(0, taps_ / 2 - 1);
+}
+
+static float
+dot(const float *a, const float *b, int n)
+{
+	int i = 0;
+	float sum = 0;
+#ifdef __SSE2__
+	__m128 acc = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4)
+		acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+	float v[4];
+	_mm_storeu_ps(v, acc);
+	sum = v[0] + v[1] + v[2] + v[3];
+#endif
+	for (; i < n; i++)
+		sum += a[i] * b[i];
+	return sum;
+}
+
+void
+Resampler::process(const QVector<float> *in, int frames, QVector<float> *out)
+{
+	for (int c = 0; c < channels_; c++) {
+		if (up_ == down_)
+			out[c] += in[c].mid(0, frames);
+		else
+			hist_[c] += in[c].mid(0, frames);
+	}
+	in_frames_ += frames;
+	if (up_ != down_)
+		produce(out, false);
+}
+
+void
+Resampler::flush(QVector<float> *out)
+{
+	if (up_ == down_)
+		return;
+	for (int c = 0; c < channels_; c++)
+		hist_[c] += QVector<float>(taps_ / 2, 0.0f);
+	produce(out, true);
+}
+
+void
+Resampler::produce(QVector<float> *out, bool flushing)
+{
+	int half = taps_ / 2;
+	qint64 avail = hist_pos_ + hist_[0].size();
+	/* all the output there is for the input so far */
+	qint64 total = (in_frames_ * up_ + down_ - 1) / down_;
+	qint64 n = out_frames_;
+	for (;; n++) {
+		qint64 t = n * down_, i = t / up_;
+		if (i + half >= avail || (flushing && n >= total))
+			break;
+		const float *c = coef_.constData() + (t % up_) * taps_;
+		int first = int(i - half + 1 - hist_pos_);
+		for (int ch = 0; ch < channels_; ch++)
+			out[ch].append(dot(hist_[ch].constData() + first, c, taps_));
+	}
+	out_frames_ = n;
+
+	/* keep what the next output frame reaches back to */
+	int drop = int(n * down_ / up_ - half + 1 - hist_pos_);
+	if (drop > 0) {
+		for (int ch = 0; ch < channels_; ch++)
+			hist_[ch].remove(0, qMin(drop, hist_[ch].size()));
+		hist_pos_ += drop;
+	}
+}
+
+/* the two stages of the K-weighting filter as BS.1770 gives them for
+ * 48 kHz, redone for the sample rate the way libebur128 does */
+
+LoudnessMeter::LoudnessMeter(int channels, int samplerate)
+	: channels_(channels), step_(qMax(samplerate / 10, 1)), state_(channels * 8, 0.0),
+	sum_(0), count_(0), peak_(0)
+{
+	double f0 = 1681.974450955533, gain = 3.999843853973347, q = 0.7071752369554196;
+	double k = tan(M_PI * f0 / samplerate);
+	double vh = pow(10.0, gain / 20), vb = pow(vh, 0.4996667741545416);
+	double a0 = 1 + k / q + k * k;
+	shelf_.b0 = (vh + vb * k / q + k * k) / a0;
+	shelf_.b1 = 2 * (k * k - vh) / a0;
+	shelf_.b2 = (vh - vb * k / q + k * k) / a0;
+	shelf_.a1 = 2 * (k * k - 1) / a0;
+	shelf_.a2 = (1 - k / q + k * k) / a0;
+
+	f0 = 38.13547087602444;
+	q = 0.5003270373238773;
+	k = tan(M_PI * f0 / samplerate);
+	a0 = 1 + k / q + k * k;
+	highpass_.b0 = 1;
+	highpass_.b1 = -2;
+	highpass_.b2 = 1;
+	highpass_.a1 = 2 * (k * k - 1) / a0;
+	highpass_.a2 = (1 - k / q + k * k) / a0;
+}
+
+/* s holds x[n-1], x[n-2], y[n-1], y[n-2] */
+
+double
+LoudnessMeter::run(const Biquad &f, double *s, double x)
+{
+	double y = f.b0 * x + f.b1 * s[0] + f.b2 * s[1] - f.a1 * s[2] - f.a2 * s[3];
+	s[1] = s[0];
+	s[0] = x;
+	s[3] = s[2];
+	s[2] = y;
+	return y;
+}
+
+/* channels all weigh the same: they are mono or stereo by now */
+
+void
+LoudnessMeter::add(const QVector<float> *planar, int frames)
+{
+	for (int f = 0; f < frames; f++) {
+		for (int c = 0; c < channels_; c++) {
+			double x = planar[c][f];
+			peak_ = qMax(peak_, float(fabs(x)));
+			double *s = state_.data() + c * 8;
+			double y = run(shelf_, s, x);
+			y = run(highpass_, s + 4, y);
+			sum_ += y * y;
+		}
+		if (++count_ == step_) {
+			steps_ << sum_ / step_;
+			sum_ = 0;
+			count_ = 0;
+		}
+	}
+}
+
+static double
+lufs(double mean_square)
+{
+	return -0.691 + 10 * log10(mean_square);
+}
+
+double
+LoudnessMeter::loudness() const
+{
+	QVector<double> blocks;
+	for (int i = 3; i < steps_.size(); i++) {
+		double z = (steps_[i - 3] + steps_[i - 2] + steps_[i - 1] + steps_[i]) / 4;
+		if (z > 0 && lufs(z) > -70)
+			blocks << z;
+	}
+	if (blocks.isEmpty())
+		return -HUGE_VAL;
+	double mean = 0;
+	for (int i = 0; i < blocks.size(); i++)
+		mean += blocks[i];
+	double gate = lufs(mean / blocks.size()) - 10;
+	double sum = 0;
+	int n = 0;
+	for (int i = 0; i < blocks.size(); i++)
+		if (lufs(blocks[i]) > gate) {
+			sum += blocks[i];
+			n++;
+		}
+	return lufs(sum / n);
+}
+
+AudioFilter::AudioFilter()
+	: loudness_(0), offset_(0), queued_(0), done_(false), stopping_(false)
+{
+}
+
+AudioFilter::~AudioFilter()
+{
+	stop();
+}
+
+void
+AudioFilter::start(const QString &input, const QStringList &options, const QStringList &input_options,
+	const AudioFormat &decoded, const AudioFormat &out, double loudness)
+{
+	input_ = input;
+	options_ = options;
+	input_options_ = input_options;
+	decoded_ = decoded;
+	out_ = out;
+	loudness_ = loudness;
+	queue_.clear();
+	offset_ = queued_ = 0;
+	done_ = stopping_ = false;
+	error_.clear();
+	QThread::start();
+}
+
+void
+AudioFilter::stop()
+{
+	{
+		QMutexLocker locker(&mutex_);
+		stopping_ = true;
+		changed_.wakeAll();
+	}
+	wait();
+}
+
+int
+AudioFilter::read(float *interleaved, int frames)
+{
+	QMutexLocker locker(&mutex_);
+	int ch = out_.channels, got = 0;
+	while (got < frames) {
+		while (queue_.isEmpty() && !done_)
+			changed_.wait(&mutex_);
+		if (queue_.isEmpty())
+			break;
+		const QVector<float> &chunk = queue_.first();
+		int n = qMin(frames - got, chunk.size() / ch - offset_);
+		memcpy(interleaved + got * ch, chunk.constData() + offset_ * ch, n * ch * sizeof(float));
+		got += n;
+		offset_ += n;
+		queued_ -= n;
+		if (offset_ * ch == chunk.size()) {
+			queue_.removeFirst();
+			offset_ = 0;
+		}
+		changed_.wakeAll();
+	}
+	if (got == 0 && !error_.isEmpty())
+		throw std::runtime_error(error_.toStdString());
+	return got;
+}
+
+void
+AudioFilter::run()
+{
+	try {
+		filter(loudness_ != 0 ? measure() : 1.0);
+	} catch (std::exception &x) {
+		QMutexLocker locker(&mutex_);
+		error_ = x.what();
+	}
+	QMutexLocker locker(&mutex_);
+	done_ = true;
+	changed_.wakeAll();
+}
+
+/* Measured after the mix, before resampling, which doesn't change the
+ * loudness. Rather than a limiter, the gain is held down to keep the
+ * sample peak under the ceiling. Silence stays as it is.
+ */
+
+double
+AudioFilter::measure()
+{
+	Decoder dec;
+	dec.open(Decoder::AUDIO, input_, options_, input_options_);
+	Downmix mix(decoded_.channels, out_.channels);
+	LoudnessMeter meter(out_.channels, decoded_.samplerate);
+	QVector<float> buf(CHUNK * decoded_.channels);
+	QVector<QVector<float> > mixed(out_.channels);
+	int n;
+	while (!stopping_ && (n = dec.readSamples(buf.data(), CHUNK)) > 0) {
+		mix.process(buf.constData(), n, mixed.data());
+		meter.add(mixed.constData(), n);
+	}
+	double l = meter.loudness();
+	if (l == -HUGE_VAL)
+		return 1;
+	double db = loudness_ - l;
+	if (meter.peak() > 0)
+		db = qMin(db, PEAK_CEILING - 20 * log10(meter.peak()));
+	return pow(10.0, db / 20);
+}
+
+void
+AudioFilter::filter(double gain)
+{
+	Decoder dec;
+	dec.open(Decoder::AUDIO, input_, options_, input_options_);
+	Downmix mix(decoded_.channels, out_.channels);
+	Resampler resampler(decoded_.samplerate, out_.samplerate, out_.channels);
+	QVector<float> buf(CHUNK * decoded_.channels);
+	QVector<QVector<float> > mixed(out_.channels), resampled(out_.channels);
+	for (;;) {
+		int n = stopping_ ? 0 : dec.readSamples(buf.data(), CHUNK);
+		for (int c = 0; c < out_.channels; c++)
+			resampled[c].resize(0);
+		if (n > 0) {
+			mix.process(buf.constData(), n, mixed.data());
+			resampler.process(mixed.constData(), n, resampled.data());
+		} else
+			resampler.flush(resampled.data());
+		push(resampled.constData(), gain);
+		if (n <= 0)
+			break;
+	}
+}
+
+/* waits while the queue is full, or until stopped */
+
+void
+AudioFilter::push(const QVector<float> *planar, double gain)
+{
+	int ch = out_.channels, frames = planar[0].size();
+	if (frames == 0)
+		return;
+	QVector<float> chunk(frames * ch);
+	float g = float(gain);
+	for (int f = 0; f < frames; f++)
+		for (int c = 0; c < ch; c++)
+			chunk[f * ch + c] = planar[c][f] * g;
+
+	QMutexLocker locker(&mutex_);
+	while (queued_ >= out_.samplerate * MAX_QUEUED && !stopping_)
+		changed_.wait(&mutex_);
+	queue_ << chunk;
+	queued_ += frames;
+	changed_.wakeAll();
+}
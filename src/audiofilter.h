@@ -0,0 +1,158 @@
+/*
+ * audiofilter.h - resampling, mixing and loudness of decoded audio
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_AUDIOFILTER
+#define H_AUDIOFILTER
+
+#include <QList>
+#include <QMutex>
+#include <QStringList>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+#include "decoder.h"
+
+/* Mixes down to mono or stereo from the layouts ffmpeg gives n channels
+ * by default (5.0, 5.1, 6.1 and 7.1 beyond stereo), leaving out LFE.
+ * Rows are scaled down where needed so that the mix can't clip.
+ */
+
+class Downmix
+{
+public:
+	Downmix(int in, int out);
+	static bool supported(int in, int out);
+	/* interleaved in, one vector per output channel out */
+	void process(const float *in, int frames, QVector<float> *out) const;
+
+private:
+	int in_;
+	int out_;
+	QVector<float> matrix_;
+};
+
+/* Polyphase windowed sinc. The rates' ratio is reduced to up/down with
+ * up phases of taps coefficients each; the taps grow with the
+ * downsampling factor so that the transition band scales with it.
+ */
+
+class Resampler
+{
+public:
+	Resampler(int in_rate, int out_rate, int channels);
+	static bool supported(int in_rate, int out_rate);
+	/* planar in, appended to planar out; flush after the last input */
+	void process(const QVector<float> *in, int frames, QVector<float> *out);
+	void flush(QVector<float> *out);
+
+private:
+	void produce(QVector<float> *out, bool flushing);
+
+	int channels_;
+	int up_;
+	int down_;
+	int taps_;
+	QVector<float> coef_;
+	QVector<QVector<float> > hist_;
+	qint64 hist_pos_; /* the input frame hist_[c][0] is */
+	qint64 in_frames_;
+	qint64 out_frames_;
+};
+
+/* Integrated loudness after ITU-R BS.1770: K-weighted, in 400 ms blocks
+ * every 100 ms, gated at -70 LUFS and then 10 LU below the mean.
+ */
+
+class LoudnessMeter
+{
+public:
+	LoudnessMeter(int channels, int samplerate);
+	void add(const QVector<float> *planar, int frames);
+	/* in LUFS, or -HUGE_VAL for silence */
+	double loudness() const;
+	float peak() const { return peak_; }
+
+private:
+	struct Biquad {
+		double b0, b1, b2, a1, a2;
+	};
+	static double run(const Biquad &, double *state, double x);
+
+	int channels_;
+	int step_;
+	Biquad shelf_;
+	Biquad highpass_;
+	QVector<double> state_; /* four per stage and channel */
+	double sum_;
+	int count_;
+	QVector<double> steps_; /* mean squares of the 100 ms steps */
+	float peak_;
+};
+
+/* Decodes the audio at the source's rate and channels, and mixes,
+ * resamples and normalizes it in a thread of its own, queueing a couple
+ * of seconds ahead of the encoder. With a loudness target, the stream is
+ * decoded once more beforehand to measure it, which is only done for a
+ * two-pass encode, whose first pass has no audio to wait for, or when
+ * there is no video to hold up.
+ */
+
+class AudioFilter : public QThread
+{
+public:
+	AudioFilter();
+	~AudioFilter();
+
+	/* options get decoded from ffmpeg, out from here;
+	 * loudness is the target in LUFS, 0 for none */
+	void start(const QString &input, const QStringList &options, const QStringList &input_options,
+		const AudioFormat &decoded, const AudioFormat &out, double loudness);
+	void stop();
+	const AudioFormat &format() const { return out_; }
+	/* interleaved, fewer frames only at the end; throws if decoding failed */
+	int read(float *interleaved, int frames);
+
+protected:
+	void run();
+
+private:
+	double measure();
+	void filter(double gain);
+	void push(const QVector<float> *planar, double gain);
+
+	QString input_;
+	QStringList options_;
+	QStringList input_options_;
+	AudioFormat decoded_;
+	AudioFormat out_;
+	double loudness_;
+
+	QMutex mutex_;
+	QWaitCondition changed_;
+	QList<QVector<float> > queue_;
+	int offset_; /* frames of the first chunk already read */
+	int queued_;
+	bool done_;
+	bool stopping_;
+	QString error_;
+};
+
+#endif // H_AUDIOFILTER
@@ -0,0 +1,189 @@
+/*
+ * benchmark.cpp - encoder settings sweep
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QFileInfo>
+#include <QTime>
+#include <cstdio>
+#include <stdexcept>
+#include "benchmark.h"
+#include "fileinfo.h"
+
+Benchmark::Benchmark(const QStringList &inputs)
+	: QObject(NULL), inputs_(inputs), engine_(Transcoder::PROCESS), reason_(Transcoder::FAILED)
+{
+	speed_levels_ << 0 << 1 << 2;
+	qualities_ << 3 << 5 << 7 << 9;
+}
+
+void
+Benchmark::statusUpdate(QString status)
+{
+	fprintf(stderr, "%s\n", qPrintable(status));
+}
+
+/* Audio is left out, so that sizes and times depend on the video settings
+ * only. --optimize needs no runs of its own: it is speed level 0.
+ */
+
+Benchmark::Result
+Benchmark::encode(const QString &input, double frames, int speed_level, int quality)
+{
+	Result r;
+	r.input = input;
+	r.speed_level = speed_level;
+	r.quality = quality;
+	r.secs = r.fps = 0;
+	r.bytes = 0;
+
+	QString output = QDir::temp().filePath(
+		QString("qtheorafrontend-benchmark-%1.ogv").arg(QCoreApplication::applicationPid()));
+	QFile::remove(output);
+
+	Transcoder t(NULL);
+	t.setEngine(engine_);
+	connect(&t, SIGNAL(finished(int)), this, SLOT(finished(int)));
+	connect(&t, SIGNAL(statusUpdate(QString)), this, SLOT(statusUpdate(QString)));
+	QEventLoop loop;
+	connect(&t, SIGNAL(finished()), &loop, SLOT(quit()));
+
+	reason_ = Transcoder::FAILED;
+	QTime timer;
+	timer.start();
+	t.start(input, output, QStringList() << "--noaudio"
+		<< "--speedlevel" << QString::number(speed_level)
+		<< "--videoquality" << QString::number(quality));
+	loop.exec();
+	/* finished() comes just before the thread ends, t must outlive it */
+	t.wait();
+
+	r.secs = timer.elapsed() / 1000.0;
+	r.ok = reason_ == Transcoder::OK;
+	r.bytes = QFileInfo(output).size();
+	if (frames > 0 && r.secs > 0)
+		r.fps = frames / r.secs;
+	QFile::remove(output);
+	return r;
+}
+
+/* slower, bigger and worse looking than another run at once: not a preset */
+
+void
+Benchmark::markPareto(const QList<Result> &results, QList<bool> *pareto)
+{
+	pareto->clear();
+	for (int i = 0; i < results.size(); i++) {
+		const Result &a = results[i];
+		bool dominated = false;
+		for (int j = 0; j < results.size() && !dominated; j++) {
+			const Result &b = results[j];
+			dominated = b.secs <= a.secs && b.bytes <= a.bytes && b.quality >= a.quality &&
+				(b.secs < a.secs || b.bytes < a.bytes || b.quality > a.quality);
+		}
+		pareto->push_back(!dominated);
+	}
+}
+
+void
+Benchmark::print(const Result &r, bool pareto)
+{
+	QString input = r.input;
+	input.replace("\"", "\"\"");
+	printf("\"%s\",%d,%d,%.2f,%.1f,%lld,%s\n", qPrintable(input), r.speed_level, r.quality,
+		r.secs, r.fps, (long long)r.bytes, pareto ? "yes" : "no");
+}
+
+int
+Benchmark::run()
+{
+	printf("input,speed_level,quality,seconds,fps,bytes,pareto\n");
+	QList<Result> all;
+	int probed = 0, failed = 0;
+
+	for (int i = 0; i < inputs_.size(); i++) {
+		const QString &input = inputs_[i];
+		FileInfo fi;
+		try {
+			fi.retrieve(input);
+		} catch (std::exception &x) {
+			fprintf(stderr, "%s: %s\n", qPrintable(input), x.what());
+			failed++;
+			continue;
+		}
+		probed++;
+		double frames = -1;
+		if (fi.duration > 0 && !fi.video_streams.isEmpty())
+			frames = fi.duration * parse_frame_rate(fi.video_streams[0].framerate);
+
+		QList<Result> results;
+		for (int q = 0; q < qualities_.size(); q++)
+			for (int s = 0; s < speed_levels_.size(); s++) {
+				Result r = encode(input, frames, speed_levels_[s], qualities_[q]);
+				if (r.ok)
+					results << r;
+				else
+					failed++;
+			}
+		QList<bool> pareto;
+		markPareto(results, &pareto);
+		for (int j = 0; j < results.size(); j++)
+			print(results[j], pareto[j]);
+		fflush(stdout);
+		all << results;
+	}
+
+	/* the corpus as a whole, for settings that worked on every file */
+	if (probed > 1) {
+		QList<Result> totals;
+		for (int q = 0; q < qualities_.size(); q++)
+			for (int s = 0; s < speed_levels_.size(); s++) {
+				Result t;
+				t.input = "(corpus)";
+				t.speed_level = speed_levels_[s];
+				t.quality = qualities_[q];
+				t.secs = 0;
+				t.bytes = 0;
+				t.ok = true;
+				double frames = 0;
+				int n = 0;
+				for (int i = 0; i < all.size(); i++) {
+					const Result &r = all[i];
+					if (r.speed_level != t.speed_level || r.quality != t.quality)
+						continue;
+					t.secs += r.secs;
+					t.bytes += r.bytes;
+					frames += r.fps * r.secs;
+					n++;
+				}
+				t.fps = t.secs > 0 ? frames / t.secs : 0;
+				if (n == probed)
+					totals << t;
+			}
+		QList<bool> pareto;
+		markPareto(totals, &pareto);
+		for (int j = 0; j < totals.size(); j++)
+			print(totals[j], pareto[j]);
+	}
+	return failed > 0 ? 1 : 0;
+}
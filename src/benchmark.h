@@ -0,0 +1,73 @@
+/*
+ * benchmark.h - encoder settings sweep
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_BENCHMARK
+#define H_BENCHMARK
+
+#include <QList>
+#include <QObject>
+#include <QStringList>
+#include "transcoder.h"
+
+/* Encodes every file of a corpus with each combination of speed level
+ * and quality, one job at a time, and prints a CSV line per run. Runs
+ * that no other run beats in time, size and quality at once are marked
+ * as Pareto-optimal, per file and over the whole corpus.
+ */
+
+class Benchmark : public QObject
+{
+	Q_OBJECT
+
+public:
+	Benchmark(const QStringList &inputs);
+	void setSpeedLevels(const QList<int> &l) { speed_levels_ = l; }
+	void setQualities(const QList<int> &l) { qualities_ = l; }
+	void setEngine(Transcoder::Engine e) { engine_ = e; }
+	int run();
+
+private slots:
+	void finished(int reason) { reason_ = reason; }
+	void statusUpdate(QString);
+
+private:
+	struct Result {
+		QString input;
+		int speed_level;
+		int quality;
+		double secs;
+		double fps;
+		qint64 bytes;
+		bool ok;
+	};
+
+	Result encode(const QString &input, double frames, int speed_level, int quality);
+	static void markPareto(const QList<Result> &, QList<bool> *);
+	static void print(const Result &, bool pareto);
+
+	QStringList inputs_;
+	QList<int> speed_levels_;
+	QList<int> qualities_;
+	Transcoder::Engine engine_;
+	int reason_;
+};
+
+#endif // H_BENCHMARK
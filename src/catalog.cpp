@@ -0,0 +1,307 @@
+/*
+ * catalog.cpp - compact media catalog for large directory trees
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <stdexcept>
+#include "catalog.h"
+#include "fileinfo.h"
+
+#define CATALOG_MAGIC 0x51544643 /* "QTFC" */
+#define CATALOG_VERSION 1
+#define MAX_STRINGS 256
+#define OTHER_STRING 1
+
+MediaCatalog::MediaCatalog()
+{
+	/* 0 is no stream, 1 whatever doesn't fit */
+	intern(QString());
+	intern("other");
+}
+
+qint64
+MediaCatalog::bytes() const
+{
+	qint64 ret = names_.capacity();
+	ret += dir_.capacity() * sizeof(quint32) + name_.capacity() * sizeof(quint32);
+	ret += mtime_.capacity() * sizeof(quint32) + size_kb_.capacity() * sizeof(quint32);
+	ret += duration_.capacity() * sizeof(float);
+	ret += (width_.capacity() + height_.capacity()) * sizeof(quint16);
+	ret += video_codec_.capacity() + pixel_format_.capacity() + audio_codec_.capacity();
+	for (int i = 0; i < dirs_.size(); i++)
+		ret += dirs_[i].size() * 2;
+	return ret;
+}
+
+int
+MediaCatalog::intern(const QString &s)
+{
+	QHash<QString, int>::const_iterator i = string_index_.find(s);
+	if (i != string_index_.end())
+		return i.value();
+	if (strings_.size() >= MAX_STRINGS)
+		return OTHER_STRING;
+	string_index_.insert(s, strings_.size());
+	strings_ << s;
+	return strings_.size() - 1;
+}
+
+int
+MediaCatalog::internDir(const QString &s)
+{
+	QHash<QString, int>::const_iterator i = dir_index_.find(s);
+	if (i != dir_index_.end())
+		return i.value();
+	dir_index_.insert(s, dirs_.size());
+	dirs_ << s;
+	return dirs_.size() - 1;
+}
+
+void
+MediaCatalog::add(const CatalogRecord &r)
+{
+	QFileInfo fi(r.path);
+	dir_ << internDir(fi.path());
+	name_ << names_.size();
+	names_.append(fi.fileName().toUtf8());
+	names_.append('\0');
+	mtime_ << r.mtime;
+	size_kb_ << quint32(qMin(r.size >> 10, qint64(0xffffffffU)));
+	duration_ << float(r.duration);
+	width_ << quint16(qBound(0, r.width, 0xffff));
+	height_ << quint16(qBound(0, r.height, 0xffff));
+	video_codec_ << intern(r.video_codec);
+	pixel_format_ << intern(r.pixel_format);
+	audio_codec_ << intern(r.audio_codec);
+}
+
+void
+MediaCatalog::compact(const QVector<bool> &keep)
+{
+	QByteArray names;
+	int n = 0;
+	for (int i = 0; i < size(); i++) {
+		if (!keep[i])
+			continue;
+		const char *nm = name(i);
+		dir_[n] = dir_[i];
+		name_[n] = names.size();
+		names.append(nm);
+		names.append('\0');
+		mtime_[n] = mtime_[i];
+		size_kb_[n] = size_kb_[i];
+		duration_[n] = duration_[i];
+		width_[n] = width_[i];
+		height_[n] = height_[i];
+		video_codec_[n] = video_codec_[i];
+		pixel_format_[n] = pixel_format_[i];
+		audio_codec_[n] = audio_codec_[i];
+		n++;
+	}
+	names_ = names;
+	dir_.resize(n);
+	name_.resize(n);
+	mtime_.resize(n);
+	size_kb_.resize(n);
+	duration_.resize(n);
+	width_.resize(n);
+	height_.resize(n);
+	video_codec_.resize(n);
+	pixel_format_.resize(n);
+	audio_codec_.resize(n);
+	dir_.squeeze();
+	name_.squeeze();
+	mtime_.squeeze();
+	size_kb_.squeeze();
+	duration_.squeeze();
+	width_.squeeze();
+	height_.squeeze();
+	video_codec_.squeeze();
+	pixel_format_.squeeze();
+	audio_codec_.squeeze();
+}
+
+QHash<QString, CatalogKnown>
+MediaCatalog::known(const QString &root) const
+{
+	QString prefix = root.endsWith('/') ? root : root + "/";
+	QVector<bool> under(dirs_.size());
+	for (int d = 0; d < dirs_.size(); d++)
+		under[d] = dirs_[d] == root || dirs_[d].startsWith(prefix);
+	QHash<QString, CatalogKnown> ret;
+	for (int i = 0; i < size(); i++) {
+		if (!under[dir_[i]])
+			continue;
+		CatalogKnown k;
+		k.mtime = mtime_[i];
+		k.size = fileSize(i);
+		k.index = i;
+		ret.insert(path(i), k);
+	}
+	return ret;
+}
+
+QString
+MediaCatalog::path(int i) const
+{
+	return dirs_[dir_[i]] + "/" + QString::fromUtf8(name(i));
+}
+
+/* a missing or damaged catalog is just an empty one */
+
+void
+MediaCatalog::load(const QString &filename)
+{
+	QFile f(filename);
+	if (!f.open(QIODevice::ReadOnly))
+		return;
+	QDataStream s(&f);
+	quint32 magic, version;
+	s >> magic >> version;
+	if (magic != CATALOG_MAGIC || version != CATALOG_VERSION)
+		return;
+	MediaCatalog c;
+	s >> c.dirs_ >> c.strings_ >> c.dir_ >> c.name_ >> c.names_ >> c.mtime_ >> c.size_kb_ >>
+		c.duration_ >> c.width_ >> c.height_ >> c.video_codec_ >> c.pixel_format_ >> c.audio_codec_;
+	int n = c.dir_.size();
+	if (s.status() != QDataStream::Ok || c.strings_.size() > MAX_STRINGS ||
+	    c.name_.size() != n || c.mtime_.size() != n || c.size_kb_.size() != n ||
+	    c.duration_.size() != n || c.width_.size() != n || c.height_.size() != n ||
+	    c.video_codec_.size() != n || c.pixel_format_.size() != n || c.audio_codec_.size() != n)
+		return;
+	for (int i = 0; i < n; i++)
+		if (int(c.dir_[i]) >= c.dirs_.size() || int(c.name_[i]) >= c.names_.size() ||
+		    c.video_codec_[i] >= c.strings_.size() || c.pixel_format_[i] >= c.strings_.size() ||
+		    c.audio_codec_[i] >= c.strings_.size())
+			return;
+	if (!c.names_.isEmpty() && !c.names_.endsWith('\0'))
+		return;
+	c.dir_index_.clear();
+	for (int d = 0; d < c.dirs_.size(); d++)
+		c.dir_index_.insert(c.dirs_[d], d);
+	c.string_index_.clear();
+	for (int j = 0; j < c.strings_.size(); j++)
+		c.string_index_.insert(c.strings_[j], j);
+	*this = c;
+}
+
+bool
+MediaCatalog::save(const QString &filename) const
+{
+	QString part = filename + ".part";
+	QFile f(part);
+	if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+	QDataStream s(&f);
+	s << quint32(CATALOG_MAGIC) << quint32(CATALOG_VERSION);
+	s << dirs_ << strings_ << dir_ << name_ << names_ << mtime_ << size_kb_ <<
+		duration_ << width_ << height_ << video_codec_ << pixel_format_ << audio_codec_;
+	f.close();
+	if (s.status() != QDataStream::Ok || f.error() != QFile::NoError) {
+		QFile::remove(part);
+		return false;
+	}
+	QFile::remove(filename);
+	return QFile::rename(part, filename);
+}
+
+CatalogScanner::CatalogScanner(const QString &root, const QStringList &patterns,
+	const QHash<QString, CatalogKnown> &known)
+	: QThread(NULL), root_(root), patterns_(patterns), known_(known),
+	stopping_(false), complete_(false), scanned_(0)
+{
+}
+
+QList<CatalogRecord>
+CatalogScanner::take()
+{
+	QMutexLocker locker(&mutex_);
+	QList<CatalogRecord> ret = found_;
+	found_.clear();
+	return ret;
+}
+
+QList<int>
+CatalogScanner::stale() const
+{
+	QMutexLocker locker(&mutex_);
+	QList<int> ret = replaced_;
+	if (!complete_)
+		return ret;
+	for (QHash<QString, CatalogKnown>::const_iterator i = known_.begin(); i != known_.end(); ++i)
+		ret << i.value().index;
+	return ret;
+}
+
+/* A changed file is probed again and its old entry goes into replaced_;
+ * what's left in known_ in the end is gone. Probing is by far the slowest
+ * part, a directory listing costs next to nothing.
+ */
+
+void
+CatalogScanner::run()
+{
+	QDirIterator it(root_, patterns_, QDir::Files | QDir::Readable, QDirIterator::Subdirectories);
+	while (!stopping_ && it.hasNext()) {
+		QString path = it.next();
+		QFileInfo info = it.fileInfo();
+		scanned_++;
+		CatalogRecord r;
+		r.path = path;
+		r.mtime = info.lastModified().toTime_t();
+		r.size = info.size();
+		QHash<QString, CatalogKnown>::iterator k = known_.find(path);
+		int replaced = -1;
+		if (k != known_.end()) {
+			bool same = k.value().mtime == r.mtime && k.value().size >> 10 == r.size >> 10;
+			replaced = k.value().index;
+			known_.erase(k);
+			if (same)
+				continue;
+		}
+		r.duration = -1;
+		r.width = r.height = 0;
+		try {
+			FileInfo fi;
+			fi.retrieve(path);
+			r.duration = fi.duration;
+			if (!fi.video_streams.isEmpty()) {
+				const VideoStreamInfo &v = fi.video_streams[0];
+				r.video_codec = v.codec;
+				r.pixel_format = v.pixel_format;
+				r.width = v.width;
+				r.height = v.height;
+			}
+			if (!fi.audio_streams.isEmpty())
+				r.audio_codec = fi.audio_streams[0].codec;
+		} catch (std::exception &) {
+			/* kept without streams, so as not to probe it again */
+		}
+		QMutexLocker locker(&mutex_);
+		found_ << r;
+		if (replaced >= 0)
+			replaced_ << replaced;
+	}
+	complete_ = !stopping_;
+}
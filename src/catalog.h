@@ -0,0 +1,157 @@
+/*
+ * catalog.h - compact media catalog for large directory trees
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_CATALOG
+#define H_CATALOG
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QStringList>
+#include <QThread>
+#include <QVector>
+
+/* one probed file, on its way into the catalog */
+
+struct CatalogRecord
+{
+	QString path;
+	uint mtime;
+	qint64 size;
+	double duration;
+	int width;
+	int height;
+	QString video_codec;
+	QString pixel_format;
+	QString audio_codec;
+};
+
+/* what the catalog has of a file, to skip it if it hasn't changed */
+
+struct CatalogKnown
+{
+	uint mtime;
+	qint64 size;
+	int index;
+};
+
+/* What a library view needs of each of a lot of files, column by column:
+ * directories and codec names are interned, file names are packed into
+ * one buffer, and the numbers are kept in flat arrays of the smallest
+ * types that hold them. A file takes about 30 bytes plus its name. Files
+ * that couldn't be probed are kept too, without streams, so that rescans
+ * don't probe them again.
+ */
+
+class MediaCatalog
+{
+public:
+	MediaCatalog();
+
+	int size() const { return dir_.size(); }
+	qint64 bytes() const;
+
+	void add(const CatalogRecord &);
+	/* drops the files for which keep is false */
+	void compact(const QVector<bool> &keep);
+	/* the files under a directory, by path */
+	QHash<QString, CatalogKnown> known(const QString &root) const;
+
+	QString path(int i) const;
+	const char *name(int i) const { return names_.constData() + name_[i]; }
+	int dir(int i) const { return dir_[i]; }
+	int dirs() const { return dirs_.size(); }
+	const QString &dirName(int d) const { return dirs_[d]; }
+	uint mtime(int i) const { return mtime_[i]; }
+	qint64 fileSize(int i) const { return qint64(size_kb_[i]) << 10; }
+	double duration(int i) const { return duration_[i]; }
+	int width(int i) const { return width_[i]; }
+	int height(int i) const { return height_[i]; }
+	/* indexes into strings(), 0 for none */
+	int videoCodec(int i) const { return video_codec_[i]; }
+	int pixelFormat(int i) const { return pixel_format_[i]; }
+	int audioCodec(int i) const { return audio_codec_[i]; }
+	const QStringList &strings() const { return strings_; }
+	bool probed(int i) const { return video_codec_[i] != 0 || audio_codec_[i] != 0; }
+
+	void load(const QString &filename);
+	bool save(const QString &filename) const;
+
+private:
+	int intern(const QString &);
+	int internDir(const QString &);
+
+	QStringList dirs_;
+	QHash<QString, int> dir_index_;
+	QStringList strings_;
+	QHash<QString, int> string_index_;
+
+	QVector<quint32> dir_;
+	QVector<quint32> name_; /* offsets into names_ */
+	QByteArray names_;      /* UTF-8, each ended with a 0 */
+	QVector<quint32> mtime_;
+	QVector<quint32> size_kb_;
+	QVector<float> duration_;
+	QVector<quint16> width_;
+	QVector<quint16> height_;
+	QVector<quint8> video_codec_;
+	QVector<quint8> pixel_format_;
+	QVector<quint8> audio_codec_;
+};
+
+/* Walks a directory tree and probes the media files in it that the
+ * catalog doesn't have as they are, handing them over in batches.
+ */
+
+class CatalogScanner : public QThread
+{
+	Q_OBJECT
+
+public:
+	CatalogScanner(const QString &root, const QStringList &patterns,
+		const QHash<QString, CatalogKnown> &known);
+	void stop() { stopping_ = true; }
+
+	/* what has been probed since the last call */
+	QList<CatalogRecord> take();
+	/* files seen so far */
+	int scanned() const { return scanned_; }
+	/* catalog entries superseded by what take() returned; once the scan
+	 * has gone all the way, those of files that are gone as well */
+	QList<int> stale() const;
+
+protected:
+	void run();
+
+private:
+	QString root_;
+	QStringList patterns_;
+	QHash<QString, CatalogKnown> known_;
+	volatile bool stopping_;
+	volatile bool complete_;
+	volatile int scanned_;
+	mutable QMutex mutex_;
+	QList<CatalogRecord> found_;
+	QList<int> replaced_;
+};
+
+#endif // H_CATALOG
@@ -0,0 +1,227 @@
+/*
+ * decoder.cpp - raw frame and sample source implementation
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QList>
+#include <QMutex>
+#include <stdexcept>
+#include "decoder.h"
+
+#define Y4M_MAGIC "YUV4MPEG2"
+#define FRAME_MAGIC "FRAME"
+
+void
+YuvFrame::alloc(int w, int h)
+{
+	width[0] = w;
+	height[0] = h;
+	width[1] = width[2] = (w + 1) / 2;
+	height[1] = height[2] = (h + 1) / 2;
+	int size = 0;
+	for (int i = 0; i < 3; i++) {
+		stride[i] = width[i];
+		size += stride[i] * height[i];
+	}
+	data.resize(size);
+	unsigned char *p = (unsigned char *)data.data();
+	for (int i = 0; i < 3; i++) {
+		plane[i] = p;
+		p += stride[i] * height[i];
+	}
+}
+
+Decoder::Decoder()
+	: type_(VIDEO)
+{
+}
+
+Decoder::~Decoder()
+{
+	close();
+}
+
+/* decoders are opened from several threads at once */
+
+static QMutex ffmpeg_mutex;
+
+QString
+Decoder::ffmpeg()
+{
+	static QString ffmpeg_;
+	QMutexLocker locker(&ffmpeg_mutex);
+	if (ffmpeg_.isEmpty()) {
+		ffmpeg_ = "ffmpeg";
+		QString suffix = QFileInfo(QCoreApplication::applicationFilePath()).suffix();
+		if (!suffix.isEmpty())
+			ffmpeg_ += "." + suffix;
+		QString bundled = QDir(QCoreApplication::applicationDirPath()).filePath(ffmpeg_);
+		if (QFile(bundled).exists())
+			ffmpeg_ = bundled;
+	}
+	return ffmpeg_;
+}
+
+static QString
+option_value(const QStringList &options, const QString &opt)
+{
+	int i = options.lastIndexOf(opt);
+	return i >= 0 && i + 1 < options.size() ? options[i + 1] : QString();
+}
+
+void
+Decoder::open(Type type, const QString &input, const QStringList &options,
+	const QStringList &input_options)
+{
+	close();
+	type_ = type;
+	vformat_ = VideoFormat();
+	aformat_ = AudioFormat();
+
+	QStringList args;
+	args << "-v" << "error" << "-nostdin" << input_options << "-i" << input << options;
+
+	if (type == VIDEO) {
+		args << "-an" << "-sn" << "-pix_fmt" << "yuv420p" << "-f" << "yuv4mpegpipe" << "-";
+	} else {
+		aformat_.samplerate = option_value(options, "-ar").toInt();
+		aformat_.channels = option_value(options, "-ac").toInt();
+		if (aformat_.samplerate <= 0 || aformat_.channels <= 0)
+			throw std::runtime_error("Audio decoding needs a sample rate and channel count");
+		args << "-vn" << "-sn" << "-f" << "f32le" << "-acodec" << "pcm_f32le" << "-";
+	}
+
+	proc_.setReadChannel(QProcess::StandardOutput);
+	proc_.start(ffmpeg(), args);
+	if (!proc_.waitForStarted())
+		throw std::runtime_error("Decoding failed to start");
+	if (type == VIDEO)
+		parseHeader(readLine());
+}
+
+void
+Decoder::close()
+{
+	if (proc_.state() != QProcess::NotRunning) {
+		proc_.kill();
+		proc_.waitForFinished();
+	}
+}
+
+bool
+Decoder::read(char *buf, qint64 size)
+{
+	while (size > 0) {
+		if (proc_.bytesAvailable() <= 0 && !proc_.waitForReadyRead(-1))
+			return false;
+		qint64 n = proc_.read(buf, size);
+		if (n < 0)
+			return false;
+		buf += n;
+		size -= n;
+	}
+	return true;
+}
+
+QByteArray
+Decoder::readLine()
+{
+	QByteArray line;
+	char c;
+	while (read(&c, 1) && c != '\n')
+		line += c;
+	return line;
+}
+
+static void
+parse_ratio(const QByteArray &s, int *num, int *den)
+{
+	QList<QByteArray> l = s.split(':');
+	if (l.size() == 2 && l[0].toInt() > 0 && l[1].toInt() > 0) {
+		*num = l[0].toInt();
+		*den = l[1].toInt();
+	}
+}
+
+void
+Decoder::parseHeader(const QByteArray &header)
+{
+	QList<QByteArray> tokens = header.split(' ');
+	if (tokens.isEmpty() || tokens[0] != Y4M_MAGIC)
+		throw std::runtime_error("Unable to decode the video stream");
+	for (int i = 1; i < tokens.size(); i++) {
+		const QByteArray &t = tokens[i];
+		if (t.isEmpty())
+			continue;
+		QByteArray v = t.mid(1);
+		switch (t[0]) {
+		case 'W':
+			vformat_.width = v.toInt();
+			break;
+		case 'H':
+			vformat_.height = v.toInt();
+			break;
+		case 'F':
+			parse_ratio(v, &vformat_.fps_num, &vformat_.fps_den);
+			break;
+		case 'A':
+			parse_ratio(v, &vformat_.par_num, &vformat_.par_den);
+			break;
+		case 'C':
+			if (!v.startsWith("420"))
+				throw std::runtime_error("Unsupported yuv4mpeg colorspace");
+			break;
+		}
+	}
+	if (vformat_.width <= 0 || vformat_.height <= 0)
+		throw std::runtime_error("Invalid yuv4mpeg header");
+}
+
+bool
+Decoder::readFrame(YuvFrame *frame)
+{
+	QByteArray tag = readLine();
+	if (!tag.startsWith(FRAME_MAGIC))
+		return false;
+	if (frame->width[0] != vformat_.width || frame->height[0] != vformat_.height
+			|| frame->data.isEmpty())
+		frame->alloc(vformat_.width, vformat_.height);
+	return read(frame->data.data(), frame->data.size());
+}
+
+int
+Decoder::readSamples(float *interleaved, int frames)
+{
+	qint64 frame_size = sizeof(float) * aformat_.channels;
+	char *buf = (char *)interleaved;
+	qint64 got = 0, want = frames * frame_size;
+	while (got < want) {
+		if (proc_.bytesAvailable() <= 0 && !proc_.waitForReadyRead(-1))
+			break;
+		qint64 n = proc_.read(buf + got, want - got);
+		if (n <= 0)
+			break;
+		got += n;
+	}
+	/* a partial sample at eof is dropped */
+	return int(got / frame_size);
+}
@@ -0,0 +1,104 @@
+/*
+ * decoder.h - raw frame and sample source declarations
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_DECODER
+#define H_DECODER
+
+#include <QByteArray>
+#include <QProcess>
+#include <QStringList>
+
+struct VideoFormat
+{
+	int width;
+	int height;
+	int fps_num;
+	int fps_den;
+	int par_num;
+	int par_den;
+
+	VideoFormat(): width(-1), height(-1), fps_num(25), fps_den(1), par_num(1), par_den(1) { }
+	double fps() const { return fps_num / double(fps_den); }
+};
+
+struct AudioFormat
+{
+	int samplerate;
+	int channels;
+
+	AudioFormat(): samplerate(-1), channels(-1) { }
+};
+
+/* a planar 4:2:0 picture */
+
+struct YuvFrame
+{
+	QByteArray data;
+	unsigned char *plane[3];
+	int stride[3];
+	int width[3];
+	int height[3];
+
+	YuvFrame() { width[0] = height[0] = 0; }
+	void alloc(int w, int h);
+};
+
+/* Decodes one stream of the input into yuv4mpeg frames or float
+ * samples by running ffmpeg, so that in-process stages don't need
+ * to link libavcodec.
+ */
+
+class Decoder
+{
+public:
+	enum Type {
+		VIDEO,
+		AUDIO
+	};
+
+	Decoder();
+	~Decoder();
+	static QString ffmpeg();
+
+	/* options go after the input (filters, -map, -ar and so on),
+	 * input_options before it (-ss, -f, -r) */
+	void open(Type, const QString &input, const QStringList &options = QStringList(),
+		const QStringList &input_options = QStringList());
+	void close();
+
+	const VideoFormat &videoFormat() const { return vformat_; }
+	const AudioFormat &audioFormat() const { return aformat_; }
+
+	bool readFrame(YuvFrame *);
+	int readSamples(float *interleaved, int frames);
+
+private:
+	bool read(char *, qint64);
+	QByteArray readLine();
+	void parseHeader(const QByteArray &);
+
+	QProcess proc_;
+	Type type_;
+	VideoFormat vformat_;
+	AudioFormat aformat_;
+};
+
+#endif // H_DECODER
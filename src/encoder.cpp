@@ -0,0 +1,698 @@
+/*
+ * encoder.cpp - built-in Theora/Vorbis encoder implementation
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <QRegExp>
+#include "encoder.h"
+#include "transcoder.h"
+
+#define DEFAULT_VIDEO_QUALITY 5
+#define DEFAULT_AUDIO_QUALITY 1
+#define DEFAULT_KEYINT 64
+#define REPORT_INTERVAL 250 /* ms */
+
+EncoderOptions::EncoderOptions()
+	: audio(true), video(true), start(-1), end(-1),
+	audio_stream(-1), video_stream(-1), channels(-1), samplerate(-1),
+	audio_quality(DEFAULT_AUDIO_QUALITY), audio_bitrate(-1),
+	video_quality(-1), video_bitrate(-1),
+	two_pass(false), soft_target(false), optimize(false), speed_level(-1),
+	keyint(DEFAULT_KEYINT), buf_delay(-1), prefilter_frames(false),
+	audio_prefilter(false), loudness(0), scene_keyframes(false)
+{
+}
+
+void
+EncoderOptions::parse(const QStringList &args)
+{
+	int *crop = prefilter.crop;
+	bool deinterlace = false;
+	QString inputfps, framerate;
+	QStringList eq;
+
+	for (int i = 0; i < args.size(); i++) {
+		QString opt = args[i];
+		QString v;
+		if (option_takes_value(opt)) {
+			if (++i >= args.size())
+				throw std::runtime_error("Missing value for " + opt.toStdString());
+			v = args[i];
+		}
+
+		if (opt == "--noaudio")
+			audio = false;
+		else if (opt == "--novideo")
+			video = false;
+		else if (opt == "--starttime")
+			start = v.toDouble();
+		else if (opt == "--endtime")
+			end = v.toDouble();
+		else if (opt == "--audiostream")
+			audio_stream = v.toInt();
+		else if (opt == "--videostream")
+			video_stream = v.toInt();
+		else if (opt == "--channels")
+			channels = v.toInt();
+		else if (opt == "--samplerate")
+			samplerate = v.toInt();
+		else if (opt == "--audioquality")
+			audio_quality = v.toDouble();
+		else if (opt == "--audiobitrate")
+			audio_bitrate = v.toInt();
+		else if (opt == "--videoquality" || opt == "-v")
+			video_quality = v.toDouble();
+		else if (opt == "--videobitrate")
+			video_bitrate = v.toInt();
+		else if (opt == "--two-pass")
+			two_pass = true;
+		else if (opt == "--soft-target")
+			soft_target = true;
+		else if (opt == "--optimize")
+			optimize = true;
+		else if (opt == "--speedlevel")
+			speed_level = v.toInt();
+		else if (opt == "--keyint")
+			keyint = v.toInt();
+		else if (opt == "--buf-delay")
+			buf_delay = v.toInt();
+		else if (opt == "--aspect")
+			aspect = v;
+		else if (opt == "--width")
+			prefilter.width = v.toInt();
+		else if (opt == "--height")
+			prefilter.height = v.toInt();
+		else if (opt == "--max-size")
+			prefilter.max_size = true;
+		else if (opt == "--no-upscaling")
+			prefilter.no_upscaling = true;
+		else if (opt == "--croptop")
+			crop[0] = v.toInt();
+		else if (opt == "--cropbottom")
+			crop[1] = v.toInt();
+		else if (opt == "--cropleft")
+			crop[2] = v.toInt();
+		else if (opt == "--cropright")
+			crop[3] = v.toInt();
+		else if (opt == "--deinterlace")
+			deinterlace = true;
+		else if (opt == "--inputfps")
+			inputfps = v;
+		else if (opt == "--framerate")
+			framerate = v;
+		else if (opt == "--format")
+			input_options << "-f" << v;
+		else if (opt == "--contrast") {
+			eq << "contrast=" + v;
+			prefilter.contrast = v.toDouble();
+		} else if (opt == "--brightness") {
+			eq << "brightness=" + v;
+			prefilter.brightness = v.toDouble();
+		} else if (opt == "--gamma") {
+			eq << "gamma=" + v;
+			prefilter.gamma = v.toDouble();
+		} else if (opt == "--saturation") {
+			eq << "saturation=" + v;
+			prefilter.saturation = v.toDouble();
+		} else if (opt == PREFILTER_OPTION)
+			prefilter_frames = true;
+		else if (opt == AUDIO_PREFILTER_OPTION)
+			audio_prefilter = true;
+		else if (opt == LOUDNESS_OPTION)
+			loudness = v.toDouble();
+		else if (opt == SCENE_KEYFRAMES_OPTION)
+			scene_keyframes = true;
+		else if (opt == "--subtitles")
+			throw std::runtime_error("Subtitles are not supported by the built-in encoder");
+		else if (const char *tag = option_tag(opt))
+			tags.push_back(qMakePair(QByteArray(tag), v.toUtf8()));
+		else {
+			/* --sync, --no-skeleton, --nosubtitles, --nometadata and
+			 * the subtitle details need nothing from us */
+		}
+	}
+
+	if (!inputfps.isEmpty())
+		input_options << "-r" << inputfps;
+	if (deinterlace)
+		video_filters << "yadif";
+	if (!prefilter_frames) {
+		if (crop[0] || crop[1] || crop[2] || crop[3])
+			video_filters << QString("crop=iw-%1:ih-%2:%3:%4")
+				.arg(crop[2] + crop[3]).arg(crop[0] + crop[1]).arg(crop[2]).arg(crop[0]);
+		if (prefilter.width > 0 && prefilter.height > 0) {
+			QString w = QString::number(prefilter.width), h = QString::number(prefilter.height);
+			if (prefilter.no_upscaling) {
+				w = QString("min(%1\\,iw)").arg(w);
+				h = QString("min(%1\\,ih)").arg(h);
+			}
+			QString scale = QString("scale=%1:%2").arg(w, h);
+			if (prefilter.max_size)
+				scale += ":force_original_aspect_ratio=decrease";
+			video_filters << scale;
+		}
+		if (!eq.isEmpty())
+			video_filters << "eq=" + eq.join(":");
+	}
+	if (!framerate.isEmpty())
+		video_filters << "fps=" + framerate;
+	if (video_quality < 0 && (video_bitrate <= 0 || soft_target))
+		video_quality = DEFAULT_VIDEO_QUALITY;
+}
+
+QStringList
+EncoderOptions::decoderOptions(Decoder::Type type) const
+{
+	QStringList ret;
+	int stream = type == Decoder::VIDEO ? video_stream : audio_stream;
+	if (stream >= 0)
+		ret << "-map" << QString("0:%1").arg(stream);
+	if (end > 0)
+		ret << "-t" << QString::number(end - qMax(start, 0.0));
+	if (type == Decoder::VIDEO) {
+		if (!video_filters.isEmpty())
+			ret << "-vf" << video_filters.join(",");
+	} else {
+		if (channels > 0)
+			ret << "-ac" << QString::number(channels);
+		if (samplerate > 0)
+			ret << "-ar" << QString::number(samplerate);
+	}
+	return ret;
+}
+
+/* seeking before the input is fast and still frame accurate */
+
+QStringList
+EncoderOptions::decoderInputOptions() const
+{
+	QStringList ret = input_options;
+	if (start > 0)
+		ret << "-ss" << QString::number(start);
+	return ret;
+}
+
+static int
+ilog(unsigned v)
+{
+	int ret = 0;
+	while (v > 0) {
+		ret++;
+		v >>= 1;
+	}
+	return ret;
+}
+
+static long long
+gcd(long long a, long long b)
+{
+	while (b != 0) {
+		long long t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* "4:3" or "1.7778" display aspect ratio to pixel aspect ratio */
+
+static bool
+pixel_aspect(const QString &dar, int w, int h, int *num, int *den)
+{
+	long long n, d;
+	QStringList sl = dar.split(QRegExp("[:/]"));
+	if (sl.size() == 2) {
+		n = sl[0].toLongLong();
+		d = sl[1].toLongLong();
+	} else {
+		n = (long long)(dar.toDouble() * 10000 + 0.5);
+		d = 10000;
+	}
+	if (n <= 0 || d <= 0 || w <= 0 || h <= 0)
+		return false;
+	n *= h;
+	d *= w;
+	long long g = gcd(n, d);
+	n /= g;
+	d /= g;
+	while (n > 0xffffff || d > 0xffffff) {
+		n >>= 1;
+		d >>= 1;
+	}
+	*num = int(n);
+	*den = int(d);
+	return n > 0 && d > 0;
+}
+
+Encoder::Encoder(const EncoderOptions &options, ProgressListener *listener)
+	: options_(options), listener_(listener), pass_(-1),
+	video_open_(false), td_(NULL), held_valid_(false), twopass_pos_(0),
+	frames_in_(0), next_keyframe_(0), audio_open_(false), channels_(0)
+{
+}
+
+Encoder::~Encoder()
+{
+	release();
+}
+
+void
+Encoder::release()
+{
+	if (video_open_) {
+		th_encode_free(td_);
+		th_info_clear(&ti_);
+		ogg_stream_clear(&to_);
+		td_ = NULL;
+		video_open_ = false;
+	}
+	if (audio_open_) {
+		ogg_stream_clear(&vo_);
+		vorbis_block_clear(&vb_);
+		vorbis_dsp_clear(&vd_);
+		vorbis_comment_clear(&vc_);
+		vorbis_info_clear(&vi_);
+		audio_open_ = false;
+	}
+	if (out_.isOpen())
+		out_.close();
+}
+
+void
+Encoder::open(const QString &output, const VideoFormat *vf, const AudioFormat *af, int pass)
+{
+	release();
+	pass_ = pass;
+	vpages_.clear();
+	apages_.clear();
+	video_time_ = audio_time_ = 0;
+	video_bytes_ = audio_bytes_ = 0;
+	video_done_ = vf == NULL;
+	audio_done_ = af == NULL || pass == 0;
+	held_valid_ = false;
+	twopass_pos_ = 0;
+	frames_in_ = 0;
+	next_keyframe_ = 0;
+	if (pass != 1)
+		twopass_.clear();
+
+	quint32 serial = random_serialno();
+	if (vf != NULL) {
+		openVideo(*vf);
+		ogg_stream_init(&to_, serial++);
+	}
+	if (!audio_done_) {
+		openAudio(*af);
+		ogg_stream_init(&vo_, serial);
+	}
+	report_timer_.start();
+
+	if (pass == 0)
+		return;
+	out_.setFileName(output);
+	if (!out_.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		throw std::runtime_error("Unable to open the output file");
+	writeHeaders();
+}
+
+void
+Encoder::openVideo(const VideoFormat &vf)
+{
+	th_info_init(&ti_);
+	ti_.frame_width = (vf.width + 15) & ~15;
+	ti_.frame_height = (vf.height + 15) & ~15;
+	ti_.pic_width = vf.width;
+	ti_.pic_height = vf.height;
+	ti_.pic_x = 0;
+	ti_.pic_y = 0;
+	ti_.fps_numerator = vf.fps_num;
+	ti_.fps_denominator = vf.fps_den;
+	if (options_.aspect.isEmpty() || !pixel_aspect(options_.aspect, vf.width, vf.height,
+			&ti_.aspect_numerator, &ti_.aspect_denominator)) {
+		ti_.aspect_numerator = vf.par_num;
+		ti_.aspect_denominator = vf.par_den;
+	}
+	ti_.colorspace = TH_CS_UNSPECIFIED;
+	ti_.pixel_fmt = TH_PF_420;
+	ti_.target_bitrate = options_.video_bitrate > 0 ? options_.video_bitrate * 1000 : 0;
+	ti_.quality = options_.video_quality >= 0 ? int(options_.video_quality * 6.3 + 0.5) : 0;
+	ti_.keyframe_granule_shift = ilog(options_.keyint - 1);
+
+	td_ = th_encode_alloc(&ti_);
+	if (td_ == NULL) {
+		th_info_clear(&ti_);
+		throw std::runtime_error("Unsupported video parameters");
+	}
+	video_open_ = true;
+
+	ogg_uint32_t keyint = options_.keyint;
+	th_encode_ctl(td_, TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE, &keyint, sizeof(keyint));
+	if (options_.video_bitrate > 0 && options_.soft_target) {
+		int flags = TH_RATECTL_CAP_UNDERFLOW;
+		th_encode_ctl(td_, TH_ENCCTL_SET_RATE_FLAGS, &flags, sizeof(flags));
+	}
+	if (options_.video_bitrate > 0 && options_.buf_delay > 0) {
+		int delay = options_.buf_delay;
+		th_encode_ctl(td_, TH_ENCCTL_SET_RATE_BUFFER, &delay, sizeof(delay));
+	}
+	/* --optimize is speed level 0, as in ffmpeg2theora */
+	int level = options_.speed_level >= 0 ? options_.speed_level : options_.optimize ? 0 : -1;
+	if (level >= 0) {
+		int max = level;
+		th_encode_ctl(td_, TH_ENCCTL_GET_SPLEVEL_MAX, &max, sizeof(max));
+		level = qMin(level, max);
+		th_encode_ctl(td_, TH_ENCCTL_SET_SPLEVEL, &level, sizeof(level));
+	}
+
+	if (pass_ == 0) {
+		unsigned char *buf;
+		int n = th_encode_ctl(td_, TH_ENCCTL_2PASS_OUT, &buf, sizeof(buf));
+		if (n < 0)
+			throw std::runtime_error("Two-pass encoding needs a target bitrate");
+		twopass_.append((const char *)buf, n);
+	} else if (pass_ == 1) {
+		if (th_encode_ctl(td_, TH_ENCCTL_2PASS_IN, NULL, 0) < 0)
+			throw std::runtime_error("Two-pass encoding needs a target bitrate");
+	}
+}
+
+void
+Encoder::openAudio(const AudioFormat &af)
+{
+	vorbis_info_init(&vi_);
+	int ret = options_.audio_bitrate > 0 ?
+		vorbis_encode_init(&vi_, af.channels, af.samplerate, -1, options_.audio_bitrate * 1000, -1) :
+		vorbis_encode_init_vbr(&vi_, af.channels, af.samplerate, float(options_.audio_quality / 10.0));
+	if (ret != 0) {
+		vorbis_info_clear(&vi_);
+		throw std::runtime_error("Unsupported audio parameters");
+	}
+	vorbis_comment_init(&vc_);
+	for (int i = 0; i < options_.tags.size(); i++) {
+		QByteArray tag = options_.tags[i].first, value = options_.tags[i].second;
+		vorbis_comment_add_tag(&vc_, tag.data(), value.data());
+	}
+	vorbis_analysis_init(&vd_, &vi_);
+	vorbis_block_init(&vd_, &vb_);
+	channels_ = af.channels;
+	audio_open_ = true;
+}
+
+void
+Encoder::write(const QByteArray &data)
+{
+	if (out_.write(data) != data.size())
+		throw std::runtime_error("Unable to write the output file");
+}
+
+static QByteArray
+page_data(const ogg_page &og)
+{
+	return QByteArray((const char *)og.header, og.header_len)
+		+ QByteArray((const char *)og.body, og.body_len);
+}
+
+void
+Encoder::writeHeaders()
+{
+	ogg_packet op;
+	ogg_page og;
+
+	/* the first page of every stream must come first and alone */
+	if (video_open_) {
+		th_comment tc;
+		th_comment_init(&tc);
+		for (int i = 0; i < options_.tags.size(); i++) {
+			QByteArray tag = options_.tags[i].first, value = options_.tags[i].second;
+			th_comment_add_tag(&tc, tag.data(), value.data());
+		}
+		int ret = th_encode_flushheader(td_, &tc, &op);
+		if (ret <= 0) {
+			th_comment_clear(&tc);
+			throw std::runtime_error("Internal Theora library error");
+		}
+		ogg_stream_packetin(&to_, &op);
+		if (ogg_stream_pageout(&to_, &og) != 1) {
+			th_comment_clear(&tc);
+			throw std::runtime_error("Internal Ogg library error");
+		}
+		write(page_data(og));
+		while ((ret = th_encode_flushheader(td_, &tc, &op)) > 0)
+			ogg_stream_packetin(&to_, &op);
+		th_comment_clear(&tc);
+		if (ret < 0)
+			throw std::runtime_error("Internal Theora library error");
+	}
+	if (audio_open_) {
+		ogg_packet header, header_comm, header_code;
+		vorbis_analysis_headerout(&vd_, &vc_, &header, &header_comm, &header_code);
+		ogg_stream_packetin(&vo_, &header);
+		if (ogg_stream_pageout(&vo_, &og) != 1)
+			throw std::runtime_error("Internal Ogg library error");
+		write(page_data(og));
+		ogg_stream_packetin(&vo_, &header_comm);
+		ogg_stream_packetin(&vo_, &header_code);
+	}
+
+	/* and the remaining headers must end their pages before any data */
+	if (video_open_)
+		while (ogg_stream_flush(&to_, &og) > 0)
+			write(page_data(og));
+	if (audio_open_)
+		while (ogg_stream_flush(&vo_, &og) > 0)
+			write(page_data(og));
+}
+
+void
+Encoder::writeVideo(const YuvFrame &frame)
+{
+	th_ycbcr_buffer ycbcr;
+	for (int i = 0; i < 3; i++) {
+		ycbcr[i].width = frame.width[i];
+		ycbcr[i].height = frame.height[i];
+		ycbcr[i].stride = frame.stride[i];
+		ycbcr[i].data = frame.plane[i];
+	}
+
+	if (pass_ == 1) {
+		for (;;) {
+			int want = th_encode_ctl(td_, TH_ENCCTL_2PASS_IN, NULL, 0);
+			if (want < 0)
+				throw std::runtime_error("Corrupt two-pass data");
+			int left = twopass_.size() - twopass_pos_;
+			if (want == 0 || left <= 0)
+				break;
+			int n = th_encode_ctl(td_, TH_ENCCTL_2PASS_IN,
+				twopass_.data() + twopass_pos_, qMin(want, left));
+			if (n < 0)
+				throw std::runtime_error("Corrupt two-pass data");
+			twopass_pos_ += n;
+		}
+	}
+
+	/* libtheora can't be asked for a keyframe, but codes one once the
+	 * frames since the last reach the forced interval: for the first
+	 * frame of a scene, that is 1 */
+	bool key = false;
+	if (next_keyframe_ < options_.keyframes.size()) {
+		double fps = ti_.fps_numerator / double(ti_.fps_denominator);
+		double t = qMax(options_.start, 0.0) + frames_in_ / fps, half = 0.5 / fps;
+		while (next_keyframe_ < options_.keyframes.size() &&
+		       options_.keyframes[next_keyframe_] < t - half)
+			next_keyframe_++;
+		key = next_keyframe_ < options_.keyframes.size() &&
+			options_.keyframes[next_keyframe_] < t + half;
+	}
+	ogg_uint32_t keyint = 1;
+	if (key)
+		th_encode_ctl(td_, TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE, &keyint, sizeof(keyint));
+	if (th_encode_ycbcr_in(td_, ycbcr) != 0)
+		throw std::runtime_error("Invalid video frame");
+	frames_in_++;
+	if (key) {
+		keyint = options_.keyint;
+		th_encode_ctl(td_, TH_ENCCTL_SET_KEYFRAME_FREQUENCY_FORCE, &keyint, sizeof(keyint));
+		next_keyframe_++;
+	}
+
+	if (pass_ == 0) {
+		unsigned char *buf;
+		int n = th_encode_ctl(td_, TH_ENCCTL_2PASS_OUT, &buf, sizeof(buf));
+		if (n < 0)
+			throw std::runtime_error("Internal Theora library error");
+		twopass_.append((const char *)buf, n);
+	}
+	flushVideo();
+	writePages();
+	report();
+}
+
+/* The last packet has to be flagged as the end of stream, but we only
+ * know it was the last one when close() is called, so one packet is
+ * always held back.
+ */
+
+void
+Encoder::submitHeldPacket(bool eos)
+{
+	if (!held_valid_)
+		return;
+	held_op_.packet = (unsigned char *)held_.data();
+	held_op_.e_o_s = eos ? 1 : 0;
+	ogg_stream_packetin(&to_, &held_op_);
+	video_bytes_ += held_.size();
+	held_valid_ = false;
+}
+
+void
+Encoder::flushVideo()
+{
+	ogg_packet op;
+	while (th_encode_packetout(td_, 0, &op) > 0) {
+		video_time_ = th_granule_time(td_, op.granulepos);
+		if (pass_ == 0)
+			continue;
+		submitHeldPacket(false);
+		held_ = QByteArray((const char *)op.packet, op.bytes);
+		held_op_ = op;
+		held_valid_ = true;
+	}
+	if (pass_ != 0)
+		queuePages(true, false);
+}
+
+void
+Encoder::writeAudio(const float *interleaved, int frames)
+{
+	if (!audio_open_)
+		return;
+	float **buf = vorbis_analysis_buffer(&vd_, frames);
+	for (int i = 0; i < frames; i++)
+		for (int c = 0; c < channels_; c++)
+			buf[c][i] = *interleaved++;
+	vorbis_analysis_wrote(&vd_, frames);
+	flushAudio();
+	writePages();
+	report();
+}
+
+void
+Encoder::flushAudio()
+{
+	ogg_packet op;
+	while (vorbis_analysis_blockout(&vd_, &vb_) == 1) {
+		vorbis_analysis(&vb_, NULL);
+		vorbis_bitrate_addblock(&vb_);
+		while (vorbis_bitrate_flushpacket(&vd_, &op)) {
+			ogg_stream_packetin(&vo_, &op);
+			audio_bytes_ += op.bytes;
+			if (op.granulepos >= 0)
+				audio_time_ = vorbis_granule_time(&vd_, op.granulepos);
+		}
+	}
+	queuePages(false, false);
+}
+
+void
+Encoder::queuePages(bool video, bool flush)
+{
+	ogg_stream_state *os = video ? &to_ : &vo_;
+	QList<Page> *queue = video ? &vpages_ : &apages_;
+	ogg_page og;
+	while (flush ? ogg_stream_flush(os, &og) : ogg_stream_pageout(os, &og)) {
+		Page p;
+		p.data = page_data(og);
+		ogg_int64_t gp = ogg_page_granulepos(&og);
+		if (gp >= 0)
+			p.time = video ? th_granule_time(td_, gp) : vorbis_granule_time(&vd_, gp);
+		else
+			p.time = queue->empty() ? 0 : queue->back().time;
+		queue->push_back(p);
+	}
+}
+
+/* pages go out in the order of their time; a stream that has nothing
+ * queued blocks the other one until it's finished */
+
+void
+Encoder::writePages()
+{
+	if (pass_ == 0)
+		return;
+	for (;;) {
+		bool v = !vpages_.empty(), a = !apages_.empty();
+		if (v && (a ? vpages_.front().time <= apages_.front().time : audio_done_))
+			write(vpages_.takeFirst().data);
+		else if (a && (v || video_done_))
+			write(apages_.takeFirst().data);
+		else
+			break;
+	}
+}
+
+void
+Encoder::report(bool force)
+{
+	if (!force && report_timer_.elapsed() < REPORT_INTERVAL)
+		return;
+	report_timer_.restart();
+
+	double pos = video_open_ ? video_time_ : audio_time_;
+	if (video_open_ && audio_open_)
+		pos = qMin(video_time_, audio_time_);
+	double audio_b = audio_open_ && audio_time_ > 0 ? audio_bytes_ * 8 / 1000.0 / audio_time_ : -1;
+	double video_b = video_open_ && video_time_ > 0 && pass_ != 0 ? video_bytes_ * 8 / 1000.0 / video_time_ : -1;
+	if (listener_ != NULL)
+		listener_->progress(pos, audio_b, video_b, pass_);
+}
+
+void
+Encoder::close()
+{
+	if (video_open_) {
+		flushVideo();
+		if (pass_ == 0) {
+			/* the final summary replaces the preliminary one at the start */
+			unsigned char *buf;
+			int n = th_encode_ctl(td_, TH_ENCCTL_2PASS_OUT, &buf, sizeof(buf));
+			if (n > 0 && n <= twopass_.size())
+				memcpy(twopass_.data(), buf, n);
+		} else {
+			submitHeldPacket(true);
+			queuePages(true, true);
+		}
+	}
+	video_done_ = true;
+
+	if (audio_open_) {
+		vorbis_analysis_wrote(&vd_, 0);
+		flushAudio();
+		queuePages(false, true);
+	}
+	audio_done_ = true;
+
+	writePages();
+	report(true);
+	if (out_.isOpen() && !out_.flush())
+		throw std::runtime_error("Unable to write the output file");
+	release();
+}
@@ -0,0 +1,145 @@
+/*
+ * encoder.h - built-in Theora/Vorbis encoder declarations
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_ENCODER
+#define H_ENCODER
+
+#include <QFile>
+#include <QList>
+#include <QPair>
+#include <QStringList>
+#include <QTime>
+#include <theora/theoraenc.h>
+#include <vorbis/vorbisenc.h>
+#include <ogg/ogg.h>
+#include "decoder.h"
+#include "prefilter.h"
+#include "util.h"
+
+/* ffmpeg2theora command line, as built by Frontend::transcode(),
+ * split into what the decoder does and what libtheora/libvorbis do
+ */
+
+struct EncoderOptions
+{
+	bool audio;
+	bool video;
+	double start;
+	double end;
+	int audio_stream;
+	int video_stream;
+	int channels;
+	int samplerate;
+	double audio_quality;
+	int audio_bitrate;
+	double video_quality;
+	int video_bitrate;
+	bool two_pass;
+	bool soft_target;
+	bool optimize;
+	int speed_level;
+	int keyint;
+	int buf_delay;
+	QString aspect;
+	QStringList input_options;
+	QStringList video_filters;
+	QList<QPair<QByteArray, QByteArray> > tags;
+	/* crop, scale and eq here rather than in the decoder */
+	bool prefilter_frames;
+	PrefilterOptions prefilter;
+	/* resample and mix here rather than in the decoder */
+	bool audio_prefilter;
+	double loudness; /* LUFS, 0 for none */
+	/* find the scene cuts first and start each scene on a keyframe */
+	bool scene_keyframes;
+	QList<double> keyframes; /* input times */
+
+	EncoderOptions();
+	void parse(const QStringList &args);
+	QStringList decoderOptions(Decoder::Type) const;
+	QStringList decoderInputOptions() const;
+};
+
+class Encoder
+{
+public:
+	Encoder(const EncoderOptions &, ProgressListener *);
+	~Encoder();
+
+	/* pass is -1 for single pass encoding, 0 or 1 for two-pass;
+	 * the first pass takes video only and writes nothing
+	 */
+	void open(const QString &output, const VideoFormat *, const AudioFormat *, int pass = -1);
+	void writeVideo(const YuvFrame &);
+	void writeAudio(const float *interleaved, int frames);
+	void close();
+
+private:
+	struct Page {
+		QByteArray data;
+		double time;
+	};
+
+	void openVideo(const VideoFormat &);
+	void openAudio(const AudioFormat &);
+	void writeHeaders();
+	void flushVideo();
+	void flushAudio();
+	void submitHeldPacket(bool eos);
+	void queuePages(bool video, bool flush);
+	void writePages();
+	void write(const QByteArray &);
+	void report(bool force = false);
+	void release();
+
+	EncoderOptions options_;
+	ProgressListener *listener_;
+	int pass_;
+	QFile out_;
+	QTime report_timer_;
+
+	bool video_open_;
+	th_info ti_;
+	th_enc_ctx *td_;
+	ogg_stream_state to_;
+	QByteArray held_;
+	ogg_packet held_op_;
+	bool held_valid_;
+	QByteArray twopass_;
+	int twopass_pos_;
+	qint64 frames_in_;
+	int next_keyframe_;
+
+	bool audio_open_;
+	int channels_;
+	vorbis_info vi_;
+	vorbis_comment vc_;
+	vorbis_dsp_state vd_;
+	vorbis_block vb_;
+	ogg_stream_state vo_;
+
+	QList<Page> vpages_, apages_;
+	double video_time_, audio_time_;
+	bool video_done_, audio_done_;
+	qint64 video_bytes_, audio_bytes_;
+};
+
+#endif // H_ENCODER
@@ -20,32 +20,144 @@
  *
  */
 
+#include <QHash>
 #include <QProcess>
+#include <cstring>
 #include <stdexcept>
 #include "fileinfo.h"
+#include "remote.h"
+#include "sniff.h"
+#include "trace.h"
 #include "transcoder.h"
 #include "util.h"
 
+/* scope, name and how the frontend shows it; the type comes from the member */
 #define FIELDS \
-	FILE_FIELD(duration, .toDouble()) \
-	FILE_FIELD(bitrate, .toDouble()) \
-	FILE_FIELD(size, .toLongLong()) \
+	FILE_FIELD(duration, TIME) \
+	FILE_FIELD(bitrate, BITRATE) \
+	FILE_FIELD(size, BYTES) \
 \
-	STREAM_FIELD(codec, ) \
-	STREAM_FIELD(bitrate, .toDouble()) \
-	STREAM_FIELD(id, .toInt()) \
+	STREAM_FIELD(codec, PLAIN) \
+	STREAM_FIELD(bitrate, BITRATE) \
+	STREAM_FIELD(id, PLAIN) \
 \
-	VSTREAM_FIELD(pixel_format, ) \
-	VSTREAM_FIELD(height, .toInt()) \
-	VSTREAM_FIELD(width, .toInt()) \
-	VSTREAM_FIELD(framerate, ) \
-	VSTREAM_FIELD(pixel_aspect_ratio, ) \
-	VSTREAM_FIELD(display_aspect_ratio, ) \
+	ASTREAM_FIELD(samplerate, PLAIN) \
+	ASTREAM_FIELD(channels, PLAIN) \
 \
-	ASTREAM_FIELD(samplerate, .toInt()) \
-	ASTREAM_FIELD(channels, .toInt()) \
+	VSTREAM_FIELD(pixel_format, PLAIN) \
+	VSTREAM_FIELD(height, PLAIN) \
+	VSTREAM_FIELD(width, PLAIN) \
+	VSTREAM_FIELD(framerate, PLAIN) \
+	VSTREAM_FIELD(pixel_aspect_ratio, PLAIN) \
+	VSTREAM_FIELD(display_aspect_ratio, PLAIN) \
 
 #define BUF_SIZE 256
+#define SERIAL_MAGIC "FI"
+#define SERIAL_VERSION 1
+#define SCOPES 4
+#define MAX_STREAMS 1024
+
+/* a member's Type as a constant: sizeof of what the overload returns */
+template <class C> char (&type_tag(QString C::*))[FileInfoField::STRING + 1];
+template <class C> char (&type_tag(int C::*))[FileInfoField::INT + 1];
+template <class C> char (&type_tag(long long C::*))[FileInfoField::LONG_LONG + 1];
+template <class C> char (&type_tag(double C::*))[FileInfoField::DOUBLE + 1];
+#define TYPE_OF(member) FileInfoField::Type(sizeof(type_tag(member)) - 1)
+
+#define FILE_FIELD(f, u) FIELD(FileInfo, f, FILE_SCOPE, u)
+#define STREAM_FIELD(f, u) FIELD(StreamInfo, f, STREAM_SCOPE, u)
+#define ASTREAM_FIELD(f, u) FIELD(AudioStreamInfo, f, AUDIO_SCOPE, u)
+#define VSTREAM_FIELD(f, u) FIELD(VideoStreamInfo, f, VIDEO_SCOPE, u)
+
+#define FIELD(cls, f, scope, u) \
+	static void *cls##_##f(void *obj) { return &static_cast<cls *>(obj)->f; }
+FIELDS
+#undef FIELD
+
+#define FIELD(cls, f, scope, u) \
+	{ #f, FileInfoField::scope, TYPE_OF(&cls::f), FileInfoField::u, cls##_##f },
+const FileInfoField fileinfo_fields[] = {
+	FIELDS
+};
+#undef FIELD
+
+const int fileinfo_field_count = sizeof(fileinfo_fields) / sizeof(*fileinfo_fields);
+
+QString
+FileInfoField::toString(const void *obj) const
+{
+	const void *p = in(obj);
+	switch (type) {
+	case STRING:
+		return *static_cast<const QString *>(p);
+	case INT:
+		return QString::number(*static_cast<const int *>(p));
+	case LONG_LONG:
+		return QString::number(*static_cast<const long long *>(p));
+	case DOUBLE:
+		return QString::number(*static_cast<const double *>(p));
+	}
+	return QString();
+}
+
+double
+FileInfoField::number(const void *obj) const
+{
+	const void *p = in(obj);
+	switch (type) {
+	case INT:
+		return *static_cast<const int *>(p);
+	case LONG_LONG:
+		return double(*static_cast<const long long *>(p));
+	case DOUBLE:
+		return *static_cast<const double *>(p);
+	default:
+		return 0;
+	}
+}
+
+static void
+set_field(const FileInfoField &f, void *obj, const QString &value)
+{
+	void *p = f.in(obj);
+	switch (f.type) {
+	case FileInfoField::STRING:
+		*static_cast<QString *>(p) = value;
+		break;
+	case FileInfoField::INT:
+		*static_cast<int *>(p) = value.toInt();
+		break;
+	case FileInfoField::LONG_LONG:
+		*static_cast<long long *>(p) = value.toLongLong();
+		break;
+	case FileInfoField::DOUBLE:
+		*static_cast<double *>(p) = value.toDouble();
+		break;
+	}
+}
+
+/* a key names at most one field of the file and one of the streams */
+
+struct FieldSlots {
+	int file;
+	int stream;
+
+	FieldSlots(): file(-1), stream(-1) { }
+};
+
+static QHash<QString, FieldSlots>
+build_index()
+{
+	QHash<QString, FieldSlots> ret;
+	for (int i = 0; i < fileinfo_field_count; i++) {
+		FieldSlots &slots = ret[fileinfo_fields[i].name];
+		if (fileinfo_fields[i].scope == FileInfoField::FILE_SCOPE)
+			slots.file = i;
+		else
+			slots.stream = i;
+	}
+	return ret;
+}
 
 enum StreamType {
 	NONE,
@@ -62,6 +174,24 @@ struct State {
 	State(): stream(NULL), stream_type(NONE), astream(NULL), vstream(NULL) { }
 };
 
+static void *
+stream_object(FileInfoField::Scope scope, const State *s)
+{
+	switch (scope) {
+	case FileInfoField::STREAM_SCOPE:
+		return s->stream;
+	case FileInfoField::AUDIO_SCOPE:
+		return s->astream;
+	case FileInfoField::VIDEO_SCOPE:
+		return s->vstream;
+	default:
+		return NULL;
+	}
+}
+
+/* A key shared by the file and the streams, like "bitrate", is the
+ * stream's once one has begun. */
+
 static void
 process_field(FileInfo *fi, State *s, const QString &key, const QString &value)
 {
@@ -91,25 +221,45 @@ process_field(FileInfo *fi, State *s, const QString &key, const QString &value)
 		process_field(fi, s, "codec", value);
 	}
 
-#define FIELD(field, conv, obj) \
-	if (key == #field && obj != NULL) \
-		obj->field = value conv;
-#define FILE_FIELD(f, c) FIELD(f, c, fi)
-#define STREAM_FIELD(f, c) FIELD(f, c, s->stream)
-#define ASTREAM_FIELD(f, c) FIELD(f, c, s->astream)
-#define VSTREAM_FIELD(f, c) FIELD(f, c, s->vstream)
-	FIELDS
-#undef FIELD
+	static const QHash<QString, FieldSlots> index = build_index();
+	QHash<QString, FieldSlots>::const_iterator i = index.find(key);
+	if (i == index.end())
+		return;
+	int f = i.value().stream;
+	void *obj = f >= 0 ? stream_object(fileinfo_fields[f].scope, s) : NULL;
+	if (obj == NULL && (f = i.value().file) >= 0)
+		obj = fi;
+	if (obj != NULL)
+		set_field(fileinfo_fields[f], obj, value);
 }
 
 void
-FileInfo::retrieve(const QString &filename)
+FileInfo::clear()
 {
 	duration = -1;
 	bitrate = -1;
 	size = -1;
 	audio_streams.clear();
 	video_streams.clear();
+}
+
+void
+FileInfo::retrieve(const QString &filename, const QString &worker)
+{
+	TraceScope trace("probe", filename);
+	clear();
+	if (!worker.isEmpty()) {
+		QByteArray data = remote_probe(worker, filename);
+		if (!data.isEmpty())
+			deserialize(data);
+		else
+			parse(remote_info(worker, filename));
+		return;
+	}
+
+	Sniff sniffed = sniff_file(filename);
+	if (sniffed.verdict == Sniff::JUNK)
+		throw std::runtime_error(std::string("Not audio or video: ") + sniffed.what);
 
 	QProcess proc;
 	proc.start(Transcoder::ffmpeg2theora(), QStringList() << "--info" << filename);
@@ -136,3 +286,227 @@ FileInfo::retrieve(const QString &filename)
 	if (proc.exitCode() != 0 || proc.exitStatus() != QProcess::NormalExit)
 		throw std::runtime_error("Invalid input file");
 }
+
+void
+FileInfo::parse(const QList<QByteArray> &lines)
+{
+	State state;
+	for (int i = 0; i < lines.size(); i++) {
+		QString key, value;
+		if (parse_json_pair(QString::fromUtf8(lines[i]), &key, &value))
+			process_field(this, &state, key, value);
+	}
+}
+
+/* The encoding: magic and version, then for each scope the number of its
+ * fields and their types, then the values: the file's, and those of each
+ * stream, common fields first. Integers are zigzag varints, doubles are
+ * little-endian IEEE, strings are UTF-8 after their length.
+ */
+
+static void
+put_varint(QByteArray *out, quint64 v)
+{
+	while (v >= 0x80) {
+		out->append(char(v | 0x80));
+		v >>= 7;
+	}
+	out->append(char(v));
+}
+
+static void
+put_value(QByteArray *out, const FileInfoField &f, const void *obj)
+{
+	const void *p = f.in(obj);
+	switch (f.type) {
+	case FileInfoField::STRING: {
+		QByteArray s = static_cast<const QString *>(p)->toUtf8();
+		put_varint(out, s.size());
+		out->append(s);
+		break;
+	}
+	case FileInfoField::INT:
+	case FileInfoField::LONG_LONG: {
+		qint64 v = f.type == FileInfoField::INT ? *static_cast<const int *>(p) :
+			*static_cast<const long long *>(p);
+		put_varint(out, (quint64(v) << 1) ^ quint64(v >> 63));
+		break;
+	}
+	case FileInfoField::DOUBLE: {
+		quint64 bits;
+		memcpy(&bits, p, sizeof(bits));
+		for (int i = 0; i < 8; i++)
+			out->append(char(bits >> (8 * i)));
+		break;
+	}
+	}
+}
+
+static void
+put_fields(QByteArray *out, FileInfoField::Scope scope, const void *obj)
+{
+	for (int i = 0; i < fileinfo_field_count; i++)
+		if (fileinfo_fields[i].scope == scope)
+			put_value(out, fileinfo_fields[i], obj);
+}
+
+QByteArray
+FileInfo::serialize() const
+{
+	QByteArray out(SERIAL_MAGIC);
+	out.append(char(SERIAL_VERSION));
+	for (int scope = 0; scope < SCOPES; scope++) {
+		QByteArray types;
+		for (int i = 0; i < fileinfo_field_count; i++)
+			if (fileinfo_fields[i].scope == scope)
+				types.append(char(fileinfo_fields[i].type));
+		out.append(char(types.size()));
+		out.append(types);
+	}
+	put_fields(&out, FileInfoField::FILE_SCOPE, this);
+	put_varint(&out, audio_streams.size());
+	for (int i = 0; i < audio_streams.size(); i++) {
+		const AudioStreamInfo &a = audio_streams[i];
+		put_fields(&out, FileInfoField::STREAM_SCOPE, static_cast<const StreamInfo *>(&a));
+		put_fields(&out, FileInfoField::AUDIO_SCOPE, &a);
+	}
+	put_varint(&out, video_streams.size());
+	for (int i = 0; i < video_streams.size(); i++) {
+		const VideoStreamInfo &v = video_streams[i];
+		put_fields(&out, FileInfoField::STREAM_SCOPE, static_cast<const StreamInfo *>(&v));
+		put_fields(&out, FileInfoField::VIDEO_SCOPE, &v);
+	}
+	return out;
+}
+
+namespace {
+
+class SerialReader
+{
+public:
+	SerialReader(const QByteArray &data)
+		: p_((const uchar *)data.constData()), end_(p_ + data.size()) { }
+	int left() const { return end_ - p_; }
+	const uchar *take(int n);
+	quint64 varint();
+	/* into the field if there is one, else skipped */
+	void value(FileInfoField::Type, const FileInfoField *, void *obj);
+
+private:
+	const uchar *p_;
+	const uchar *end_;
+};
+
+}
+
+const uchar *
+SerialReader::take(int n)
+{
+	if (n < 0 || n > left())
+		throw std::runtime_error("Damaged file information");
+	const uchar *ret = p_;
+	p_ += n;
+	return ret;
+}
+
+quint64
+SerialReader::varint()
+{
+	quint64 v = 0;
+	for (int shift = 0; shift < 64; shift += 7) {
+		uchar b = *take(1);
+		v |= quint64(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return v;
+	}
+	throw std::runtime_error("Damaged file information");
+}
+
+void
+SerialReader::value(FileInfoField::Type type, const FileInfoField *f, void *obj)
+{
+	void *p = f != NULL ? f->in(obj) : NULL;
+	switch (type) {
+	case FileInfoField::STRING: {
+		quint64 n = varint();
+		const char *s = (const char *)take(n > quint64(left()) ? -1 : int(n));
+		if (p != NULL)
+			*static_cast<QString *>(p) = QString::fromUtf8(s, int(n));
+		break;
+	}
+	case FileInfoField::INT:
+	case FileInfoField::LONG_LONG: {
+		quint64 z = varint();
+		qint64 v = qint64(z >> 1) ^ -qint64(z & 1);
+		if (p != NULL && type == FileInfoField::INT)
+			*static_cast<int *>(p) = int(v);
+		else if (p != NULL)
+			*static_cast<long long *>(p) = v;
+		break;
+	}
+	case FileInfoField::DOUBLE: {
+		const uchar *b = take(8);
+		quint64 bits = 0;
+		for (int i = 0; i < 8; i++)
+			bits |= quint64(b[i]) << (8 * i);
+		if (p != NULL)
+			memcpy(p, &bits, sizeof(bits));
+		break;
+	}
+	default:
+		throw std::runtime_error("Damaged file information");
+	}
+}
+
+/* the fields the writer had, as far as they are known here and of the same type */
+
+static void
+get_fields(SerialReader *r, const QByteArray &types, FileInfoField::Scope scope, void *obj)
+{
+	int k = 0;
+	for (int i = 0; i < fileinfo_field_count && k < types.size(); i++)
+		if (fileinfo_fields[i].scope == scope) {
+			FileInfoField::Type type = FileInfoField::Type(types[k++]);
+			r->value(type, type == fileinfo_fields[i].type ? &fileinfo_fields[i] : NULL, obj);
+		}
+	for (; k < types.size(); k++)
+		r->value(FileInfoField::Type(types[k]), NULL, obj);
+}
+
+void
+FileInfo::deserialize(const QByteArray &data)
+{
+	SerialReader r(data);
+	if (memcmp(r.take(2), SERIAL_MAGIC, 2) != 0 || *r.take(1) != SERIAL_VERSION)
+		throw std::runtime_error("Unknown file information format");
+	QByteArray types[SCOPES];
+	for (int scope = 0; scope < SCOPES; scope++) {
+		int n = *r.take(1);
+		types[scope] = QByteArray((const char *)r.take(n), n);
+	}
+
+	FileInfo fi;
+	fi.clear();
+	get_fields(&r, types[FileInfoField::FILE_SCOPE], FileInfoField::FILE_SCOPE, &fi);
+	quint64 n = r.varint();
+	if (n > MAX_STREAMS)
+		throw std::runtime_error("Damaged file information");
+	for (quint64 i = 0; i < n; i++) {
+		AudioStreamInfo a;
+		get_fields(&r, types[FileInfoField::STREAM_SCOPE], FileInfoField::STREAM_SCOPE,
+			static_cast<StreamInfo *>(&a));
+		get_fields(&r, types[FileInfoField::AUDIO_SCOPE], FileInfoField::AUDIO_SCOPE, &a);
+		fi.audio_streams << a;
+	}
+	n = r.varint();
+	if (n > MAX_STREAMS)
+		throw std::runtime_error("Damaged file information");
+	for (quint64 i = 0; i < n; i++) {
+		VideoStreamInfo v;
+		get_fields(&r, types[FileInfoField::STREAM_SCOPE], FileInfoField::STREAM_SCOPE,
+			static_cast<StreamInfo *>(&v));
+		get_fields(&r, types[FileInfoField::VIDEO_SCOPE], FileInfoField::VIDEO_SCOPE, &v);
+		fi.video_streams << v;
+	}
+	*this = fi;
+}
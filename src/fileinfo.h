@@ -22,6 +22,7 @@
 #ifndef H_FILEINFO
 #define H_FILEINFO
 
+#include <QByteArray>
 #include <QList>
 #include <QString>
 
@@ -62,7 +63,58 @@ struct FileInfo
 	QList<AudioStreamInfo> audio_streams;
 	QList<VideoStreamInfo> video_streams;
 
-	void retrieve(const QString &);
+	void clear();
+	/* probes on the given worker if there is one, see remote.h */
+	void retrieve(const QString &, const QString &worker = QString());
+	/* ffmpeg2theora --info output, one "key": value pair at a time */
+	void parse(const QList<QByteArray> &lines);
+
+	/* A compact binary form, for keeping or sending elsewhere. It starts
+	 * with the types of the fields it has, so that fields can be added
+	 * at the end of a struct without breaking older readers or data.
+	 * deserialize() throws on damaged data. */
+	QByteArray serialize() const;
+	void deserialize(const QByteArray &);
 };
 
+/* The fields above, as parsed, shown in the Info tab and serialized;
+ * entries of a scope are in the order of its struct.
+ */
+
+struct FileInfoField
+{
+	enum Scope {
+		FILE_SCOPE,
+		STREAM_SCOPE, /* StreamInfo, in both kinds of stream */
+		AUDIO_SCOPE,
+		VIDEO_SCOPE
+	};
+	enum Type {
+		STRING,
+		INT,
+		LONG_LONG,
+		DOUBLE
+	};
+	enum Unit {
+		PLAIN,
+		TIME,
+		BITRATE,
+		BYTES
+	};
+
+	const char *name;
+	Scope scope;
+	Type type;
+	Unit unit;
+	void *(*member)(void *); /* in the FileInfo or stream */
+
+	const void *in(const void *obj) const { return member(const_cast<void *>(obj)); }
+	void *in(void *obj) const { return member(obj); }
+	QString toString(const void *obj) const;
+	double number(const void *obj) const; /* 0 for strings */
+};
+
+extern const FileInfoField fileinfo_fields[];
+extern const int fileinfo_field_count;
+
 #endif // H_FILEINFO
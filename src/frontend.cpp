@@ -26,7 +26,15 @@
 #include <QCloseEvent>
 #include <QPlastiqueStyle>
 #include <QSettings>
+#include <QShortcut>
 #include "frontend.h"
+#include "library.h"
+#include "preview.h"
+#include "remux.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "trimdetect.h"
+#include "watchdog.h"
 
 #define LENGTH(x) int(sizeof(x) / sizeof(*x))
 
@@ -36,6 +44,8 @@
 #define MAX_KEYINT 2147483647
 #define MIN_BDELAY 1
 #define MAX_BDELAY 2147483647
+#define MIN_LOUDNESS -30
+#define MAX_LOUDNESS -5
 #define ADJUST_SCALE 10.0
 
 /* a year will do :) */
@@ -45,6 +55,7 @@
 #define DEPEND_CONNECT(wdep, w) connect(ui.w, SIGNAL(toggled(bool)), ui.wdep, SLOT(setEnabled(bool)));
 
 static QString input_filter();
+static QStringList input_patterns();
 
 static void
 activate_layout(QWidget *widget)
@@ -125,7 +136,9 @@ Frontend::Frontend(QWidget* parent)
 	output_dlg(this, "Select the output file", QString(), "*.*"),
 	subtitles_dlg(this, "Select the subtitles file", QString(), "Subtitles (*.srt);;Any files (*)"),
 	exitting(false),
-	input_valid(false)
+	input_valid(false),
+	library(NULL),
+	preview(NULL)
 {
 	ui.setupUi(this);
 	ui.progress->setStyle(new QPlastiqueStyle());
@@ -136,6 +149,8 @@ Frontend::Frontend(QWidget* parent)
 	connect(transcoder, SIGNAL(statusUpdate(QString)), this, SLOT(updateStatus(QString)));
 	connect(transcoder, SIGNAL(statusUpdate(double, double, double, double, int)),
 			this, SLOT(updateStatus(double, double, double, double, int)));
+	trim_detector = new TrimDetector(this);
+	connect(trim_detector, SIGNAL(finished()), this, SLOT(trimDetected()));
 
 	input_dlg.setOption(QFileDialog::HideNameFilterDetails);
 	input_dlg.setFileMode(QFileDialog::ExistingFile);
@@ -152,11 +167,19 @@ Frontend::Frontend(QWidget* parent)
 	connect(ui.output, SIGNAL(textChanged(QString)), this, SLOT(outputChanged()));
 	connect(ui.transcode, SIGNAL(released()), this, SLOT(transcode()));
 	connect(ui.cancel, SIGNAL(released()), this, SLOT(cancel()));
+	connect(ui.pause, SIGNAL(toggled(bool)), this, SLOT(pauseToggled(bool)));
+	connect(ui.priority, SIGNAL(currentIndexChanged(int)), this, SLOT(priorityChanged()));
+	new QShortcut(QKeySequence::New, this, SLOT(newWindow()));
+	new QShortcut(QKeySequence("Ctrl+Shift+L"), this, SLOT(showWatchdog()));
+	connect(ui.input_library, SIGNAL(clicked()), this, SLOT(showLibrary()));
 	connect(ui.partial_start, SIGNAL(valueChanged(double)), ui.partial_end, SLOT(setMinimum(double)));
 	connect(ui.partial_end, SIGNAL(valueChanged(double)), ui.partial_start, SLOT(setMaximum(double)));
 	connect(ui.no_skeleton, SIGNAL(toggled(bool)), this, SLOT(fixExtension()));
 	DEPEND_CONNECT(partial_start, partial);
 	DEPEND_CONNECT(partial_end, partial);
+	DEPEND_CONNECT(partial_keyframes, partial);
+	connect(ui.partial_keyframes, SIGNAL(toggled(bool)), this, SLOT(updateStreamCopy()));
+	connect(ui.partial_detect, SIGNAL(clicked()), this, SLOT(detectTrim()));
 
 	/* Info */
 	connect(ui.info_audio_stream, SIGNAL(currentIndexChanged(int)), this, SLOT(updateInfo()));
@@ -185,6 +208,7 @@ Frontend::Frontend(QWidget* parent)
 	DEPEND_CONNECT(video_st, video_const_bitrate);
 	connect(ui.video_const_bitrate, SIGNAL(toggled(bool)), this, SLOT(updateSoftTarget()));
 	connect(ui.video_const_bitrate, SIGNAL(toggled(bool)), this, SLOT(updateAdvanced()));
+	connect(ui.video_two_pass, SIGNAL(toggled(bool)), this, SLOT(updateAdvanced()));
 	connect(ui.video_st, SIGNAL(toggled(bool)), this, SLOT(updateSoftTarget()));
 	connect(ui.video_st_quality_on, SIGNAL(toggled(bool)), this, SLOT(updateSoftTarget()));
 	connect(ui.video_quality, SIGNAL(valueChanged(int)), ui.video_quality_label, SLOT(setNum(int)));
@@ -219,15 +243,37 @@ Frontend::Frontend(QWidget* parent)
 	connect(ui.advanced_gamma, SIGNAL(valueChanged(int)), this, SLOT(updateAdvanced()));
 	connect(ui.advanced_saturation, SIGNAL(valueChanged(int)), this, SLOT(updateAdvanced()));
 	connect(ui.advanced_adjust_reset, SIGNAL(released()), this, SLOT(resetAdjust()));
+	connect(ui.advanced_adjust_preview, SIGNAL(clicked()), this, SLOT(showPreview()));
+	connect(ui.advanced_adjust, SIGNAL(toggled(bool)), this, SLOT(updateAdvanced()));
 	DEPEND_CONNECT(advanced_keyint_value, advanced_keyint);
 	DEPEND_CONNECT(advanced_format_value, advanced_format);
 	DEPEND_CONNECT(advanced_bdelay_value, advanced_bdelay);
 	set_label_min_size(ui.advanced_contrast_label, "10.0");
 	ui.advanced_keyint_value->setValidator(new QIntValidator(MIN_KEYINT, MAX_KEYINT, this));
 	ui.advanced_bdelay_value->setValidator(new QIntValidator(MIN_BDELAY, MAX_BDELAY, this));
+	connect(ui.advanced_stream_copy, SIGNAL(toggled(bool)), this, SLOT(updateStreamCopy()));
+	connect(ui.tabs, SIGNAL(currentChanged(int)), this, SLOT(updateStreamCopy()));
+	DEPEND_CONNECT(advanced_prefilter, advanced_internal_encoder);
+	DEPEND_CONNECT(advanced_audio_prefilter, advanced_internal_encoder);
+	connect(ui.advanced_internal_encoder, SIGNAL(toggled(bool)), this, SLOT(updateAdvanced()));
+	connect(ui.audio_encode, SIGNAL(toggled(bool)), this, SLOT(updateAdvanced()));
+	DEPEND_CONNECT(advanced_scene_keyframes, advanced_internal_encoder);
+	DEPEND_CONNECT(advanced_loudness_value, advanced_loudness);
+	ui.advanced_loudness_value->setValidator(new QIntValidator(MIN_LOUDNESS, MAX_LOUDNESS, this));
+	connect(ui.advanced_internal_encoder, SIGNAL(toggled(bool)), ui.advanced_split, SLOT(setDisabled(bool)));
+	connect(ui.advanced_internal_encoder, SIGNAL(toggled(bool)), this, SLOT(updatePreview()));
+#ifndef INTERNAL_ENCODER
+	ui.advanced_internal_encoder->hide();
+	ui.advanced_prefilter->hide();
+	ui.advanced_audio_prefilter->hide();
+	ui.advanced_loudness->hide();
+	ui.advanced_loudness_value->hide();
+	ui.advanced_scene_keyframes->hide();
+#endif
 
 	/* Metadata */
 	connect(ui.metadata_add, SIGNAL(toggled(bool)), this, SLOT(updateMetadata()));
+	connect(ui.metadata_rewrite, SIGNAL(clicked()), this, SLOT(rewriteMetadata()));
 
 	readSettings();
 	retrieveInfo();
@@ -252,7 +298,7 @@ Frontend::cancel_ask(const QString &reason, bool cancel_button)
 void
 Frontend::closeEvent(QCloseEvent *event)
 {
-	if (!transcoder->isRunning()) {
+	if (!transcoder->isRunning() && !Scheduler::instance()->isQueued(transcoder)) {
 		writeSettings();
 		event->accept();
 	} else {
@@ -269,17 +315,9 @@ static QString widget_value(QComboBox *w)      { return w->currentText(); }
 static QString widget_value(QLineEdit *w)      { return w->text(); }
 static QString widget_value(QLabel *w)         { return w->text(); }
 
-void
-Frontend::transcode()
+QStringList
+Frontend::arguments() const
 {
-	if (QFileInfo(ui.output->text()).exists()) {
-		if (QMessageBox::warning(this, "Overwrite file?",
-			"The output file already exists. Do you want to replace it?",
-			QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes
-		)
-			return;
-	}
-
 	QStringList ea;
 
 #define OPTION(opt) ea = ea << opt
@@ -300,6 +338,9 @@ Frontend::transcode()
 	OPTION_VALUE("--endtime", partial_end);
 	OPTION_FLAG("--sync", sync);
 	OPTION_FLAG("--no-skeleton", no_skeleton);
+	if (!ui.no_skeleton->isChecked())
+		OPTION_FLAG(KEYFRAME_INDEX_OPTION, advanced_keyframe_index);
+	OPTION_FLAG(PREFILTER_OPTION, advanced_prefilter);
 
 	if (ui.audio_encode->isChecked()) {
 		OPTION_VALUE("--audiostream", audio_stream);
@@ -307,11 +348,15 @@ Frontend::transcode()
 		OPTION_VALUE("--samplerate", audio_samplerate);
 		OPTION_VALUE("--audioquality", audio_quality);
 		OPTION_VALUE("--audiobitrate", audio_bitrate);
+		OPTION_FLAG(AUDIO_PREFILTER_OPTION, advanced_audio_prefilter);
+		if (ui.advanced_loudness->isEnabled())
+			OPTION_VALUE(LOUDNESS_OPTION, advanced_loudness_value);
 	} else
 		OPTION("--noaudio");
 
 	if (ui.video_encode->isChecked()) {
 		OPTION_VALUE("--videostream", video_stream);
+		OPTION_FLAG(SCENE_KEYFRAMES_OPTION, advanced_scene_keyframes);
 		OPTION_VALUE("--videoquality", video_quality);
 		OPTION_VALUE("--videobitrate", video_bitrate);
 		OPTION_FLAG("--two-pass", video_two_pass);
@@ -326,6 +371,7 @@ Frontend::transcode()
 		OPTION_VALUE("--cropbottom", video_crop_bottom);
 		OPTION_VALUE("--cropleft", video_crop_left);
 		OPTION_VALUE("--cropright", video_crop_right);
+		OPTION_DEFVALUE("--speedlevel", video_speedlevel);
 		OPTION_FLAG("--optimize", video_optimize);
 		OPTION_FLAG("--deinterlace", video_deinterlace);
 		OPTION_FRAMERATE("--inputfps", video_input_framerate);
@@ -366,18 +412,132 @@ Frontend::transcode()
 #undef OPTION_FLAG
 #undef OPTION_VALUE
 #undef OPTION_DEFVALUE
+	return ea;
+}
+
+void
+Frontend::transcode()
+{
+	if (QFileInfo(ui.output->text()).exists()) {
+		if (QMessageBox::warning(this, "Overwrite file?",
+			"The output file already exists. Do you want to replace it?",
+			QMessageBox::Yes | QMessageBox::No) != QMessageBox::Yes
+		)
+			return;
+		QFile::remove(ui.output->text());
+	}
+
+	QStringList ea = arguments();
 
 	if (ui.partial->isChecked()) {
 		double duration = ui.partial_end->value() - ui.partial_start->value();
 		ui.progress->setMaximum((int)duration);
 	} else
 		ui.progress->setMaximum(finfo.duration > 0 ? int(finfo.duration) : 0);
-	transcoder->start(ui.input->text(), ui.output->text(), ea);
+	transcoder->setDuration(ui.progress->maximum() > 0 ? ui.progress->maximum() : -1);
+	QStringList blockers = streamCopyBlockers();
+	transcoder->setEngine(engine());
+	if (transcoder->engine() == Transcoder::REMOTE) {
+		/* jobs of all windows are spread over the workers in turn */
+		static int next_worker = 0;
+		QStringList w = workers();
+		transcoder->setWorker(w[next_worker++ % w.size()], ui.advanced_workers_shared->isChecked());
+	}
+	job = JobFeatures(finfo, ea, transcoder->engine());
+	transcoder->setPriority(Transcoder::Priority(ui.priority->currentIndex()));
+
+	/* the engines don't produce identical files */
+	transcoder->setCacheArgs(QStringList(ea) << (transcoder->engine() == Transcoder::REMUX ? "remux" :
+		transcoder->engine() == Transcoder::INTERNAL ? "internal" :
+		transcoder->engine() == Transcoder::SPLIT ? "split" : "ffmpeg2theora"));
+
+	ui.rate_graph->clear();
+	Scheduler::instance()->submit(transcoder, ui.input->text(), ui.output->text(), ea);
+	if (Scheduler::instance()->isQueued(transcoder)) {
+		updateButtons();
+		updateStatus("Waiting for a free processor");
+	} else if (transcoder->engine() == Transcoder::REMUX)
+		updateStatus("Copying the streams");
+	else if (ui.advanced_stream_copy->isChecked() || ui.partial_keyframes->isEnabled())
+		updateStatus("Re-encoding for " + blockers.join(", "));
+}
+
+/* the one transcode() would use */
+
+Transcoder::Engine
+Frontend::engine() const
+{
+	if (streamCopyBlockers().isEmpty())
+		return Transcoder::REMUX;
+	if (!workers().isEmpty())
+		return Transcoder::REMOTE;
+	if (ui.advanced_internal_encoder->isChecked())
+		return Transcoder::INTERNAL;
+	/* a second processor for the audio, if there is one to spare */
+	if (ui.advanced_split->isChecked() && ui.audio_encode->isChecked() &&
+	    ui.video_encode->isChecked() && Scheduler::instance()->capacity() > 1)
+		return Transcoder::SPLIT;
+	return Transcoder::PROCESS;
+}
+
+/* how long the job would take going by the earlier ones, see history.h */
+
+void
+Frontend::updatePrediction()
+{
+	if (transcoder->isRunning() || Scheduler::instance()->isQueued(transcoder))
+		return;
+	History::Prediction p;
+	if (!input_valid ||
+	    !History::instance()->predict(JobFeatures(finfo, arguments(), engine()), &p)) {
+		ui.prediction->clear();
+		return;
+	}
+	ui.prediction->setText(QString("Expected to take %1 (%2 to %3), going by %4 earlier job%5")
+		.arg(time2string(p.secs, 0, false)).arg(time2string(p.low, 0, false))
+		.arg(time2string(p.high, 0, false)).arg(p.jobs).arg(p.jobs == 1 ? "" : "s"));
+}
+
+/* why the streams can't just be copied, empty if they can */
+
+QStringList
+Frontend::streamCopyBlockers() const
+{
+	bool keyframe_cut = ui.partial_keyframes->isEnabled() && ui.partial_keyframes->isChecked();
+	if (!ui.advanced_stream_copy->isChecked() && !keyframe_cut)
+		return QStringList() << "stream copy being off";
+	if (!input_valid)
+		return QStringList() << "an unknown input";
+	return remux_blockers(ui.input->text(), arguments(), finfo, keyframe_cut);
+}
+
+void
+Frontend::updateStreamCopy()
+{
+	if (!ui.advanced_stream_copy->isChecked()) {
+		ui.advanced_stream_copy_status->clear();
+		return;
+	}
+	QStringList blockers = streamCopyBlockers();
+	if (blockers.isEmpty())
+		ui.advanced_stream_copy_status->setText("The streams will be copied");
+	else
+		ui.advanced_stream_copy_status->setText("Re-encoding for " + blockers.join(", "));
 }
 
 bool
 Frontend::cancel()
 {
+	if (Scheduler::instance()->remove(transcoder)) {
+		updateButtons();
+		updateStatus("Encoding cancelled");
+		return true;
+	}
+	/* the file stays whole either way */
+	if (transcoder->engine() == Transcoder::RETAG) {
+		transcoder->stop();
+		return true;
+	}
 	switch (cancel_ask("You are going to cancel the encoding. ", true)) {
 	case QMessageBox::Discard:
 		keep_output = false;
@@ -395,12 +555,15 @@ Frontend::cancel()
 void
 Frontend::updateStatus(QString statusText)
 {
+	TraceScope trace("Frontend::updateStatus");
 	ui.status->setText(statusText);
 }
 
 void
 Frontend::updateStatus(double pos, double eta, double audio_b, double video_b, int pass)
 {
+	TraceScope trace("Frontend::updateProgress");
+	ui.rate_graph->addSample(pos, audio_b, video_b, pass);
 	QString status = "";
 	status += "Position: " + time2string(pos);
 	if (finfo.duration > 0)
@@ -432,20 +595,37 @@ Frontend::finished(int reason)
 {
 	QString finish_message;
 
+	if (transcoder->engine() == Transcoder::RETAG) {
+		if (reason == Transcoder::OK)
+			updateStatus("Metadata updated");
+		else if (reason == Transcoder::STOPPED)
+			updateStatus("Metadata update cancelled");
+		else if (!transcoder->verification().isEmpty())
+			updateStatus("Updating the metadata failed. " + transcoder->verification());
+		return;
+	}
+
 	switch (reason) {
 	case Transcoder::OK:
 		keep_output = true;
+		/* a copy says nothing of how long an encode takes */
+		if (!transcoder->cached())
+			History::instance()->record(job, transcoder->elapsed());
 		if (ui.progress->maximum() > 0)
 			ui.progress->setValue(ui.progress->maximum());
 		else {
 			ui.progress->setMaximum(1);
 			ui.progress->reset();
 		}
-		finish_message = "Encoding finished successfully";
+		finish_message = transcoder->cached() ? "Copied from the result cache" :
+			"Encoding finished successfully";
+		if (!transcoder->verification().isEmpty())
+			finish_message += ". " + transcoder->verification();
 		QMessageBox::information(this, "qtheorafeontend", finish_message);
 		break;
 	case Transcoder::FAILED:
-		keep_output = cancel_ask("Encoding failed. ", false) == QMessageBox::Save;
+		keep_output = cancel_ask(transcoder->verification().isEmpty() ? QString("Encoding failed. ") :
+			"Encoding failed. " + transcoder->verification() + ". ", false) == QMessageBox::Save;
 	case Transcoder::STOPPED:
 		finish_message = keep_output ?
 			QString("Encoding failed. Partial file kept") :
@@ -466,9 +646,12 @@ Frontend::updateAdvancedMode()
 	ui.partial->setVisible(adv);
 	ui.partial_start->setVisible(adv);
 	ui.partial_end->setVisible(adv);
+	ui.partial_detect->setVisible(adv);
+	ui.partial_keyframes->setVisible(adv);
 	ui.sync->setVisible(adv);
 	ui.no_skeleton->setVisible(adv);
 	ui.tabs->setVisible(adv);
+	ui.rate_graph->setVisible(adv);
 	layout()->activate();
 	resize(QSize(width(), minimumSize().height()));
 }
@@ -483,7 +666,7 @@ Frontend::outputSelected(const QString &s)
 void
 Frontend::updateButtons()
 {
-	bool running = transcoder->isRunning();
+	bool running = transcoder->isRunning() || Scheduler::instance()->isQueued(transcoder);
 	bool missing_data = ui.input->text().isEmpty() ||
 		ui.output->text().isEmpty() ||
 		ui.input->text() == ui.output->text();
@@ -494,8 +677,14 @@ Frontend::updateButtons()
 	ui.output->setEnabled(input_valid);
 	ui.transcode->setEnabled(can_start);
 	ui.transcode->setDefault(can_start);
+	ui.metadata_rewrite->setEnabled(!running && !ui.output->text().isEmpty() &&
+		QFileInfo(ui.output->text()).exists());
 	ui.cancel->setEnabled(running);
+	ui.pause->setEnabled(transcoder->isRunning());
+	if (!running)
+		ui.pause->setChecked(false);
 	ui.partial->setEnabled(input_valid);
+	ui.partial_detect->setEnabled(input_valid && !trim_detector->isRunning());
 	ui.progress->setEnabled(running);
 	if (!running) {
 		ui.progress->setMaximum(100);
@@ -504,10 +693,71 @@ Frontend::updateButtons()
 	checkForSomethingToEncode();
 	DEPEND(partial_start, partial);
 	DEPEND(partial_end, partial);
+	DEPEND(partial_keyframes, partial);
+	updatePrediction();
 	if (exitting)
 		close();
 }
 
+void
+Frontend::pauseToggled(bool on)
+{
+	ui.pause->setText(on ? "Resume" : "Pause");
+	if (on)
+		Scheduler::instance()->pause(transcoder);
+	else
+		Scheduler::instance()->resume(transcoder);
+	if (!on && Scheduler::instance()->isPreempted(transcoder))
+		updateStatus("Waiting for a more urgent job to finish");
+}
+
+void
+Frontend::priorityChanged()
+{
+	transcoder->setPriority(Transcoder::Priority(ui.priority->currentIndex()));
+	Scheduler::instance()->reschedule();
+}
+
+/* windows share the scheduler, so a rush job can be started
+ * next to a running bulk one */
+
+void
+Frontend::newWindow()
+{
+	Frontend *f = new Frontend();
+	f->setAttribute(Qt::WA_DeleteOnClose);
+	f->show();
+}
+
+/* how responsive the window has been, see watchdog.h */
+
+void
+Frontend::showWatchdog()
+{
+	QMessageBox box(QMessageBox::Information, "qtheorafrontend", Watchdog::instance()->report(),
+		QMessageBox::Save | QMessageBox::Close, this);
+	if (box.exec() != QMessageBox::Save)
+		return;
+	QString filename = QFileDialog::getSaveFileName(this, "Save the latency report",
+		"qtheorafrontend-latency.txt");
+	if (!filename.isEmpty() && !Watchdog::instance()->dump(filename))
+		QMessageBox::warning(this, "qtheorafrontend", "Can't write " + filename);
+}
+
+/* the catalog is loaded the first time only, see library.h */
+
+void
+Frontend::showLibrary()
+{
+	if (library == NULL) {
+		library = new LibraryDialog(input_patterns(), this);
+		connect(library, SIGNAL(fileSelected(QString)), ui.input, SLOT(setText(QString)));
+	}
+	library->show();
+	library->raise();
+	library->activateWindow();
+}
+
 void
 Frontend::checkForSomethingToEncode()
 {
@@ -586,33 +836,8 @@ Frontend::setDefaultOutput()
 	output_dlg.selectFile(name);
 }
 
-#define FIELDS \
-	FILE_FIELD(duration, time) \
-	FILE_FIELD(bitrate, bitrate) \
-	FILE_FIELD(size, file_size) \
-\
-	VSTREAM_FIELD(codec, as_is) \
-	VSTREAM_FIELD(bitrate, bitrate) \
-	VSTREAM_FIELD(pixel_format, as_is) \
-	VSTREAM_FIELD(height, int) \
-	VSTREAM_FIELD(width, int) \
-	VSTREAM_FIELD(framerate, as_is) \
-	VSTREAM_FIELD(pixel_aspect_ratio, as_is) \
-	VSTREAM_FIELD(display_aspect_ratio, as_is) \
-\
-	ASTREAM_FIELD(codec, as_is) \
-	ASTREAM_FIELD(bitrate, bitrate) \
-	ASTREAM_FIELD(samplerate, int) \
-	ASTREAM_FIELD(channels, int)
-
 #define BUF_SIZE 256
 
-static QString
-present_as_is(const QString &s)
-{
-	return s;
-}
-
 static QString
 present_time(double t)
 {
@@ -651,9 +876,28 @@ present_bitrate(double bitrate)
 }
 
 static QString
-present_int(int n)
+present(const FileInfoField &f, const void *obj)
+{
+	switch (f.unit) {
+	case FileInfoField::TIME:
+		return present_time(f.number(obj));
+	case FileInfoField::BITRATE:
+		return present_bitrate(f.number(obj));
+	case FileInfoField::BYTES:
+		return present_file_size((long long)f.number(obj));
+	default:
+		return f.toString(obj);
+	}
+}
+
+/* into the Info tab's label for it, if it has one */
+
+static void
+show_field(QWidget *w, const QString &prefix, const FileInfoField &f, const void *obj, bool valid)
 {
-	return QString::number(n);
+	QLabel *label = w->findChild<QLabel *>(prefix + f.name);
+	if (label != NULL)
+		label->setText(obj != NULL && valid ? present(f, obj) : QString(""));
 }
 
 template <class Info>
@@ -693,7 +937,9 @@ Frontend::retrieveInfo()
 			throw std::runtime_error("File does not exist");
 		else if(!fi.isFile())
 			throw std::runtime_error("Not a file");
-		finfo.retrieve(input);
+		QStringList w = workers();
+		bool remote = !w.isEmpty() && ui.advanced_workers_shared->isChecked();
+		finfo.retrieve(input, remote ? w[0] : QString());
 
 		double max_time = finfo.duration > 0 ? finfo.duration : MAX_TIME;
 		ui.partial_start->setMinimum(0);
@@ -730,12 +976,26 @@ Frontend::retrieveInfo()
 void
 Frontend::updateInfo()
 {
-#define FIELD(f, uif, t, o) ui. uif ->setText((o != NULL && input_valid) ? present_##t(o->f) : QString(""));
-#define FILE_FIELD(f, c) FIELD(f, info_##f, c, (&finfo))
-#define ASTREAM_FIELD(f, c) FIELD(f, info_audio_##f, c, stream(ui.info_audio_stream, finfo.audio_streams))
-#define VSTREAM_FIELD(f, c) FIELD(f, info_video_##f, c, stream(ui.info_video_stream, finfo.video_streams))
-		FIELDS
-#undef FIELD
+	const AudioStreamInfo *a = stream(ui.info_audio_stream, finfo.audio_streams);
+	const VideoStreamInfo *v = stream(ui.info_video_stream, finfo.video_streams);
+	for (int i = 0; i < fileinfo_field_count; i++) {
+		const FileInfoField &f = fileinfo_fields[i];
+		switch (f.scope) {
+		case FileInfoField::FILE_SCOPE:
+			show_field(this, "info_", f, &finfo, input_valid);
+			break;
+		case FileInfoField::STREAM_SCOPE:
+			show_field(this, "info_audio_", f, static_cast<const StreamInfo *>(a), input_valid);
+			show_field(this, "info_video_", f, static_cast<const StreamInfo *>(v), input_valid);
+			break;
+		case FileInfoField::AUDIO_SCOPE:
+			show_field(this, "info_audio_", f, a, input_valid);
+			break;
+		case FileInfoField::VIDEO_SCOPE:
+			show_field(this, "info_video_", f, v, input_valid);
+			break;
+		}
+	}
 }
 
 static const int samplerates[] = {
@@ -802,6 +1062,7 @@ Frontend::updateAudio()
 		select_last(ui.audio_samplerate);
 		select_last(ui.audio_bitrate);
 	}
+	updatePrediction();
 }
 
 void
@@ -856,6 +1117,92 @@ Frontend::updateAdvanced(bool another_file)
 	DEPEND(advanced_keyint, video_encode);
 	DEPEND(advanced_bdelay, video_const_bitrate);
 	DEPEND(advanced_bdelay_value, advanced_bdelay);
+	/* the loudness is measured in a pass without audio, or before the
+	 * audio when there's no video to hold up */
+	ui.advanced_loudness->setEnabled(ui.advanced_internal_encoder->isChecked() &&
+		ui.audio_encode->isChecked() && (!ui.video_encode->isChecked() ||
+		(ui.video_two_pass->isEnabled() && ui.video_two_pass->isChecked())));
+	DEPEND(advanced_loudness_value, advanced_loudness);
+	updatePrediction();
+	updatePreview();
+}
+
+void
+Frontend::showPreview()
+{
+	if (preview == NULL)
+		preview = new PreviewDialog(this);
+	preview->show();
+	preview->raise();
+	preview->activateWindow();
+	updatePreview();
+}
+
+/* The middle of the input, adjusted only if the encode will be. The
+ * tables are those of ffmpeg's eq filter, which only the built-in encoder
+ * uses; ffmpeg2theora maps the values its own way.
+ */
+
+void
+Frontend::updatePreview()
+{
+	if (preview == NULL || !preview->isVisible())
+		return;
+	if (input_valid && !finfo.video_streams.empty())
+		preview->setInput(ui.input->text(), finfo.duration > 0 ? finfo.duration / 2 : 0);
+	bool adjust = ui.advanced_adjust->isEnabled() && ui.advanced_adjust->isChecked();
+	bool shown = engine() == Transcoder::INTERNAL;
+	preview->setNote(adjust && !shown ? "Adjustments are only previewed for the built-in encoder" : "");
+	if (adjust && shown)
+		preview->setAdjustment(ui.advanced_contrast_label->text().toDouble(),
+			ui.advanced_brightness_label->text().toDouble(),
+			ui.advanced_gamma_label->text().toDouble(),
+			ui.advanced_saturation_label->text().toDouble());
+	else
+		preview->setAdjustment(1, 0, 1, 1);
+}
+
+/* the selected streams, whether or not they are to be encoded: a blank
+ * picture over sound is no leader */
+
+void
+Frontend::detectTrim()
+{
+	if (!input_valid || trim_detector->isRunning())
+		return;
+	const AudioStreamInfo *a = stream(ui.audio_stream, finfo.audio_streams);
+	const VideoStreamInfo *v = stream(ui.video_stream, finfo.video_streams);
+	if (a == NULL && v == NULL)
+		return;
+	updateStatus("Looking for black and silence...");
+	trim_detector->detect(ui.input->text(), finfo.duration, v != NULL, v != NULL ? v->id : -1,
+		a != NULL, a != NULL ? a->id : -1);
+	updateButtons();
+}
+
+/* the end first, it bounds the start */
+
+void
+Frontend::trimDetected()
+{
+	updateButtons();
+	if (trim_detector->input() != ui.input->text())
+		return;
+	if (!trim_detector->error().isEmpty()) {
+		updateStatus(trim_detector->error());
+		return;
+	}
+	double start = trim_detector->trimStart(), end = trim_detector->trimEnd();
+	if (start <= 0 && end < 0) {
+		updateStatus("No black or silence to trim");
+		return;
+	}
+	ui.partial->setChecked(true);
+	if (end >= 0)
+		ui.partial_end->setValue(end);
+	ui.partial_start->setValue(start);
+	updateStatus(QString("Trimmed %1 at the start and %2 at the end")
+		.arg(time2string(start, 1)).arg(time2string(end >= 0 ? finfo.duration - end : 0, 1)));
 }
 
 void
@@ -866,6 +1213,30 @@ Frontend::updateMetadata(bool another_file)
 	layout_enable(ui.metadata_options_layout, ui.metadata_add->isChecked());
 }
 
+/* Only the comment headers of the existing output change, see retag.h;
+ * the other options don't matter. */
+
+void
+Frontend::rewriteMetadata()
+{
+	QStringList args = arguments(), tags;
+	for (int i = 0; i < args.size(); i++) {
+		const QString &opt = args[i];
+		QString v = option_takes_value(opt) ? args.value(++i) : QString();
+		if (opt == "--nometadata")
+			tags << opt;
+		else if (option_tag(opt))
+			tags << opt << v;
+	}
+	transcoder->setCacheArgs(QStringList());
+	keep_output = true;
+	ui.progress->setMaximum(0);
+	transcoder->setDuration(-1);
+	transcoder->setEngine(Transcoder::RETAG);
+	Scheduler::instance()->submit(transcoder, ui.output->text(), ui.output->text(), tags);
+	updateButtons();
+}
+
 QString
 Frontend::time2string(double t, int decimals, bool colons)
 {
@@ -941,6 +1312,15 @@ input_filter()
 	return QString("Video and Audio files (") + ext_list + ");;Any files (*)";
 }
 
+static QStringList
+input_patterns()
+{
+	QStringList ret;
+	for (int i = 0; i < LENGTH(extensions); i++)
+		ret << QString("*.") + extensions[i];
+	return ret;
+}
+
 static QString
 output_filter(bool has_video)
 {
@@ -1060,6 +1440,16 @@ Frontend::readSettings()
 	resize(size);
 	move(pos);
 	ui.advanced_mode->setChecked(adv);
+	ui.advanced_workers->setText(settings.value("workers").toString());
+	ui.advanced_workers_shared->setChecked(settings.value("workers_shared_fs", false).toBool());
+	ui.advanced_stream_copy->setChecked(settings.value("stream_copy", true).toBool());
+	ui.advanced_keyframe_index->setChecked(settings.value("keyframe_index", false).toBool());
+	ui.advanced_prefilter->setChecked(settings.value("prefilter", false).toBool());
+	ui.advanced_audio_prefilter->setChecked(settings.value("audio_prefilter", false).toBool());
+	ui.advanced_loudness->setChecked(settings.value("loudness", false).toBool());
+	ui.advanced_loudness_value->setText(settings.value("loudness_target", "-16").toString());
+	ui.advanced_split->setChecked(settings.value("split_av", false).toBool());
+	ui.advanced_scene_keyframes->setChecked(settings.value("scene_keyframes", false).toBool());
 }
 
 void
@@ -1069,4 +1459,31 @@ Frontend::writeSettings()
 	settings.setValue("pos", pos());
 	settings.setValue("size", size());
 	settings.setValue("advanced_mode", ui.advanced_mode->isChecked());
+	settings.setValue("workers", ui.advanced_workers->text());
+	settings.setValue("workers_shared_fs", ui.advanced_workers_shared->isChecked());
+	settings.setValue("stream_copy", ui.advanced_stream_copy->isChecked());
+	settings.setValue("keyframe_index", ui.advanced_keyframe_index->isChecked());
+	settings.setValue("prefilter", ui.advanced_prefilter->isChecked());
+	settings.setValue("audio_prefilter", ui.advanced_audio_prefilter->isChecked());
+	settings.setValue("loudness", ui.advanced_loudness->isChecked());
+	settings.setValue("loudness_target", ui.advanced_loudness_value->text());
+	settings.setValue("split_av", ui.advanced_split->isChecked());
+	settings.setValue("scene_keyframes", ui.advanced_scene_keyframes->isChecked());
+}
+
+void
+Frontend::setWorkers(const QString &list)
+{
+	ui.advanced_workers->setText(list);
+}
+
+QStringList
+Frontend::workers() const
+{
+	QStringList ret;
+	QStringList sl = ui.advanced_workers->text().split(',', QString::SkipEmptyParts);
+	for (int i = 0; i < sl.size(); i++)
+		if (!sl[i].trimmed().isEmpty())
+			ret << sl[i].trimmed();
+	return ret;
 }
@@ -25,8 +25,13 @@
 #include <QFileDialog>
 #include "transcoder.h"
 #include "fileinfo.h"
+#include "history.h"
 #include "ui_dialog.h"
 
+class LibraryDialog;
+class PreviewDialog;
+class TrimDetector;
+
 class Frontend : public QDialog
 {
 	Q_OBJECT
@@ -34,6 +39,7 @@ class Frontend : public QDialog
 public:
 	Frontend(QWidget* parent = 0);
 	int cancel_ask(const QString &, bool);
+	void setWorkers(const QString &);
 
 	static QString time2string(double, int decimals = 0, bool colons = true);
 
@@ -42,6 +48,10 @@ protected:
 	bool encode_audio() const { return ui.audio_encode->isChecked(); }
 	bool encode_video() const { return ui.video_encode->isChecked(); }
 	QString default_extension() const;
+	QStringList workers() const;
+	QStringList arguments() const;
+	QStringList streamCopyBlockers() const;
+	Transcoder::Engine engine() const;
 
 protected slots:
 	void transcode();
@@ -51,6 +61,12 @@ protected slots:
 	void finished(int reason);
 	void updateButtons();
 	void checkForSomethingToEncode();
+	void pauseToggled(bool);
+	void priorityChanged();
+	void newWindow();
+	void showWatchdog();
+	void showLibrary();
+	void updatePrediction();
 
 	void updateAdvancedMode();
 	void outputSelected(const QString &);
@@ -66,6 +82,7 @@ protected slots:
 	void updateSubtitles(bool another_file = false);
 	void updateAdvanced(bool another_file = false);
 	void updateMetadata(bool another_file = false);
+	void rewriteMetadata();
 	double cropped_aspect() const;
 	void fixVideoWidth();
 	void fixVideoHeight();
@@ -75,6 +92,11 @@ protected slots:
 	void videoHeightChanged();
 	void updateSoftTarget();
 	void resetAdjust();
+	void showPreview();
+	void updatePreview();
+	void updateStreamCopy();
+	void detectTrim();
+	void trimDetected();
 
 	void readSettings();
 	void writeSettings();
@@ -87,8 +109,12 @@ private:
 	bool input_valid;
 	bool keep_output;
 	FileInfo finfo;
+	JobFeatures job;
 
 	Transcoder* transcoder;
+	LibraryDialog *library;
+	PreviewDialog *preview;
+	TrimDetector *trim_detector;
 };
 
 #endif // H_FRONTEND
@@ -0,0 +1,260 @@
+/*
+ * history.cpp - job throughput history and time prediction
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+#include <QTextStream>
+#include <cmath>
+#include "fileinfo.h"
+#include "history.h"
+
+#define MAX_ENTRIES 5000
+#define FIELDS 12
+#define MIN_SIMILARITY 0.01
+/* how far off a guess from a single, identical earlier job can be, in
+ * log throughput: about 30% either way */
+#define PRIOR_SPREAD 0.25
+#define Z90 1.645
+
+static const char *
+engine_name(Transcoder::Engine e)
+{
+	switch (e) {
+	case Transcoder::INTERNAL:
+		return "internal";
+	case Transcoder::REMOTE:
+		return "remote";
+	case Transcoder::REMUX:
+		return "remux";
+	case Transcoder::RETAG:
+		return "retag";
+	case Transcoder::SPLIT:
+		return "split";
+	default:
+		return "ffmpeg2theora";
+	}
+}
+
+JobFeatures::JobFeatures()
+	: width(0), height(0), fps(0), duration(-1), speed_level(-1), quality(-1),
+	two_pass(false), audio(false)
+{
+}
+
+JobFeatures::JobFeatures(const FileInfo &fi, const QStringList &args, Transcoder::Engine e)
+	: engine(engine_name(e)), width(0), height(0), fps(0), duration(fi.duration),
+	speed_level(-1), quality(-1), two_pass(false), audio(!fi.audio_streams.isEmpty())
+{
+	bool video = !fi.video_streams.isEmpty();
+	if (video) {
+		const VideoStreamInfo &v = fi.video_streams[0];
+		codec = v.codec;
+		width = v.width;
+		height = v.height;
+		fps = parse_frame_rate(v.framerate);
+	}
+	double start = 0, end = -1;
+	bool bitrate = false;
+	for (int i = 0; i < args.size(); i++) {
+		const QString &opt = args[i];
+		QString v = option_takes_value(opt) ? args.value(++i) : QString();
+		if (opt == "--novideo")
+			video = false;
+		else if (opt == "--noaudio")
+			audio = false;
+		else if (opt == "--width")
+			width = v.toInt();
+		else if (opt == "--height")
+			height = v.toInt();
+		else if (opt == "--framerate")
+			fps = parse_frame_rate(v);
+		else if (opt == "--starttime")
+			start = v.toDouble();
+		else if (opt == "--endtime")
+			end = v.toDouble();
+		else if (opt == "--speedlevel")
+			speed_level = v.toInt();
+		else if (opt == "--videoquality" || opt == "-v")
+			quality = v.toDouble();
+		else if (opt == "--videobitrate")
+			bitrate = true;
+		else if (opt == "--two-pass")
+			two_pass = true;
+	}
+	if (!video) {
+		codec = QString();
+		width = height = 0;
+	}
+	if (bitrate)
+		quality = -1;
+	if (end > start && (duration < 0 || end < duration))
+		duration = end;
+	if (duration > 0)
+		duration = qMax(0.0, duration - start);
+}
+
+double
+JobFeatures::work() const
+{
+	if (!video())
+		return audio ? duration : 0;
+	return double(width) * height * (fps > 0 ? fps : 25) * duration;
+}
+
+History *
+History::instance()
+{
+	static History *history = NULL;
+	if (history == NULL)
+		history = new History();
+	return history;
+}
+
+/* time engine codec width height fps duration speed_level quality
+ * two_pass audio seconds, tab separated */
+
+History::History()
+{
+	QSettings settings("QTheoraFrontend team", "QTheoraFrontend");
+	file_ = settings.value("history_file",
+		QDir::home().filePath(".qtheorafrontend/history")).toString();
+	QFile f(file_);
+	if (!f.open(QIODevice::ReadOnly | QIODevice::Text))
+		return;
+	QTextStream s(&f);
+	while (!s.atEnd()) {
+		QStringList sl = s.readLine().split('\t');
+		if (sl.size() != FIELDS)
+			continue;
+		Entry e;
+		e.features.engine = sl[1];
+		e.features.codec = sl[2];
+		e.features.width = sl[3].toInt();
+		e.features.height = sl[4].toInt();
+		e.features.fps = sl[5].toDouble();
+		e.features.duration = sl[6].toDouble();
+		e.features.speed_level = sl[7].toInt();
+		e.features.quality = sl[8].toDouble();
+		e.features.two_pass = sl[9] == "1";
+		e.features.audio = sl[10] == "1";
+		double secs = sl[11].toDouble();
+		if (!e.features.valid() || secs <= 0)
+			continue;
+		e.rate = e.features.work() / secs;
+		entries_.push_back(e);
+		if (entries_.size() > MAX_ENTRIES)
+			entries_.removeFirst();
+	}
+}
+
+void
+History::record(const JobFeatures &f, double secs)
+{
+	if (!f.valid() || secs <= 0)
+		return;
+	Entry e;
+	e.features = f;
+	e.rate = f.work() / secs;
+	entries_.push_back(e);
+	if (entries_.size() > MAX_ENTRIES)
+		entries_.removeFirst();
+
+	QDir().mkpath(QFileInfo(file_).path());
+	QFile file(file_);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text))
+		return;
+	QStringList sl;
+	sl << QDateTime::currentDateTime().toString(Qt::ISODate) << f.engine << f.codec
+		<< QString::number(f.width) << QString::number(f.height)
+		<< QString::number(f.fps) << QString::number(f.duration)
+		<< QString::number(f.speed_level) << QString::number(f.quality)
+		<< (f.two_pass ? "1" : "0") << (f.audio ? "1" : "0") << QString::number(secs);
+	QTextStream(&file) << sl.join("\t") << "\n";
+}
+
+/* 1 for the same kind of job, less the more it differs in what affects
+ * the throughput; 0 for another engine or kind of output */
+
+double
+History::similarity(const JobFeatures &a, const JobFeatures &b)
+{
+	if (a.engine != b.engine || a.video() != b.video())
+		return 0;
+	double w = 1;
+	if (a.codec != b.codec)
+		w *= 0.5;
+	if (a.speed_level != b.speed_level)
+		w *= 0.3;
+	if (a.two_pass != b.two_pass)
+		w *= 0.2;
+	if (a.audio != b.audio)
+		w *= 0.7;
+	if ((a.quality < 0) != (b.quality < 0))
+		w *= 0.5;
+	else if (a.quality >= 0)
+		w *= exp(-fabs(a.quality - b.quality) / 3);
+	if (a.video())
+		w *= exp(-fabs(log(double(a.width) * a.height / (double(b.width) * b.height))));
+	return w;
+}
+
+bool
+History::predict(const JobFeatures &f, Prediction *p) const
+{
+	if (!f.valid())
+		return false;
+	double sw = 0, sw2 = 0, sx = 0;
+	QList<double> weights;
+	for (int i = 0; i < entries_.size(); i++) {
+		double w = similarity(f, entries_[i].features);
+		weights << w;
+		if (w < MIN_SIMILARITY)
+			continue;
+		sw += w;
+		sw2 += w * w;
+		sx += w * log(entries_[i].rate);
+	}
+	if (sw <= 0)
+		return false;
+	double mean = sx / sw, var = 0;
+	p->jobs = 0;
+	for (int i = 0; i < entries_.size(); i++) {
+		double w = weights[i];
+		if (w < MIN_SIMILARITY)
+			continue;
+		double d = log(entries_[i].rate) - mean;
+		var += w * d * d;
+		p->jobs++;
+	}
+	/* the spread, pulled towards the prior where there's little to go
+	 * by, plus the uncertainty of the mean itself */
+	double n = sw * sw / sw2;
+	var = (var + PRIOR_SPREAD * PRIOR_SPREAD) / (sw + 1);
+	double spread = Z90 * sqrt(var * (1 + 1 / n));
+	double work = f.work();
+	p->secs = work / exp(mean);
+	p->low = work / exp(mean + spread);
+	p->high = work / exp(mean - spread);
+	return true;
+}
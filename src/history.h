@@ -0,0 +1,90 @@
+/*
+ * history.h - job throughput history and time prediction
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_HISTORY
+#define H_HISTORY
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include "transcoder.h"
+
+struct FileInfo;
+
+/* what a job's time depends on, as far as we can tell beforehand */
+
+struct JobFeatures
+{
+	QString engine;
+	QString codec;   /* of the input video, empty for audio only */
+	int width;       /* of the output pictures */
+	int height;
+	double fps;
+	double duration; /* of the output */
+	int speed_level; /* -1 if not given */
+	double quality;  /* -1 if not given, or if there's a bitrate */
+	bool two_pass;
+	bool audio;
+
+	JobFeatures();
+	JobFeatures(const FileInfo &, const QStringList &args, Transcoder::Engine);
+	bool video() const { return width > 0 && height > 0; }
+	/* what the job has to get through: pixels, or seconds of audio alone */
+	double work() const;
+	bool valid() const { return !engine.isEmpty() && duration > 0 && work() > 0; }
+};
+
+/* Finished jobs go to ~/.qtheorafrontend/history (the history_file
+ * setting), a line each. The time of a new job is its work divided by
+ * the throughput of the earlier jobs with the same engine, weighted by
+ * how much they are like it; the range covers 90% of the spread of their
+ * throughputs, and is wider the fewer of them there are.
+ */
+
+class History
+{
+public:
+	struct Prediction {
+		double secs;
+		double low;
+		double high;
+		int jobs;
+	};
+
+	static History *instance();
+	void record(const JobFeatures &, double secs);
+	/* false if no earlier job is anything like it */
+	bool predict(const JobFeatures &, Prediction *) const;
+
+private:
+	struct Entry {
+		JobFeatures features;
+		double rate; /* work per second */
+	};
+
+	History();
+	static double similarity(const JobFeatures &, const JobFeatures &);
+
+	QString file_;
+	QList<Entry> entries_;
+};
+
+#endif // H_HISTORY
@@ -0,0 +1,515 @@
+/*
+ * library.cpp - media library browser
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QComboBox>
+#include <QDir>
+#include <QFileDialog>
+#include <QHBoxLayout>
+#include <QHeaderView>
+#include <QLabel>
+#include <QLineEdit>
+#include <QMap>
+#include <QPushButton>
+#include <QSettings>
+#include <QSpinBox>
+#include <QTableView>
+#include <QVBoxLayout>
+#include <QtAlgorithms>
+#include "frontend.h"
+#include "library.h"
+#include "qtimespinbox.h"
+
+#define COLLECT_INTERVAL 500 /* ms */
+#define MAX_DURATION (24 * 3600)
+
+/* the bytes past ASCII are parts of UTF-8 sequences, left alone */
+
+static inline char
+ascii_lower(char c)
+{
+	return uchar(c) < 0x80 ? QChar(c).toLower().toAscii() : c;
+}
+
+/* ASCII case-insensitive, which is what file name filters need */
+
+static bool
+contains_nocase(const char *s, const QByteArray &lower)
+{
+	const char *l = lower.constData();
+	if (*l == '\0')
+		return true;
+	for (; *s != '\0'; s++) {
+		int i = 0;
+		while (l[i] != '\0' && s[i] != '\0' && ascii_lower(s[i]) == l[i])
+			i++;
+		if (l[i] == '\0')
+			return true;
+		if (s[i] == '\0')
+			return false;
+	}
+	return false;
+}
+
+/* the order of some strings, case-insensitive */
+
+static QVector<int>
+ranks(const QStringList &strings)
+{
+	QMap<QString, int> sorted;
+	for (int i = 0; i < strings.size(); i++)
+		sorted.insertMulti(strings[i].toLower(), i);
+	QVector<int> ret(strings.size());
+	int rank = 0;
+	for (QMap<QString, int>::const_iterator i = sorted.begin(); i != sorted.end(); ++i)
+		ret[i.value()] = rank++;
+	return ret;
+}
+
+namespace {
+
+class RowLess
+{
+public:
+	RowLess(const MediaCatalog *catalog, int column, bool descending,
+		const QVector<int> &dir_rank, const QVector<int> &string_rank)
+		: c_(catalog), column_(column), descending_(descending),
+		dir_rank_(dir_rank), string_rank_(string_rank) { }
+
+	bool operator()(int a, int b) const
+	{
+		if (descending_)
+			qSwap(a, b);
+		int d = compare(a, b);
+		return d != 0 ? d < 0 : a < b;
+	}
+
+private:
+	template <class T>
+	static int sign(T a, T b) { return a < b ? -1 : b < a ? 1 : 0; }
+
+	int compare(int a, int b) const
+	{
+		switch (column_) {
+		case LibraryModel::FOLDER: {
+			int d = sign(dir_rank_[c_->dir(a)], dir_rank_[c_->dir(b)]);
+			return d != 0 ? d : qstricmp(c_->name(a), c_->name(b));
+		}
+		case LibraryModel::DURATION:
+			return sign(c_->duration(a), c_->duration(b));
+		case LibraryModel::RESOLUTION:
+			return sign(c_->width(a) * c_->height(a), c_->width(b) * c_->height(b));
+		case LibraryModel::VIDEO:
+			return sign(string_rank_[c_->videoCodec(a)], string_rank_[c_->videoCodec(b)]);
+		case LibraryModel::PIXEL_FORMAT:
+			return sign(string_rank_[c_->pixelFormat(a)], string_rank_[c_->pixelFormat(b)]);
+		case LibraryModel::AUDIO:
+			return sign(string_rank_[c_->audioCodec(a)], string_rank_[c_->audioCodec(b)]);
+		case LibraryModel::SIZE:
+			return sign(c_->fileSize(a), c_->fileSize(b));
+		default:
+			return qstricmp(c_->name(a), c_->name(b));
+		}
+	}
+
+	const MediaCatalog *c_;
+	int column_;
+	bool descending_;
+	const QVector<int> &dir_rank_;
+	const QVector<int> &string_rank_;
+};
+
+}
+
+LibraryModel::LibraryModel(const MediaCatalog *catalog, QObject *parent)
+	: QAbstractTableModel(parent), catalog_(catalog), sort_column_(NAME),
+	sort_order_(Qt::AscendingOrder)
+{
+	refresh();
+}
+
+int
+LibraryModel::rowCount(const QModelIndex &parent) const
+{
+	return parent.isValid() ? 0 : rows_.size();
+}
+
+int
+LibraryModel::columnCount(const QModelIndex &parent) const
+{
+	return parent.isValid() ? 0 : int(COLUMNS);
+}
+
+QVariant
+LibraryModel::data(const QModelIndex &index, int role) const
+{
+	if (!index.isValid() || index.row() >= rows_.size())
+		return QVariant();
+	int f = rows_[index.row()];
+	if (role == Qt::ToolTipRole)
+		return catalog_->path(f);
+	if (role == Qt::TextAlignmentRole)
+		return index.column() == DURATION || index.column() == SIZE ?
+			QVariant(Qt::AlignRight | Qt::AlignVCenter) : QVariant();
+	if (role != Qt::DisplayRole)
+		return QVariant();
+
+	const QStringList &strings = catalog_->strings();
+	switch (index.column()) {
+	case NAME:
+		return QString::fromUtf8(catalog_->name(f));
+	case FOLDER:
+		return catalog_->dirName(catalog_->dir(f));
+	case DURATION:
+		return catalog_->duration(f) > 0 ? Frontend::time2string(catalog_->duration(f)) : QString();
+	case RESOLUTION:
+		return catalog_->width(f) > 0 ?
+			QString("%1x%2").arg(catalog_->width(f)).arg(catalog_->height(f)) : QString();
+	case VIDEO:
+		return strings[catalog_->videoCodec(f)];
+	case PIXEL_FORMAT:
+		return strings[catalog_->pixelFormat(f)];
+	case AUDIO:
+		return strings[catalog_->audioCodec(f)];
+	case SIZE:
+		return QString::number(catalog_->fileSize(f) / 1048576.0, 'f', 1) + " MB";
+	}
+	return QVariant();
+}
+
+QVariant
+LibraryModel::headerData(int section, Qt::Orientation orientation, int role) const
+{
+	static const char *names[COLUMNS] = {
+		"Name", "Folder", "Duration", "Resolution", "Video", "Pixel Format", "Audio", "Size"
+	};
+	if (orientation != Qt::Horizontal || role != Qt::DisplayRole || section < 0 || section >= COLUMNS)
+		return QVariant();
+	return QString(names[section]);
+}
+
+bool
+LibraryModel::accepts(int f) const
+{
+	if (!catalog_->probed(f))
+		return false;
+	if (filter_.video_codec >= 0 && catalog_->videoCodec(f) != filter_.video_codec)
+		return false;
+	if (catalog_->height(f) < filter_.min_height)
+		return false;
+	double d = catalog_->duration(f);
+	if (d < filter_.min_duration || (filter_.max_duration >= 0 && d > filter_.max_duration))
+		return false;
+	return contains_nocase(catalog_->name(f), text_);
+}
+
+void
+LibraryModel::sortRows()
+{
+	QVector<int> dir_rank, string_rank = ranks(catalog_->strings());
+	if (sort_column_ == FOLDER) {
+		QStringList dirs;
+		for (int d = 0; d < catalog_->dirs(); d++)
+			dirs << catalog_->dirName(d);
+		dir_rank = ranks(dirs);
+	}
+	qSort(rows_.begin(), rows_.end(), RowLess(catalog_, sort_column_,
+		sort_order_ == Qt::DescendingOrder, dir_rank, string_rank));
+}
+
+/* new rows, with the selection and the current item staying with their
+ * files, and the view where it was */
+
+void
+LibraryModel::relayout(const QVector<int> &rows)
+{
+	emit layoutAboutToBeChanged();
+	QModelIndexList before = persistentIndexList();
+	QVector<int> files;
+	for (int i = 0; i < before.size(); i++)
+		files << rows_[before[i].row()];
+	rows_ = rows;
+	sortRows();
+	if (!before.isEmpty()) {
+		QHash<int, int> row_of;
+		for (int i = 0; i < files.size(); i++)
+			row_of.insert(files[i], -1);
+		for (int r = 0; r < rows_.size(); r++)
+			if (row_of.contains(rows_[r]))
+				row_of[rows_[r]] = r;
+		for (int i = 0; i < before.size(); i++) {
+			int r = row_of[files[i]];
+			changePersistentIndex(before[i], r >= 0 ? index(r, before[i].column()) : QModelIndex());
+		}
+	}
+	emit layoutChanged();
+}
+
+void
+LibraryModel::sort(int column, Qt::SortOrder order)
+{
+	sort_column_ = column;
+	sort_order_ = order;
+	relayout(rows_);
+}
+
+void
+LibraryModel::setFilter(const LibraryFilter &filter)
+{
+	filter_ = filter;
+	text_ = filter.text.toLower().toUtf8();
+	QVector<int> rows;
+	for (int f = 0; f < catalog_->size(); f++)
+		if (accepts(f))
+			rows << f;
+	relayout(rows);
+}
+
+void
+LibraryModel::added(int first)
+{
+	QVector<int> rows = rows_;
+	for (int f = first; f < catalog_->size(); f++)
+		if (accepts(f))
+			rows << f;
+	if (rows.size() > rows_.size())
+		relayout(rows);
+}
+
+void
+LibraryModel::refresh()
+{
+	rows_.clear();
+	for (int f = 0; f < catalog_->size(); f++)
+		if (accepts(f))
+			rows_ << f;
+	sortRows();
+	reset();
+}
+
+LibraryDialog::LibraryDialog(const QStringList &patterns, QWidget *parent)
+	: QDialog(parent), patterns_(patterns), scanner_(NULL)
+{
+	setWindowTitle("Media Library");
+	QSettings settings("QTheoraFrontend team", "QTheoraFrontend");
+	catalog_file_ = settings.value("catalog_file",
+		QDir::home().filePath(".qtheorafrontend/catalog")).toString();
+	catalog_.load(catalog_file_);
+	model_ = new LibraryModel(&catalog_, this);
+
+	scan_ = new QPushButton("Scan Folder...");
+	text_ = new QLineEdit();
+	text_->setToolTip("Part of the file name");
+	codec_ = new QComboBox();
+	min_height_ = new QSpinBox();
+	min_height_->setRange(0, 0xffff);
+	min_height_->setSingleStep(120);
+	min_height_->setPrefix("Height >= ");
+	min_duration_ = new QTimeSpinBox();
+	min_duration_->setMaximum(MAX_DURATION);
+	max_duration_ = new QTimeSpinBox();
+	max_duration_->setMaximum(MAX_DURATION);
+	max_duration_->setSpecialValueText("Any length");
+
+	view_ = new QTableView();
+	view_->setModel(model_);
+	view_->setSortingEnabled(true);
+	view_->sortByColumn(LibraryModel::NAME, Qt::AscendingOrder);
+	view_->setSelectionBehavior(QAbstractItemView::SelectRows);
+	view_->setSelectionMode(QAbstractItemView::SingleSelection);
+	view_->setShowGrid(false);
+	view_->setWordWrap(false);
+	/* fixed row heights, or the view measures every row */
+	view_->verticalHeader()->hide();
+	view_->verticalHeader()->setResizeMode(QHeaderView::Fixed);
+	view_->verticalHeader()->setDefaultSectionSize(fontMetrics().height() + 4);
+	view_->horizontalHeader()->setStretchLastSection(true);
+
+	status_ = new QLabel();
+	QPushButton *use = new QPushButton("Use as Input");
+	QPushButton *close = new QPushButton("Close");
+
+	QHBoxLayout *filters = new QHBoxLayout();
+	filters->addWidget(scan_);
+	filters->addWidget(text_, 1);
+	filters->addWidget(codec_);
+	filters->addWidget(min_height_);
+	filters->addWidget(new QLabel("Duration:"));
+	filters->addWidget(min_duration_);
+	filters->addWidget(new QLabel("to"));
+	filters->addWidget(max_duration_);
+	QHBoxLayout *buttons = new QHBoxLayout();
+	buttons->addWidget(status_, 1);
+	buttons->addWidget(use);
+	buttons->addWidget(close);
+	QVBoxLayout *layout = new QVBoxLayout(this);
+	layout->addLayout(filters);
+	layout->addWidget(view_);
+	layout->addLayout(buttons);
+	resize(900, 500);
+
+	connect(scan_, SIGNAL(clicked()), this, SLOT(scan()));
+	connect(text_, SIGNAL(textChanged(QString)), this, SLOT(updateFilter()));
+	connect(codec_, SIGNAL(currentIndexChanged(int)), this, SLOT(updateFilter()));
+	connect(min_height_, SIGNAL(valueChanged(int)), this, SLOT(updateFilter()));
+	connect(min_duration_, SIGNAL(valueChanged(double)), this, SLOT(updateFilter()));
+	connect(max_duration_, SIGNAL(valueChanged(double)), this, SLOT(updateFilter()));
+	connect(view_, SIGNAL(activated(QModelIndex)), this, SLOT(activated(QModelIndex)));
+	connect(use, SIGNAL(clicked()), this, SLOT(activated()));
+	connect(close, SIGNAL(clicked()), this, SLOT(reject()));
+	connect(&collect_timer_, SIGNAL(timeout()), this, SLOT(collect()));
+	updateCodecs();
+	updateStatus();
+}
+
+LibraryDialog::~LibraryDialog()
+{
+	if (scanner_ != NULL) {
+		scanner_->stop();
+		scanner_->wait();
+		collect();
+		dropStale();
+		catalog_.save(catalog_file_);
+		delete scanner_;
+	}
+}
+
+void
+LibraryDialog::scan()
+{
+	if (scanner_ != NULL) {
+		scanner_->stop();
+		return;
+	}
+	QString root = QFileDialog::getExistingDirectory(this, "Scan a folder for media files");
+	if (root.isEmpty())
+		return;
+	root = QDir(root).absolutePath();
+	scanner_ = new CatalogScanner(root, patterns_, catalog_.known(root));
+	connect(scanner_, SIGNAL(finished()), this, SLOT(scanFinished()));
+	scan_->setText("Stop Scanning");
+	collect_timer_.start(COLLECT_INTERVAL);
+	scanner_->start(QThread::LowPriority);
+	updateStatus();
+}
+
+/* what the scanner has found so far goes into the catalog in batches */
+
+void
+LibraryDialog::collect()
+{
+	if (scanner_ == NULL)
+		return;
+	QList<CatalogRecord> found = scanner_->take();
+	if (!found.isEmpty()) {
+		int first = catalog_.size();
+		for (int i = 0; i < found.size(); i++)
+			catalog_.add(found[i]);
+		model_->added(first);
+		updateCodecs();
+	}
+	updateStatus();
+}
+
+/* once everything the scanner found is in, even if it was stopped: a
+ * changed file is in there twice until its old entry goes */
+
+void
+LibraryDialog::dropStale()
+{
+	QList<int> stale = scanner_->stale();
+	if (stale.isEmpty())
+		return;
+	QVector<bool> keep(catalog_.size(), true);
+	for (int i = 0; i < stale.size(); i++)
+		keep[stale[i]] = false;
+	catalog_.compact(keep);
+	model_->refresh();
+	updateCodecs();
+}
+
+void
+LibraryDialog::scanFinished()
+{
+	collect_timer_.stop();
+	collect();
+	dropStale();
+	if (!catalog_.save(catalog_file_))
+		status_->setText("Can't write " + catalog_file_);
+	delete scanner_;
+	scanner_ = NULL;
+	scan_->setText("Scan Folder...");
+	updateStatus();
+}
+
+void
+LibraryDialog::updateFilter()
+{
+	LibraryFilter f;
+	f.text = text_->text();
+	f.video_codec = codec_->itemData(codec_->currentIndex()).toInt();
+	f.min_height = min_height_->value();
+	f.min_duration = min_duration_->value();
+	f.max_duration = max_duration_->value() > 0 ? max_duration_->value() : -1;
+	model_->setFilter(f);
+	updateStatus();
+}
+
+void
+LibraryDialog::activated(const QModelIndex &index)
+{
+	QModelIndex i = index.isValid() ? index : view_->currentIndex();
+	if (!i.isValid())
+		return;
+	emit fileSelected(catalog_.path(model_->file(i.row())));
+	accept();
+}
+
+/* the video codecs there are, for the filter */
+
+void
+LibraryDialog::updateCodecs()
+{
+	QVector<bool> used(catalog_.strings().size());
+	for (int i = 0; i < catalog_.size(); i++)
+		used[catalog_.videoCodec(i)] = true;
+	int current = codec_->itemData(codec_->currentIndex()).toInt();
+	codec_->blockSignals(true);
+	codec_->clear();
+	codec_->addItem("Any video", -1);
+	for (int s = 1; s < used.size(); s++)
+		if (used[s]) {
+			codec_->addItem(catalog_.strings()[s], s);
+			if (s == current)
+				codec_->setCurrentIndex(codec_->count() - 1);
+		}
+	codec_->blockSignals(false);
+}
+
+void
+LibraryDialog::updateStatus()
+{
+	QString s = QString("%1 of %2 files, %3 bytes per file")
+		.arg(model_->rowCount()).arg(catalog_.size())
+		.arg(catalog_.size() > 0 ? catalog_.bytes() / catalog_.size() : 0);
+	if (scanner_ != NULL)
+		s += QString(", scanning (%1 seen)").arg(scanner_->scanned());
+	status_->setText(s);
+}
@@ -0,0 +1,145 @@
+/*
+ * library.h - media library browser
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_LIBRARY
+#define H_LIBRARY
+
+#include <QAbstractTableModel>
+#include <QDialog>
+#include <QTimer>
+#include <QVector>
+#include "catalog.h"
+
+class QComboBox;
+class QLabel;
+class QLineEdit;
+class QPushButton;
+class QSpinBox;
+class QTableView;
+class QTimeSpinBox;
+
+struct LibraryFilter
+{
+	QString text;        /* in the file name */
+	int video_codec;     /* in MediaCatalog::strings(), -1 for any */
+	int min_height;
+	double min_duration;
+	double max_duration; /* < 0 for no limit */
+
+	LibraryFilter(): video_codec(-1), min_height(0), min_duration(0), max_duration(-1) { }
+};
+
+/* The rows are just catalog indexes, filtered and sorted; cells are made
+ * up only when the view asks for them, so that only what's on screen
+ * costs anything.
+ */
+
+class LibraryModel : public QAbstractTableModel
+{
+	Q_OBJECT
+
+public:
+	enum Column {
+		NAME,
+		FOLDER,
+		DURATION,
+		RESOLUTION,
+		VIDEO,
+		PIXEL_FORMAT,
+		AUDIO,
+		SIZE,
+		COLUMNS
+	};
+
+	LibraryModel(const MediaCatalog *, QObject *parent = NULL);
+	int rowCount(const QModelIndex &parent = QModelIndex()) const;
+	int columnCount(const QModelIndex &parent = QModelIndex()) const;
+	QVariant data(const QModelIndex &, int role = Qt::DisplayRole) const;
+	QVariant headerData(int section, Qt::Orientation, int role = Qt::DisplayRole) const;
+	void sort(int column, Qt::SortOrder = Qt::AscendingOrder);
+
+	void setFilter(const LibraryFilter &);
+	/* after files from first on were added to the catalog */
+	void added(int first);
+	/* after the catalog has changed otherwise */
+	void refresh();
+	/* the catalog index of a row */
+	int file(int row) const { return rows_[row]; }
+
+private:
+	bool accepts(int file) const;
+	void sortRows();
+	void relayout(const QVector<int> &rows);
+
+	const MediaCatalog *catalog_;
+	QVector<int> rows_;
+	LibraryFilter filter_;
+	QByteArray text_; /* lowercase UTF-8 */
+	int sort_column_;
+	Qt::SortOrder sort_order_;
+};
+
+/* Browsing a big archive tree for something to encode: the catalog is
+ * kept in ~/.qtheorafrontend/catalog (the catalog_file setting) and a
+ * rescan only probes files that are new or have changed.
+ */
+
+class LibraryDialog : public QDialog
+{
+	Q_OBJECT
+
+public:
+	LibraryDialog(const QStringList &patterns, QWidget *parent = NULL);
+	~LibraryDialog();
+
+signals:
+	void fileSelected(QString);
+
+protected slots:
+	void scan();
+	void collect();
+	void scanFinished();
+	void updateFilter();
+	void activated(const QModelIndex & = QModelIndex());
+	void updateCodecs();
+	void updateStatus();
+
+private:
+	void dropStale();
+
+	QStringList patterns_;
+	QString catalog_file_;
+	MediaCatalog catalog_;
+	LibraryModel *model_;
+	CatalogScanner *scanner_;
+	QTimer collect_timer_;
+
+	QTableView *view_;
+	QPushButton *scan_;
+	QLineEdit *text_;
+	QComboBox *codec_;
+	QSpinBox *min_height_;
+	QTimeSpinBox *min_duration_;
+	QTimeSpinBox *max_duration_;
+	QLabel *status_;
+};
+
+#endif // H_LIBRARY
@@ -20,14 +20,211 @@
  */
 
 #include <QApplication>
+#include <QDir>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include "benchmark.h"
 #include "frontend.h"
+#include "scenecut.h"
+#include "scheduler.h"
+#include "segmenter.h"
+#include "trace.h"
+#include "watchdog.h"
+#include "worker.h"
+
+/* qtheorafrontend --worker <address> [--jobs <n>] [--secret <word>]
+ * [--root <dir>] serves encodes to frontends started with
+ * --workers <address>,... (see remote.h and worker.h). Any of the modes
+ * takes --trace <file.json>, see trace.h. */
+
+static const char *
+option(int argc, char *argv[], const char *name)
+{
+	for (int i = 1; i < argc - 1; i++)
+		if (strcmp(argv[i], name) == 0)
+			return argv[i + 1];
+	return NULL;
+}
+
+static int
+run_worker(int argc, char *argv[], const char *address)
+{
+	QCoreApplication app(argc, argv);
+	if (const char *jobs = option(argc, argv, "--jobs"))
+		Scheduler::instance()->setCapacity(atoi(jobs));
+
+	Worker worker;
+	if (const char *secret = option(argc, argv, "--secret"))
+		worker.setSecret(QString::fromLocal8Bit(secret));
+	if (const char *root = option(argc, argv, "--root"))
+		worker.setRoot(QString::fromLocal8Bit(root));
+	if (!worker.listen(address)) {
+		fprintf(stderr, "Can't listen on %s: %s\n", address, qPrintable(worker.errorString()));
+		return 1;
+	}
+	fprintf(stderr, "Listening on %s, %d jobs at a time\n", address, Scheduler::instance()->capacity());
+	return app.exec();
+}
+
+static QList<int>
+int_list(const char *s)
+{
+	QList<int> ret;
+	QStringList sl = QString(s).split(',', QString::SkipEmptyParts);
+	for (int i = 0; i < sl.size(); i++)
+		ret << sl[i].toInt();
+	return ret;
+}
+
+/* qtheorafrontend --benchmark [--speedlevels 0,1,2] [--qualities 3,5,7,9]
+ * [--engine internal] <files or directories...> */
+
+static int
+run_benchmark(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QStringList inputs;
+	QList<int> speed_levels, qualities;
+	bool internal = false;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--benchmark") == 0)
+			continue;
+		else if (strcmp(argv[i], "--speedlevels") == 0 && i + 1 < argc)
+			speed_levels = int_list(argv[++i]);
+		else if (strcmp(argv[i], "--qualities") == 0 && i + 1 < argc)
+			qualities = int_list(argv[++i]);
+		else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc)
+			internal = strcmp(argv[++i], "internal") == 0;
+		else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+			i++;
+		else {
+			QString path = QString::fromLocal8Bit(argv[i]);
+			if (!QFileInfo(path).isDir()) {
+				inputs << path;
+				continue;
+			}
+			QDir dir(path);
+			QStringList files = dir.entryList(QDir::Files, QDir::Name);
+			for (int j = 0; j < files.size(); j++)
+				inputs << dir.filePath(files[j]);
+		}
+	}
+	if (inputs.isEmpty()) {
+		fprintf(stderr, "No input files to benchmark\n");
+		return 1;
+	}
+
+	Benchmark b(inputs);
+	if (!speed_levels.isEmpty())
+		b.setSpeedLevels(speed_levels);
+	if (!qualities.isEmpty())
+		b.setQualities(qualities);
+	if (internal)
+		b.setEngine(Transcoder::INTERNAL);
+	return b.run();
+}
+
+/* qtheorafrontend --segment <seconds> [--engine internal] [--jobs <n>]
+ * [--scene-cuts] <input> <output> [ffmpeg2theora options...], see segmenter.h */
+
+static int
+run_segment(int argc, char *argv[], const char *seconds)
+{
+	QCoreApplication app(argc, argv);
+	if (const char *jobs = option(argc, argv, "--jobs"))
+		Scheduler::instance()->setCapacity(atoi(jobs));
+	QStringList files, args;
+	bool internal = false, scene_cuts = false;
+	for (int i = 1; i < argc; i++) {
+		if ((strcmp(argv[i], "--segment") == 0 || strcmp(argv[i], "--jobs") == 0 ||
+		     strcmp(argv[i], "--trace") == 0) && i + 1 < argc)
+			i++;
+		else if (strcmp(argv[i], "--engine") == 0 && i + 1 < argc)
+			internal = strcmp(argv[++i], "internal") == 0;
+		else if (strcmp(argv[i], "--scene-cuts") == 0)
+			scene_cuts = true;
+		else if (files.size() < 2)
+			files << QString::fromLocal8Bit(argv[i]);
+		else
+			args << QString::fromLocal8Bit(argv[i]);
+	}
+	if (files.size() < 2 || atof(seconds) <= 0) {
+		fprintf(stderr, "Usage: %s --segment <seconds> <input> <output> [options...]\n", argv[0]);
+		return 1;
+	}
+
+	Segmenter s(files[0], files[1], args, atof(seconds));
+	if (internal)
+		s.setEngine(Transcoder::INTERNAL);
+	s.setSceneCuts(scene_cuts);
+	return s.run();
+}
+
+/* qtheorafrontend --scenes <input> [--videostream <n>] [<file>] prints the
+ * scene cuts of the input, in seconds, or writes them to the file; see
+ * scenecut.h */
+
+static int
+run_scenes(int argc, char *argv[], const char *input)
+{
+	QCoreApplication app(argc, argv);
+	QString file;
+	int stream = -1;
+	for (int i = 1; i < argc; i++) {
+		if ((strcmp(argv[i], "--scenes") == 0 || strcmp(argv[i], "--trace") == 0) && i + 1 < argc)
+			i++;
+		else if (strcmp(argv[i], "--videostream") == 0 && i + 1 < argc)
+			stream = atoi(argv[++i]);
+		else
+			file = QString::fromLocal8Bit(argv[i]);
+	}
+
+	QList<double> cuts;
+	try {
+		SceneDetector detector;
+		detector.setVideoStream(stream);
+		cuts = detector.run(QString::fromLocal8Bit(input));
+	} catch (std::exception &x) {
+		fprintf(stderr, "%s: %s\n", input, x.what());
+		return 1;
+	}
+	if (file.isEmpty()) {
+		for (int i = 0; i < cuts.size(); i++)
+			printf("%.3f\n", cuts[i]);
+	} else if (!SceneDetector::save(file, cuts)) {
+		fprintf(stderr, "Can't write %s\n", qPrintable(file));
+		return 1;
+	}
+	return 0;
+}
 
 int main(int argc, char *argv[])
 {
+	if (const char *trace = option(argc, argv, "--trace")) {
+		Trace::open(QString::fromLocal8Bit(trace));
+		Trace::threadName("main");
+	}
+	if (const char *address = option(argc, argv, "--worker"))
+		return run_worker(argc, argv, address);
+	if (const char *seconds = option(argc, argv, "--segment"))
+		return run_segment(argc, argv, seconds);
+	if (const char *input = option(argc, argv, "--scenes"))
+		return run_scenes(argc, argv, input);
+	for (int i = 1; i < argc; i++)
+		if (strcmp(argv[i], "--benchmark") == 0)
+			return run_benchmark(argc, argv);
+
 	QApplication app(argc, argv);
 
 	Frontend fe;
+	if (const char *workers = option(argc, argv, "--workers"))
+		fe.setWorkers(QString::fromLocal8Bit(workers));
 	fe.show();
 
-	return app.exec();
+	Watchdog::instance()->watch();
+	int ret = app.exec();
+	Watchdog::instance()->stop();
+	return ret;
 }
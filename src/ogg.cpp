@@ -0,0 +1,516 @@
+/*
+ * ogg.cpp - Ogg page reading and writing
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <cstring>
+#include <stdexcept>
+#include "ogg.h"
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#endif
+
+#define WINDOW_SIZE (16 << 20)
+#define PAGE_BODY 4096
+
+/* CRC-32 with polynomial 0x04c11db7, not reflected, no final xor, eight
+ * bytes at a time: t[k] is the table for a byte k positions from the end
+ * of each eight */
+
+static struct CrcTable {
+	quint32 t[8][256];
+
+	CrcTable()
+	{
+		for (int i = 0; i < 256; i++) {
+			quint32 r = quint32(i) << 24;
+			for (int j = 0; j < 8; j++)
+				r = (r & 0x80000000) ? (r << 1) ^ 0x04c11db7 : r << 1;
+			t[0][i] = r;
+		}
+		for (int k = 1; k < 8; k++)
+			for (int i = 0; i < 256; i++)
+				t[k][i] = (t[k - 1][i] << 8) ^ t[0][t[k - 1][i] >> 24];
+	}
+} crc_table;
+
+quint32
+ogg_crc(const uchar *data, int len, quint32 crc)
+{
+	const quint32 (*t)[256] = crc_table.t;
+	for (; len >= 8; data += 8, len -= 8) {
+		crc ^= (quint32(data[0]) << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+		crc = t[7][crc >> 24] ^ t[6][(crc >> 16) & 0xff] ^
+			t[5][(crc >> 8) & 0xff] ^ t[4][crc & 0xff] ^
+			t[3][data[4]] ^ t[2][data[5]] ^ t[1][data[6]] ^ t[0][data[7]];
+	}
+	for (int i = 0; i < len; i++)
+		crc = (crc << 8) ^ t[0][((crc >> 24) ^ data[i]) & 0xff];
+	return crc;
+}
+
+static quint32
+get32(const uchar *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | (quint32(p[3]) << 24);
+}
+
+static qint64
+get64(const uchar *p)
+{
+	return qint64(get32(p)) | (qint64(get32(p + 4)) << 32);
+}
+
+static void
+put32(uchar *p, quint32 v)
+{
+	for (int i = 0; i < 4; i++)
+		p[i] = uchar(v >> (8 * i));
+}
+
+static quint32
+get32be(const uchar *p)
+{
+	return (quint32(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+int
+OggPage::packets() const
+{
+	int ret = 0;
+	for (int i = 0; i < segments.size(); i++)
+		if (uchar(segments[i]) < 255)
+			ret++;
+	return ret;
+}
+
+int
+OggPage::parse(const uchar *p, qint64 avail, bool copy_body)
+{
+	if (avail >= 5 && (memcmp(p, "OggS", 4) != 0 || p[4] != 0))
+		return -1;
+	if (avail < OGG_HEADER_SIZE)
+		return 0;
+	int nsegs = p[26];
+	if (avail < OGG_HEADER_SIZE + nsegs)
+		return 0;
+	int body_len = 0;
+	for (int i = 0; i < nsegs; i++)
+		body_len += p[OGG_HEADER_SIZE + i];
+	int size = OGG_HEADER_SIZE + nsegs + body_len;
+	if (avail < size)
+		return 0;
+
+	/* the checksum is computed with its own field zeroed */
+	static const uchar zero[4] = {0, 0, 0, 0};
+	quint32 crc = ogg_crc(p, 22);
+	crc = ogg_crc(zero, 4, crc);
+	crc = ogg_crc(p + 26, size - 26, crc);
+	if (crc != get32(p + 22))
+		return -1;
+
+	flags = p[5];
+	granulepos = get64(p + 6);
+	serialno = get32(p + 14);
+	seqno = get32(p + 18);
+	segments = QByteArray((const char *)p + OGG_HEADER_SIZE, nsegs);
+	if (copy_body)
+		body = QByteArray((const char *)p + OGG_HEADER_SIZE + nsegs, body_len);
+	else
+		body.clear();
+	return size;
+}
+
+QByteArray
+OggPage::serialize() const
+{
+	QByteArray ret(size(), 0);
+	uchar *p = (uchar *)ret.data();
+	memcpy(p, "OggS", 4);
+	p[4] = 0;
+	p[5] = flags;
+	put32(p + 6, quint32(granulepos));
+	put32(p + 10, quint32(quint64(granulepos) >> 32));
+	put32(p + 14, serialno);
+	put32(p + 18, seqno);
+	p[26] = segments.size();
+	memcpy(p + OGG_HEADER_SIZE, segments.constData(), segments.size());
+	memcpy(p + OGG_HEADER_SIZE + segments.size(), body.constData(), body.size());
+	put32(p + 22, ogg_crc(p, ret.size()));
+	return ret;
+}
+
+OggReader::OggReader()
+	: size_(0), pos_(0), skipped_(0), map_(NULL), map_pos_(0), map_len_(0)
+{
+}
+
+OggReader::~OggReader()
+{
+	close();
+}
+
+void
+OggReader::open(const QString &filename)
+{
+	close();
+	file_.setFileName(filename);
+	if (!file_.open(QIODevice::ReadOnly))
+		throw std::runtime_error(qPrintable("Can't open " + filename));
+	size_ = file_.size();
+	pos_ = skipped_ = 0;
+}
+
+void
+OggReader::close()
+{
+	if (map_ != NULL)
+		file_.unmap(map_);
+	map_ = NULL;
+	map_pos_ = map_len_ = 0;
+	buf_.clear();
+	file_.close();
+}
+
+/* at least len bytes at pos, unless the file ends before; where the file
+ * can't be mapped it is read into a buffer of the same size instead */
+
+const uchar *
+OggReader::window(qint64 pos, qint64 len, qint64 *avail)
+{
+	len = qMin(len, size_ - pos);
+	if (len <= 0) {
+		*avail = 0;
+		return NULL;
+	}
+	if (pos < map_pos_ || pos + len > map_pos_ + map_len_) {
+		if (map_ != NULL)
+			file_.unmap(map_);
+		buf_.clear();
+		map_pos_ = pos;
+		map_len_ = qMin(qMax(len, qint64(WINDOW_SIZE)), size_ - pos);
+		map_ = file_.map(map_pos_, map_len_);
+#ifdef Q_OS_UNIX
+		if (map_ != NULL)
+			madvise(map_, map_len_, MADV_SEQUENTIAL);
+#endif
+		if (map_ == NULL) {
+			file_.seek(map_pos_);
+			buf_ = file_.read(map_len_);
+			map_len_ = buf_.size();
+		}
+	}
+	*avail = map_pos_ + map_len_ - pos;
+	const uchar *base = map_ != NULL ? map_ : (const uchar *)buf_.constData();
+	return base + (pos - map_pos_);
+}
+
+bool
+OggReader::readPage(OggPage *page, bool body)
+{
+	for (;;) {
+		qint64 avail;
+		const uchar *p = window(pos_, OGG_MAX_PAGE, &avail);
+		if (avail < OGG_HEADER_SIZE) {
+			skipped_ += avail;
+			pos_ += avail;
+			return false;
+		}
+		int n = page->parse(p, avail, body);
+		if (n > 0) {
+			page->offset = pos_;
+			pos_ += n;
+			return true;
+		}
+
+		/* not a page, or a truncated one: look for the next capture pattern */
+		qint64 skip = 1;
+		while (skip + 4 <= avail && memcmp(p + skip, "OggS", 4) != 0) {
+			const void *o = memchr(p + skip + 1, 'O', avail - skip - 1);
+			skip = o != NULL ? (const uchar *)o - p : avail - 3;
+		}
+		skip = qMax(skip, qint64(1));
+		skipped_ += skip;
+		pos_ += skip;
+	}
+}
+
+void
+OggPacketReader::pageIn(const OggPage &page)
+{
+	/* a continuation without a beginning, or a beginning without one */
+	bool skipping = page.continued() && partial_.isEmpty();
+	if (!page.continued())
+		partial_.clear();
+
+	int last = -1;
+	for (int i = 0; i < page.segments.size(); i++)
+		if (uchar(page.segments[i]) < 255)
+			last = i;
+
+	int pos = 0;
+	for (int i = 0; i < page.segments.size(); i++) {
+		int len = uchar(page.segments[i]);
+		if (!skipping)
+			partial_.append(page.body.constData() + pos, len);
+		pos += len;
+		if (len < 255) {
+			if (!skipping) {
+				Packet p;
+				p.data = partial_;
+				p.granulepos = i == last ? page.granulepos : -1;
+				ready_.push_back(p);
+			}
+			partial_.clear();
+			skipping = false;
+		}
+	}
+}
+
+bool
+OggPacketReader::packetOut(QByteArray *data, qint64 *granulepos)
+{
+	if (ready_.isEmpty())
+		return false;
+	Packet p = ready_.takeFirst();
+	*data = p.data;
+	if (granulepos != NULL)
+		*granulepos = p.granulepos;
+	return true;
+}
+
+OggPacketWriter::OggPacketWriter(quint32 serialno, quint32 seqno)
+	: serialno_(serialno), seqno_(seqno), bos_(seqno == 0), continued_(false)
+{
+}
+
+void
+OggPacketWriter::packetIn(const QByteArray &data, qint64 granulepos, bool eos)
+{
+	segments_.append(QByteArray(data.size() / 255, char(255)));
+	segments_.append(char(data.size() % 255));
+	body_.append(data);
+	Packet p;
+	p.end = segments_.size();
+	p.granulepos = granulepos;
+	p.eos = eos;
+	packets_.push_back(p);
+}
+
+bool
+OggPacketWriter::pageOut(OggPage *page, bool flush)
+{
+	if (segments_.isEmpty())
+		return false;
+	int nsegs = 0, bytes = 0;
+	while (nsegs < segments_.size() && nsegs < 255 && bytes < PAGE_BODY)
+		bytes += uchar(segments_[nsegs++]);
+	if (!flush && nsegs == segments_.size() && nsegs < 255 && bytes < PAGE_BODY)
+		return false;
+
+	page->flags = (continued_ ? OGG_CONTINUED : 0) | (bos_ ? OGG_BOS : 0);
+	page->granulepos = -1;
+	page->serialno = serialno_;
+	page->seqno = seqno_++;
+	page->offset = -1;
+	while (!packets_.isEmpty() && packets_.first().end <= nsegs) {
+		page->granulepos = packets_.first().granulepos;
+		if (packets_.first().eos)
+			page->flags |= OGG_EOS;
+		packets_.removeFirst();
+	}
+	for (int i = 0; i < packets_.size(); i++)
+		packets_[i].end -= nsegs;
+	page->segments = segments_.left(nsegs);
+	page->body = body_.left(bytes);
+	segments_.remove(0, nsegs);
+	body_.remove(0, bytes);
+
+	continued_ = uchar(page->segments[nsegs - 1]) == 255;
+	bos_ = false;
+	return true;
+}
+
+OggStreamInfo::OggStreamInfo()
+	: codec(UNKNOWN), serialno(0), rate_num(0), rate_den(1), granule_shift(0),
+	preroll(0), headers(0), width(-1), height(-1), channels(-1), samplerate(-1),
+	zero_based(false)
+{
+}
+
+bool
+OggStreamInfo::identify(quint32 serial, const QByteArray &packet)
+{
+	const uchar *p = (const uchar *)packet.constData();
+	int len = packet.size();
+	serialno = serial;
+	codec = UNKNOWN;
+
+	if (len >= 42 && p[0] == 0x80 && memcmp(p + 1, "theora", 6) == 0) {
+		codec = THEORA;
+		width = (p[14] << 16) | (p[15] << 8) | p[16];
+		height = (p[17] << 16) | (p[18] << 8) | p[19];
+		rate_num = get32be(p + 22);
+		rate_den = get32be(p + 26);
+		granule_shift = ((p[40] & 0x03) << 3) | (p[41] >> 5);
+		zero_based = p[7] * 10000 + p[8] * 100 + p[9] < 30201;
+		headers = 3;
+		preroll = 0;
+	} else if (len >= 30 && p[0] == 0x01 && memcmp(p + 1, "vorbis", 6) == 0) {
+		codec = VORBIS;
+		channels = p[11];
+		samplerate = get32(p + 12);
+		rate_num = samplerate;
+		rate_den = 1;
+		headers = 3;
+		preroll = 2;
+	} else if (len >= 64 && memcmp(p, "fishead", 8) == 0)
+		codec = SKELETON;
+	return codec != UNKNOWN && rate_num >= 0 && rate_den > 0;
+}
+
+/* frames (or samples) up to and including the granule's one */
+
+qint64
+OggStreamInfo::frames(qint64 granulepos) const
+{
+	if (granulepos < 0)
+		return -1;
+	qint64 ret = granulepos;
+	if (granule_shift > 0)
+		ret = (granulepos >> granule_shift) + (granulepos & ((qint64(1) << granule_shift) - 1));
+	return zero_based ? ret + 1 : ret;
+}
+
+qint64
+OggStreamInfo::keyframe(qint64 granulepos) const
+{
+	if (granulepos < 0)
+		return -1;
+	return (granulepos >> granule_shift) + (zero_based ? 1 : 0);
+}
+
+double
+OggStreamInfo::time(qint64 granulepos) const
+{
+	if (granulepos < 0 || rate_num <= 0)
+		return -1;
+	return double(frames(granulepos)) * rate_den / rate_num;
+}
+
+const char *
+OggStreamInfo::contentType() const
+{
+	switch (codec) {
+	case THEORA:
+		return "video/theora";
+	case VORBIS:
+		return "audio/vorbis";
+	default:
+		return "application/octet-stream";
+	}
+}
+
+static const char *
+comment_prefix(OggStreamInfo::Codec codec)
+{
+	return codec == OggStreamInfo::THEORA ? "\x81theora" : "\x03vorbis";
+}
+
+bool
+parse_comments(const QByteArray &packet, OggStreamInfo::Codec codec,
+	QByteArray *vendor, QList<QByteArray> *comments)
+{
+	const uchar *p = (const uchar *)packet.constData();
+	qint64 len = packet.size(), pos = 7;
+	if (len < 11 || memcmp(p, comment_prefix(codec), 7) != 0)
+		return false;
+	quint32 n = get32(p + pos);
+	pos += 4;
+	if (n > len - pos)
+		return false;
+	*vendor = packet.mid(pos, n);
+	pos += n;
+	if (pos + 4 > len)
+		return false;
+	quint32 count = get32(p + pos);
+	pos += 4;
+	comments->clear();
+	for (quint32 i = 0; i < count; i++) {
+		if (pos + 4 > len)
+			return false;
+		n = get32(p + pos);
+		pos += 4;
+		if (n > len - pos)
+			return false;
+		comments->push_back(packet.mid(pos, n));
+		pos += n;
+	}
+	return true;
+}
+
+QByteArray
+build_comments(OggStreamInfo::Codec codec, const QByteArray &vendor, const QList<QByteArray> &comments)
+{
+	uchar n[4];
+	QByteArray ret(comment_prefix(codec), 7);
+	put32(n, vendor.size());
+	ret.append((const char *)n, 4);
+	ret.append(vendor);
+	put32(n, comments.size());
+	ret.append((const char *)n, 4);
+	for (int i = 0; i < comments.size(); i++) {
+		put32(n, comments[i].size());
+		ret.append((const char *)n, 4);
+		ret.append(comments[i]);
+	}
+	/* the framing bit */
+	if (codec == OggStreamInfo::VORBIS)
+		ret.append(char(1));
+	return ret;
+}
+
+/* tag names are case-insensitive */
+
+void
+set_comment(QList<QByteArray> *comments, const QByteArray &tag, const QByteArray &value)
+{
+	QByteArray prefix = tag.toUpper() + "=";
+	for (int i = comments->size() - 1; i >= 0; i--)
+		if ((*comments)[i].left(prefix.size()).toUpper() == prefix)
+			comments->removeAt(i);
+	comments->push_back(tag + "=" + value);
+}
+
+QByteArray
+edit_comments(const QByteArray &packet, OggStreamInfo::Codec codec, bool keep,
+	const QList<QPair<QByteArray, QByteArray> > &tags)
+{
+	if (keep && tags.isEmpty())
+		return packet;
+	QByteArray vendor;
+	QList<QByteArray> c;
+	if (!parse_comments(packet, codec, &vendor, &c))
+		return packet;
+	if (!keep)
+		c.clear();
+	for (int i = 0; i < tags.size(); i++)
+		set_comment(&c, tags[i].first, tags[i].second);
+	return build_comments(codec, vendor, c);
+}
@@ -0,0 +1,189 @@
+/*
+ * ogg.h - Ogg page reading and writing
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_OGG
+#define H_OGG
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QPair>
+
+/* Just enough of Ogg to copy streams around without libogg: pages are
+ * parsed and built here, packets are split and joined, and the three
+ * codecs we deal with are told apart by their first packet.
+ */
+
+#define OGG_CONTINUED 0x01
+#define OGG_BOS 0x02
+#define OGG_EOS 0x04
+#define OGG_HEADER_SIZE 27
+#define OGG_MAX_PAGE (OGG_HEADER_SIZE + 255 + 255 * 255)
+
+quint32 ogg_crc(const uchar *data, int len, quint32 crc = 0);
+
+struct OggPage
+{
+	quint8 flags;
+	qint64 granulepos;
+	quint32 serialno;
+	quint32 seqno;
+	QByteArray segments;
+	QByteArray body;
+	qint64 offset; /* where it was read from, -1 for new pages */
+
+	OggPage(): flags(0), granulepos(-1), serialno(0), seqno(0), offset(-1) { }
+	bool continued() const { return flags & OGG_CONTINUED; }
+	bool bos() const { return flags & OGG_BOS; }
+	bool eos() const { return flags & OGG_EOS; }
+	int size() const { return OGG_HEADER_SIZE + segments.size() + body.size(); }
+	/* packets ending on this page */
+	int packets() const;
+
+	/* the page size, 0 if more data is needed, -1 if there's no valid
+	 * page at data; without copy_body, body is left empty and only the
+	 * return value tells the size */
+	int parse(const uchar *data, qint64 avail, bool copy_body = true);
+	QByteArray serialize() const;
+};
+
+/* Reads pages of a file through a sliding memory map, skipping
+ * anything that isn't a page with a good checksum.
+ */
+
+class OggReader
+{
+public:
+	OggReader();
+	~OggReader();
+
+	void open(const QString &);
+	void close();
+	qint64 size() const { return size_; }
+	qint64 pos() const { return pos_; }
+	void seek(qint64 pos) { pos_ = pos; }
+	bool readPage(OggPage *, bool body = true);
+	/* bytes passed over while looking for pages */
+	qint64 skipped() const { return skipped_; }
+
+private:
+	const uchar *window(qint64 pos, qint64 len, qint64 *avail);
+
+	QFile file_;
+	qint64 size_;
+	qint64 pos_;
+	qint64 skipped_;
+	uchar *map_;
+	qint64 map_pos_;
+	qint64 map_len_;
+	QByteArray buf_;
+};
+
+/* packets of one logical stream, out of its pages */
+
+class OggPacketReader
+{
+public:
+	void pageIn(const OggPage &);
+	/* granulepos is that of the page if the packet is the last one ending on it */
+	bool packetOut(QByteArray *, qint64 *granulepos = NULL);
+
+private:
+	struct Packet {
+		QByteArray data;
+		qint64 granulepos;
+	};
+	QByteArray partial_;
+	QList<Packet> ready_;
+};
+
+/* pages of one logical stream, out of its packets, as libogg lays them out */
+
+class OggPacketWriter
+{
+public:
+	OggPacketWriter(quint32 serialno, quint32 seqno = 0);
+	quint32 serialno() const { return serialno_; }
+	quint32 seqno() const { return seqno_; }
+	void packetIn(const QByteArray &, qint64 granulepos, bool eos = false);
+	/* a page once there's enough data for one, or anything left if flushing */
+	bool pageOut(OggPage *, bool flush = false);
+
+private:
+	struct Packet {
+		int end; /* segment index past the packet */
+		qint64 granulepos;
+		bool eos;
+	};
+	quint32 serialno_;
+	quint32 seqno_;
+	bool bos_;
+	bool continued_;
+	QByteArray segments_;
+	QByteArray body_;
+	QList<Packet> packets_;
+};
+
+/* what a logical stream is and how its granules map to time */
+
+struct OggStreamInfo
+{
+	enum Codec {
+		UNKNOWN,
+		THEORA,
+		VORBIS,
+		SKELETON
+	};
+
+	Codec codec;
+	quint32 serialno;
+	qint64 rate_num;
+	qint64 rate_den;
+	int granule_shift;
+	int preroll;
+	int headers;
+	int width;
+	int height;
+	int channels;
+	int samplerate;
+	bool zero_based; /* Theora before 3.2.1 counted frames from 0 */
+
+	OggStreamInfo();
+	bool identify(quint32 serialno, const QByteArray &bos_packet);
+	qint64 frames(qint64 granulepos) const;
+	/* the frame number of the last keyframe up to the granule's frame */
+	qint64 keyframe(qint64 granulepos) const;
+	double time(qint64 granulepos) const;
+	const char *contentType() const;
+};
+
+/* Theora and Vorbis comment headers, as "TAG=value" entries */
+
+bool parse_comments(const QByteArray &packet, OggStreamInfo::Codec,
+	QByteArray *vendor, QList<QByteArray> *comments);
+QByteArray build_comments(OggStreamInfo::Codec, const QByteArray &vendor,
+	const QList<QByteArray> &comments);
+void set_comment(QList<QByteArray> *comments, const QByteArray &tag, const QByteArray &value);
+/* the comment packet with the tags set, dropping the old ones unless keep */
+QByteArray edit_comments(const QByteArray &packet, OggStreamInfo::Codec, bool keep,
+	const QList<QPair<QByteArray, QByteArray> > &tags);
+
+#endif // H_OGG
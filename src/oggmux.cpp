@@ -0,0 +1,272 @@
+/*
+ * oggmux.cpp - interleaving of separately encoded Ogg files
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <stdexcept>
+#include "oggmux.h"
+#include "skeleton.h"
+
+#define OUT_BUFFER (1 << 20)
+#define REPORT_INTERVAL 250 /* ms */
+
+OggMuxer::OggMuxer(bool skeleton, ProgressListener *listener)
+	: skeleton_(skeleton), listener_(listener), time_(0)
+{
+}
+
+OggMuxer::~OggMuxer()
+{
+	qDeleteAll(streams_);
+	qDeleteAll(inputs_);
+}
+
+void
+OggMuxer::run(const QStringList &inputs, const QString &output)
+{
+	for (int i = 0; i < inputs.size(); i++) {
+		Input *in = new Input;
+		in->name = inputs[i];
+		in->next_stream = NULL;
+		in->started = in->done = false;
+		inputs_ << in;
+		in->reader.open(inputs[i]);
+		readHeaders(in);
+	}
+
+	out_.setFileName(output);
+	if (!out_.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		throw std::runtime_error(qPrintable("Can't create " + output));
+	report_timer_.start();
+	writeHeaders();
+	copyPages();
+	flush();
+	out_.close();
+	report(true);
+}
+
+OggMuxer::Stream *
+OggMuxer::find(Input *in, quint32 serialno) const
+{
+	for (int i = 0; i < in->streams.size(); i++)
+		if (in->streams[i]->info.serialno == serialno)
+			return in->streams[i];
+	return NULL;
+}
+
+/* A skeleton of the input is left out, a new one covers all the streams.
+ * Serial numbers are picked at random by each encoder, so they may clash.
+ */
+
+void
+OggMuxer::readHeaders(Input *in)
+{
+	const QString &name = in->name;
+	OggPage page;
+	int done = 0;
+	while (in->reader.readPage(&page)) {
+		if (page.bos()) {
+			OggPacketReader reader;
+			reader.pageIn(page);
+			QByteArray packet;
+			OggStreamInfo info;
+			if (!reader.packetOut(&packet) || !info.identify(page.serialno, packet))
+				throw std::runtime_error(qPrintable("Unknown stream in " + name));
+			if (info.codec == OggStreamInfo::SKELETON)
+				continue;
+			Stream *s = new Stream;
+			s->info = info;
+			s->headers << packet;
+			s->header_pages = 1;
+			s->seen = 0;
+			s->seqno = 0;
+			s->time = 0;
+			s->serialno = page.serialno;
+			for (int i = 0; i < streams_.size(); i++)
+				if (streams_[i]->serialno == s->serialno) {
+					s->serialno = random_serialno();
+					i = -1;
+				}
+			in->streams << s;
+			if (info.codec == OggStreamInfo::THEORA)
+				streams_.prepend(s);
+			else
+				streams_ << s;
+			continue;
+		}
+		Stream *s = find(in, page.serialno);
+		if (s == NULL || s->headers.size() >= s->info.headers)
+			continue;
+		s->header_pages++;
+		s->reader.pageIn(page);
+		QByteArray packet;
+		while (s->headers.size() < s->info.headers && s->reader.packetOut(&packet))
+			s->headers << packet;
+		if (s->headers.size() == s->info.headers && ++done == in->streams.size())
+			break;
+	}
+	if (in->streams.isEmpty())
+		throw std::runtime_error(qPrintable("No Theora or Vorbis stream in " + name));
+	if (done < in->streams.size())
+		throw std::runtime_error(qPrintable("The stream headers of " + name + " are incomplete"));
+	in->reader.seek(0);
+}
+
+/* as Remuxer lays them out, see remux.cpp */
+
+void
+OggMuxer::writeHeaders()
+{
+	quint32 skeleton_serial;
+	bool clash;
+	do {
+		skeleton_serial = random_serialno();
+		clash = false;
+		for (int i = 0; i < streams_.size(); i++)
+			clash = clash || streams_[i]->serialno == skeleton_serial;
+	} while (clash);
+	OggPacketWriter skeleton(skeleton_serial);
+	OggPage page;
+
+	if (skeleton_) {
+		skeleton.packetIn(skeleton_fishead(), 0);
+		while (skeleton.pageOut(&page, true))
+			write(page);
+	}
+
+	QList<OggPacketWriter> writers;
+	for (int i = 0; i < streams_.size(); i++) {
+		writers << OggPacketWriter(streams_[i]->serialno);
+		writers[i].packetIn(streams_[i]->headers[0], 0);
+		while (writers[i].pageOut(&page, true))
+			write(page);
+	}
+
+	if (skeleton_) {
+		for (int i = 0; i < streams_.size(); i++) {
+			OggStreamInfo info = streams_[i]->info;
+			info.serialno = streams_[i]->serialno;
+			skeleton.packetIn(skeleton_fisbone(info), 0);
+		}
+		while (skeleton.pageOut(&page, true))
+			write(page);
+	}
+
+	for (int i = 0; i < streams_.size(); i++) {
+		Stream *s = streams_[i];
+		for (int j = 1; j < s->headers.size(); j++)
+			writers[i].packetIn(s->headers[j], 0);
+		while (writers[i].pageOut(&page, true))
+			write(page);
+		s->seqno = writers[i].seqno();
+	}
+
+	if (skeleton_) {
+		skeleton.packetIn(QByteArray(), 0, true);
+		while (skeleton.pageOut(&page, true))
+			write(page);
+	}
+}
+
+/* the input's next data page, of the first link only */
+
+bool
+OggMuxer::advance(Input *in)
+{
+	OggPage page;
+	while (!in->done && in->reader.readPage(&page)) {
+		if (page.bos() && in->started)
+			break;
+		Stream *s = find(in, page.serialno);
+		if (s == NULL || s->seen++ < s->header_pages)
+			continue;
+		in->next = page;
+		in->next_stream = s;
+		in->started = true;
+		return true;
+	}
+	in->done = true;
+	return false;
+}
+
+/* A page goes at the time of its granule; one that ends no packet goes
+ * with the one before it, ahead of the page completing its packet.
+ */
+
+void
+OggMuxer::copyPages()
+{
+	for (int i = 0; i < inputs_.size(); i++)
+		advance(inputs_[i]);
+	while (!listener_->cancelled()) {
+		listener_->waitWhilePaused();
+		Input *first = NULL;
+		double first_time = 0;
+		for (int i = 0; i < inputs_.size(); i++) {
+			Input *in = inputs_[i];
+			if (in->done)
+				continue;
+			const OggPage &page = in->next;
+			const Stream *s = in->next_stream;
+			double t = page.granulepos >= 0 ? s->info.time(page.granulepos) : s->time;
+			if (first == NULL || t < first_time) {
+				first = in;
+				first_time = t;
+			}
+		}
+		if (first == NULL)
+			break;
+
+		OggPage &page = first->next;
+		Stream *s = first->next_stream;
+		page.serialno = s->serialno;
+		page.seqno = s->seqno++;
+		if (page.granulepos >= 0)
+			s->time = s->info.time(page.granulepos);
+		time_ = qMax(time_, s->time);
+		write(page);
+		report();
+		advance(first);
+	}
+}
+
+void
+OggMuxer::write(const OggPage &page)
+{
+	buf_.append(page.serialize());
+	if (buf_.size() >= OUT_BUFFER)
+		flush();
+}
+
+void
+OggMuxer::flush()
+{
+	if (out_.write(buf_) != buf_.size())
+		throw std::runtime_error(qPrintable("Can't write " + out_.fileName()));
+	buf_.clear();
+}
+
+void
+OggMuxer::report(bool force)
+{
+	if (!force && report_timer_.elapsed() < REPORT_INTERVAL)
+		return;
+	report_timer_.restart();
+	listener_->progress(time_);
+}
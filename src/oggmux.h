@@ -0,0 +1,85 @@
+/*
+ * oggmux.h - interleaving of separately encoded Ogg files
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_OGGMUX
+#define H_OGGMUX
+
+#include <QFile>
+#include <QList>
+#include <QStringList>
+#include <QTime>
+#include "ogg.h"
+#include "util.h"
+
+/* Joins the Theora and Vorbis streams of several Ogg files into one, as
+ * when audio and video were encoded by processes of their own. Headers
+ * are laid out anew under a single skeleton, the data pages of the inputs
+ * are copied in the order of their times, reading each input once.
+ */
+
+class OggMuxer
+{
+public:
+	OggMuxer(bool skeleton, ProgressListener *);
+	~OggMuxer();
+	void run(const QStringList &inputs, const QString &output);
+
+private:
+	struct Stream {
+		OggStreamInfo info;
+		QList<QByteArray> headers;
+		OggPacketReader reader;
+		quint32 serialno; /* in the output */
+		int header_pages;
+		int seen;
+		quint32 seqno;
+		double time; /* of the last page with a granule */
+	};
+	struct Input {
+		QString name;
+		OggReader reader;
+		QList<Stream *> streams;
+		OggPage next;
+		Stream *next_stream;
+		bool started;
+		bool done;
+	};
+
+	void readHeaders(Input *);
+	Stream *find(Input *, quint32 serialno) const;
+	void writeHeaders();
+	bool advance(Input *);
+	void copyPages();
+	void write(const OggPage &);
+	void flush();
+	void report(bool force = false);
+
+	bool skeleton_;
+	ProgressListener *listener_;
+	QList<Input *> inputs_;
+	QList<Stream *> streams_; /* Theora first, as its spec wants */
+	QFile out_;
+	QByteArray buf_;
+	double time_;
+	QTime report_timer_;
+};
+
+#endif // H_OGGMUX
@@ -0,0 +1,314 @@
+/*
+ * prefilter.cpp - parallel crop, scaling and adjustment of decoded frames
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QSemaphore>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "prefilter.h"
+#include "util.h"
+
+#define COEF_BITS 14
+#define FRAC_BITS 6 /* of the horizontally filtered rows */
+#define MIN_SLICE_ROWS 32
+
+PrefilterOptions::PrefilterOptions()
+	: width(-1), height(-1), max_size(false), no_upscaling(false),
+	contrast(1), brightness(0), gamma(1), saturation(1)
+{
+	crop[0] = crop[1] = crop[2] = crop[3] = 0;
+}
+
+class Prefilter::Slice : public QRunnable
+{
+public:
+	Slice(const Prefilter *filter, const YuvFrame *in, YuvFrame *out, int y0, int y1,
+		QSemaphore *done)
+		: filter_(filter), in_(in), out_(out), y0_(y0), y1_(y1), done_(done) { }
+
+	void run()
+	{
+		filter_->filterRows(*in_, out_, y0_, y1_);
+		done_->release();
+	}
+
+private:
+	const Prefilter *filter_;
+	const YuvFrame *in_;
+	YuvFrame *out_;
+	int y0_;
+	int y1_;
+	QSemaphore *done_;
+};
+
+Prefilter::Prefilter(const PrefilterOptions &options)
+	: options_(options), scaling_(false)
+{
+	adjust_[0] = adjust_[1] = false;
+}
+
+Prefilter::~Prefilter()
+{
+	pool_.waitForDone();
+}
+
+/* av_rescale(), rounding to nearest */
+
+static int
+rescale(qint64 a, qint64 b, qint64 c)
+{
+	return int((a * b + c / 2) / c);
+}
+
+static qint64
+gcd(qint64 a, qint64 b)
+{
+	while (b) {
+		qint64 t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+const VideoFormat &
+Prefilter::open(const VideoFormat &in)
+{
+	/* ffmpeg's crop keeps to whole chroma samples */
+	const int *crop = options_.crop;
+	int cw = (in.width - crop[2] - crop[3]) & ~1;
+	int ch = (in.height - crop[0] - crop[1]) & ~1;
+	if (cw <= 0 || ch <= 0)
+		throw std::runtime_error("Cropping leaves no picture");
+	x_[0] = crop[2] & ~1;
+	y_[0] = crop[0] & ~1;
+	x_[1] = x_[0] / 2;
+	y_[1] = y_[0] / 2;
+
+	/* as the scale filter sizes it */
+	int w = cw, h = ch;
+	if (options_.width > 0 && options_.height > 0) {
+		w = options_.width;
+		h = options_.height;
+		if (options_.no_upscaling) {
+			w = qMin(w, cw);
+			h = qMin(h, ch);
+		}
+		if (options_.max_size) {
+			int fit_w = rescale(h, cw, ch), fit_h = rescale(w, ch, cw);
+			w = qMax(qMin(w, fit_w), 1);
+			h = qMax(qMin(h, fit_h), 1);
+		}
+	}
+
+	format_ = in;
+	format_.width = w;
+	format_.height = h;
+	scaling_ = w != cw || h != ch;
+	if (scaling_ && in.par_num > 0 && in.par_den > 0) {
+		qint64 num = qint64(in.par_num) * h * cw, den = qint64(in.par_den) * w * ch;
+		qint64 d = gcd(num, den);
+		format_.par_num = int(num / d);
+		format_.par_den = int(den / d);
+	}
+	if (scaling_) {
+		makeTaps(&htaps_[0], cw, w);
+		makeTaps(&vtaps_[0], ch, h);
+		makeTaps(&htaps_[1], (cw + 1) / 2, (w + 1) / 2);
+		makeTaps(&vtaps_[1], (ch + 1) / 2, (h + 1) / 2);
+	}
+	adjust_[0] = eq_lut(lut_[0], options_.contrast, options_.brightness, options_.gamma);
+	adjust_[1] = eq_lut(lut_[1], options_.saturation);
+	return format_;
+}
+
+void
+Prefilter::process(const YuvFrame &in, YuvFrame *out)
+{
+	out->alloc(format_.width, format_.height);
+	/* slices of whole chroma rows */
+	int slices = qBound(1, format_.height / MIN_SLICE_ROWS, pool_.maxThreadCount());
+	QSemaphore done;
+	int y0 = 0;
+	for (int i = 0; i < slices; i++) {
+		int y1 = i == slices - 1 ? format_.height : (format_.height * (i + 1) / slices) & ~1;
+		pool_.start(new Slice(this, &in, out, y0, y1, &done));
+		y0 = y1;
+	}
+	done.acquire(slices);
+}
+
+/* swscale's default bicubic, B = 0 and C = 0.6 */
+
+static double
+cubic(double x)
+{
+	x = fabs(x);
+	if (x < 1)
+		return (8.4 * x * x * x - 14.4 * x * x + 6) / 6;
+	if (x < 2)
+		return (-3.6 * x * x * x + 18 * x * x - 28.8 * x + 14.4) / 6;
+	return 0;
+}
+
+/* the kernel is stretched over the input when shrinking, and taps past
+ * the edges fall on the edge samples */
+
+void
+Prefilter::makeTaps(Taps *t, int in, int out)
+{
+	double scale = in / double(out);
+	double stretch = qMax(scale, 1.0);
+	double support = 2 * stretch;
+	t->size = in == out ? 1 : int(ceil(2 * support));
+	t->index.resize(out * t->size);
+	t->coef.resize(out * t->size);
+	QVector<double> w(t->size);
+	for (int i = 0; i < out; i++) {
+		int *index = t->index.data() + i * t->size;
+		qint16 *coef = t->coef.data() + i * t->size;
+		if (in == out) {
+			index[0] = i;
+			coef[0] = 1 << COEF_BITS;
+			continue;
+		}
+		double center = (i + 0.5) * scale - 0.5;
+		int first = int(floor(center - support)) + 1;
+		double sum = 0;
+		for (int k = 0; k < t->size; k++) {
+			w[k] = cubic((first + k - center) / stretch);
+			sum += w[k];
+		}
+		int total = 0, biggest = 0;
+		for (int k = 0; k < t->size; k++) {
+			index[k] = qBound(0, first + k, in - 1);
+			coef[k] = qint16(qRound(w[k] / sum * (1 << COEF_BITS)));
+			total += coef[k];
+			if (qAbs(coef[k]) > qAbs(coef[biggest]))
+				biggest = k;
+		}
+		coef[biggest] += (1 << COEF_BITS) - total;
+	}
+}
+
+static void
+apply_lut(uchar *dst, const uchar *src, int width, const uchar *lut)
+{
+	for (int x = 0; x < width; x++)
+		dst[x] = lut[src[x]];
+}
+
+static void
+hfilter(qint16 *dst, const uchar *src, const int *index, const qint16 *coef, int taps, int width)
+{
+	for (int x = 0; x < width; x++, index += taps, coef += taps) {
+		int acc = 1 << (COEF_BITS - FRAC_BITS - 1);
+		for (int k = 0; k < taps; k++)
+			acc += coef[k] * src[index[k]];
+		dst[x] = qint16(acc >> (COEF_BITS - FRAC_BITS));
+	}
+}
+
+/* The vertical pass has the same taps all along a row, so it goes eight
+ * pixels at a time, two taps per multiply-add; the scalar loop gives the
+ * same result for the rest of the row or without SSE2.
+ */
+
+static void
+vfilter(uchar *dst, const qint16 *const *rows, const qint16 *coef, int taps, int width)
+{
+	const int shift = COEF_BITS + FRAC_BITS;
+	int x = 0;
+#ifdef __SSE2__
+	for (; x + 8 <= width; x += 8) {
+		__m128i lo = _mm_set1_epi32(1 << (shift - 1)), hi = lo;
+		for (int k = 0; k < taps; k += 2) {
+			bool pair = k + 1 < taps;
+			__m128i a = _mm_loadu_si128((const __m128i *)(rows[k] + x));
+			__m128i b = _mm_loadu_si128((const __m128i *)(rows[pair ? k + 1 : k] + x));
+			__m128i c = _mm_set1_epi32(int(quint16(coef[k]) |
+				quint32(pair ? quint16(coef[k + 1]) : 0) << 16));
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), c));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), c));
+		}
+		__m128i v = _mm_packs_epi32(_mm_srai_epi32(lo, shift), _mm_srai_epi32(hi, shift));
+		_mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(v, v));
+	}
+#endif
+	for (; x < width; x++) {
+		int acc = 1 << (shift - 1);
+		for (int k = 0; k < taps; k++)
+			acc += coef[k] * rows[k][x];
+		acc >>= shift;
+		dst[x] = uchar(acc < 0 ? 0 : acc > 255 ? 255 : acc);
+	}
+}
+
+/* luma rows y0 to y1 and the chroma rows that go with them */
+
+void
+Prefilter::filterRows(const YuvFrame &in, YuvFrame *out, int y0, int y1) const
+{
+	for (int p = 0; p < 3; p++) {
+		int c = p > 0;
+		int r0 = c ? y0 / 2 : y0, r1 = c ? (y1 + 1) / 2 : y1;
+		if (r0 >= r1)
+			continue;
+		int width = out->width[p];
+		const uchar *src = in.plane[p] + y_[c] * in.stride[p] + x_[c];
+		const uchar *lut = adjust_[c] ? lut_[c] : NULL;
+
+		if (!scaling_) {
+			for (int y = r0; y < r1; y++) {
+				const uchar *s = src + y * in.stride[p];
+				uchar *d = out->plane[p] + y * out->stride[p];
+				if (lut)
+					apply_lut(d, s, width, lut);
+				else
+					memcpy(d, s, width);
+			}
+			continue;
+		}
+
+		/* the input rows within reach of the slice, filtered across */
+		const Taps &h = htaps_[c], &v = vtaps_[c];
+		int first = v.index[r0 * v.size], last = v.index[r1 * v.size - 1];
+		int padded = (width + 7) & ~7;
+		QVector<qint16> tmp((last - first + 1) * padded);
+		for (int r = first; r <= last; r++)
+			hfilter(tmp.data() + (r - first) * padded, src + r * in.stride[p],
+				h.index.constData(), h.coef.constData(), h.size, width);
+
+		QVector<const qint16 *> rows(v.size);
+		for (int y = r0; y < r1; y++) {
+			const int *index = v.index.constData() + y * v.size;
+			for (int k = 0; k < v.size; k++)
+				rows[k] = tmp.constData() + (index[k] - first) * padded;
+			uchar *d = out->plane[p] + y * out->stride[p];
+			vfilter(d, rows.constData(), v.coef.constData() + y * v.size, v.size, width);
+			if (lut)
+				apply_lut(d, d, width, lut);
+		}
+	}
+}
@@ -0,0 +1,90 @@
+/*
+ * prefilter.h - parallel crop, scaling and adjustment of decoded frames
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_PREFILTER
+#define H_PREFILTER
+
+#include <QThreadPool>
+#include <QVector>
+#include "decoder.h"
+
+/* Cropping, scaling and the contrast/brightness/gamma/saturation
+ * adjustments of the built-in encoder, done on decoded frames in row
+ * slices across a thread pool instead of in ffmpeg's filter thread.
+ * Deinterlacing and frame rate changes stay in ffmpeg: they need the
+ * neighbouring frames.
+ *
+ * Cropping and the adjustments give the same bytes as ffmpeg's crop and
+ * eq filters. Scaling uses swscale's default bicubic kernel (B = 0,
+ * C = 0.6) with 14-bit taps, but its own rounding and centred chroma, so
+ * scaled pixels can be a few levels off the ffmpeg path, mostly at edges.
+ */
+
+struct PrefilterOptions
+{
+	int crop[4]; /* top, bottom, left, right */
+	int width; /* -1 keeps the size */
+	int height;
+	bool max_size;
+	bool no_upscaling;
+	double contrast;
+	double brightness;
+	double gamma;
+	double saturation;
+
+	PrefilterOptions();
+};
+
+class Prefilter
+{
+public:
+	Prefilter(const PrefilterOptions &);
+	~Prefilter();
+
+	/* the format of the frames coming out, given that of those going in */
+	const VideoFormat &open(const VideoFormat &);
+	void process(const YuvFrame &in, YuvFrame *out);
+
+private:
+	/* size input samples with their weights, summing to 1 << 14,
+	 * for every output sample */
+	struct Taps {
+		int size;
+		QVector<int> index;
+		QVector<qint16> coef;
+	};
+	class Slice;
+	friend class Slice;
+
+	static void makeTaps(Taps *, int in, int out);
+	void filterRows(const YuvFrame &in, YuvFrame *out, int y0, int y1) const;
+
+	PrefilterOptions options_;
+	VideoFormat format_;
+	int x_[2], y_[2]; /* the crop offset, luma and chroma */
+	bool scaling_;
+	Taps htaps_[2], vtaps_[2];
+	bool adjust_[2];
+	uchar lut_[2][256];
+	QThreadPool pool_;
+};
+
+#endif // H_PREFILTER
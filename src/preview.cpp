@@ -0,0 +1,292 @@
+/*
+ * preview.cpp - picture adjustment preview
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QHBoxLayout>
+#include <QLabel>
+#include <QPainter>
+#include <QPushButton>
+#include <QVBoxLayout>
+#include <QVector>
+#include <cstring>
+#include <stdexcept>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "frontend.h"
+#include "preview.h"
+#include "util.h"
+
+/* BT.601 studio range to RGB with 6 fractional bits */
+#define Y_COEF 75
+#define V_TO_R 102
+#define U_TO_G 25
+#define V_TO_G 52
+#define U_TO_B 129
+
+void
+FrameGrabber::grab(const QString &input, double time)
+{
+	input_ = input;
+	time_ = time;
+	start();
+}
+
+/* past the end of a file of unknown length, the first frame will do */
+
+void
+FrameGrabber::run()
+{
+	error_.clear();
+	try {
+		Decoder dec;
+		bool ok = false;
+		for (int seek = time_ > 0; seek >= 0 && !ok; seek--) {
+			QStringList input_options;
+			if (seek)
+				input_options << "-ss" << QString::number(time_);
+			dec.open(Decoder::VIDEO, input_, QStringList() << "-frames:v" << "1", input_options);
+			ok = dec.readFrame(&frame_);
+		}
+		if (!ok)
+			throw std::runtime_error("No picture could be decoded");
+		format_ = dec.videoFormat();
+	} catch (std::exception &x) {
+		error_ = x.what();
+	}
+}
+
+static void
+set_lut(uchar *lut, double contrast, double brightness = 0, double gamma = 1)
+{
+	if (!eq_lut(lut, contrast, brightness, gamma))
+		for (int i = 0; i < 256; i++)
+			lut[i] = uchar(i);
+}
+
+AdjustPreview::AdjustPreview(QWidget *parent)
+	: QWidget(parent), dirty_(true)
+{
+	set_lut(lut_[0], 1);
+	set_lut(lut_[1], 1);
+	setMinimumSize(160, 90);
+}
+
+QSize
+AdjustPreview::sizeHint() const
+{
+	return QSize(480, 270);
+}
+
+/* a copy of its own: the grabber reuses its frame */
+
+void
+AdjustPreview::setFrame(const YuvFrame &frame, const VideoFormat &format)
+{
+	frame_.alloc(frame.width[0], frame.height[0]);
+	for (int p = 0; p < 3; p++)
+		for (int y = 0; y < frame.height[p]; y++)
+			memcpy(frame_.plane[p] + y * frame_.stride[p],
+				frame.plane[p] + y * frame.stride[p], frame.width[p]);
+	format_ = format;
+	dirty_ = true;
+	update();
+}
+
+void
+AdjustPreview::setAdjustment(double contrast, double brightness, double gamma, double saturation)
+{
+	set_lut(lut_[0], contrast, brightness, gamma);
+	set_lut(lut_[1], saturation);
+	dirty_ = true;
+	update();
+}
+
+void
+AdjustPreview::resizeEvent(QResizeEvent *)
+{
+	dirty_ = true;
+}
+
+void
+AdjustPreview::paintEvent(QPaintEvent *)
+{
+	if (dirty_) {
+		render();
+		dirty_ = false;
+	}
+	QPainter p(this);
+	p.fillRect(rect(), Qt::black);
+	if (!image_.isNull())
+		p.drawImage((width() - image_.width()) / 2, (height() - image_.height()) / 2, image_);
+}
+
+static inline quint32
+clamp(int v)
+{
+	return v < 0 ? 0 : v > 255 ? 255 : v;
+}
+
+/* The SSE2 loop does eight pixels at once and gives the same result as
+ * the scalar one: where its 16-bit sums saturate, the pixel clamps to
+ * 255 anyway.
+ */
+
+static void
+yuv_to_rgb(const uchar *y, const uchar *u, const uchar *v, quint32 *rgb, int width)
+{
+	int x = 0;
+#ifdef __SSE2__
+	const __m128i zero = _mm_setzero_si128(), alpha = _mm_set1_epi8(-1);
+	const __m128i c16 = _mm_set1_epi16(16), c128 = _mm_set1_epi16(128), round = _mm_set1_epi16(32);
+	for (; x + 8 <= width; x += 8) {
+		__m128i l = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(y + x)), zero);
+		__m128i cu = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(u + x)), zero);
+		__m128i cv = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(v + x)), zero);
+		l = _mm_adds_epi16(_mm_mullo_epi16(_mm_sub_epi16(l, c16), _mm_set1_epi16(Y_COEF)), round);
+		cu = _mm_sub_epi16(cu, c128);
+		cv = _mm_sub_epi16(cv, c128);
+		__m128i r = _mm_adds_epi16(l, _mm_mullo_epi16(cv, _mm_set1_epi16(V_TO_R)));
+		__m128i g = _mm_subs_epi16(_mm_subs_epi16(l, _mm_mullo_epi16(cu, _mm_set1_epi16(U_TO_G))),
+			_mm_mullo_epi16(cv, _mm_set1_epi16(V_TO_G)));
+		__m128i b = _mm_adds_epi16(l, _mm_mullo_epi16(cu, _mm_set1_epi16(U_TO_B)));
+		r = _mm_packus_epi16(_mm_srai_epi16(r, 6), zero);
+		g = _mm_packus_epi16(_mm_srai_epi16(g, 6), zero);
+		b = _mm_packus_epi16(_mm_srai_epi16(b, 6), zero);
+		__m128i bg = _mm_unpacklo_epi8(b, g), ra = _mm_unpacklo_epi8(r, alpha);
+		_mm_storeu_si128((__m128i *)(rgb + x), _mm_unpacklo_epi16(bg, ra));
+		_mm_storeu_si128((__m128i *)(rgb + x + 4), _mm_unpackhi_epi16(bg, ra));
+	}
+#endif
+	for (; x < width; x++) {
+		int l = (y[x] - 16) * Y_COEF + 32, cu = u[x] - 128, cv = v[x] - 128;
+		rgb[x] = 0xff000000 | clamp((l + V_TO_R * cv) >> 6) << 16 |
+			clamp((l - U_TO_G * cu - V_TO_G * cv) >> 6) << 8 | clamp((l + U_TO_B * cu) >> 6);
+	}
+}
+
+/* fitted to the widget with the frame's aspect, sampling the middle of
+ * each shown pixel */
+
+void
+AdjustPreview::render()
+{
+	image_ = QImage();
+	int fw = frame_.width[0], fh = frame_.height[0];
+	if (fw <= 0 || fh <= 0)
+		return;
+	double aspect = fw / double(fh);
+	if (format_.par_num > 0 && format_.par_den > 0)
+		aspect = aspect * format_.par_num / format_.par_den;
+	int w = width(), h = qRound(w / aspect);
+	if (h > height()) {
+		h = height();
+		w = qRound(h * aspect);
+	}
+	if (w <= 0 || h <= 0)
+		return;
+	image_ = QImage(w, h, QImage::Format_RGB32);
+
+	QVector<int> xs(w);
+	for (int x = 0; x < w; x++)
+		xs[x] = int((2 * x + 1) * qint64(fw) / (2 * w));
+	QVector<uchar> ys(w), us(w), vs(w);
+	for (int y = 0; y < h; y++) {
+		int sy = int((2 * y + 1) * qint64(fh) / (2 * h));
+		const uchar *py = frame_.plane[0] + sy * frame_.stride[0];
+		const uchar *pu = frame_.plane[1] + sy / 2 * frame_.stride[1];
+		const uchar *pv = frame_.plane[2] + sy / 2 * frame_.stride[2];
+		for (int x = 0; x < w; x++) {
+			ys[x] = lut_[0][py[xs[x]]];
+			us[x] = lut_[1][pu[xs[x] / 2]];
+			vs[x] = lut_[1][pv[xs[x] / 2]];
+		}
+		yuv_to_rgb(ys.constData(), us.constData(), vs.constData(),
+			(quint32 *)image_.scanLine(y), w);
+	}
+}
+
+PreviewDialog::PreviewDialog(QWidget *parent)
+	: QDialog(parent), time_(0), regrab_(false)
+{
+	setWindowTitle("Adjustment Preview");
+	view_ = new AdjustPreview();
+	status_ = new QLabel();
+	note_ = new QLabel();
+	QPushButton *close = new QPushButton("Close");
+
+	QHBoxLayout *buttons = new QHBoxLayout();
+	buttons->addWidget(status_, 1);
+	buttons->addWidget(note_);
+	buttons->addWidget(close);
+	QVBoxLayout *layout = new QVBoxLayout(this);
+	layout->addWidget(view_, 1);
+	layout->addLayout(buttons);
+
+	connect(close, SIGNAL(clicked()), this, SLOT(hide()));
+	connect(&grabber_, SIGNAL(finished()), this, SLOT(grabbed()));
+}
+
+void
+PreviewDialog::setInput(const QString &input, double time)
+{
+	input_ = input;
+	time_ = time;
+	QString key = input + "@" + QString::number(time);
+	if (key == shown_)
+		return;
+	shown_ = key;
+	status_->setText("Decoding...");
+	if (grabber_.isRunning())
+		regrab_ = true;
+	else
+		grabber_.grab(input_, time_);
+}
+
+void
+PreviewDialog::setAdjustment(double contrast, double brightness, double gamma, double saturation)
+{
+	view_->setAdjustment(contrast, brightness, gamma, saturation);
+}
+
+void
+PreviewDialog::setNote(const QString &note)
+{
+	note_->setText(note);
+}
+
+/* a frame of an input since replaced isn't worth showing */
+
+void
+PreviewDialog::grabbed()
+{
+	if (regrab_) {
+		regrab_ = false;
+		grabber_.grab(input_, time_);
+		return;
+	}
+	if (!grabber_.error().isEmpty()) {
+		status_->setText(grabber_.error());
+		shown_.clear();
+		return;
+	}
+	view_->setFrame(grabber_.frame(), grabber_.format());
+	status_->setText("Frame at " + Frontend::time2string(time_));
+}
@@ -0,0 +1,113 @@
+/*
+ * preview.h - picture adjustment preview
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_PREVIEW
+#define H_PREVIEW
+
+#include <QDialog>
+#include <QImage>
+#include <QThread>
+#include <QWidget>
+#include "decoder.h"
+
+class QLabel;
+
+/* decodes a single frame of the input, off the GUI thread */
+
+class FrameGrabber : public QThread
+{
+	Q_OBJECT
+
+public:
+	FrameGrabber(QObject *parent = NULL): QThread(parent), time_(0) { }
+	void grab(const QString &input, double time);
+	const YuvFrame &frame() const { return frame_; }
+	const VideoFormat &format() const { return format_; }
+	/* empty if the frame was grabbed */
+	QString error() const { return error_; }
+
+protected:
+	void run();
+
+private:
+	QString input_;
+	double time_;
+	YuvFrame frame_;
+	VideoFormat format_;
+	QString error_;
+};
+
+/* The frame with the adjustments applied through eq_lut(), the same tables
+ * the built-in encoder's eq filter would use. Only the pixels shown are looked up
+ * and converted, so the cost depends on the widget's size, not the frame's.
+ */
+
+class AdjustPreview : public QWidget
+{
+	Q_OBJECT
+
+public:
+	AdjustPreview(QWidget *parent = NULL);
+	QSize sizeHint() const;
+	void setFrame(const YuvFrame &, const VideoFormat &);
+	void setAdjustment(double contrast, double brightness, double gamma, double saturation);
+
+protected:
+	void paintEvent(QPaintEvent *);
+	void resizeEvent(QResizeEvent *);
+
+private:
+	void render();
+
+	YuvFrame frame_;
+	VideoFormat format_;
+	uchar lut_[2][256];
+	QImage image_;
+	bool dirty_;
+};
+
+class PreviewDialog : public QDialog
+{
+	Q_OBJECT
+
+public:
+	PreviewDialog(QWidget *parent = NULL);
+	/* decodes the frame at time unless it's the one shown already */
+	void setInput(const QString &, double time);
+	void setAdjustment(double contrast, double brightness, double gamma, double saturation);
+	/* shown next to the status, e.g. why the frame isn't adjusted */
+	void setNote(const QString &);
+
+private slots:
+	void grabbed();
+
+private:
+	AdjustPreview *view_;
+	QLabel *status_;
+	QLabel *note_;
+	FrameGrabber grabber_;
+	QString input_;
+	double time_;
+	QString shown_;
+	bool regrab_;
+};
+
+#endif // H_PREVIEW
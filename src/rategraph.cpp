@@ -0,0 +1,167 @@
+/*
+ * rategraph.cpp - bitrate and encoding speed history
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QPainter>
+#include <QPaintEvent>
+#include <QVector>
+#include "rategraph.h"
+
+#define MIN_INTERVAL 0.25 /* seconds between samples */
+#define SERIES 3
+
+static const Qt::GlobalColor colors[SERIES] = {Qt::darkBlue, Qt::darkGreen, Qt::darkRed};
+static const char *names[SERIES] = {"video", "audio", "speed"};
+
+RateGraph::RateGraph(QWidget *parent)
+	: QWidget(parent)
+{
+	setSizePolicy(QSizePolicy::Expanding, QSizePolicy::Fixed);
+	clear();
+}
+
+QSize
+RateGraph::sizeHint() const
+{
+	return QSize(300, 90);
+}
+
+void
+RateGraph::clear()
+{
+	first_ = count_ = 0;
+	last_time_ = last_pos_ = 0;
+	last_pass_ = -1;
+	clock_.start();
+	update();
+}
+
+/* the speed is how much of the input went by since the last sample; a
+ * new pass starts over from the beginning of it */
+
+void
+RateGraph::addSample(double pos, double audio_b, double video_b, int pass)
+{
+	double time = clock_.elapsed() / 1000.0;
+	if (count_ > 0 && time - last_time_ < MIN_INTERVAL && pass == last_pass_)
+		return;
+	if (pass != last_pass_)
+		last_pos_ = 0;
+
+	Sample s;
+	s.time = time;
+	s.speed = time > last_time_ ? qMax(pos - last_pos_, 0.0) / (time - last_time_) : 0;
+	s.audio_b = qMax(audio_b, 0.0);
+	s.video_b = qMax(video_b, 0.0);
+	s.pass = pass;
+	if (count_ < RATEGRAPH_SAMPLES)
+		ring_[(first_ + count_++) % RATEGRAPH_SAMPLES] = s;
+	else {
+		ring_[first_] = s;
+		first_ = (first_ + 1) % RATEGRAPH_SAMPLES;
+	}
+	last_time_ = time;
+	last_pos_ = pos;
+	last_pass_ = pass;
+	update();
+}
+
+static float
+value(int series, float video_b, float audio_b, float speed)
+{
+	return series == 0 ? video_b : series == 1 ? audio_b : speed;
+}
+
+void
+RateGraph::paintEvent(QPaintEvent *)
+{
+	QPainter p(this);
+	QRect r = rect().adjusted(0, 0, -1, -1);
+	p.fillRect(r, palette().base());
+	p.setPen(palette().color(QPalette::Mid));
+	p.drawRect(r);
+	if (count_ < 2)
+		return;
+
+	float kbps_max = 1, speed_max = 1;
+	for (int i = 0; i < count_; i++) {
+		kbps_max = qMax(kbps_max, qMax(at(i).video_b, at(i).audio_b));
+		speed_max = qMax(speed_max, at(i).speed);
+	}
+	float t0 = at(0).time, span = qMax(at(count_ - 1).time - t0, 1.0f);
+	int w = r.width() - 1, h = r.height() - 1;
+
+	/* the range of each series within a pixel column, and the passes */
+	QVector<QPolygonF> lines(SERIES);
+	int i = 0;
+	while (i < count_) {
+		int x = int((at(i).time - t0) / span * (w - 1));
+		float lo[SERIES], hi[SERIES];
+		for (int k = 0; k < SERIES; k++) {
+			lo[k] = 1e30f;
+			hi[k] = -1e30f;
+		}
+		for (; i < count_ && int((at(i).time - t0) / span * (w - 1)) == x; i++) {
+			const Sample &s = at(i);
+			if (i > 0 && s.pass != at(i - 1).pass) {
+				p.setPen(QPen(palette().color(QPalette::Mid), 0, Qt::DashLine));
+				p.drawLine(r.left() + 1 + x, r.top(), r.left() + 1 + x, r.bottom());
+			}
+			for (int k = 0; k < SERIES; k++) {
+				float v = value(k, s.video_b, s.audio_b, s.speed);
+				lo[k] = qMin(lo[k], v);
+				hi[k] = qMax(hi[k], v);
+			}
+		}
+		for (int k = 0; k < SERIES; k++) {
+			float scale = (k == 2 ? speed_max : kbps_max) * 1.1f;
+			double y_lo = r.bottom() - lo[k] / scale * h, y_hi = r.bottom() - hi[k] / scale * h;
+			if (y_lo - y_hi >= 1) {
+				p.setPen(QColor(colors[k]).lighter(170));
+				p.drawLine(QPointF(r.left() + 1 + x, y_lo), QPointF(r.left() + 1 + x, y_hi));
+			}
+			lines[k] << QPointF(r.left() + 1 + x, (y_lo + y_hi) / 2);
+		}
+	}
+	p.setRenderHint(QPainter::Antialiasing);
+	for (int k = 0; k < SERIES; k++) {
+		p.setPen(colors[k]);
+		p.drawPolyline(lines[k]);
+	}
+
+	/* the latest values and the scales */
+	p.setRenderHint(QPainter::Antialiasing, false);
+	const Sample &last = at(count_ - 1);
+	QString legend[SERIES] = {
+		QString("%1 kbps").arg(last.video_b, 0, 'f', 0),
+		QString("%1 kbps").arg(last.audio_b, 0, 'f', 0),
+		QString("%1x").arg(last.speed, 0, 'f', 1)
+	};
+	int x = r.left() + 4, y = r.top() + fontMetrics().ascent() + 2;
+	for (int k = 0; k < SERIES; k++) {
+		QString text = QString("%1 %2").arg(names[k]).arg(legend[k]);
+		p.setPen(colors[k]);
+		p.drawText(x, y, text);
+		x += fontMetrics().width(text) + 12;
+	}
+	p.setPen(palette().color(QPalette::Text));
+	QString scales = QString("%1 kbps / %2x").arg(kbps_max * 1.1f, 0, 'f', 0).arg(speed_max * 1.1f, 0, 'f', 1);
+	p.drawText(r.right() - 4 - fontMetrics().width(scales), y, scales);
+}
@@ -0,0 +1,70 @@
+/*
+ * rategraph.h - bitrate and encoding speed history
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_RATEGRAPH
+#define H_RATEGRAPH
+
+#include <QTime>
+#include <QWidget>
+
+/* The last RATEGRAPH_SAMPLES progress reports of a job, in a ring, drawn
+ * as the video and audio bitrates (left scale) and the speed relative to
+ * realtime (right scale). Where there are more samples than pixels, each
+ * column shows their range.
+ */
+
+#define RATEGRAPH_SAMPLES 4096
+
+class RateGraph : public QWidget
+{
+	Q_OBJECT
+
+public:
+	explicit RateGraph(QWidget *parent = 0);
+	QSize sizeHint() const;
+
+public slots:
+	void clear();
+	void addSample(double pos, double audio_b, double video_b, int pass);
+
+protected:
+	void paintEvent(QPaintEvent *);
+
+private:
+	struct Sample {
+		float time;     /* wall clock seconds since clear() */
+		float speed;
+		float audio_b;
+		float video_b;
+		int pass;
+	};
+	const Sample &at(int i) const { return ring_[(first_ + i) % RATEGRAPH_SAMPLES]; }
+
+	Sample ring_[RATEGRAPH_SAMPLES];
+	int first_;
+	int count_;
+	QTime clock_;
+	double last_time_;
+	double last_pos_;
+	int last_pass_;
+};
+
+#endif // H_RATEGRAPH
@@ -0,0 +1,222 @@
+/*
+ * remote.cpp - worker protocol, client side
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QFile>
+#include <QFileInfo>
+#include <QLocalSocket>
+#include <QSettings>
+#include <QTcpSocket>
+#include <stdexcept>
+#include "remote.h"
+
+#define CONNECT_TIMEOUT 5000
+#define CHUNK_SIZE 65536
+
+QByteArray
+encode_message(const QStringList &tokens)
+{
+	QByteArray ret;
+	for (int i = 0; i < tokens.size(); i++) {
+		if (i > 0)
+			ret += ' ';
+		/* an empty token still has to take a place */
+		ret += tokens[i].isEmpty() ? QByteArray("%") : tokens[i].toUtf8().toPercentEncoding();
+	}
+	return ret + '\n';
+}
+
+QStringList
+decode_message(const QByteArray &line)
+{
+	QStringList ret;
+	QList<QByteArray> tokens = line.trimmed().split(' ');
+	for (int i = 0; i < tokens.size(); i++) {
+		if (tokens[i] == "%")
+			ret << QString();
+		else if (!tokens[i].isEmpty())
+			ret << QString::fromUtf8(QByteArray::fromPercentEncoding(tokens[i]));
+	}
+	return ret;
+}
+
+bool
+is_tcp_address(const QString &address, QString *host, quint16 *port)
+{
+	int colon = address.lastIndexOf(':');
+	if (colon <= 0 || address.contains('/'))
+		return false;
+	bool ok;
+	quint16 p = address.mid(colon + 1).toUShort(&ok);
+	if (!ok)
+		return false;
+	if (host != NULL)
+		*host = address.left(colon);
+	if (port != NULL)
+		*port = p;
+	return true;
+}
+
+RemoteConnection::RemoteConnection(const QString &address)
+{
+	QString host;
+	quint16 port;
+	if (is_tcp_address(address, &host, &port)) {
+		QTcpSocket *s = new QTcpSocket();
+		s->connectToHost(host, port);
+		sock_ = s;
+	} else {
+		QLocalSocket *s = new QLocalSocket();
+		s->connectToServer(address);
+		sock_ = s;
+	}
+	bool connected = false;
+	if (QTcpSocket *s = qobject_cast<QTcpSocket *>(sock_))
+		connected = s->waitForConnected(CONNECT_TIMEOUT);
+	else if (QLocalSocket *s = qobject_cast<QLocalSocket *>(sock_))
+		connected = s->waitForConnected(CONNECT_TIMEOUT);
+	if (!connected) {
+		QString error = sock_->errorString();
+		delete sock_;
+		throw std::runtime_error(qPrintable("Can't connect to " + address + ": " + error));
+	}
+	QSettings settings("QTheoraFrontend team", "QTheoraFrontend");
+	QString secret = settings.value("worker_secret").toString();
+	if (!secret.isEmpty())
+		send(QStringList() << "AUTH" << secret);
+}
+
+RemoteConnection::~RemoteConnection()
+{
+	delete sock_;
+}
+
+bool
+RemoteConnection::isConnected() const
+{
+	if (QTcpSocket *s = qobject_cast<QTcpSocket *>(sock_))
+		return s->state() == QAbstractSocket::ConnectedState;
+	if (QLocalSocket *s = qobject_cast<QLocalSocket *>(sock_))
+		return s->state() == QLocalSocket::ConnectedState;
+	return false;
+}
+
+static void
+write_all(QIODevice *dev, const QByteArray &data)
+{
+	if (dev->write(data) != data.size())
+		throw std::runtime_error("Connection to the worker lost");
+	while (dev->bytesToWrite() > 0)
+		if (!dev->waitForBytesWritten(CONNECT_TIMEOUT))
+			throw std::runtime_error("Connection to the worker lost");
+}
+
+void
+RemoteConnection::send(const QStringList &message)
+{
+	write_all(sock_, encode_message(message));
+}
+
+/* false on timeout; a lost connection is an error */
+
+bool
+RemoteConnection::receive(QStringList *message, int msecs)
+{
+	while (!sock_->canReadLine()) {
+		if (sock_->waitForReadyRead(msecs))
+			continue;
+		if (sock_->canReadLine())
+			break;
+		if (isConnected())
+			return false;
+		throw std::runtime_error("Connection to the worker lost");
+	}
+	*message = decode_message(sock_->readLine());
+	if (message->isEmpty())
+		return receive(message, msecs);
+	return true;
+}
+
+void
+RemoteConnection::sendFile(const QString &filename)
+{
+	QFile f(filename);
+	if (!f.open(QIODevice::ReadOnly))
+		throw std::runtime_error(qPrintable("Can't open " + filename));
+	send(QStringList() << "UPLOAD" << QString::number(f.size()) << QFileInfo(filename).suffix());
+	while (!f.atEnd())
+		write_all(sock_, f.read(CHUNK_SIZE));
+}
+
+void
+RemoteConnection::receiveFile(const QString &filename, qint64 size)
+{
+	QFile f(filename);
+	if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		throw std::runtime_error(qPrintable("Can't create " + filename));
+	while (size > 0) {
+		if (sock_->bytesAvailable() == 0 && !sock_->waitForReadyRead(CONNECT_TIMEOUT))
+			throw std::runtime_error("Connection to the worker lost");
+		QByteArray data = sock_->read(qMin(size, qint64(CHUNK_SIZE)));
+		if (f.write(data) != data.size())
+			throw std::runtime_error(qPrintable("Can't write " + filename));
+		size -= data.size();
+	}
+}
+
+/* ffmpeg2theora --info output of a file on the worker */
+
+QList<QByteArray>
+remote_info(const QString &address, const QString &filename)
+{
+	RemoteConnection conn(address);
+	conn.send(QStringList() << "INFO" << filename);
+	QList<QByteArray> ret;
+	QStringList msg;
+	for (;;) {
+		conn.receive(&msg);
+		if (msg[0] == "LINE")
+			ret << msg.value(1).toUtf8();
+		else if (msg[0] == "END") {
+			if (msg.value(1).toInt() != 0)
+				throw std::runtime_error("Invalid input file");
+			return ret;
+		} else if (msg[0] == "ERROR")
+			throw std::runtime_error(qPrintable(msg.value(1)));
+	}
+}
+
+QByteArray
+remote_probe(const QString &address, const QString &filename)
+{
+	RemoteConnection conn(address);
+	conn.send(QStringList() << "PROBE" << filename);
+	QStringList msg;
+	for (;;) {
+		conn.receive(&msg);
+		if (msg[0] == "FILEINFO")
+			return QByteArray::fromBase64(msg.value(1).toAscii());
+		else if (msg[0] == "ERROR") {
+			if (msg.value(1).startsWith("Unknown command"))
+				return QByteArray();
+			throw std::runtime_error(qPrintable(msg.value(1)));
+		}
+	}
+}
@@ -0,0 +1,83 @@
+/*
+ * remote.h - worker protocol declarations
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_REMOTE
+#define H_REMOTE
+
+#include <QByteArray>
+#include <QList>
+#include <QStringList>
+
+class QIODevice;
+
+/* A message is one line of space separated, percent-encoded tokens,
+ * the first one being the command. Files follow a "UPLOAD <size>" or
+ * "OUTPUT <size>" message as raw bytes.
+ *
+ * coordinator -> worker:
+ *   AUTH <secret> (first, if the worker has one)
+ *   PROBE <path>
+ *   INFO <path> (for workers from before PROBE)
+ *   UPLOAD <size> <suffix>
+ *   ENCODE <priority> <input|-> <output|-> <ffmpeg2theora args...>
+ *   STOP, PAUSE, RESUME
+ *
+ * worker -> coordinator:
+ *   FILEINFO <FileInfo::serialize(), base64>
+ *   LINE <ffmpeg2theora --info output line>, END <exit code>
+ *   STATUS <text>
+ *   PROGRESS <pos> <eta> <audio kbps> <video kbps> <pass>
+ *   OUTPUT <size>
+ *   FINISHED <Transcoder reason>
+ *   ERROR <text>
+ */
+
+#define REMOTE_DEFAULT_PORT 7146
+
+QByteArray encode_message(const QStringList &);
+QStringList decode_message(const QByteArray &);
+
+/* "host:port" is TCP, anything else is a local socket name or path */
+bool is_tcp_address(const QString &, QString *host = NULL, quint16 *port = NULL);
+
+/* blocking client side, for use inside a transcoder thread */
+
+class RemoteConnection
+{
+public:
+	explicit RemoteConnection(const QString &address);
+	~RemoteConnection();
+
+	bool isConnected() const;
+	void send(const QStringList &);
+	bool receive(QStringList *, int msecs = -1);
+	void sendFile(const QString &filename);
+	void receiveFile(const QString &filename, qint64 size);
+
+private:
+	QIODevice *sock_;
+};
+
+QList<QByteArray> remote_info(const QString &address, const QString &filename);
+/* a serialized FileInfo, empty if the worker doesn't know PROBE */
+QByteArray remote_probe(const QString &address, const QString &filename);
+
+#endif // H_REMOTE
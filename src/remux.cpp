@@ -0,0 +1,628 @@
+/*
+ * remux.cpp - stream copy of Theora/Vorbis inputs
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <cmath>
+#include <stdexcept>
+#include "fileinfo.h"
+#include "remux.h"
+#include "skeleton.h"
+
+#define OUT_BUFFER (1 << 20)
+#define REPORT_INTERVAL 250 /* ms */
+#define SEEK_LINEAR (256 << 10)
+
+static bool
+is_ogg(const QString &filename)
+{
+	QFile f(filename);
+	return f.open(QIODevice::ReadOnly) && f.read(4) == "OggS";
+}
+
+template <class T>
+static const T *
+selected_stream(const QList<T> &streams, int id)
+{
+	for (int i = 0; i < streams.size(); i++)
+		if (id < 0 || streams[i].id == id)
+			return &streams[i];
+	return NULL;
+}
+
+QStringList
+remux_blockers(const QString &input, const QStringList &args, const FileInfo &fi,
+	bool keyframe_cut)
+{
+	bool audio = true, video = true;
+	int audio_stream = -1, video_stream = -1;
+	for (int i = 0; i < args.size(); i++) {
+		const QString &opt = args[i];
+		QString v = option_takes_value(opt) ? args.value(++i) : QString();
+		if (opt == "--noaudio")
+			audio = false;
+		else if (opt == "--novideo")
+			video = false;
+		else if (opt == "--audiostream")
+			audio_stream = v.toInt();
+		else if (opt == "--videostream")
+			video_stream = v.toInt();
+	}
+	const AudioStreamInfo *as = audio ? selected_stream(fi.audio_streams, audio_stream) : NULL;
+	const VideoStreamInfo *vs = video ? selected_stream(fi.video_streams, video_stream) : NULL;
+
+	QStringList ret;
+	if (!is_ogg(input))
+		ret << "the input isn't Ogg";
+	if (vs != NULL && vs->codec != "theora")
+		ret << "the video isn't Theora";
+	if (as != NULL && as->codec != "vorbis")
+		ret << "the audio isn't Vorbis";
+	if (as == NULL && vs == NULL)
+		ret << "there's nothing to copy";
+
+	for (int i = 0; i < args.size(); i++) {
+		const QString &opt = args[i];
+		QString v = option_takes_value(opt) ? args.value(++i) : QString();
+		if ((opt == "--starttime" || opt == "--endtime") && !keyframe_cut)
+			ret << "partial encoding";
+		else if ((opt == "--width" && vs != NULL && v.toInt() != vs->width) ||
+			 (opt == "--height" && vs != NULL && v.toInt() != vs->height))
+			ret << "scaling";
+		else if (opt.startsWith("--crop") && v.toInt() != 0)
+			ret << "cropping";
+		else if (opt == "--aspect")
+			ret << "aspect ratio";
+		else if (opt == "--videobitrate")
+			ret << "video bitrate";
+		else if (opt == "--audiobitrate")
+			ret << "audio bitrate";
+		else if (opt == "--channels" && as != NULL && v.toInt() != as->channels)
+			ret << "channels";
+		else if (opt == "--samplerate" && as != NULL && v.toInt() != as->samplerate)
+			ret << "sample rate";
+		else if (opt == "--inputfps" || opt == "--framerate")
+			ret << "frame rate";
+		else if (opt == "--deinterlace")
+			ret << "deinterlacing";
+		else if (opt == "--contrast" || opt == "--brightness" ||
+			 opt == "--gamma" || opt == "--saturation")
+			ret << "image adjustment";
+		else if (opt == "--keyint")
+			ret << "keyframe interval";
+		else if (opt == "--scene-keyframes")
+			ret << "keyframes at scene cuts";
+		else if (opt == "--format")
+			ret << "input format";
+		else if (opt == "--subtitles")
+			ret << "subtitles";
+		else if (opt == "--loudness" && as != NULL)
+			ret << "loudness normalization";
+	}
+	ret.removeDuplicates();
+	return ret;
+}
+
+Remuxer::Remuxer(const QStringList &args, ProgressListener *listener)
+	: audio_(true), video_(true), audio_stream_(-1), video_stream_(-1),
+	skeleton_(true), keep_metadata_(true), start_(0), end_(-1), listener_(listener),
+	data_start_(0), time_(0)
+{
+	for (int i = 0; i < args.size(); i++) {
+		const QString &opt = args[i];
+		QString v = option_takes_value(opt) ? args.value(++i) : QString();
+		if (opt == "--noaudio")
+			audio_ = false;
+		else if (opt == "--novideo")
+			video_ = false;
+		else if (opt == "--audiostream")
+			audio_stream_ = v.toInt();
+		else if (opt == "--videostream")
+			video_stream_ = v.toInt();
+		else if (opt == "--no-skeleton")
+			skeleton_ = false;
+		else if (opt == "--nometadata")
+			keep_metadata_ = false;
+		else if (opt == "--starttime")
+			start_ = v.toDouble();
+		else if (opt == "--endtime")
+			end_ = v.toDouble();
+		else if (const char *tag = option_tag(opt))
+			tags_.push_back(qMakePair(QByteArray(tag), v.toUtf8()));
+	}
+}
+
+void
+Remuxer::run(const QString &input, const QString &output)
+{
+	in_.open(input);
+	readHeaders();
+
+	out_.setFileName(output);
+	if (!out_.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		throw std::runtime_error(qPrintable("Can't create " + output));
+	report_timer_.start();
+	writeHeaders();
+	if (start_ > 0 || end_ >= 0)
+		trimPages();
+	else
+		copyPages();
+	flush();
+	out_.close();
+	report(true);
+}
+
+/* stream ids are those of ffmpeg, which numbers the streams in the order
+ * of their BOS pages */
+
+void
+Remuxer::select()
+{
+	int video = -1, audio = -1;
+	for (int i = 0; i < order_.size(); i++) {
+		const OggStreamInfo &info = streams_[order_[i]].info;
+		if (video_ && video < 0 && info.codec == OggStreamInfo::THEORA &&
+		    (video_stream_ < 0 || video_stream_ == i))
+			video = i;
+		if (audio_ && audio < 0 && info.codec == OggStreamInfo::VORBIS &&
+		    (audio_stream_ < 0 || audio_stream_ == i))
+			audio = i;
+	}
+	if (video >= 0)
+		kept_ << order_[video];
+	if (audio >= 0)
+		kept_ << order_[audio];
+	if (kept_.isEmpty())
+		throw std::runtime_error("No Theora or Vorbis stream to copy");
+}
+
+bool
+Remuxer::headersDone() const
+{
+	for (int i = 0; i < kept_.size(); i++) {
+		const Stream &s = streams_[kept_[i]];
+		if (s.headers.size() < s.info.headers)
+			return false;
+	}
+	return true;
+}
+
+/* All the BOS pages come first, then the rest of the headers; a page
+ * finishing the headers of a stream has nothing else on it. */
+
+void
+Remuxer::readHeaders()
+{
+	OggPage page;
+	bool selected = false;
+	while (in_.readPage(&page)) {
+		if (page.bos() && !selected) {
+			Stream s;
+			s.header_pages = 1;
+			s.seqno = 0;
+			s.reader.pageIn(page);
+			QByteArray packet;
+			if (s.reader.packetOut(&packet)) {
+				s.info.identify(page.serialno, packet);
+				s.headers << packet;
+			}
+			order_ << page.serialno;
+			streams_.insert(page.serialno, s);
+			continue;
+		}
+		if (!selected) {
+			select();
+			selected = true;
+		}
+		if (!kept_.contains(page.serialno))
+			continue;
+		Stream &s = streams_[page.serialno];
+		if (s.headers.size() >= s.info.headers)
+			continue;
+		s.header_pages++;
+		s.reader.pageIn(page);
+		QByteArray packet;
+		while (s.headers.size() < s.info.headers && s.reader.packetOut(&packet))
+			s.headers << packet;
+		if (headersDone())
+			break;
+	}
+	data_start_ = in_.pos();
+	if (!selected)
+		select();
+	if (!headersDone())
+		throw std::runtime_error("The stream headers are incomplete");
+}
+
+QByteArray
+Remuxer::comments(const Stream &s) const
+{
+	return edit_comments(s.headers[1], s.info.codec, keep_metadata_, tags_);
+}
+
+void
+Remuxer::writeHeaders()
+{
+	quint32 skeleton_serial;
+	do
+		skeleton_serial = random_serialno();
+	while (streams_.contains(skeleton_serial));
+	OggPacketWriter skeleton(skeleton_serial);
+	OggPage page;
+
+	if (skeleton_) {
+		skeleton.packetIn(skeleton_fishead(), 0);
+		while (skeleton.pageOut(&page, true))
+			write(page);
+	}
+
+	QList<OggPacketWriter> writers;
+	for (int i = 0; i < kept_.size(); i++) {
+		Stream &s = streams_[kept_[i]];
+		writers << OggPacketWriter(s.info.serialno);
+		writers[i].packetIn(s.headers[0], 0);
+		while (writers[i].pageOut(&page, true))
+			write(page);
+	}
+
+	if (skeleton_) {
+		for (int i = 0; i < kept_.size(); i++)
+			skeleton.packetIn(skeleton_fisbone(streams_[kept_[i]].info), 0);
+		while (skeleton.pageOut(&page, true))
+			write(page);
+	}
+
+	/* the data pages have to start on a fresh page */
+	for (int i = 0; i < kept_.size(); i++) {
+		Stream &s = streams_[kept_[i]];
+		writers[i].packetIn(comments(s), 0);
+		for (int j = 2; j < s.headers.size(); j++)
+			writers[i].packetIn(s.headers[j], 0);
+		while (writers[i].pageOut(&page, true))
+			write(page);
+		s.seqno = writers[i].seqno();
+	}
+
+	if (skeleton_) {
+		skeleton.packetIn(QByteArray(), 0, true);
+		while (skeleton.pageOut(&page, true))
+			write(page);
+	}
+}
+
+/* data pages go as they are, only renumbered after the new headers */
+
+void
+Remuxer::copyPages()
+{
+	QMap<quint32, int> seen;
+	OggPage page;
+	bool data = false;
+	in_.seek(0);
+	while (in_.readPage(&page) && !listener_->cancelled()) {
+		listener_->waitWhilePaused();
+		/* only the first link of a chained file */
+		if (page.bos() && data)
+			break;
+		if (!kept_.contains(page.serialno))
+			continue;
+		Stream &s = streams_[page.serialno];
+		if (seen[page.serialno]++ < s.header_pages)
+			continue;
+		data = true;
+		page.seqno = s.seqno++;
+		write(page);
+		if (page.granulepos >= 0)
+			time_ = qMax(time_, s.info.time(page.granulepos));
+		report();
+	}
+}
+
+/* Theora packets with their frame numbers, of which the stream only has
+ * that of the last packet ending on each page */
+
+namespace {
+
+struct Frame
+{
+	QByteArray data;
+	qint64 number;
+	bool keyframe;
+};
+
+class FrameReader
+{
+public:
+	FrameReader(const OggStreamInfo &info): info_(info) { }
+	void pageIn(const OggPage &);
+	bool frameOut(Frame *);
+
+private:
+	OggStreamInfo info_;
+	OggPacketReader reader_;
+	QList<QByteArray> pending_;
+	QList<Frame> ready_;
+};
+
+}
+
+void
+FrameReader::pageIn(const OggPage &page)
+{
+	reader_.pageIn(page);
+	QByteArray data;
+	qint64 granulepos;
+	while (reader_.packetOut(&data, &granulepos)) {
+		pending_ << data;
+		if (granulepos < 0)
+			continue;
+		qint64 number = info_.frames(granulepos) - pending_.size() + 1;
+		while (!pending_.isEmpty()) {
+			Frame f;
+			f.data = pending_.takeFirst();
+			f.number = number++;
+			/* empty packets repeat the previous frame */
+			f.keyframe = !f.data.isEmpty() && !(f.data[0] & 0x40);
+			ready_ << f;
+		}
+	}
+}
+
+bool
+FrameReader::frameOut(Frame *f)
+{
+	if (ready_.isEmpty())
+		return false;
+	*f = ready_.takeFirst();
+	return true;
+}
+
+/* The last page of the stream whose granule is at or before the frame (or
+ * sample), -1 if there's none. Granules only grow, so it's bisected down
+ * to a stretch short enough to read through.
+ */
+
+qint64
+Remuxer::findPage(const Stream &s, qint64 frame, OggPage *found)
+{
+	qint64 lo = data_start_, hi = in_.size(), ret = -1;
+	OggPage page;
+	while (hi - lo > SEEK_LINEAR) {
+		qint64 mid = lo + (hi - lo) / 2;
+		bool before = false;
+		in_.seek(mid);
+		while (in_.readPage(&page) && page.offset < hi) {
+			if (page.serialno != s.info.serialno || page.granulepos < 0)
+				continue;
+			before = s.info.frames(page.granulepos) <= frame;
+			break;
+		}
+		if (before) {
+			ret = page.offset;
+			*found = page;
+			lo = in_.pos();
+		} else
+			hi = mid;
+	}
+	in_.seek(ret >= 0 ? ret : lo);
+	while (in_.readPage(&page)) {
+		if (page.serialno != s.info.serialno || page.granulepos < 0)
+			continue;
+		if (s.info.frames(page.granulepos) > frame)
+			break;
+		ret = page.offset;
+		*found = page;
+	}
+	return ret;
+}
+
+/* The latest keyframe at or before the frame, or the first one after if
+ * there's none, -1 if the video ends before. offset is where reading has
+ * to start for its packet to be complete.
+ */
+
+qint64
+Remuxer::findKeyframe(const Stream &s, qint64 frame, qint64 *offset)
+{
+	OggPage page;
+	qint64 key = 1;
+	if (findPage(s, frame, &page) >= 0)
+		key = s.info.keyframe(page.granulepos);
+	*offset = findPage(s, key - 1, &page);
+	if (*offset < 0)
+		*offset = data_start_;
+
+	/* a later keyframe may still come before the frame */
+	qint64 ret = -1;
+	FrameReader frames(s.info);
+	Frame f;
+	in_.seek(*offset);
+	while (in_.readPage(&page)) {
+		if (page.serialno != s.info.serialno)
+			continue;
+		frames.pageIn(page);
+		while (frames.frameOut(&f)) {
+			if (f.number > frame && (ret >= 0 || f.keyframe))
+				return ret >= 0 ? ret : f.number;
+			if (f.keyframe)
+				ret = f.number;
+		}
+	}
+	return ret;
+}
+
+/* the first page kept may begin with the tail of a packet that wasn't */
+
+static void
+drop_continuation(OggPage *page)
+{
+	if (!page->continued())
+		return;
+	int n = 0, bytes = 0;
+	while (n < page->segments.size()) {
+		uchar lace = page->segments[n++];
+		bytes += lace;
+		if (lace < 255)
+			break;
+	}
+	page->segments.remove(0, n);
+	page->body.remove(0, bytes);
+	page->flags &= ~OGG_CONTINUED;
+}
+
+/* Video is repacketized to give every frame its new granule, audio pages
+ * are copied with the granules shifted, dropping the ones that end before
+ * the video starts and the part of a packet the first one kept carries
+ * over. The last page of each stream is held back to get the EOS flag.
+ */
+
+void
+Remuxer::trimPages()
+{
+	const Stream *video = NULL, *audio = NULL;
+	for (int i = 0; i < kept_.size(); i++) {
+		const Stream &s = streams_[kept_[i]];
+		if (s.info.codec == OggStreamInfo::THEORA)
+			video = &s;
+		else if (s.info.codec == OggStreamInfo::VORBIS)
+			audio = &s;
+	}
+
+	double start = start_;
+	qint64 from = in_.size();
+	qint64 first_frame = 0, last_frame = -1;
+	if (video != NULL) {
+		const OggStreamInfo &vi = video->info;
+		first_frame = findKeyframe(*video, qint64(start * vi.rate_num / vi.rate_den) + 1, &from);
+		if (first_frame < 0)
+			throw std::runtime_error("The video ends before the start time");
+		start = (first_frame - 1) * double(vi.rate_den) / vi.rate_num;
+		if (end_ >= 0)
+			last_frame = qint64(ceil(end_ * vi.rate_num / vi.rate_den));
+	}
+	qint64 audio_base = 0, audio_end = -1;
+	if (audio != NULL) {
+		OggPage page;
+		audio_base = qint64(start * audio->info.rate_num + 0.5);
+		if (end_ >= 0)
+			audio_end = qint64(end_ * audio->info.rate_num);
+		qint64 offset = findPage(*audio, audio_base, &page);
+		from = qMin(from, offset >= 0 ? offset : data_start_);
+	}
+
+	const OggStreamInfo &vi = video != NULL ? video->info : OggStreamInfo();
+	FrameReader frames(vi);
+	OggPacketWriter writer(vi.serialno, video != NULL ? video->seqno : 1);
+	qint64 zero = vi.zero_based ? 1 : 0, key = first_frame;
+	Frame held;
+	qint64 held_granule = -1;
+	bool video_done = video == NULL;
+
+	quint32 audio_seqno = audio != NULL ? audio->seqno : 0;
+	OggPage held_page;
+	bool audio_started = false, audio_done = audio == NULL;
+
+	OggPage page;
+	in_.seek(from);
+	while (!(video_done && audio_done) && in_.readPage(&page) && !listener_->cancelled()) {
+		listener_->waitWhilePaused();
+		if (page.bos())
+			break;
+		if (!video_done && page.serialno == vi.serialno) {
+			frames.pageIn(page);
+			Frame f;
+			while (!video_done && frames.frameOut(&f)) {
+				if (f.number < first_frame)
+					continue;
+				if (last_frame >= 0 && f.number > last_frame) {
+					video_done = true;
+					break;
+				}
+				if (held_granule >= 0) {
+					writer.packetIn(held.data, held_granule);
+					while (writer.pageOut(&page))
+						write(page);
+				}
+				if (f.keyframe)
+					key = f.number;
+				qint64 n = f.number - first_frame + 1 - zero, k = key - first_frame + 1 - zero;
+				held = f;
+				held_granule = (k << vi.granule_shift) | (n - k);
+				time_ = qMax(time_, vi.time(held_granule));
+			}
+		} else if (!audio_done && page.serialno == audio->info.serialno) {
+			if (!audio_started && (page.granulepos < 0 || page.granulepos <= audio_base))
+				continue;
+			if (!audio_started) {
+				drop_continuation(&page);
+				if (page.segments.isEmpty())
+					continue;
+			}
+			audio_started = true;
+			if (held_page.offset >= 0)
+				write(held_page);
+			if (audio_end >= 0 && page.granulepos >= audio_end) {
+				page.granulepos = audio_end;
+				audio_done = true;
+			}
+			if (page.granulepos >= 0) {
+				page.granulepos -= audio_base;
+				time_ = qMax(time_, audio->info.time(page.granulepos));
+			}
+			page.flags &= ~OGG_EOS;
+			page.seqno = audio_seqno++;
+			held_page = page;
+		}
+		report();
+	}
+
+	if (held_granule >= 0)
+		writer.packetIn(held.data, held_granule, true);
+	while (writer.pageOut(&page, true))
+		write(page);
+	if (held_page.offset >= 0) {
+		held_page.flags |= OGG_EOS;
+		write(held_page);
+	}
+}
+
+void
+Remuxer::write(const OggPage &page)
+{
+	buf_.append(page.serialize());
+	if (buf_.size() >= OUT_BUFFER)
+		flush();
+}
+
+void
+Remuxer::flush()
+{
+	if (out_.write(buf_) != buf_.size())
+		throw std::runtime_error(qPrintable("Can't write " + out_.fileName()));
+	buf_.clear();
+}
+
+void
+Remuxer::report(bool force)
+{
+	if (!force && report_timer_.elapsed() < REPORT_INTERVAL)
+		return;
+	report_timer_.restart();
+	listener_->progress(time_);
+}
@@ -0,0 +1,102 @@
+/*
+ * remux.h - stream copy of Theora/Vorbis inputs
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_REMUX
+#define H_REMUX
+
+#include <QByteArray>
+#include <QFile>
+#include <QList>
+#include <QMap>
+#include <QPair>
+#include <QStringList>
+#include <QTime>
+#include "ogg.h"
+#include "util.h"
+
+struct FileInfo;
+
+/* What keeps an encode from being a stream copy: the input not being
+ * Ogg Theora/Vorbis, or options that change the pictures or the sound.
+ * Quality settings don't count, the copy simply keeps the source's. With
+ * keyframe_cut, a partial encode is a copy starting at a keyframe.
+ */
+
+QStringList remux_blockers(const QString &input, const QStringList &args, const FileInfo &,
+	bool keyframe_cut = false);
+
+/* Copies the selected Theora and Vorbis streams page by page, with new
+ * headers where the comments or the skeleton change. Given --starttime or
+ * --endtime, the copy starts at the keyframe before the start and the
+ * granules are rebased to it.
+ */
+
+class Remuxer
+{
+public:
+	Remuxer(const QStringList &args, ProgressListener *);
+	void run(const QString &input, const QString &output);
+
+private:
+	struct Stream {
+		OggStreamInfo info;
+		QList<QByteArray> headers;
+		OggPacketReader reader;
+		int header_pages;
+		quint32 seqno;
+	};
+
+	void readHeaders();
+	void select();
+	bool headersDone() const;
+	void writeHeaders();
+	void copyPages();
+	qint64 findPage(const Stream &, qint64 frame, OggPage *);
+	qint64 findKeyframe(const Stream &, qint64 frame, qint64 *offset);
+	void trimPages();
+	QByteArray comments(const Stream &) const;
+	void write(const OggPage &);
+	void flush();
+	void report(bool force = false);
+
+	bool audio_;
+	bool video_;
+	int audio_stream_;
+	int video_stream_;
+	bool skeleton_;
+	bool keep_metadata_;
+	double start_;
+	double end_;
+	QList<QPair<QByteArray, QByteArray> > tags_;
+	ProgressListener *listener_;
+
+	OggReader in_;
+	QFile out_;
+	QByteArray buf_;
+	QList<quint32> order_;
+	QMap<quint32, Stream> streams_;
+	QList<quint32> kept_;
+	qint64 data_start_;
+	double time_;
+	QTime report_timer_;
+};
+
+#endif // H_REMUX
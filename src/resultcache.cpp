@@ -0,0 +1,228 @@
+/*
+ * resultcache.cpp - cache of finished encodes
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QSettings>
+#include <QTime>
+#include <stdexcept>
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <utime.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+#include "resultcache.h"
+#include "verifier.h"
+
+#define SAMPLES 16
+#define SAMPLE_SIZE 65536
+#define DEFAULT_MAX_SIZE 4096 /* MB */
+#define DEFAULT_MAX_AGE 30 /* days */
+#define COPY_BUFFER (1 << 20)
+#define REPORT_INTERVAL 250 /* ms */
+
+ResultCache *
+ResultCache::instance()
+{
+	static ResultCache *cache = NULL;
+	if (cache == NULL)
+		cache = new ResultCache();
+	return cache;
+}
+
+ResultCache::ResultCache()
+{
+	QSettings settings("QTheoraFrontend team", "QTheoraFrontend");
+	enabled_ = settings.value("cache_enabled", false).toBool();
+	dir_ = settings.value("cache_dir", QDir::home().filePath(".qtheorafrontend/cache")).toString();
+	max_size_ = settings.value("cache_max_size", DEFAULT_MAX_SIZE).toLongLong() * 1024 * 1024;
+	max_age_ = settings.value("cache_max_age", DEFAULT_MAX_AGE).toInt();
+	if (enabled_ && !QDir().mkpath(dir_))
+		enabled_ = false;
+}
+
+QString
+ResultCache::entry(const QByteArray &key) const
+{
+	return QDir(dir_).filePath(QString::fromAscii(key) + ".ogv");
+}
+
+static bool
+hash_file(QCryptographicHash *hash, const QString &filename)
+{
+	QFile f(filename);
+	if (!f.open(QIODevice::ReadOnly))
+		return false;
+	qint64 size = f.size();
+	hash->addData(QByteArray::number(size));
+	if (size <= SAMPLES * SAMPLE_SIZE)
+		hash->addData(f.readAll());
+	else
+		for (int i = 0; i < SAMPLES; i++) {
+			f.seek((size - SAMPLE_SIZE) * i / (SAMPLES - 1));
+			hash->addData(f.read(SAMPLE_SIZE));
+		}
+	return true;
+}
+
+QByteArray
+ResultCache::key(const QString &input, const QStringList &args) const
+{
+	QCryptographicHash hash(QCryptographicHash::Sha1);
+	if (!hash_file(&hash, input))
+		return QByteArray();
+	for (int i = 0; i < args.size(); i++) {
+		hash.addData(args[i].toUtf8());
+		hash.addData("", 1);
+		/* the files the options name go in as well as their names */
+		if (args[i] == "--subtitles" && i + 1 < args.size() &&
+		    !hash_file(&hash, args[i + 1]))
+			return QByteArray();
+	}
+	return hash.result().toHex();
+}
+
+/* A copy of its own, so that nothing done to the output reaches the
+ * entry or the other way round. Where the file system shares the blocks
+ * until either is written, the copy costs neither time nor space. A
+ * copy that fails or is cancelled leaves nothing behind.
+ */
+
+static bool
+place_file(const QString &from, const QString &to, ProgressListener *listener)
+{
+	QFile::remove(to);
+	QFile in(from), out(to);
+	if (!in.open(QIODevice::ReadOnly) || !out.open(QIODevice::WriteOnly))
+		return false;
+#ifdef FICLONE
+	if (ioctl(out.handle(), FICLONE, in.handle()) == 0)
+		return true;
+#endif
+	qint64 size = in.size(), done = 0;
+	QTime report_timer;
+	report_timer.start();
+	bool ok = true;
+	while (ok && done < size) {
+		if (listener != NULL) {
+			listener->waitWhilePaused();
+			if (listener->cancelled())
+				break;
+			if (report_timer.elapsed() >= REPORT_INTERVAL) {
+				report_timer.restart();
+				listener->progress(done / double(size));
+			}
+		}
+		QByteArray buf = in.read(COPY_BUFFER);
+		ok = !buf.isEmpty() && out.write(buf) == buf.size();
+		done += buf.size();
+	}
+	ok = ok && done == size && out.flush();
+	out.close();
+	if (!ok)
+		QFile::remove(to);
+	return ok;
+}
+
+/* an entry spoiled on disk is dropped rather than handed out */
+
+static bool
+intact(const QString &filename)
+{
+	try {
+		return verify_ogg(filename).problems().isEmpty();
+	} catch (const std::exception &) {
+		return false;
+	}
+}
+
+/* entries are evicted by modification time, so a hit renews it */
+
+static void
+touch(const QString &filename)
+{
+#ifdef Q_OS_UNIX
+	utime(QFile::encodeName(filename).constData(), NULL);
+#else
+	Q_UNUSED(filename);
+#endif
+}
+
+bool
+ResultCache::fetch(const QByteArray &key, const QString &output, ProgressListener *listener)
+{
+	QString e = entry(key);
+	if (!enabled_ || key.isEmpty() || !QFile::exists(e))
+		return false;
+	if (!intact(e)) {
+		QFile::remove(e);
+		return false;
+	}
+	if (!place_file(e, output, listener))
+		return false;
+	touch(e);
+	return true;
+}
+
+bool
+ResultCache::store(const QByteArray &key, const QString &output, ProgressListener *listener)
+{
+	if (!enabled_ || key.isEmpty())
+		return false;
+	QString e = entry(key);
+	if (QFile::exists(e)) {
+		touch(e);
+		return true;
+	}
+	/* a half-copied entry must never be found */
+	QString part = e + ".part";
+	if (!place_file(output, part, listener) || !QFile::rename(part, e)) {
+		QFile::remove(part);
+		return false;
+	}
+	touch(e);
+	evict();
+	return true;
+}
+
+void
+ResultCache::evict()
+{
+	QFileInfoList entries = QDir(dir_).entryInfoList(QStringList() << "*.ogv",
+		QDir::Files, QDir::Time | QDir::Reversed);
+	qint64 total = 0;
+	for (int i = 0; i < entries.size(); i++)
+		total += entries[i].size();
+
+	/* oldest first, so both limits are met by going down the list */
+	QDateTime limit = QDateTime::currentDateTime().addDays(-max_age_);
+	for (int i = 0; i < entries.size(); i++) {
+		if (total <= max_size_ && entries[i].lastModified() >= limit)
+			break;
+		if (QFile::remove(entries[i].filePath()))
+			total -= entries[i].size();
+	}
+}
@@ -0,0 +1,67 @@
+/*
+ * resultcache.h - cache of finished encodes
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_RESULTCACHE
+#define H_RESULTCACHE
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include "util.h"
+
+/* Outputs of successful encodes, named by a hash of the input and of the
+ * ffmpeg2theora arguments, with any subtitles file they name. Only a few
+ * evenly spaced chunks of the files are hashed, along with their sizes,
+ * so a key is cheap even for huge files. Entries are copied in and out,
+ * as clones where the file system has them, and checked before they are
+ * handed out; the least recently used ones go once the cache is over its
+ * size, and any older than its age limit. The cache is off unless the
+ * cache_enabled setting turns it on, as it takes as much room again as
+ * the outputs.
+ */
+
+class ResultCache
+{
+public:
+	static ResultCache *instance();
+
+	bool enabled() const { return enabled_; }
+	QString directory() const { return dir_; }
+
+	/* empty if the input can't be read */
+	QByteArray key(const QString &input, const QStringList &args) const;
+	/* both read or copy whole files, for the transcoder thread; the
+	 * listener hears the fraction copied as the position */
+	bool fetch(const QByteArray &key, const QString &output, ProgressListener * = NULL);
+	bool store(const QByteArray &key, const QString &output, ProgressListener * = NULL);
+	void evict();
+
+private:
+	ResultCache();
+	QString entry(const QByteArray &key) const;
+
+	bool enabled_;
+	QString dir_;
+	qint64 max_size_;
+	int max_age_;
+};
+
+#endif // H_RESULTCACHE
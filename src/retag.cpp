@@ -0,0 +1,267 @@
+/*
+ * retag.cpp - metadata edits of finished Ogg files
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QFile>
+#include <QMap>
+#include <QTime>
+#include <stdexcept>
+#include "ogg.h"
+#include "retag.h"
+#include "skeleton.h"
+#include "util.h"
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+#define COPY_BUFFER (1 << 20)
+#define REPORT_INTERVAL 250 /* ms */
+
+namespace {
+
+struct RetagStream
+{
+	OggStreamInfo info;
+	OggPacketReader reader;
+	QList<QByteArray> headers;
+	QList<OggPage> pages; /* those of the headers after the first */
+	int pages_size;
+	QByteArray comments;
+};
+
+}
+
+static bool
+linked(const QString &filename)
+{
+#ifdef Q_OS_UNIX
+	struct stat st;
+	return stat(QFile::encodeName(filename).constData(), &st) == 0 && st.st_nlink > 1;
+#else
+	Q_UNUSED(filename);
+	return false;
+#endif
+}
+
+/* a skeleton index points at byte offsets, which a copy moves */
+
+static bool
+indexed(const QByteArray &fishead)
+{
+	return fishead.size() >= 10 && fishead.startsWith(QByteArray("fishead\0", 8)) &&
+		(uchar(fishead[8]) | uchar(fishead[9]) << 8) >= 4;
+}
+
+/* The packet sizes stay the same, and with them the segment tables: the
+ * padded comments and the other headers are poured back into the bodies
+ * of the old pages. Decoders stop reading at the last comment.
+ */
+
+static void
+rewrite_in_place(const QString &filename, const QList<RetagStream *> &changed)
+{
+	QFile f(filename);
+	if (!f.open(QIODevice::ReadWrite))
+		throw std::runtime_error(qPrintable("Can't open " + filename));
+	for (int i = 0; i < changed.size(); i++) {
+		RetagStream *s = changed[i];
+		QByteArray data = s->comments;
+		data.append(QByteArray(s->headers[1].size() - data.size(), '\0'));
+		for (int j = 2; j < s->headers.size(); j++)
+			data.append(s->headers[j]);
+		int pos = 0;
+		for (int j = 0; j < s->pages.size(); j++) {
+			OggPage page = s->pages[j];
+			page.body = data.mid(pos, page.body.size());
+			pos += page.body.size();
+			QByteArray bytes = page.serialize();
+			if (!f.seek(page.offset) || f.write(bytes) != bytes.size())
+				throw std::runtime_error(qPrintable("Can't write " + filename));
+		}
+	}
+	if (!f.flush())
+		throw std::runtime_error(qPrintable("Can't write " + filename));
+}
+
+/* everything but the old header pages goes as it is, renumbered after the
+ * new ones */
+
+static void
+rewrite_copy(const QString &filename, QMap<quint32, RetagStream> &streams,
+	ProgressListener *listener)
+{
+	OggReader in;
+	in.open(filename);
+	QString part = filename + ".retag.part";
+	QFile out(part);
+	if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		throw std::runtime_error(qPrintable("Can't create " + part));
+
+	QMap<quint32, int> shift;
+	QByteArray buf;
+	OggPage page;
+	QTime report_timer;
+	report_timer.start();
+	double time = 0;
+	bool ok = true;
+	while (ok && in.readPage(&page) && !listener->cancelled()) {
+		listener->waitWhilePaused();
+		QMap<quint32, RetagStream>::iterator i = streams.find(page.serialno);
+		RetagStream *s = i != streams.end() && !i.value().comments.isNull() ? &i.value() : NULL;
+		if (s != NULL && !page.bos() && page.offset <= s->pages.last().offset) {
+			if (page.offset != s->pages.first().offset)
+				continue;
+			OggPacketWriter writer(page.serialno, page.seqno);
+			writer.packetIn(s->comments, 0);
+			for (int j = 2; j < s->headers.size(); j++)
+				writer.packetIn(s->headers[j], 0);
+			OggPage header;
+			while (writer.pageOut(&header, true))
+				buf.append(header.serialize());
+			shift[page.serialno] = writer.seqno() - s->pages.last().seqno - 1;
+		} else {
+			if (s != NULL)
+				page.seqno += shift.value(page.serialno);
+			buf.append(page.serialize());
+		}
+		if (i != streams.end() && page.granulepos > 0 &&
+		    (i.value().info.codec == OggStreamInfo::THEORA ||
+		     i.value().info.codec == OggStreamInfo::VORBIS))
+			time = qMax(time, i.value().info.time(page.granulepos));
+		if (buf.size() >= COPY_BUFFER) {
+			ok = out.write(buf) == buf.size();
+			buf.clear();
+		}
+		if (report_timer.elapsed() >= REPORT_INTERVAL) {
+			report_timer.restart();
+			listener->progress(time);
+		}
+	}
+	ok = ok && out.write(buf) == buf.size();
+	out.close();
+	in.close();
+	if (listener->cancelled()) {
+		QFile::remove(part);
+		return;
+	}
+	/* a new file, which also leaves alone any hard links to the old one */
+	if (!ok || !replace_file(part, filename)) {
+		QFile::remove(part);
+		throw std::runtime_error(qPrintable("Can't write " + filename));
+	}
+}
+
+void
+retag_ogg(const QString &filename, const QStringList &args, ProgressListener *listener)
+{
+	bool keep = true;
+	QList<QPair<QByteArray, QByteArray> > tags;
+	for (int i = 0; i < args.size(); i++) {
+		const QString &opt = args[i];
+		QString v = option_takes_value(opt) ? args.value(++i) : QString();
+		if (opt == "--nometadata")
+			keep = false;
+		else if (const char *tag = option_tag(opt))
+			tags.push_back(qMakePair(QByteArray(tag), v.toUtf8()));
+	}
+
+	/* the headers of the first link */
+	OggReader in;
+	in.open(filename);
+	QMap<quint32, RetagStream> streams;
+	bool has_index = false;
+	OggPage page;
+	while (in.readPage(&page)) {
+		if (page.bos()) {
+			RetagStream s;
+			QByteArray packet;
+			s.reader.pageIn(page);
+			if (s.reader.packetOut(&packet))
+				s.info.identify(page.serialno, packet);
+			if (s.info.codec == OggStreamInfo::SKELETON)
+				has_index = has_index || indexed(packet);
+			s.headers << packet;
+			s.pages_size = 0;
+			streams.insert(page.serialno, s);
+			continue;
+		}
+		QMap<quint32, RetagStream>::iterator i = streams.find(page.serialno);
+		if (i == streams.end() || (i.value().info.codec != OggStreamInfo::THEORA &&
+					   i.value().info.codec != OggStreamInfo::VORBIS))
+			continue;
+		RetagStream &s = i.value();
+		if (s.headers.size() >= s.info.headers)
+			break;
+		s.pages << page;
+		s.pages_size += page.body.size();
+		s.reader.pageIn(page);
+		QByteArray packet;
+		while (s.reader.packetOut(&packet))
+			s.headers << packet;
+	}
+	in.close();
+
+	QList<RetagStream *> changed;
+	int found = 0;
+	bool fits = !linked(filename);
+	for (QMap<quint32, RetagStream>::iterator i = streams.begin(); i != streams.end(); ++i) {
+		RetagStream &s = i.value();
+		if (s.info.codec != OggStreamInfo::THEORA && s.info.codec != OggStreamInfo::VORBIS)
+			continue;
+		found++;
+		if (s.headers.size() < s.info.headers)
+			throw std::runtime_error("The stream headers are incomplete");
+		/* the header pages have to hold nothing but the headers */
+		int size = 0;
+		for (int j = 1; j < s.headers.size(); j++)
+			size += s.headers[j].size();
+		if (s.headers.size() > s.info.headers || size != s.pages_size)
+			throw std::runtime_error("A header page also holds data");
+		QByteArray comments = edit_comments(s.headers[1], s.info.codec, keep, tags);
+		if (comments == s.headers[1])
+			continue;
+		s.comments = comments;
+		changed << &s;
+		fits = fits && comments.size() <= s.headers[1].size();
+	}
+	if (found == 0)
+		throw std::runtime_error("No Theora or Vorbis stream to retag");
+	if (changed.isEmpty())
+		return;
+
+	if (fits) {
+		rewrite_in_place(filename, changed);
+		return;
+	}
+	if (!has_index) {
+		rewrite_copy(filename, streams, listener);
+		return;
+	}
+	/* the index has to be rebuilt on the copy anyway */
+	QMap<quint32, QList<QByteArray> > headers;
+	for (int i = 0; i < changed.size(); i++) {
+		RetagStream *s = changed[i];
+		QList<QByteArray> &packets = headers[s->info.serialno];
+		packets << s->comments;
+		for (int j = 2; j < s->headers.size(); j++)
+			packets << s->headers[j];
+	}
+	skeleton_index(filename, headers);
+}
@@ -0,0 +1,39 @@
+/*
+ * retag.h - metadata edits of finished Ogg files
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_RETAG
+#define H_RETAG
+
+#include <QString>
+#include <QStringList>
+#include "util.h"
+
+/* Puts the metadata options of args (the tags and --nometadata) into the
+ * comment headers of the Theora and Vorbis streams of an Ogg file, leaving
+ * the rest of it alone. New comments no longer than the old ones are
+ * padded to their size and the header pages overwritten where they are;
+ * otherwise, or if the file is hard-linked from elsewhere,
+ * it is copied once with new header pages.
+ */
+
+void retag_ogg(const QString &filename, const QStringList &args, ProgressListener *);
+
+#endif // H_RETAG
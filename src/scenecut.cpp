@@ -0,0 +1,370 @@
+/*
+ * scenecut.cpp - scene cut detection
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QDir>
+#include <QFile>
+#include <QRunnable>
+#include <QSettings>
+#include <QTextStream>
+#include <QThread>
+#include <QThreadPool>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "fileinfo.h"
+#include "resultcache.h"
+#include "scenecut.h"
+#include "scheduler.h"
+
+#define WIDTH 128 /* of the pictures compared */
+#define HEIGHT 72
+#define MIN_STRETCH 30.0 /* seconds of input per decoder, at least */
+#define HIST_CUT 0.3 /* of the pixels in other bins */
+#define SAD_CUT 8.0 /* levels per pixel, at least */
+#define SAD_RATIO 3.0 /* times the average over the last frames */
+#define SAD_WINDOW 8 /* frames */
+#define MIN_SCENE 0.5 /* seconds */
+#define REPORT_INTERVAL 250 /* ms */
+#define VERSION "1" /* of the above, for the cache */
+
+#define BIN(v) ((v) * SCENE_HIST_BINS >> 8)
+
+/* one decoder reading from start for length seconds, or to the end */
+
+class SceneDetector::Stretch : public QRunnable
+{
+public:
+	Stretch(SceneDetector *detector, const QString &input, double start, double length)
+		: frames(0), fps(25), start_(start), length_(length), detector_(detector), input_(input) { }
+
+	void run();
+	double start() const { return start_; }
+
+	QVector<Change> changes;
+	Frame first;
+	Frame last;
+	int frames;
+	double fps;
+	QString error;
+
+private:
+	double start_;
+	double length_;
+	SceneDetector *detector_;
+	QString input_;
+};
+
+void
+SceneDetector::Stretch::run()
+{
+	try {
+		QStringList options, input_options;
+		if (detector_->video_stream_ >= 0)
+			options << "-map" << QString("0:%1").arg(detector_->video_stream_);
+		if (length_ > 0)
+			options << "-t" << QString::number(length_);
+		options << "-vf" << QString("scale=%1:%2").arg(WIDTH).arg(HEIGHT);
+		if (start_ > 0)
+			input_options << "-ss" << QString::number(start_);
+
+		Decoder dec;
+		dec.open(Decoder::VIDEO, input_, options, input_options);
+		fps = dec.videoFormat().fps();
+		YuvFrame yuv;
+		Frame frame;
+		while (!detector_->cancelled() && dec.readFrame(&yuv)) {
+			detector_->waitWhilePaused();
+			analyze(yuv, &frame);
+			if (frames == 0)
+				first = frame;
+			else
+				changes << compare(last, frame, start_ + frames / fps);
+			last = frame;
+			frames++;
+			detector_->scanned(1 / fps);
+		}
+		dec.close();
+	} catch (std::exception &x) {
+		error = x.what();
+	}
+	detector_->scanned(0, true);
+}
+
+SceneDetector::SceneDetector(ProgressListener *listener)
+	: listener_(listener), video_stream_(-1), scanned_(0), running_(0)
+{
+}
+
+void
+SceneDetector::scanned(double secs, bool done)
+{
+	QMutexLocker locker(&mutex_);
+	scanned_ += secs;
+	if (done) {
+		running_--;
+		changed_.wakeAll();
+	}
+}
+
+/* The luma is kept for the next frame's differences. Pixels go to four
+ * histograms in turn, so that runs of equal pixels don't wait on the
+ * same counter, and are added up at the end.
+ */
+
+void
+SceneDetector::analyze(const YuvFrame &yuv, Frame *f)
+{
+	int w = yuv.width[0], h = yuv.height[0];
+	int hist[4][SCENE_HIST_BINS];
+	memset(hist, 0, sizeof(hist));
+	f->luma.resize(w * h);
+	uchar *dst = (uchar *)f->luma.data();
+	for (int y = 0; y < h; y++) {
+		const uchar *src = yuv.plane[0] + y * yuv.stride[0];
+		memcpy(dst + y * w, src, w);
+		int x = 0;
+		for (; x + 4 <= w; x += 4) {
+			hist[0][BIN(src[x])]++;
+			hist[1][BIN(src[x + 1])]++;
+			hist[2][BIN(src[x + 2])]++;
+			hist[3][BIN(src[x + 3])]++;
+		}
+		for (; x < w; x++)
+			hist[0][BIN(src[x])]++;
+	}
+	for (int i = 0; i < SCENE_HIST_BINS; i++)
+		f->hist[i] = hist[0][i] + hist[1][i] + hist[2][i] + hist[3][i];
+}
+
+/* sixteen pixels at a time with SSE2 */
+
+static quint64
+sad(const uchar *a, const uchar *b, int n)
+{
+	quint64 sum = 0;
+	int i = 0;
+#ifdef __SSE2__
+	__m128i acc = _mm_setzero_si128();
+	for (; i + 16 <= n; i += 16)
+		acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i *)(a + i)),
+			_mm_loadu_si128((const __m128i *)(b + i))));
+	quint64 lanes[2];
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	sum = lanes[0] + lanes[1];
+#endif
+	for (; i < n; i++)
+		sum += abs(a[i] - b[i]);
+	return sum;
+}
+
+/* four bins at a time with SSE2, |d| being (d ^ s) - s for the sign s of d */
+
+static int
+hist_distance(const int *a, const int *b)
+{
+	int sum = 0, i = 0;
+#ifdef __SSE2__
+	__m128i acc = _mm_setzero_si128();
+	for (; i + 4 <= SCENE_HIST_BINS; i += 4) {
+		__m128i d = _mm_sub_epi32(_mm_loadu_si128((const __m128i *)(a + i)),
+			_mm_loadu_si128((const __m128i *)(b + i)));
+		__m128i s = _mm_srai_epi32(d, 31);
+		acc = _mm_add_epi32(acc, _mm_sub_epi32(_mm_xor_si128(d, s), s));
+	}
+	int lanes[4];
+	_mm_storeu_si128((__m128i *)lanes, acc);
+	sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+	for (; i < SCENE_HIST_BINS; i++)
+		sum += abs(a[i] - b[i]);
+	return sum;
+}
+
+SceneDetector::Change
+SceneDetector::compare(const Frame &a, const Frame &b, double time)
+{
+	Change c;
+	c.time = time;
+	c.sad = c.hist = 0;
+	int n = qMin(a.luma.size(), b.luma.size());
+	if (n > 0) {
+		c.sad = sad((const uchar *)a.luma.constData(), (const uchar *)b.luma.constData(), n) / double(n);
+		c.hist = hist_distance(a.hist, b.hist) / (2.0 * n);
+	}
+	return c;
+}
+
+/* A fade or a pan moves the histogram or the pixels, not both at once;
+ * a flash is a cut and another one right after, the second being too
+ * close to count.
+ */
+
+QList<double>
+SceneDetector::findCuts(const QVector<Change> &changes)
+{
+	QList<double> cuts;
+	double recent[SAD_WINDOW], sum = 0, last = 0;
+	int seen = 0;
+	for (int i = 0; i < changes.size(); i++) {
+		const Change &c = changes[i];
+		double average = seen > 0 ? sum / qMin(seen, SAD_WINDOW) : 0;
+		if (c.hist >= HIST_CUT && c.sad >= qMax(SAD_CUT, SAD_RATIO * average) &&
+		    c.time - last >= MIN_SCENE) {
+			cuts << c.time;
+			last = c.time;
+		}
+		if (seen >= SAD_WINDOW)
+			sum -= recent[seen % SAD_WINDOW];
+		recent[seen % SAD_WINDOW] = c.sad;
+		sum += c.sad;
+		seen++;
+	}
+	return cuts;
+}
+
+QList<double>
+SceneDetector::run(const QString &input)
+{
+	QList<double> cuts;
+	QString cache = cacheFile(input);
+	if (!cache.isEmpty() && load(cache, &cuts))
+		return cuts;
+
+	FileInfo fi;
+	fi.retrieve(input);
+	/* the job holds one processor of the scheduler's, the others are lent */
+	int n = 1;
+	if (fi.duration > 0)
+		n = qBound(1, int(fi.duration / MIN_STRETCH),
+			qMin(QThread::idealThreadCount(), 1 + Scheduler::instance()->spare()));
+
+	QThreadPool pool;
+	pool.setMaxThreadCount(n);
+	scanned_ = 0;
+	running_ = n;
+	QList<Stretch *> stretches;
+	for (int i = 0; i < n; i++) {
+		double start = n > 1 ? fi.duration * i / n : 0;
+		double length = i < n - 1 ? fi.duration / n : -1;
+		Stretch *s = new Stretch(this, input, start, length);
+		s->setAutoDelete(false);
+		stretches << s;
+		pool.start(s);
+	}
+	for (;;) {
+		mutex_.lock();
+		if (running_ > 0)
+			changed_.wait(&mutex_, REPORT_INTERVAL);
+		int left = running_;
+		double pos = scanned_;
+		mutex_.unlock();
+		if (left == 0)
+			break;
+		if (listener_ != NULL)
+			listener_->progress(pos);
+	}
+	pool.waitForDone();
+
+	/* the first frame of each stretch against the last of the one before */
+	QVector<Change> changes;
+	QString error;
+	const Frame *last = NULL;
+	for (int i = 0; i < stretches.size(); i++) {
+		Stretch *s = stretches[i];
+		if (!s->error.isEmpty())
+			error = s->error;
+		else if (s->frames > 0) {
+			if (last != NULL)
+				changes << compare(*last, s->first, s->start());
+			changes << s->changes;
+			last = &s->last;
+		}
+	}
+	if (error.isEmpty() && !cancelled())
+		cuts = findCuts(changes);
+	for (int i = 0; i < stretches.size(); i++)
+		delete stretches[i];
+	if (!error.isEmpty())
+		throw std::runtime_error(error.toStdString());
+	if (!cancelled() && !cache.isEmpty())
+		save(cache, cuts);
+	return cuts;
+}
+
+QString
+SceneDetector::cacheFile(const QString &input) const
+{
+	QSettings settings("QTheoraFrontend team", "QTheoraFrontend");
+	QDir dir(settings.value("scene_dir", QDir::home().filePath(".qtheorafrontend/scenes")).toString());
+	QByteArray key = ResultCache::instance()->key(input,
+		QStringList() << "scenes" << VERSION << QString::number(video_stream_));
+	if (key.isEmpty() || !dir.mkpath("."))
+		return QString();
+	return dir.filePath(QString(key) + ".txt");
+}
+
+bool
+SceneDetector::load(const QString &file, QList<double> *cuts)
+{
+	QFile f(file);
+	if (!f.open(QIODevice::ReadOnly | QIODevice::Text))
+		return false;
+	cuts->clear();
+	while (!f.atEnd()) {
+		QByteArray line = f.readLine().trimmed();
+		if (line.isEmpty() || line.startsWith('#'))
+			continue;
+		bool ok;
+		double t = line.toDouble(&ok);
+		if (!ok) {
+			cuts->clear();
+			return false;
+		}
+		cuts->push_back(t);
+	}
+	return true;
+}
+
+/* written aside and renamed: half a list would pass for a whole one */
+
+bool
+SceneDetector::save(const QString &file, const QList<double> &cuts)
+{
+	QString part = file + ".part";
+	QFile f(part);
+	if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+		return false;
+	QTextStream s(&f);
+	for (int i = 0; i < cuts.size(); i++)
+		s << QString::number(cuts[i], 'f', 3) << "\n";
+	s.flush();
+	bool ok = s.status() == QTextStream::Ok;
+	f.close();
+	if (!ok) {
+		QFile::remove(part);
+		return false;
+	}
+	QFile::remove(file);
+	return QFile::rename(part, file);
+}
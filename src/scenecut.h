@@ -0,0 +1,94 @@
+/*
+ * scenecut.h - scene cut detection
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_SCENECUT
+#define H_SCENECUT
+
+#include <QByteArray>
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <QWaitCondition>
+#include "decoder.h"
+#include "util.h"
+
+#define SCENE_HIST_BINS 64
+
+/* Finds where the scenes of an input change. The pictures are scaled
+ * down by the decoder and compared frame to frame by the sum of absolute
+ * luma differences and by the distance between their luma histograms; a
+ * cut is where the histograms are far apart and the difference is well
+ * above what it has been over the frames before, so that motion, fades
+ * and flashes don't count. The input is read in one stretch per
+ * processor the scheduler has to spare besides the job's own, each by a
+ * decoder of its own, and the cuts are kept in ~/.qtheorafrontend/scenes
+ * by the input's contents. The listener hears of the seconds read by all
+ * the stretches together, and pausing it pauses them.
+ */
+
+class SceneDetector
+{
+public:
+	SceneDetector(ProgressListener * = NULL);
+	void setVideoStream(int id) { video_stream_ = id; }
+
+	/* the times of the first frames of new scenes, in seconds from the
+	 * start of the input */
+	QList<double> run(const QString &input);
+
+	/* one time per line, as kept in the cache */
+	static bool load(const QString &file, QList<double> *);
+	static bool save(const QString &file, const QList<double> &);
+
+private:
+	struct Frame {
+		QByteArray luma;
+		int hist[SCENE_HIST_BINS];
+	};
+	/* how frame time differs from the one before */
+	struct Change {
+		double time;
+		double sad; /* per pixel */
+		double hist; /* 0 to 1 */
+	};
+	class Stretch;
+	friend class Stretch;
+
+	static void analyze(const YuvFrame &, Frame *);
+	static Change compare(const Frame &a, const Frame &b, double time);
+	static QList<double> findCuts(const QVector<Change> &);
+	bool cancelled() const { return listener_ != NULL && listener_->cancelled(); }
+	void waitWhilePaused() { if (listener_ != NULL) listener_->waitWhilePaused(); }
+	/* from the stretches' threads */
+	void scanned(double secs, bool done = false);
+	QString cacheFile(const QString &input) const;
+
+	ProgressListener *listener_;
+	int video_stream_;
+
+	QMutex mutex_;
+	QWaitCondition changed_;
+	double scanned_; /* seconds */
+	int running_;    /* stretches */
+};
+
+#endif // H_SCENECUT
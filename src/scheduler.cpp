@@ -0,0 +1,280 @@
+/*
+ * scheduler.cpp - transcoder queue and priority preemption
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QSettings>
+#include <QThread>
+#include "scheduler.h"
+#include "stager.h"
+#include "trace.h"
+#include "transcoder.h"
+
+Scheduler *
+Scheduler::instance()
+{
+	static Scheduler *scheduler = NULL;
+	if (scheduler == NULL)
+		scheduler = new Scheduler();
+	return scheduler;
+}
+
+/* ffmpeg2theora is single-threaded, so one job per core, two for a
+ * split one; remote jobs are limited by the workers' own schedulers
+ * instead */
+
+Scheduler::Scheduler()
+	: QObject(NULL)
+{
+	QSettings settings("QTheoraFrontend team", "QTheoraFrontend");
+	capacity_ = qMax(settings.value("concurrent_jobs", QThread::idealThreadCount()).toInt(), 1);
+	spare_ = capacity_;
+}
+
+void
+Scheduler::setCapacity(int n)
+{
+	capacity_ = qMax(n, 1);
+	reschedule();
+}
+
+int
+Scheduler::findQueued(Transcoder *t) const
+{
+	for (int i = 0; i < queue_.size(); i++)
+		if (queue_[i].transcoder == t)
+			return i;
+	return -1;
+}
+
+int
+Scheduler::findLookup(Transcoder *t) const
+{
+	for (int i = 0; i < lookups_.size(); i++)
+		if (lookups_[i].transcoder == t)
+			return i;
+	return -1;
+}
+
+bool
+Scheduler::isQueued(Transcoder *t) const
+{
+	return findQueued(t) >= 0;
+}
+
+/* jobs that take no processor here: never queued nor preempted */
+
+static bool
+unscheduled(const Transcoder *t)
+{
+	return t->engine() == Transcoder::REMOTE || t->engine() == Transcoder::RETAG;
+}
+
+/* processors taken */
+
+static int
+weight(const Transcoder *t)
+{
+	return t->engine() == Transcoder::SPLIT ? 2 : 1;
+}
+
+int
+Scheduler::active() const
+{
+	int ret = 0;
+	for (int i = 0; i < running_.size(); i++)
+		if (!waiting_.contains(running_[i]) && !held_.contains(running_[i]) &&
+		    !unscheduled(running_[i]))
+			ret += weight(running_[i]);
+	return ret;
+}
+
+void
+Scheduler::submit(Transcoder *t, const QString &input, const QString &output, const QStringList &args)
+{
+	if (isQueued(t) || running_.contains(t) || findLookup(t) >= 0)
+		return;
+	Job job;
+	job.transcoder = t;
+	job.input = input;
+	job.output = output;
+	job.args = args;
+	disconnect(t, SIGNAL(finished()), this, SLOT(jobFinished()));
+	connect(t, SIGNAL(finished()), this, SLOT(jobFinished()));
+	if (unscheduled(t)) {
+		running_.push_back(t);
+		t->start(input, output, args);
+		return;
+	}
+	if (t->cacheLookup()) {
+		disconnect(t, SIGNAL(slotWanted()), this, SLOT(slotWanted()));
+		connect(t, SIGNAL(slotWanted()), this, SLOT(slotWanted()));
+		lookups_.push_back(job);
+		t->start(input, output, args, true);
+		return;
+	}
+	Trace::begin("queued", t, output);
+	Stager::instance()->prefetch(input, t);
+	queue_.push_back(job);
+	reschedule();
+}
+
+/* a job still looking in the cache, or waiting after it missed, is
+ * running already and has to be told to give up */
+
+bool
+Scheduler::remove(Transcoder *t)
+{
+	int i = findLookup(t);
+	if (i >= 0) {
+		lookups_.removeAt(i);
+		t->withdraw();
+		return true;
+	}
+	i = findQueued(t);
+	if (i < 0)
+		return false;
+	Stager::instance()->release(queue_[i].input, t);
+	queue_.removeAt(i);
+	Trace::end("queued", t);
+	if (t->isRunning())
+		t->withdraw();
+	return true;
+}
+
+void
+Scheduler::pause(Transcoder *t)
+{
+	if (!running_.contains(t) || held_.contains(t))
+		return;
+	if (waiting_.removeAll(t) == 0)
+		t->pause();
+	held_.push_back(t);
+	reschedule();
+}
+
+void
+Scheduler::resume(Transcoder *t)
+{
+	if (held_.removeAll(t) == 0)
+		return;
+	if (unscheduled(t)) {
+		t->resume();
+		return;
+	}
+	waiting_.push_back(t);
+	reschedule();
+}
+
+/* the job missed the cache and queues like any other */
+
+void
+Scheduler::slotWanted()
+{
+	Transcoder *t = qobject_cast<Transcoder *>(sender());
+	int i = findLookup(t);
+	if (i < 0)
+		return;
+	Job job = lookups_.takeAt(i);
+	Trace::begin("queued", t, job.output);
+	Stager::instance()->prefetch(job.input, t);
+	queue_.push_back(job);
+	reschedule();
+}
+
+void
+Scheduler::jobFinished()
+{
+	Transcoder *t = qobject_cast<Transcoder *>(sender());
+	int i = findLookup(t);
+	if (i >= 0)
+		lookups_.removeAt(i);
+	i = findQueued(t);
+	if (i >= 0) {
+		Stager::instance()->release(queue_[i].input, t);
+		queue_.removeAt(i);
+		Trace::end("queued", t);
+	}
+	running_.removeAll(t);
+	waiting_.removeAll(t);
+	held_.removeAll(t);
+	reschedule();
+}
+
+void
+Scheduler::reschedule()
+{
+	for (;;) {
+		spare_ = qMax(capacity_ - active(), 0);
+
+		/* the most urgent candidate; preempted jobs go first among equals */
+		Transcoder *next = NULL;
+		int queued = -1;
+		for (int i = 0; i < waiting_.size(); i++)
+			if (next == NULL || waiting_[i]->priority() > next->priority())
+				next = waiting_[i];
+		for (int i = 0; i < queue_.size(); i++)
+			if (next == NULL || queue_[i].transcoder->priority() > next->priority()) {
+				next = queue_[i].transcoder;
+				queued = i;
+			}
+		if (next == NULL)
+			return;
+
+		/* the least urgent of the running jobs, the latest among equals,
+		 * until there's room; nothing is preempted if there can't be */
+		int need = qMin(weight(next), capacity_), room = capacity_ - active();
+		QList<Transcoder *> victims;
+		while (room < need) {
+			Transcoder *victim = NULL;
+			for (int i = 0; i < running_.size(); i++) {
+				Transcoder *t = running_[i];
+				if (waiting_.contains(t) || held_.contains(t) || t->priority() >= next->priority() ||
+				    unscheduled(t) || victims.contains(t))
+					continue;
+				if (victim == NULL || t->priority() <= victim->priority())
+					victim = t;
+			}
+			if (victim == NULL)
+				return;
+			victims << victim;
+			room += weight(victim);
+		}
+		for (int i = 0; i < victims.size(); i++) {
+			victims[i]->pause("Paused for a more urgent job");
+			Trace::begin("preempted", victims[i]);
+			waiting_.push_back(victims[i]);
+		}
+
+		if (queued >= 0) {
+			Job job = queue_.takeAt(queued);
+			running_.push_back(job.transcoder);
+			Trace::end("queued", job.transcoder);
+			/* back from the result cache, or a new start */
+			if (job.transcoder->isRunning())
+				job.transcoder->grant();
+			else
+				job.transcoder->start(job.input, job.output, job.args);
+		} else {
+			waiting_.removeAll(next);
+			Trace::end("preempted", next);
+			next->resume();
+		}
+	}
+}
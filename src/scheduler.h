@@ -0,0 +1,91 @@
+/*
+ * scheduler.h - transcoder queue and priority preemption
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_SCHEDULER
+#define H_SCHEDULER
+
+#include <QAtomicInt>
+#include <QObject>
+#include <QList>
+#include <QStringList>
+
+class Transcoder;
+
+/* All the transcoders of the process go through here. At most
+ * capacity() of them run at once; when a job can't start because of
+ * that, it pauses the least urgent running job of a lower priority and
+ * gives the slot back once it's done. A job that looks in the result
+ * cache first starts at once and only queues if it misses.
+ */
+
+class Scheduler : public QObject
+{
+	Q_OBJECT
+
+public:
+	static Scheduler *instance();
+
+	int capacity() const { return capacity_; }
+	void setCapacity(int);
+	/* processors no job is using, as of the last reschedule; for a
+	 * running job to spread over, from any thread */
+	int spare() const { return spare_; }
+
+	void submit(Transcoder *, const QString &input, const QString &output,
+		const QStringList & = QStringList());
+	bool remove(Transcoder *);
+	bool isQueued(Transcoder *) const;
+	bool isPreempted(Transcoder *t) const { return waiting_.contains(t); }
+
+	/* pausing by the user, as opposed to preemption */
+	void pause(Transcoder *);
+	void resume(Transcoder *);
+
+public slots:
+	void reschedule();
+
+private slots:
+	void jobFinished();
+	void slotWanted();
+
+private:
+	Scheduler();
+	int findQueued(Transcoder *) const;
+	int findLookup(Transcoder *) const;
+	int active() const;
+
+	struct Job {
+		Transcoder *transcoder;
+		QString input;
+		QString output;
+		QStringList args;
+	};
+
+	QList<Job> queue_;
+	QList<Job> lookups_; /* started, in the result cache */
+	QList<Transcoder *> running_;
+	QList<Transcoder *> waiting_;
+	QList<Transcoder *> held_;
+	int capacity_;
+	QAtomicInt spare_;
+};
+
+#endif // H_SCHEDULER
@@ -0,0 +1,250 @@
+/*
+ * segmenter.cpp - output in fixed-length chunks
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+#include "fileinfo.h"
+#include "scenecut.h"
+#include "scheduler.h"
+#include "segmenter.h"
+#include "util.h"
+
+#define MIN_LAST_CHUNK 1.0 /* seconds, or it joins the one before */
+
+Segmenter::Segmenter(const QString &input, const QString &output, const QStringList &args, double length)
+	: QObject(NULL), input_(input), output_(output), args_(args), length_(length),
+	engine_(Transcoder::PROCESS), scene_cuts_(false), published_(0), done_(0), failed_(false)
+{
+}
+
+Segmenter::~Segmenter()
+{
+	for (int i = 0; i < chunks_.size(); i++) {
+		chunks_[i].transcoder->wait();
+		delete chunks_[i].transcoder;
+	}
+}
+
+QString
+Segmenter::chunkName(const QString &output, int i)
+{
+	QFileInfo fi(output);
+	QString suffix = fi.suffix().isEmpty() ? QString("ogv") : fi.suffix();
+	return fi.dir().filePath(QString("%1-%2.%3").arg(fi.completeBaseName())
+		.arg(i, 5, 10, QChar('0')).arg(suffix));
+}
+
+QString
+Segmenter::manifestName(const QString &output)
+{
+	QFileInfo fi(output);
+	return fi.dir().filePath(fi.completeBaseName() + ".m3u");
+}
+
+/* --starttime and --endtime, if given, bound the whole series */
+
+int
+Segmenter::run()
+{
+	double from = 0, to = -1;
+	int video_stream = -1;
+	QStringList args;
+	for (int i = 0; i < args_.size(); i++) {
+		const QString &opt = args_[i];
+		QString v = option_takes_value(opt) ? args_.value(++i) : QString();
+		if (opt == "--starttime")
+			from = v.toDouble();
+		else if (opt == "--endtime")
+			to = v.toDouble();
+		else {
+			if (opt == "--videostream")
+				video_stream = v.toInt();
+			args << opt;
+			if (option_takes_value(opt))
+				args << v;
+		}
+	}
+
+	FileInfo fi;
+	try {
+		fi.retrieve(input_);
+	} catch (std::exception &x) {
+		fprintf(stderr, "%s: %s\n", qPrintable(input_), x.what());
+		return 1;
+	}
+	if (to < 0 || (fi.duration > 0 && to > fi.duration))
+		to = fi.duration;
+	if (to <= from || length_ <= 0) {
+		fprintf(stderr, "%s: nothing to split, the duration is unknown or too short\n",
+			qPrintable(input_));
+		return 1;
+	}
+
+	int n = int(ceil((to - from) / length_));
+	if (n > 1 && to - (from + (n - 1) * length_) < MIN_LAST_CHUNK)
+		n--;
+	QList<double> cuts;
+	if (scene_cuts_ && n > 1) {
+		fprintf(stderr, "%s: finding scene cuts\n", qPrintable(input_));
+		try {
+			SceneDetector detector;
+			detector.setVideoStream(video_stream);
+			cuts = detector.run(input_);
+		} catch (std::exception &x) {
+			fprintf(stderr, "%s: %s, cutting at fixed lengths\n", qPrintable(input_), x.what());
+		}
+	}
+	QList<double> bounds = boundaries(from, to, n, cuts);
+	for (int i = 0; i < n; i++) {
+		Chunk c;
+		c.start = bounds[i];
+		c.end = bounds[i + 1];
+		c.reason = -1;
+		c.transcoder = new Transcoder(NULL);
+		c.transcoder->setEngine(engine_);
+		c.transcoder->setDuration(c.end - c.start);
+		connect(c.transcoder, SIGNAL(finished(int)), this, SLOT(finished(int)));
+		connect(c.transcoder, SIGNAL(statusUpdate(QString)), this, SLOT(statusUpdate(QString)));
+		chunks_ << c;
+	}
+	writeManifest(false);
+
+	/* the scheduler starts them in this order */
+	for (int i = 0; i < chunks_.size(); i++) {
+		const Chunk &c = chunks_[i];
+		QFile::remove(chunkName(output_, i));
+		Scheduler::instance()->submit(c.transcoder, input_, chunkName(output_, i), QStringList(args)
+			<< "--starttime" << QString::number(c.start, 'f', 3)
+			<< "--endtime" << QString::number(c.end, 'f', 3));
+	}
+	loop_.exec();
+	return failed_ ? 1 : 0;
+}
+
+/* every length seconds from the start, or the closest scene cut to that */
+
+QList<double>
+Segmenter::boundaries(double from, double to, int n, const QList<double> &cuts) const
+{
+	QList<double> bounds;
+	bounds << from;
+	for (int i = 1; i < n; i++) {
+		double b = from + i * length_, best = b, dist = length_ / 4;
+		for (int j = 0; j < cuts.size(); j++)
+			if (fabs(cuts[j] - b) < dist && cuts[j] < to - MIN_LAST_CHUNK) {
+				best = cuts[j];
+				dist = fabs(cuts[j] - b);
+			}
+		bounds << best;
+	}
+	bounds << to;
+	return bounds;
+}
+
+void
+Segmenter::statusUpdate(QString status)
+{
+	for (int i = 0; i < chunks_.size(); i++)
+		if (chunks_[i].transcoder == sender())
+			fprintf(stderr, "%s: %s\n", qPrintable(QFileInfo(chunkName(output_, i)).fileName()),
+				qPrintable(status));
+}
+
+void
+Segmenter::finished(int reason)
+{
+	int i = 0;
+	while (i < chunks_.size() && chunks_[i].transcoder != sender())
+		i++;
+	if (i == chunks_.size() || chunks_[i].reason >= 0)
+		return;
+	chunks_[i].reason = reason;
+	done_++;
+	QString name = QFileInfo(chunkName(output_, i)).fileName();
+	if (reason == Transcoder::OK)
+		fprintf(stderr, "%s: done, %d of %d\n", qPrintable(name), done_, chunks_.size());
+	else if (!failed_) {
+		fprintf(stderr, "%s: failed, stopping the others\n", qPrintable(name));
+		failed_ = true;
+		stopAll();
+	}
+	writeManifest(done_ == chunks_.size() && !failed_);
+	if (done_ == chunks_.size())
+		loop_.quit();
+}
+
+/* queued chunks never start, running ones report back as stopped */
+
+void
+Segmenter::stopAll()
+{
+	for (int i = 0; i < chunks_.size(); i++) {
+		Chunk &c = chunks_[i];
+		if (c.reason >= 0)
+			continue;
+		if (Scheduler::instance()->remove(c.transcoder)) {
+			c.reason = Transcoder::STOPPED;
+			done_++;
+		} else
+			c.transcoder->stop();
+	}
+}
+
+/* written aside and renamed, so that readers never see half of it */
+
+void
+Segmenter::writeManifest(bool complete)
+{
+	int n = published_;
+	while (n < chunks_.size() && chunks_[n].reason == Transcoder::OK)
+		n++;
+	published_ = n;
+
+	double target = 0;
+	for (int i = 0; i < chunks_.size(); i++)
+		target = qMax(target, chunks_[i].end - chunks_[i].start);
+
+	QString manifest = manifestName(output_), part = manifest + ".part";
+	QFile f(part);
+	if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text)) {
+		fprintf(stderr, "Can't write %s\n", qPrintable(part));
+		return;
+	}
+	QTextStream s(&f);
+	s << "#EXTM3U\n";
+	s << "#EXT-X-TARGETDURATION:" << int(ceil(target)) << "\n";
+	s << "#EXT-X-MEDIA-SEQUENCE:0\n";
+	for (int i = 0; i < published_; i++) {
+		s << "#EXTINF:" << QString::number(chunks_[i].end - chunks_[i].start, 'f', 3) << ",\n";
+		s << QFileInfo(chunkName(output_, i)).fileName() << "\n";
+	}
+	if (complete)
+		s << "#EXT-X-ENDLIST\n";
+	s.flush();
+	f.close();
+	QFile::remove(manifest);
+	QFile::rename(part, manifest);
+}
@@ -0,0 +1,84 @@
+/*
+ * segmenter.h - output in fixed-length chunks
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_SEGMENTER
+#define H_SEGMENTER
+
+#include <QEventLoop>
+#include <QList>
+#include <QObject>
+#include <QStringList>
+#include "transcoder.h"
+
+/* Encodes the input as a series of Ogg files of length seconds each,
+ * "name-00000.ogv" and so on next to the output "name.ogv". Every chunk is
+ * a job of its own, so it starts on a keyframe and plays by itself; the
+ * jobs go through the scheduler, as many at a time as it allows, earliest
+ * first. The manifest, "name.m3u", lists the chunks finished so far from
+ * the first on, so they can be published while the rest encode, and is
+ * closed with #EXT-X-ENDLIST once all are there. With scene cuts on, the
+ * chunk boundaries move to the nearest cut within a quarter of the length.
+ */
+
+class Segmenter : public QObject
+{
+	Q_OBJECT
+
+public:
+	Segmenter(const QString &input, const QString &output, const QStringList &args, double length);
+	~Segmenter();
+	void setEngine(Transcoder::Engine e) { engine_ = e; }
+	void setSceneCuts(bool on) { scene_cuts_ = on; }
+	int run();
+
+	static QString chunkName(const QString &output, int i);
+	static QString manifestName(const QString &output);
+
+private slots:
+	void finished(int reason);
+	void statusUpdate(QString);
+
+private:
+	struct Chunk {
+		Transcoder *transcoder;
+		double start;
+		double end;
+		int reason; /* -1 while encoding */
+	};
+
+	QList<double> boundaries(double from, double to, int n, const QList<double> &cuts) const;
+	void writeManifest(bool complete);
+	void stopAll();
+
+	QString input_;
+	QString output_;
+	QStringList args_;
+	double length_;
+	Transcoder::Engine engine_;
+	bool scene_cuts_;
+	QList<Chunk> chunks_;
+	int published_; /* chunks in the manifest */
+	int done_;
+	bool failed_;
+	QEventLoop loop_;
+};
+
+#endif // H_SEGMENTER
@@ -0,0 +1,340 @@
+/*
+ * skeleton.cpp - Ogg Skeleton headers
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QFile>
+#include <QMap>
+#include <QPair>
+#include <cstring>
+#include <stdexcept>
+#include "skeleton.h"
+#include "util.h"
+
+#define FISHEAD_SIZE 64
+#define FISHEAD4_SIZE 80
+#define FISBONE_SIZE 52
+#define INDEX_HEADER_SIZE 42
+#define TIME_DENOMINATOR 1000
+#define KEYPOINT_INTERVAL 2000 /* in TIME_DENOMINATOR units */
+#define COPY_BUFFER (1 << 20)
+
+static void
+put(QByteArray *b, int pos, quint64 v, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+		(*b)[pos + i] = char(v >> (8 * i));
+}
+
+QByteArray
+skeleton_fishead(qint64 content_offset, qint64 segment_length)
+{
+	bool v4 = content_offset >= 0;
+	QByteArray ret(v4 ? FISHEAD4_SIZE : FISHEAD_SIZE, 0);
+	memcpy(ret.data(), "fishead", 8);
+	put(&ret, 8, v4 ? 4 : 3, 2);        /* version 3.0 or 4.0 */
+	put(&ret, 10, 0, 2);
+	put(&ret, 12, 0, 8);                /* presentation time */
+	put(&ret, 20, TIME_DENOMINATOR, 8);
+	put(&ret, 28, 0, 8);                /* base time */
+	put(&ret, 36, TIME_DENOMINATOR, 8);
+	if (v4) {
+		put(&ret, 64, segment_length, 8);
+		put(&ret, 72, content_offset, 8);
+	}
+	return ret;
+}
+
+QByteArray
+skeleton_fisbone(const OggStreamInfo &s)
+{
+	QByteArray ret(FISBONE_SIZE, 0);
+	memcpy(ret.data(), "fisbone", 8);
+	put(&ret, 8, FISBONE_SIZE - 8, 4);  /* offset to the message headers */
+	put(&ret, 12, s.serialno, 4);
+	put(&ret, 16, s.headers, 4);
+	put(&ret, 20, s.rate_num, 8);
+	put(&ret, 28, s.rate_den, 8);
+	put(&ret, 36, 0, 8);                /* base granule */
+	put(&ret, 44, s.preroll, 4);
+	put(&ret, 48, s.granule_shift, 1);
+	ret.append("Content-Type: ");
+	ret.append(s.contentType());
+	ret.append("\r\n");
+	return ret;
+}
+
+/* 7 bits at a time, lowest first, the last byte marked by its top bit */
+
+static void
+put_varint(QByteArray *b, quint64 v)
+{
+	do {
+		uchar c = v & 0x7f;
+		v >>= 7;
+		if (v == 0)
+			c |= 0x80;
+		b->append(char(c));
+	} while (v != 0);
+}
+
+namespace {
+
+struct Keypoint
+{
+	qint64 offset; /* from the end of the headers */
+	qint64 time;
+};
+
+struct IndexedStream
+{
+	OggStreamInfo info;
+	OggPacketReader reader;
+	int header_packets;
+	QList<QByteArray> header_pages;
+	quint32 header_seqno; /* that of the first page after the BOS one */
+	quint32 data_seqno;   /* that of the first page after the headers */
+	quint32 seqno_shift;  /* for the pages after new headers */
+	QList<Keypoint> keypoints;
+	qint64 open_start;   /* where the packet running into the next page began */
+	qint64 last_key;
+	qint64 time;         /* end of the last granule seen */
+
+	IndexedStream(): header_packets(0), header_seqno(0), data_seqno(0), seqno_shift(0),
+		open_start(-1), last_key(-1), time(0) { }
+};
+
+}
+
+static QByteArray
+index_packet(const IndexedStream &s, qint64 content_offset)
+{
+	QByteArray ret(INDEX_HEADER_SIZE, 0);
+	memcpy(ret.data(), "index", 6);
+	put(&ret, 6, s.info.serialno, 4);
+	put(&ret, 10, s.keypoints.size(), 8);
+	put(&ret, 18, TIME_DENOMINATOR, 8);
+	put(&ret, 26, 0, 8);                /* first sample time */
+	put(&ret, 34, s.time, 8);           /* last sample end time */
+	qint64 offset = 0, time = 0;
+	for (int i = 0; i < s.keypoints.size(); i++) {
+		const Keypoint &k = s.keypoints[i];
+		put_varint(&ret, content_offset + k.offset - offset);
+		put_varint(&ret, k.time - time);
+		offset = content_offset + k.offset;
+		time = k.time;
+	}
+	return ret;
+}
+
+static void
+append_pages(QByteArray *out, OggPacketWriter *w)
+{
+	OggPage page;
+	while (w->pageOut(&page, true))
+		out->append(page.serialize());
+}
+
+/* the headers of the indexed file, which has content_offset bytes of them */
+
+static QByteArray
+index_headers(const QList<quint32> &order, const QMap<quint32, IndexedStream> &streams,
+	quint32 skeleton_serial, qint64 content_offset, qint64 data_size)
+{
+	QByteArray ret;
+	OggPacketWriter skeleton(skeleton_serial);
+	skeleton.packetIn(skeleton_fishead(content_offset, content_offset + data_size), 0);
+	append_pages(&ret, &skeleton);
+	QList<const IndexedStream *> s;
+	for (int i = 0; i < order.size(); i++)
+		s << &streams.find(order[i]).value();
+
+	for (int i = 0; i < s.size(); i++)
+		ret.append(s[i]->header_pages.first());
+	for (int i = 0; i < s.size(); i++)
+		skeleton.packetIn(skeleton_fisbone(s[i]->info), 0);
+	append_pages(&ret, &skeleton);
+	for (int i = 0; i < s.size(); i++)
+		skeleton.packetIn(index_packet(*s[i], content_offset), 0);
+	append_pages(&ret, &skeleton);
+	for (int i = 0; i < s.size(); i++)
+		for (int j = 1; j < s[i]->header_pages.size(); j++)
+			ret.append(s[i]->header_pages[j]);
+	skeleton.packetIn(QByteArray(), 0, true);
+	append_pages(&ret, &skeleton);
+	return ret;
+}
+
+/* Theora keypoints are where the packets ending on a page with a new
+ * keyframe begin, Vorbis ones where those of any page do. Both are spaced
+ * out, a seek only has to land before its target.
+ */
+
+static void
+add_keypoint(IndexedStream *s, const OggPage &page, qint64 offset)
+{
+	qint64 start = page.continued() && s->open_start >= 0 ? s->open_start : offset;
+	if (page.granulepos >= 0) {
+		qint64 time = -1;
+		if (s->info.codec == OggStreamInfo::THEORA) {
+			qint64 key = s->info.keyframe(page.granulepos);
+			if (key != s->last_key)
+				time = (key - 1) * TIME_DENOMINATOR * s->info.rate_den / s->info.rate_num;
+			s->last_key = key;
+		} else
+			time = s->time;
+		if (time >= 0 && (s->keypoints.isEmpty() ||
+				  time >= s->keypoints.last().time + KEYPOINT_INTERVAL)) {
+			Keypoint k;
+			k.offset = start;
+			k.time = time;
+			s->keypoints << k;
+		}
+		s->time = qint64(s->info.time(page.granulepos) * TIME_DENOMINATOR);
+	}
+	if (!page.segments.isEmpty()) {
+		if (uchar(page.segments[page.segments.size() - 1]) < 255)
+			s->open_start = -1;
+		else
+			s->open_start = page.packets() > 0 ? offset : start;
+	}
+}
+
+/* the new headers go on pages of their own, numbered on from the first */
+
+static void
+replace_headers(IndexedStream *s, const QList<QByteArray> &packets)
+{
+	OggPacketWriter writer(s->info.serialno, s->header_seqno);
+	for (int i = 0; i < packets.size(); i++)
+		writer.packetIn(packets[i], 0);
+	QByteArray bos = s->header_pages.first();
+	s->header_pages.clear();
+	s->header_pages << bos;
+	OggPage page;
+	while (writer.pageOut(&page, true))
+		s->header_pages << page.serialize();
+	s->seqno_shift = writer.seqno() - s->data_seqno;
+}
+
+void
+skeleton_index(const QString &filename, const QMap<quint32, QList<QByteArray> > &headers)
+{
+	OggReader in;
+	in.open(filename);
+
+	/* the headers, without those of any skeleton */
+	QList<quint32> order;
+	QMap<quint32, IndexedStream> streams;
+	QList<quint32> dropped;
+	OggPage page;
+	qint64 content = -1;
+	while (in.readPage(&page)) {
+		if (page.bos()) {
+			IndexedStream s;
+			QByteArray packet;
+			s.reader.pageIn(page);
+			if (!s.reader.packetOut(&packet) || !s.info.identify(page.serialno, packet))
+				throw std::runtime_error("Can't index a stream of unknown type");
+			if (s.info.codec == OggStreamInfo::SKELETON) {
+				dropped << page.serialno;
+				continue;
+			}
+			s.header_packets = 1;
+			s.header_pages << page.serialize();
+			order << page.serialno;
+			streams.insert(page.serialno, s);
+			continue;
+		}
+		if (!streams.contains(page.serialno))
+			continue;
+		IndexedStream &s = streams[page.serialno];
+		if (s.header_packets >= s.info.headers) {
+			content = page.offset;
+			break;
+		}
+		QByteArray packet;
+		s.reader.pageIn(page);
+		while (s.reader.packetOut(&packet))
+			s.header_packets++;
+		if (s.header_pages.size() == 1)
+			s.header_seqno = page.seqno;
+		s.header_pages << page.serialize();
+		s.data_seqno = page.seqno + 1;
+	}
+	if (content < 0)
+		throw std::runtime_error("There's nothing to index");
+	for (QMap<quint32, QList<QByteArray> >::const_iterator i = headers.begin();
+	     i != headers.end(); ++i)
+		if (streams.contains(i.key()) && streams[i.key()].header_pages.size() > 1)
+			replace_headers(&streams[i.key()], i.value());
+
+	/* offsets count only the pages that stay */
+	qint64 data_size = 0;
+	in.seek(content);
+	while (in.readPage(&page)) {
+		if (page.bos())
+			throw std::runtime_error("Chained files can't be indexed");
+		if (!streams.contains(page.serialno))
+			continue;
+		add_keypoint(&streams[page.serialno], page, data_size);
+		data_size += page.size();
+	}
+
+	quint32 skeleton_serial;
+	do
+		skeleton_serial = random_serialno();
+	while (streams.contains(skeleton_serial) || dropped.contains(skeleton_serial));
+
+	/* the first keypoint's offset depends on the size of the headers */
+	QByteArray headers;
+	qint64 content_offset = 0;
+	for (;;) {
+		headers = index_headers(order, streams, skeleton_serial, content_offset, data_size);
+		if (headers.size() == content_offset)
+			break;
+		content_offset = headers.size();
+	}
+
+	QString part = filename + ".index.part";
+	QFile out(part);
+	if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		throw std::runtime_error(qPrintable("Can't create " + part));
+	QByteArray buf = headers;
+	bool ok = true;
+	in.seek(content);
+	while (ok && in.readPage(&page)) {
+		if (!streams.contains(page.serialno))
+			continue;
+		page.seqno += streams[page.serialno].seqno_shift;
+		buf.append(page.serialize());
+		if (buf.size() >= COPY_BUFFER) {
+			ok = out.write(buf) == buf.size();
+			buf.clear();
+		}
+	}
+	ok = ok && out.write(buf) == buf.size();
+	out.close();
+	in.close();
+	/* a new file, which also leaves alone any hard links to the old one */
+	if (!ok || !replace_file(part, filename)) {
+		QFile::remove(part);
+		throw std::runtime_error(qPrintable("Can't write " + filename));
+	}
+}
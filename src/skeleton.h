@@ -0,0 +1,51 @@
+/*
+ * skeleton.h - Ogg Skeleton headers
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_SKELETON
+#define H_SKELETON
+
+#include <QByteArray>
+#include <QList>
+#include <QMap>
+#include <QString>
+#include "ogg.h"
+
+/* Skeleton 3.0 as ffmpeg2theora writes it: a fishead packet on its own
+ * BOS page, a fisbone per stream after all the BOS pages, and an empty
+ * EOS packet once all the other streams' headers are done. Given the
+ * offsets, the fishead is a 4.0 one, which index packets may follow.
+ */
+
+QByteArray skeleton_fishead(qint64 content_offset = -1, qint64 segment_length = -1);
+QByteArray skeleton_fisbone(const OggStreamInfo &);
+
+/* Rewrites a finished file with a Skeleton 4.0 keyframe index in its
+ * headers, so that players can seek it with a single request. Any
+ * skeleton it had is replaced. The streams in headers, by serial number,
+ * get the packets there in place of their headers after the first on the
+ * same copy. Throws if the file can't be indexed, which leaves it as it
+ * was.
+ */
+
+void skeleton_index(const QString &filename,
+	const QMap<quint32, QList<QByteArray> > &headers = QMap<quint32, QList<QByteArray> >());
+
+#endif // H_SKELETON
@@ -0,0 +1,204 @@
+/*
+ * sniff.cpp - telling media files from junk by their first bytes
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QFile>
+#include <QFileInfo>
+#include <cstring>
+#include "sniff.h"
+
+#define LENGTH(x) int(sizeof(x) / sizeof(*x))
+
+struct Signature
+{
+	int offset;
+	const char *magic;
+	int len;
+	Sniff::Verdict verdict;
+	const char *what;
+};
+
+#define MEDIA(offset, magic, what) { offset, magic, sizeof(magic) - 1, Sniff::MEDIA, what }
+#define JUNK(offset, magic, what) { offset, magic, sizeof(magic) - 1, Sniff::JUNK, what }
+
+static const Signature signatures[] = {
+	MEDIA(0, "OggS", "Ogg"),
+	MEDIA(0, "RIFF", "RIFF (AVI, WAV)"),
+	MEDIA(0, "RIFX", "RIFF (AVI, WAV)"),
+	MEDIA(0, "\x1a\x45\xdf\xa3", "Matroska"),
+	MEDIA(4, "ftyp", "MP4"),
+	MEDIA(4, "moov", "QuickTime"),
+	MEDIA(4, "mdat", "QuickTime"),
+	MEDIA(4, "wide", "QuickTime"),
+	MEDIA(4, "free", "QuickTime"),
+	MEDIA(4, "skip", "QuickTime"),
+	MEDIA(4, "pnot", "QuickTime"),
+	MEDIA(0, "\x30\x26\xb2\x75\x8e\x66\xcf\x11", "ASF"),
+	MEDIA(0, "FLV\x01", "Flash Video"),
+	MEDIA(0, "FWS", "Flash"),
+	MEDIA(0, "CWS", "Flash"),
+	MEDIA(0, ".RMF", "RealMedia"),
+	MEDIA(0, "\x00\x00\x01\xba", "MPEG program stream"),
+	MEDIA(0, "\x00\x00\x01\xb3", "MPEG video"),
+	MEDIA(0, "\x06\x0e\x2b\x34", "MXF"),
+	MEDIA(0, "NSVf", "NSV"),
+	MEDIA(0, "nut/multimedia container", "NUT"),
+	MEDIA(0, "YUV4MPEG2", "YUV4MPEG"),
+	MEDIA(0, "#EXTM3U", "a playlist"),
+	MEDIA(0, "ID3", "MP3"),
+	MEDIA(0, "fLaC", "FLAC"),
+	MEDIA(0, "FORM", "IFF (AIFF, 8SVX)"),
+	MEDIA(0, ".snd", "Sun audio"),
+	MEDIA(0, "caff", "Core Audio"),
+	MEDIA(0, "wvpk", "WavPack"),
+	MEDIA(0, "MAC ", "Monkey's Audio"),
+	MEDIA(0, "TTA1", "TTA"),
+	MEDIA(0, "MPCK", "Musepack"),
+	MEDIA(0, "MP+", "Musepack"),
+	MEDIA(0, "#!AMR", "AMR"),
+	MEDIA(0, "\x0b\x77", "AC-3"),
+	MEDIA(0, "\x7f\xfe\x80\x01", "DTS"),
+
+	JUNK(0, "%PDF", "a PDF document"),
+	JUNK(0, "%!PS", "a PostScript document"),
+	JUNK(0, "PK\x03\x04", "a ZIP archive or office document"),
+	JUNK(0, "PK\x05\x06", "an empty ZIP archive"),
+	JUNK(0, "Rar!\x1a\x07", "a RAR archive"),
+	JUNK(0, "7z\xbc\xaf\x27\x1c", "a 7-Zip archive"),
+	JUNK(0, "\x1f\x8b", "gzip compressed data"),
+	JUNK(0, "BZh", "bzip2 compressed data"),
+	JUNK(0, "\xfd" "7zXZ", "xz compressed data"),
+	JUNK(0, "\x28\xb5\x2f\xfd", "zstd compressed data"),
+	JUNK(257, "ustar", "a tar archive"),
+	JUNK(0, "\xd0\xcf\x11\xe0\xa1\xb1\x1a\xe1", "an OLE document (Word, Excel, MSI)"),
+	JUNK(0, "SQLite format 3", "an SQLite database"),
+	JUNK(0, "\x7f" "ELF", "an ELF executable"),
+	JUNK(0, "MZ", "a Windows executable"),
+	JUNK(0, "\xca\xfe\xba\xbe", "a Mach-O or Java class file"),
+	JUNK(0, "\xce\xfa\xed\xfe", "a Mach-O executable"),
+	JUNK(0, "\xcf\xfa\xed\xfe", "a Mach-O executable"),
+};
+
+/* formats without a header of their own, which may well start with silence
+ * or black */
+static const char *headerless[] = {
+	"pcm", "raw", "yuv", "rgb", "gsm"
+};
+
+/* text formats that ffmpeg reads */
+static const char *text_media[] = {
+	"avs", "avsi", "m3u", "m3u8", "sdp", "ffconcat"
+};
+
+static bool
+has_suffix(const char *const *list, int n, const QString &suffix)
+{
+	for (int i = 0; i < n; i++)
+		if (suffix.compare(list[i], Qt::CaseInsensitive) == 0)
+			return true;
+	return false;
+}
+
+/* transport stream packets every 188 bytes, or every 192 in M2TS */
+
+static bool
+is_transport_stream(const uchar *p, int len)
+{
+	for (int start = 0; start <= 4; start += 4) {
+		int size = start ? 192 : 188, n = 0;
+		for (int i = start; i < len && p[i] == 0x47; i += size)
+			n++;
+		if (n >= 3)
+			return true;
+	}
+	return false;
+}
+
+/* No NULs or control characters but tab, line ends, form feed and escape,
+ * in any 8-bit encoding. Binary media has some within the first KB.
+ */
+
+static bool
+is_text(const uchar *p, int len)
+{
+	for (int i = 0; i < len; i++) {
+		uchar c = p[i];
+		if ((c < 0x20 && c != '\t' && c != '\n' && c != '\v' && c != '\f' &&
+			 c != '\r' && c != 0x1b) || c == 0x7f)
+			return false;
+	}
+	return true;
+}
+
+static const char *
+text_kind(const uchar *p, int len)
+{
+	int i = 0;
+	if (len >= 3 && p[0] == 0xef && p[1] == 0xbb && p[2] == 0xbf)
+		i = 3;
+	while (i < len && (p[i] == ' ' || p[i] == '\t' || p[i] == '\r' || p[i] == '\n'))
+		i++;
+	if (i + 1 < len && p[i] == '#' && p[i + 1] == '!')
+		return "a script";
+	if (i < len && p[i] == '<')
+		return "an HTML or XML file";
+	if (i < len && (p[i] == '{' || p[i] == '['))
+		return "a JSON or INI file";
+	return "a text file";
+}
+
+Sniff
+sniff(const QByteArray &head, const QString &suffix)
+{
+	const uchar *p = (const uchar *)head.constData();
+	int len = head.size();
+	if (len == 0)
+		return Sniff(Sniff::JUNK, "an empty file");
+
+	for (int i = 0; i < LENGTH(signatures); i++) {
+		const Signature &s = signatures[i];
+		if (s.offset + s.len <= len && memcmp(p + s.offset, s.magic, s.len) == 0)
+			return Sniff(s.verdict, s.what);
+	}
+	if (len >= 2 && p[0] == 0xff && (p[1] & 0xe0) == 0xe0)
+		return Sniff(Sniff::MEDIA, "MPEG audio");
+	if (is_transport_stream(p, len))
+		return Sniff(Sniff::MEDIA, "MPEG transport stream");
+
+	if (!has_suffix(headerless, LENGTH(headerless), suffix)) {
+		int i = 0;
+		while (i < len && p[i] == 0)
+			i++;
+		if (i == len)
+			return Sniff(Sniff::JUNK, "only zeros at the start (an unfinished download?)");
+	}
+	if (is_text(p, len) && !has_suffix(text_media, LENGTH(text_media), suffix))
+		return Sniff(Sniff::JUNK, text_kind(p, len));
+	return Sniff();
+}
+
+Sniff
+sniff_file(const QString &filename)
+{
+	QFile f(filename);
+	if (!f.open(QIODevice::ReadOnly))
+		return Sniff();
+	return sniff(f.read(SNIFF_SIZE), QFileInfo(filename).suffix());
+}
@@ -0,0 +1,56 @@
+/*
+ * sniff.h - telling media files from junk by their first bytes
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_SNIFF
+#define H_SNIFF
+
+#include <QByteArray>
+#include <QString>
+
+/* What the first few KB of a file say it is, so that files which plainly
+ * aren't audio or video (documents, archives, executables, text, the
+ * zeros of an unfinished download) are turned away without spawning a
+ * probe. Anything not recognized either way is left for the probe to
+ * decide: only a positive match makes a file junk.
+ */
+
+#define SNIFF_SIZE 4096
+
+struct Sniff
+{
+	enum Verdict {
+		MEDIA,
+		UNKNOWN,
+		JUNK
+	};
+
+	Verdict verdict;
+	const char *what; /* "a PDF document", "Matroska"..., NULL if unknown */
+
+	Sniff(Verdict v = UNKNOWN, const char *w = NULL): verdict(v), what(w) { }
+};
+
+/* suffix is the file name extension, some formats are headerless */
+Sniff sniff(const QByteArray &head, const QString &suffix);
+/* unreadable files are UNKNOWN, the probe will tell why */
+Sniff sniff_file(const QString &filename);
+
+#endif // H_SNIFF
@@ -0,0 +1,287 @@
+/*
+ * stager.cpp - local copies of inputs on slow storage
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+#include <QTime>
+#include "stager.h"
+#ifdef Q_OS_UNIX
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/vfs.h>
+#endif
+
+#define DEFAULT_MAX_SIZE 8192 /* MB */
+#define CHUNK (1 << 20)
+#define READ_AHEAD (64 << 20)
+#define WAIT_INTERVAL 100 /* ms */
+
+Stager *
+Stager::instance()
+{
+	static Stager *stager = NULL;
+	if (stager == NULL)
+		stager = new Stager();
+	return stager;
+}
+
+Stager::Stager()
+	: QThread(NULL), rate_(0), used_(0), copying_(NULL), abort_(false), serial_(0)
+{
+	QSettings settings("QTheoraFrontend team", "QTheoraFrontend");
+	mode_ = settings.value("stage_inputs", "slow").toString();
+	dir_ = settings.value("stage_dir", QDir::home().filePath(".qtheorafrontend/stage")).toString();
+	max_size_ = settings.value("stage_max_size", DEFAULT_MAX_SIZE).toLongLong() * 1024 * 1024;
+	max_rate_ = settings.value("stage_max_rate", 0).toDouble() * 1024 * 1024;
+	if (mode_ != "off" && !QDir().mkpath(dir_))
+		mode_ = "off";
+	if (mode_ != "off")
+		cleanup();
+}
+
+/* copies are named <pid>-<n>-<name>; those of processes that are gone
+ * were left behind by a crash */
+
+void
+Stager::cleanup()
+{
+#ifdef Q_OS_UNIX
+	QDir dir(dir_);
+	QStringList files = dir.entryList(QDir::Files);
+	for (int i = 0; i < files.size(); i++) {
+		int pid = files[i].section('-', 0, 0).toInt();
+		if (pid > 0 && kill(pid, 0) != 0 && errno == ESRCH)
+			dir.remove(files[i]);
+	}
+#endif
+}
+
+/* network filesystems, and those USB disks and card readers come with */
+
+static bool
+slow_storage(const QString &path)
+{
+#ifdef Q_OS_LINUX
+	struct statfs fs;
+	if (statfs(QFile::encodeName(path).constData(), &fs) != 0)
+		return false;
+	switch ((unsigned long)fs.f_type) {
+	case 0x6969:        /* NFS */
+	case 0x517b:        /* SMB */
+	case 0xff534d42:    /* CIFS */
+	case 0xfe534d42:    /* SMB2 */
+	case 0x65735546:    /* FUSE: sshfs, NTFS, exFAT */
+	case 0x4d44:        /* FAT */
+	case 0x9660:        /* ISO 9660 */
+		return true;
+	}
+#else
+	Q_UNUSED(path);
+#endif
+	return false;
+}
+
+bool
+Stager::stages(const QString &input) const
+{
+	return mode_ == "always" || (mode_ == "slow" && slow_storage(input));
+}
+
+Stager::Entry *
+Stager::find(const QString &input)
+{
+	for (int i = 0; i < entries_.size(); i++)
+		if (entries_[i]->input == input)
+			return entries_[i];
+	return NULL;
+}
+
+Stager::Entry *
+Stager::add(const QString &input, const void *owner)
+{
+	Entry *e = find(input);
+	if (e == NULL) {
+		e = new Entry;
+		e->input = input;
+		e->size = 0;
+		e->state = PENDING;
+		entries_ << e;
+		if (!isRunning())
+			start(QThread::LowPriority);
+		cond_.wakeAll();
+	}
+	e->owners.insert(owner);
+	return e;
+}
+
+void
+Stager::remove(Entry *e)
+{
+	if (!e->local.isEmpty()) {
+		QFile::remove(e->local);
+		used_ -= e->size;
+	}
+	entries_.removeAll(e);
+	delete e;
+}
+
+void
+Stager::prefetch(const QString &input, const void *owner)
+{
+	if (!stages(input))
+		return;
+	QMutexLocker locker(&mutex_);
+	add(input, owner);
+}
+
+QString
+Stager::acquire(const QString &input, const void *owner, ProgressListener *listener)
+{
+	if (!stages(input))
+		return input;
+	QMutexLocker locker(&mutex_);
+	Entry *e = add(input, owner);
+	/* a job waiting for its input goes before the prefetches */
+	entries_.removeAll(e);
+	entries_.prepend(e);
+	while (e->state == PENDING || e->state == COPYING) {
+		if (listener != NULL && listener->cancelled())
+			return input;
+		cond_.wait(&mutex_, WAIT_INTERVAL);
+	}
+	return e->local.isEmpty() ? input : e->local;
+}
+
+void
+Stager::release(const QString &input, const void *owner)
+{
+	QMutexLocker locker(&mutex_);
+	Entry *e = find(input);
+	if (e == NULL)
+		return;
+	e->owners.remove(owner);
+	if (!e->owners.isEmpty())
+		return;
+	if (e == copying_)
+		abort_ = true;
+	else
+		remove(e);
+}
+
+/* the page cache fills from the start of the file while the job starts */
+
+static void
+read_ahead(const QString &input)
+{
+#ifdef Q_OS_LINUX
+	int fd = ::open(QFile::encodeName(input).constData(), O_RDONLY);
+	if (fd >= 0) {
+		posix_fadvise(fd, 0, READ_AHEAD, POSIX_FADV_WILLNEED);
+		::close(fd);
+	}
+#else
+	Q_UNUSED(input);
+#endif
+}
+
+/* At most max_rate_ on average since the start, so that a prefetch leaves
+ * the link to whatever else reads from it.
+ */
+
+bool
+Stager::copy(const QString &from, const QString &to, qint64 size)
+{
+	QFile in(from), out(to);
+	if (!in.open(QIODevice::ReadOnly) || !out.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return false;
+#ifdef Q_OS_LINUX
+	posix_fadvise(in.handle(), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	QTime clock;
+	clock.start();
+	qint64 done = 0;
+	while (!abort_) {
+		QByteArray chunk = in.read(CHUNK);
+		if (chunk.isEmpty())
+			break;
+		if (out.write(chunk) != chunk.size())
+			return false;
+		done += chunk.size();
+		double secs = clock.elapsed() / 1000.0;
+		if (max_rate_ > 0 && done / max_rate_ > secs)
+			msleep((unsigned long)((done / max_rate_ - secs) * 1000));
+		rate_ = done / qMax(clock.elapsed() / 1000.0, 0.001);
+	}
+	return !abort_ && done == size;
+}
+
+void
+Stager::run()
+{
+	QMutexLocker locker(&mutex_);
+	for (;;) {
+		Entry *e = NULL;
+		for (int i = 0; i < entries_.size() && e == NULL; i++)
+			if (entries_[i]->state == PENDING)
+				e = entries_[i];
+		if (e == NULL) {
+			cond_.wait(&mutex_);
+			continue;
+		}
+
+		e->state = COPYING;
+		copying_ = e;
+		abort_ = false;
+		QString input = e->input, local;
+		qint64 size = QFileInfo(input).size();
+		if (used_ + size <= max_size_) {
+			local = QDir(dir_).filePath(QString("%1-%2-%3").arg(QCoreApplication::applicationPid())
+				.arg(serial_++).arg(QFileInfo(input).fileName()));
+			used_ += size;
+		}
+
+		locker.unlock();
+		bool ok = true;
+		if (local.isEmpty())
+			read_ahead(input);
+		else if (!(ok = copy(input, local, size)))
+			QFile::remove(local);
+		locker.relock();
+
+		copying_ = NULL;
+		if (ok && !local.isEmpty()) {
+			e->local = local;
+			e->size = size;
+		} else if (!local.isEmpty())
+			used_ -= size;
+		e->state = ok ? READY : FAILED;
+		if (e->owners.isEmpty())
+			remove(e);
+		cond_.wakeAll();
+	}
+}
@@ -0,0 +1,101 @@
+/*
+ * stager.h - local copies of inputs on slow storage
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_STAGER
+#define H_STAGER
+
+#include <QList>
+#include <QMutex>
+#include <QSet>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+#include "util.h"
+
+/* Inputs on network filesystems and removable disks are copied to a local
+ * scratch directory by a thread of their own: queued jobs' inputs as soon
+ * as they're submitted, so that the next job's input comes in while the
+ * current one encodes. An input too big for the scratch space is only
+ * read ahead. Copies go once no job holds them.
+ *
+ * Settings: stage_inputs ("off", "slow" or "always"), stage_dir,
+ * stage_max_size (MB) and stage_max_rate (MB/s, 0 for no limit).
+ */
+
+class Stager : public QThread
+{
+	Q_OBJECT
+
+public:
+	static Stager *instance();
+
+	/* whether the input would be copied */
+	bool stages(const QString &input) const;
+	/* owner is the job the input is for */
+	void prefetch(const QString &input, const void *owner);
+	/* what to read the input from, waiting for its copy if needed */
+	QString acquire(const QString &input, const void *owner, ProgressListener * = NULL);
+	void release(const QString &input, const void *owner);
+
+	/* bytes per second of the last copy */
+	double rate() const { return rate_; }
+
+protected:
+	void run();
+
+private:
+	enum State {
+		PENDING,
+		COPYING,
+		READY,
+		FAILED
+	};
+	struct Entry {
+		QString input;
+		QString local;      /* empty if read from where it is */
+		qint64 size;
+		State state;
+		QSet<const void *> owners;
+	};
+
+	Stager();
+	void cleanup();
+	Entry *find(const QString &input);
+	Entry *add(const QString &input, const void *owner);
+	bool copy(const QString &from, const QString &to, qint64 size);
+	void remove(Entry *);
+
+	QString mode_;
+	QString dir_;
+	qint64 max_size_;
+	double max_rate_;
+	volatile double rate_;
+
+	QMutex mutex_;
+	QWaitCondition cond_;
+	QList<Entry *> entries_;
+	qint64 used_;
+	Entry *copying_;
+	volatile bool abort_;
+	int serial_;
+};
+
+#endif // H_STAGER
@@ -0,0 +1,158 @@
+/*
+ * trace.cpp - job lifecycle events in the Chrome trace format
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QMap>
+#include <QMutex>
+#include <QThread>
+#include <QTime>
+#include <QVector>
+#include <cstdio>
+#include <cstdlib>
+#include "trace.h"
+#ifdef Q_OS_UNIX
+#include <time.h>
+#endif
+
+bool Trace::enabled_ = false;
+
+struct TraceEvent
+{
+	char phase;
+	const char *name;
+	const void *id;
+	qint64 ts;
+	qint64 dur;
+	int tid;
+	QString arg;
+};
+
+static QMutex mutex;
+static QString trace_file;
+static QVector<TraceEvent> events;
+static QMap<Qt::HANDLE, int> threads;
+
+/* microseconds */
+
+qint64
+Trace::now()
+{
+#ifdef Q_OS_UNIX
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return qint64(t.tv_sec) * 1000000 + t.tv_nsec / 1000;
+#else
+	static QTime start = QTime::currentTime();
+	return qint64(start.elapsed()) * 1000;
+#endif
+}
+
+static void
+write_trace()
+{
+	Trace::write();
+}
+
+void
+Trace::open(const QString &filename)
+{
+	QMutexLocker locker(&mutex);
+	if (enabled_)
+		return;
+	trace_file = filename;
+	enabled_ = true;
+	atexit(write_trace);
+}
+
+void
+Trace::record(char phase, const char *name, const void *id, qint64 ts, qint64 dur,
+	const QString &arg)
+{
+	QMutexLocker locker(&mutex);
+	Qt::HANDLE thread = QThread::currentThreadId();
+	if (!threads.contains(thread))
+		threads.insert(thread, threads.size() + 1);
+	TraceEvent e;
+	e.phase = phase;
+	e.name = name;
+	e.id = id;
+	e.ts = ts;
+	e.dur = dur;
+	e.tid = threads[thread];
+	e.arg = arg;
+	events << e;
+}
+
+static QByteArray
+json_string(const QString &s)
+{
+	QByteArray ret = "\"";
+	QByteArray utf8 = s.toUtf8();
+	for (int i = 0; i < utf8.size(); i++) {
+		char c = utf8[i];
+		if (c == '"' || c == '\\')
+			ret += '\\';
+		if (uchar(c) < 0x20)
+			ret += QString().sprintf("\\u%04x", c).toAscii();
+		else
+			ret += c;
+	}
+	return ret + "\"";
+}
+
+void
+Trace::write()
+{
+	QMutexLocker locker(&mutex);
+	if (!enabled_)
+		return;
+	enabled_ = false;
+	FILE *f = fopen(QFile::encodeName(trace_file).constData(), "w");
+	if (f == NULL) {
+		fprintf(stderr, "Can't write the trace to %s\n", qPrintable(trace_file));
+		return;
+	}
+	qint64 pid = QCoreApplication::applicationPid();
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (int i = 0; i < events.size(); i++) {
+		const TraceEvent &e = events[i];
+		fprintf(f, "%s{\"ph\":\"%c\",\"pid\":%lld,\"tid\":%d,\"ts\":%lld",
+			i > 0 ? ",\n" : "", e.phase, (long long)pid, e.tid, (long long)e.ts);
+		if (e.phase == 'M') {
+			fprintf(f, ",\"name\":\"thread_name\",\"args\":{\"name\":%s}}",
+				json_string(e.name).constData());
+			continue;
+		}
+		fprintf(f, ",\"name\":%s", json_string(e.name).constData());
+		if (e.phase == 'X')
+			fprintf(f, ",\"dur\":%lld", (long long)e.dur);
+		if (e.phase == 'i')
+			fprintf(f, ",\"s\":\"t\"");
+		if (e.id != NULL)
+			fprintf(f, ",\"cat\":\"job\",\"id\":\"%p\"", e.id);
+		if (!e.arg.isEmpty())
+			fprintf(f, ",\"args\":{\"detail\":%s}", json_string(e.arg).constData());
+		fprintf(f, "}");
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+}
@@ -0,0 +1,81 @@
+/*
+ * trace.h - job lifecycle events in the Chrome trace format
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_TRACE
+#define H_TRACE
+
+#include <QString>
+
+/* Events are kept in memory and written as a JSON file, loadable by
+ * chrome://tracing and Perfetto, when the program exits. Until open() is
+ * called every call is a test of one flag. Spans that cross threads, like
+ * a job and its passes, are async events keyed by the object they're for.
+ */
+
+class Trace
+{
+public:
+	static void open(const QString &filename);
+	static bool enabled() { return enabled_; }
+	static qint64 now();
+
+	static void begin(const char *name, const void *id, const QString &arg = QString())
+		{ if (enabled_) record('b', name, id, now(), 0, arg); }
+	static void end(const char *name, const void *id)
+		{ if (enabled_) record('e', name, id, now(), 0, QString()); }
+	static void instant(const char *name, const void *id = NULL, const QString &arg = QString())
+		{ if (enabled_) record(id != NULL ? 'n' : 'i', name, id, now(), 0, arg); }
+	static void complete(const char *name, qint64 start, const QString &arg = QString())
+		{ if (enabled_) record('X', name, NULL, start, now() - start, arg); }
+	static void threadName(const char *name)
+		{ if (enabled_) record('M', name, NULL, 0, 0, QString()); }
+	/* done at exit, after which nothing more is recorded */
+	static void write();
+
+private:
+	static void record(char phase, const char *name, const void *id,
+		qint64 ts, qint64 dur, const QString &arg);
+
+	static bool enabled_;
+};
+
+/* a span of the current thread, from here to the end of the scope */
+
+class TraceScope
+{
+public:
+	TraceScope(const char *name, const QString &arg = QString())
+		: name_(name), start_(-1)
+	{
+		if (Trace::enabled()) {
+			start_ = Trace::now();
+			arg_ = arg;
+		}
+	}
+	~TraceScope() { if (start_ >= 0) Trace::complete(name_, start_, arg_); }
+
+private:
+	const char *name_;
+	qint64 start_;
+	QString arg_;
+};
+
+#endif // H_TRACE
@@ -24,12 +24,59 @@
 #include <QMetaType>
 #include <QFile>
 #include <QMessageBox>
+#include <QVector>
+#include <stdexcept>
+#ifdef Q_OS_UNIX
+#include <signal.h>
+#include <sys/resource.h>
+#endif
 #include "transcoder.h"
 #include "frontend.h"
+#include "oggmux.h"
+#include "remote.h"
+#include "remux.h"
+#include "resultcache.h"
+#include "retag.h"
+#include "scenecut.h"
+#include "skeleton.h"
+#include "stager.h"
+#include "trace.h"
+#include "verifier.h"
 #include "util.h"
+#ifdef INTERNAL_ENCODER
+#include "audiofilter.h"
+#include "encoder.h"
+#endif
+
+#define BULK_NICENESS 10
+#define NO_PASS -2 /* nothing traced yet */
+
+static const char *
+pass_name(int pass)
+{
+	return pass == 0 ? "pass 1" : pass == 1 ? "pass 2" : "encode";
+}
+
+/* the options are ours, not ffmpeg2theora's */
+
+static QStringList
+ffmpeg2theora_args(const QStringList &extra_args)
+{
+	QStringList args = extra_args;
+	args.removeAll(KEYFRAME_INDEX_OPTION);
+	args.removeAll(PREFILTER_OPTION);
+	args.removeAll(AUDIO_PREFILTER_OPTION);
+	args.removeAll(SCENE_KEYFRAMES_OPTION);
+	int i;
+	while ((i = args.indexOf(LOUDNESS_OPTION)) >= 0)
+		args.erase(args.begin() + i, args.begin() + qMin(i + 2, args.size()));
+	return args;
+}
 
 Transcoder::Transcoder(Frontend *f)
-	: QThread(NULL), frontend_(f)
+	: QThread(NULL), frontend_(f), stopping_(false), engine_(PROCESS), shared_fs_(false), duration_(-1),
+	priority_(NORMAL), lookup_(false), cached_(false), granted_(true), withdrawn_(false), paused_(false),
+	paused_secs_(0), traced_pass_(NO_PASS)
 {
 	qRegisterMetaType<QProcess::ExitStatus>("QProcess::ExitStatus");
 	proc_.moveToThread(this);
@@ -37,16 +84,29 @@ Transcoder::Transcoder(Frontend *f)
 	connect(&proc_, SIGNAL(readyReadStandardOutput()), this, SLOT(readyRead()));
 	connect(&proc_, SIGNAL(readyReadStandardError()), this, SLOT(readyRead()));
 	connect(this, SIGNAL(terminate()), &proc_, SLOT(kill()));
+	audio_proc_.moveToThread(this);
+	connect(&audio_proc_, SIGNAL(finished(int, QProcess::ExitStatus)), this, SLOT(procFinished(int, QProcess::ExitStatus)));
+	connect(&audio_proc_, SIGNAL(readyReadStandardOutput()), this, SLOT(audioReadyRead()));
+	connect(&audio_proc_, SIGNAL(readyReadStandardError()), this, SLOT(audioReadyRead()));
+	connect(this, SIGNAL(terminate()), &audio_proc_, SLOT(kill()));
 }
 
 void
-Transcoder::start(const QString &input, const QString &output, const QStringList &ea)
+Transcoder::start(const QString &input, const QString &output, const QStringList &ea, bool wait_for_slot)
 {
 	if (!isRunning()) {
 		input_filename_ = input;
 		output_filename_ = output;
 		start_time_ = QDateTime::currentDateTime();
+		paused_ = false;
+		paused_secs_ = 0;
 		extra_args_ = ea;
+		verification_.clear();
+		cache_key_.clear();
+		lookup_ = cacheLookup();
+		cached_ = withdrawn_ = false;
+		granted_ = !wait_for_slot;
+		Trace::begin("job", this, output);
 		QThread::start();
 	}
 }
@@ -55,10 +115,136 @@ void
 Transcoder::stop()
 {
 	stopping_ = true;
+	pause_cond_.wakeAll();
 	if (isRunning())
 		emit terminate();
 }
 
+/* A paused ffmpeg2theora is simply stopped with SIGSTOP; the built-in
+ * engine blocks in its feeding loop instead, and a remote job is paused
+ * by the worker. If the process hasn't been spawned yet, run() stops it
+ * right after it is.
+ */
+
+void
+Transcoder::pause(const QString &reason)
+{
+	if (!isRunning() || paused_)
+		return;
+#ifndef Q_OS_UNIX
+	if (engine_ == PROCESS || engine_ == SPLIT) {
+		emit statusUpdate("Pausing is not supported on this platform");
+		return;
+	}
+#endif
+	pause_mutex_.lock();
+	paused_ = true;
+	pause_start_ = QDateTime::currentDateTime();
+	pause_mutex_.unlock();
+#ifdef Q_OS_UNIX
+	if ((engine_ == PROCESS || engine_ == SPLIT) && proc_.pid() > 0)
+		::kill(proc_.pid(), SIGSTOP);
+	if (engine_ == SPLIT && audio_proc_.pid() > 0)
+		::kill(audio_proc_.pid(), SIGSTOP);
+#endif
+	emit statusUpdate(reason);
+}
+
+void
+Transcoder::resume()
+{
+	if (!paused_)
+		return;
+	QMutexLocker locker(&pause_mutex_);
+	paused_secs_ += pause_start_.secsTo(QDateTime::currentDateTime());
+	paused_ = false;
+#ifdef Q_OS_UNIX
+	if ((engine_ == PROCESS || engine_ == SPLIT) && proc_.pid() > 0)
+		::kill(proc_.pid(), SIGCONT);
+	if (engine_ == SPLIT && audio_proc_.pid() > 0)
+		::kill(audio_proc_.pid(), SIGCONT);
+#endif
+	pause_cond_.wakeAll();
+}
+
+void
+Transcoder::waitWhilePaused()
+{
+	QMutexLocker locker(&pause_mutex_);
+	while (paused_ && !stopping_)
+		pause_cond_.wait(&pause_mutex_);
+}
+
+bool
+Transcoder::cacheLookup() const
+{
+	return !cache_args_.isEmpty() && engine_ != RETAG && ResultCache::instance()->enabled();
+}
+
+/* the time spent in the cache and on the queue isn't the job's */
+
+void
+Transcoder::grant()
+{
+	QMutexLocker locker(&pause_mutex_);
+	start_time_ = QDateTime::currentDateTime();
+	granted_ = true;
+	pause_cond_.wakeAll();
+}
+
+void
+Transcoder::withdraw()
+{
+	{
+		QMutexLocker locker(&pause_mutex_);
+		withdrawn_ = true;
+		pause_cond_.wakeAll();
+	}
+	stop();
+}
+
+/* false if the job was stopped, meanwhile or before */
+
+bool
+Transcoder::waitForSlot()
+{
+	QMutexLocker locker(&pause_mutex_);
+	while (!granted_ && !stopping_ && !withdrawn_)
+		pause_cond_.wait(&pause_mutex_);
+	return granted_ && !stopping_ && !withdrawn_;
+}
+
+/* copies to and from the cache tell the fraction done, shown as that
+ * much of the output's duration */
+
+namespace {
+
+class CacheCopy : public ProgressListener
+{
+public:
+	CacheCopy(Transcoder *t, double duration): t_(t), scale_(duration > 0 ? duration : 1) { }
+	void progress(double pos, double, double, int) { t_->progress(pos * scale_, -1, -1, -1); }
+	bool cancelled() const { return t_->cancelled(); }
+	void waitWhilePaused() { t_->waitWhilePaused(); }
+
+private:
+	Transcoder *t_;
+	double scale_;
+};
+
+}
+
+bool
+Transcoder::fetchCached()
+{
+	TraceScope trace("cache lookup");
+	emit statusUpdate("Looking in the result cache");
+	cache_key_ = ResultCache::instance()->key(input_filename(), cache_args_);
+	CacheCopy copy(this, duration_);
+	cached_ = ResultCache::instance()->fetch(cache_key_, output_filename(), &copy);
+	return cached_;
+}
+
 QString
 Transcoder::ffmpeg2theora()
 {
@@ -75,59 +261,286 @@ Transcoder::ffmpeg2theora()
 	return ffmpeg2theora_;
 }
 
+/* time spent encoding, not counting pauses */
+
 double
 Transcoder::elapsed() const
 {
-	return start_time_.secsTo(QDateTime::currentDateTime());
+	QDateTime now = QDateTime::currentDateTime();
+	int paused = paused_secs_;
+	if (paused_)
+		paused += pause_start_.secsTo(now);
+	return start_time_.secsTo(now) - paused;
+}
+
+/* ffmpeg2theora estimates the remaining time from the wall clock,
+ * which keeps running while it's stopped */
+
+double
+Transcoder::activeFraction() const
+{
+	int wall = start_time_.secsTo(QDateTime::currentDateTime());
+	return wall > 0 ? elapsed() / wall : 1;
 }
 
 #define BUF_SIZE 256
 
 void
 Transcoder::readyRead()
+{
+	readLines(&proc_, false);
+}
+
+void
+Transcoder::audioReadyRead()
+{
+	readLines(&audio_proc_, true);
+}
+
+void
+Transcoder::readLines(QProcess *proc, bool audio_only)
 {
 	QProcess::ProcessChannel channel[2] = {QProcess::StandardOutput, QProcess::StandardError};
 	char buf[BUF_SIZE] = "";
 	for (int i = 0; i < 2; i++) {
-		proc_.setReadChannel(channel[i]);
-		while (proc_.canReadLine())
-			if (proc_.readLine(buf, BUF_SIZE) > 0)
-				processLine(QString(buf).trimmed());
+		proc->setReadChannel(channel[i]);
+		while (proc->canReadLine())
+			if (proc->readLine(buf, BUF_SIZE) > 0)
+				processLine(QString(buf).trimmed(), audio_only);
 	}
 }
 
+/* with SPLIT, the job is over once both processes are, and one of them
+ * failing dooms the other */
+
 void
 Transcoder::procFinished(int status, QProcess::ExitStatus qstatus)
 {
+	Trace::instant("process exited", this, QString::number(status));
+	int reason;
 	if (stopping_)
-		emit finished(STOPPED);
+		reason = STOPPED;
 	else {
 		bool ok = status == 0 && qstatus == 0;
-		emit finished(ok ? OK : FAILED);
+		reason = ok ? OK : FAILED;
 	}
-	quit();
+	if (sender() == &audio_proc_)
+		audio_reason_ = reason;
+	else
+		proc_reason_ = reason;
+	if (reason != OK && engine_ == SPLIT)
+		emit terminate();
+	if (proc_.state() == QProcess::NotRunning && audio_proc_.state() == QProcess::NotRunning)
+		quit();
+}
+
+/* The finishing stages, in the transcoder thread, before finished() is
+ * emitted. Workers do them themselves, the option comes along.
+ */
+
+void
+Transcoder::finish(int reason)
+{
+	Stager::instance()->release(input_filename(), this);
+	if (traced_pass_ != NO_PASS)
+		Trace::end(pass_name(traced_pass_), this);
+	if (reason == OK && !cached_ && engine_ != REMOTE && extra_args_.contains(KEYFRAME_INDEX_OPTION) &&
+	    !extra_args_.contains("--no-skeleton")) {
+		TraceScope trace("index");
+		emit statusUpdate("Indexing keyframes");
+		try {
+			skeleton_index(output_filename());
+		} catch (std::exception &x) {
+			emit statusUpdate(QString("No keyframe index: ") + x.what());
+		}
+	}
+	if (reason == OK && !cached_)
+		reason = verify();
+	if (reason == OK && !cached_ && !cache_key_.isEmpty()) {
+		TraceScope trace("cache store");
+		emit statusUpdate("Copying into the result cache");
+		CacheCopy copy(this, duration_);
+		ResultCache::instance()->store(cache_key_, output_filename(), &copy);
+	}
+	emit finished(reason);
+	Trace::end("job", this);
+}
+
+/* Exit codes don't tell truncated or damaged files, so the output is read
+ * back. A keyframe cut may start earlier than asked, and only ever makes
+ * the output longer.
+ */
+
+#define DURATION_TOLERANCE 2.0 /* seconds */
+
+int
+Transcoder::verify()
+{
+	TraceScope trace("verify");
+	emit statusUpdate("Verifying the output");
+	try {
+		OggReport r = verify_ogg(output_filename());
+		QStringList problems = r.problems();
+		if (!problems.isEmpty()) {
+			verification_ = problems.join(". ");
+			emit statusUpdate(verification_);
+			return FAILED;
+		}
+		double d = r.duration(), tolerance = qMax(DURATION_TOLERANCE, duration_ * 0.02);
+		if (duration_ > 0 && (d < duration_ - tolerance ||
+				      (d > duration_ + tolerance && engine_ != REMUX)))
+			verification_ = QString("The output lasts %1 instead of %2")
+				.arg(Frontend::time2string(d)).arg(Frontend::time2string(duration_));
+	} catch (std::exception &x) {
+		verification_ = x.what();
+		return FAILED;
+	}
+	return OK;
 }
 
 void
 Transcoder::run()
 {
+	Trace::threadName("transcoder");
+	TraceScope trace("Transcoder::run", input_filename());
 	position_ = eta_ = audio_b_ = video_b_ = -1;
 	stopping_ = false;
 	pass_ = extra_args_.contains("--two-pass") ? 0 : -1;
-	
-	proc_.start(ffmpeg2theora(), QStringList() << "--frontend"
-		<< extra_args_
-		<< "--output" << output_filename()
-		<< input_filename());
+	traced_pass_ = NO_PASS;
+
+	/* a hit takes no processor, so the scheduler only queues a miss */
+	if (lookup_ && fetchCached()) {
+		finish(OK);
+		return;
+	}
+	if (!granted_ && !stopping_ && !withdrawn_) {
+		emit statusUpdate("Waiting for a free processor");
+		emit slotWanted();
+	}
+	if (!waitForSlot()) {
+		if (withdrawn_) {
+			Trace::end("job", this);
+			return;
+		}
+		finish(STOPPED);
+		return;
+	}
 
-	if (proc_.waitForStarted())
+	/* remote jobs send the input from where it is */
+	source_ = input_filename();
+	if (engine_ != REMOTE && engine_ != RETAG && Stager::instance()->stages(source_)) {
+		TraceScope trace("stage");
+		emit statusUpdate("Staging the input");
+		source_ = Stager::instance()->acquire(input_filename(), this, this);
+		if (stopping_) {
+			finish(STOPPED);
+			return;
+		}
+	}
+
+	if (engine_ == INTERNAL) {
+		runInternal();
+		return;
+	}
+	if (engine_ == REMOTE) {
+		runRemote();
+		return;
+	}
+	if (engine_ == REMUX) {
+		runRemux();
+		return;
+	}
+	if (engine_ == RETAG) {
+		runRetag();
+		return;
+	}
+	if (engine_ == SPLIT) {
+		runSplit();
+		return;
+	}
+	proc_reason_ = audio_reason_ = FAILED;
+	if (spawn(&proc_, ffmpeg2theora_args(extra_args_), output_filename())) {
 		exec();
-	else
+		finish(proc_reason_);
+	}
+	else {
 		emit statusUpdate("Encoding failed to start");
+		finish(FAILED);
+	}
 }
 
+bool
+Transcoder::spawn(QProcess *proc, const QStringList &args, const QString &output)
+{
+	{
+		TraceScope trace("spawn");
+		proc->start(ffmpeg2theora(), QStringList() << "--frontend"
+			<< args
+			<< "--output" << output
+			<< source_);
+		if (!proc->waitForStarted())
+			return false;
+	}
+#ifdef Q_OS_UNIX
+	if (priority_ == BULK)
+		setpriority(PRIO_PROCESS, proc->pid(), BULK_NICENESS);
+	if (paused_)
+		::kill(proc->pid(), SIGSTOP);
+#endif
+	return true;
+}
+
+/* ffmpeg2theora encodes Vorbis and Theora in one thread; here each gets
+ * a process of its own, writing next to the output, and the two files
+ * are interleaved once both are done. Two-pass only concerns the video.
+ */
+
 void
-Transcoder::processLine(const QString &line)
+Transcoder::runSplit()
+{
+	QStringList args = ffmpeg2theora_args(extra_args_);
+	QStringList audio_args = args;
+	audio_args.removeAll("--two-pass");
+	QString video = output_filename() + ".video.part", audio = output_filename() + ".audio.part";
+
+	proc_reason_ = audio_reason_ = FAILED;
+	bool started = spawn(&proc_, args << "--noaudio", video);
+	if (started && !spawn(&audio_proc_, audio_args << "--novideo", audio)) {
+		proc_.kill();
+		proc_.waitForFinished(-1);
+		started = false;
+	}
+	if (!started) {
+		QFile::remove(video);
+		emit statusUpdate("Encoding failed to start");
+		finish(FAILED);
+		return;
+	}
+	exec();
+
+	int reason = proc_reason_ != OK ? proc_reason_ : audio_reason_;
+	if (reason == OK) {
+		TraceScope trace("mux");
+		emit statusUpdate("Interleaving the streams");
+		try {
+			OggMuxer muxer(!extra_args_.contains("--no-skeleton"), this);
+			muxer.run(QStringList() << video << audio, output_filename());
+		} catch (std::exception &x) {
+			emit statusUpdate(QString(x.what()));
+			reason = FAILED;
+		}
+		if (stopping_)
+			reason = STOPPED;
+	}
+	QFile::remove(video);
+	QFile::remove(audio);
+	finish(reason);
+}
+
+/* With SPLIT, the audio process only tells the audio bitrate */
+
+void
+Transcoder::processLine(const QString &line, bool audio_only)
 {
 	if (line.startsWith("{")) {
 		QStringList sl = line.split(QRegExp("(\\{|,|\\})"), QString::SkipEmptyParts);
@@ -136,19 +549,270 @@ Transcoder::processLine(const QString &line)
 			if (!parse_json_pair(*i, &key, &value))
 				continue;
 
-			if (key == "remaining")
-				eta_ = value.toDouble();
-			else if (key == "audio_kbps")
-				audio_b_ = value.toDouble();
+			if (key == "audio_kbps") {
+				if (engine_ != SPLIT || audio_only)
+					audio_b_ = value.toDouble();
+			} else if (audio_only)
+				continue;
+			else if (key == "remaining")
+				eta_ = value.toDouble() * activeFraction();
 			else if (key == "video_kbps")
 				video_b_ = value.toDouble();
 			else if (key == "position")
 				position_ = value.toDouble();
 
-			if (pass_ == 0 && (audio_b_ > 0 || video_b_ > 0))
+			if (pass_ == 0 && (video_b_ > 0 || (audio_b_ > 0 && engine_ != SPLIT)))
 				pass_ = 1;
 		}
+		tracePass(pass_);
 		emit statusUpdate(position_, eta_, audio_b_, video_b_, pass_);
 	} else
 		emit statusUpdate(line);
 }
+
+/* the in-process engines report here, from the transcoder thread */
+
+void
+Transcoder::progress(double pos, double audio_b, double video_b, int pass)
+{
+	double eta = -1;
+	if (duration_ > 0 && pos > 0) {
+		double done = pass == 0 ? pos / (2 * duration_) :
+			pass == 1 ? (duration_ + pos) / (2 * duration_) :
+			pos / duration_;
+		if (done > 0 && done < 1)
+			eta = elapsed() * (1 - done) / done;
+	}
+	tracePass(pass);
+	emit statusUpdate(pos, eta, audio_b, video_b, pass);
+}
+
+/* the first progress report, and then the passes, as spans of the job */
+
+void
+Transcoder::tracePass(int pass)
+{
+	if (!Trace::enabled() || pass == traced_pass_)
+		return;
+	if (traced_pass_ == NO_PASS)
+		Trace::instant("first progress", this);
+	else
+		Trace::end(pass_name(traced_pass_), this);
+	Trace::begin(pass_name(pass), this);
+	traced_pass_ = pass;
+}
+
+#define AUDIO_CHUNK 1024
+
+void
+Transcoder::runInternal()
+{
+#ifdef INTERNAL_ENCODER
+	int reason = OK;
+	try {
+		EncoderOptions options;
+		options.parse(extra_args_);
+		/* the loudness is measured while the first pass runs without
+		 * audio, or before the audio alone is encoded */
+		bool two_pass = options.video && options.two_pass && options.video_bitrate > 0;
+		if (options.video && !two_pass)
+			options.loudness = 0;
+		bool afiltered = options.audio && (options.audio_prefilter || options.loudness != 0);
+		AudioFormat source;
+		if (options.audio && (options.channels <= 0 || options.samplerate <= 0 || afiltered)) {
+			FileInfo fi;
+			fi.retrieve(source_);
+			for (int i = 0; i < fi.audio_streams.size(); i++) {
+				const AudioStreamInfo &a = fi.audio_streams[i];
+				if (options.audio_stream < 0 || a.id == options.audio_stream) {
+					if (options.channels <= 0)
+						options.channels = a.channels;
+					if (options.samplerate <= 0)
+						options.samplerate = a.samplerate;
+					source.channels = a.channels;
+					source.samplerate = a.samplerate;
+					break;
+				}
+			}
+		}
+
+		if (options.video && options.scene_keyframes) {
+			emit statusUpdate("Finding scene cuts");
+			SceneDetector detector(this);
+			detector.setVideoStream(options.video_stream);
+			options.keyframes = detector.run(source_);
+			if (stopping_) {
+				finish(STOPPED);
+				return;
+			}
+		}
+
+		Encoder enc(options, this);
+		Decoder vdec, adec;
+		Prefilter prefilter(options.prefilter);
+
+		/* ffmpeg still converts what we can't, e.g. 4.0 to stereo;
+		 * started now, measuring the loudness overlaps the first pass */
+		AudioFilter afilter;
+		afiltered = afiltered && options.channels > 0 && options.samplerate > 0;
+		if (afiltered) {
+			AudioFormat out, decoded;
+			out.channels = decoded.channels = options.channels;
+			out.samplerate = decoded.samplerate = options.samplerate;
+			if (options.audio_prefilter && Downmix::supported(source.channels, out.channels))
+				decoded.channels = source.channels;
+			if (options.audio_prefilter && Resampler::supported(source.samplerate, out.samplerate))
+				decoded.samplerate = source.samplerate;
+			EncoderOptions dopts = options;
+			dopts.channels = decoded.channels;
+			dopts.samplerate = decoded.samplerate;
+			afilter.start(source_, dopts.decoderOptions(Decoder::AUDIO),
+				options.decoderInputOptions(), decoded, out, options.loudness);
+		}
+		for (int pass = two_pass ? 0 : -1; pass <= (two_pass ? 1 : -1) && !stopping_; pass++) {
+			bool audio = options.audio && pass != 0;
+			if (options.video)
+				vdec.open(Decoder::VIDEO, source_,
+					options.decoderOptions(Decoder::VIDEO), options.decoderInputOptions());
+			if (audio && !afiltered)
+				adec.open(Decoder::AUDIO, source_,
+					options.decoderOptions(Decoder::AUDIO), options.decoderInputOptions());
+			const VideoFormat *vformat = &vdec.videoFormat();
+			if (options.video && options.prefilter_frames)
+				vformat = &prefilter.open(*vformat);
+			const AudioFormat *aformat = afiltered ? &afilter.format() : &adec.audioFormat();
+			enc.open(output_filename(), options.video ? vformat : NULL,
+				audio ? aformat : NULL, pass);
+
+			/* feed whichever stream is behind, so that pages interleave */
+			YuvFrame frame, filtered;
+			QVector<float> samples(AUDIO_CHUNK * qMax(options.channels, 1));
+			double fps = vdec.videoFormat().fps();
+			double vtime = 0, atime = 0;
+			long long frames = 0;
+			bool veof = !options.video, aeof = !audio;
+			while (!(veof && aeof) && !stopping_) {
+				waitWhilePaused();
+				if (!veof && (aeof || vtime <= atime)) {
+					if (vdec.readFrame(&frame)) {
+						if (options.prefilter_frames) {
+							prefilter.process(frame, &filtered);
+							enc.writeVideo(filtered);
+						} else
+							enc.writeVideo(frame);
+						vtime = ++frames / fps;
+					} else
+						veof = true;
+				} else {
+					int n = afiltered ? afilter.read(samples.data(), AUDIO_CHUNK) :
+						adec.readSamples(samples.data(), AUDIO_CHUNK);
+					if (n > 0) {
+						enc.writeAudio(samples.data(), n);
+						atime += n / double(aformat->samplerate);
+					} else
+						aeof = true;
+				}
+			}
+			/* closing even when stopped keeps the partial file playable */
+			enc.close();
+			vdec.close();
+			adec.close();
+		}
+	} catch (std::exception &x) {
+		emit statusUpdate(QString(x.what()));
+		reason = FAILED;
+	}
+	finish(stopping_ ? int(STOPPED) : reason);
+#else
+	emit statusUpdate("Built without the internal encoder");
+	finish(FAILED);
+#endif
+}
+
+/* the streams are already Theora and Vorbis, only the pages are copied */
+
+void
+Transcoder::runRemux()
+{
+	int reason = OK;
+	try {
+		Remuxer remuxer(extra_args_, this);
+		remuxer.run(source_, output_filename());
+	} catch (std::exception &x) {
+		emit statusUpdate(QString(x.what()));
+		reason = FAILED;
+	}
+	finish(stopping_ ? int(STOPPED) : reason);
+}
+
+void
+Transcoder::runRetag()
+{
+	int reason = OK;
+	try {
+		TraceScope trace("retag", output_filename());
+		emit statusUpdate("Updating the metadata");
+		retag_ogg(output_filename(), extra_args_, this);
+	} catch (std::exception &x) {
+		emit statusUpdate(QString(x.what()));
+		reason = FAILED;
+	}
+	finish(stopping_ ? int(STOPPED) : reason);
+}
+
+/* The worker runs an ordinary Transcoder and relays its signals. Without
+ * a shared filesystem the input is uploaded first and the output comes
+ * back once it's done.
+ */
+
+#define POLL_INTERVAL 100
+
+void
+Transcoder::runRemote()
+{
+	int reason = FAILED;
+	try {
+		RemoteConnection conn(worker_);
+		QString input = input_filename(), output = output_filename();
+		if (!shared_fs_) {
+			emit statusUpdate("Uploading to " + worker_);
+			conn.sendFile(input);
+			input = output = "-";
+		}
+		conn.send(QStringList() << "ENCODE" << QString::number(priority_)
+			<< input << output << extra_args_);
+
+		bool stop_sent = false, paused = false;
+		for (;;) {
+			if (stopping_ && !stop_sent) {
+				conn.send(QStringList() << "STOP");
+				stop_sent = true;
+			}
+			if (paused_ != paused) {
+				paused = paused_;
+				conn.send(QStringList() << (paused ? "PAUSE" : "RESUME"));
+			}
+
+			QStringList msg;
+			if (!conn.receive(&msg, POLL_INTERVAL))
+				continue;
+			if (msg[0] == "STATUS")
+				emit statusUpdate(msg.value(1));
+			else if (msg[0] == "PROGRESS" && msg.size() >= 6)
+				emit statusUpdate(msg[1].toDouble(), msg[2].toDouble(),
+					msg[3].toDouble(), msg[4].toDouble(), msg[5].toInt());
+			else if (msg[0] == "OUTPUT")
+				conn.receiveFile(output_filename(), msg.value(1).toLongLong());
+			else if (msg[0] == "ERROR")
+				throw std::runtime_error(qPrintable(msg.value(1)));
+			else if (msg[0] == "FINISHED") {
+				reason = msg.value(1).toInt();
+				break;
+			}
+		}
+	} catch (std::exception &x) {
+		emit statusUpdate(QString(x.what()));
+		reason = stopping_ ? int(STOPPED) : int(FAILED);
+	}
+	finish(reason);
+}
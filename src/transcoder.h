@@ -26,17 +26,32 @@
 #include <QThread>
 #include <QProcess>
 #include <QMutex>
+#include <QWaitCondition>
 #include <QDateTime>
+#include "util.h"
 
 class Frontend;
 
-class Transcoder : public QThread
+/* not for ffmpeg2theora: index the keyframes of the output once it's done */
+#define KEYFRAME_INDEX_OPTION "--keyframe-index"
+/* built-in encoder only: crop, scale and adjust frames in-process */
+#define PREFILTER_OPTION "--prefilter"
+/* built-in encoder only: resample and mix audio in-process */
+#define AUDIO_PREFILTER_OPTION "--audio-prefilter"
+/* built-in encoder only: normalize audio to this many LUFS */
+#define LOUDNESS_OPTION "--loudness"
+/* built-in encoder only: start every scene on a keyframe */
+#define SCENE_KEYFRAMES_OPTION "--scene-keyframes"
+
+class Transcoder : public QThread, public ProgressListener
 {
 	Q_OBJECT
 
 public:
 	explicit Transcoder(Frontend *);
-	void start(const QString &input, const QString &output, const QStringList & = QStringList());
+	/* wait_for_slot: after any cache lookup, until grant() */
+	void start(const QString &input, const QString &output, const QStringList & = QStringList(),
+		bool wait_for_slot = false);
 	static QString ffmpeg2theora();
 
 	QString input_filename() { return input_filename_; }
@@ -48,20 +63,82 @@ public:
 		FAILED,
 		STOPPED
 	};
+
+	enum Engine {
+		PROCESS,
+		INTERNAL,
+		REMOTE,
+		REMUX,
+		RETAG, /* only the metadata of an existing output, see retag.h */
+		SPLIT /* ffmpeg2theora for audio and for video at once, then muxed */
+	};
+	Engine engine() const { return engine_; }
+	void setEngine(Engine e) { engine_ = e; }
+	/* for REMOTE: the worker address, and whether it sees our paths */
+	void setWorker(const QString &address, bool shared_fs) { worker_ = address; shared_fs_ = shared_fs; }
+
+	enum Priority {
+		BULK,
+		NORMAL,
+		URGENT
+	};
+	Priority priority() const { return priority_; }
+	void setPriority(Priority p) { priority_ = p; }
+	bool paused() const { return paused_; }
+	/* expected duration of the output, for the ETA of in-process engines */
+	void setDuration(double d) { duration_ = d; }
+	/* what reading the output back found wrong with it */
+	QString verification() const { return verification_; }
+
+	/* With the result cache on, the job first looks for its output there
+	 * under the input and these, before the scheduler gives it a
+	 * processor, and stores it once it succeeds. See resultcache.h.
+	 */
+	void setCacheArgs(const QStringList &a) { cache_args_ = a; }
+	bool cacheLookup() const;
+	/* whether the output was copied from the result cache */
+	bool cached() const { return cached_; }
+	/* from the scheduler, once the job missed the cache: a processor is
+	 * free, or the job was taken off the queue */
+	void grant();
+	void withdraw();
+
+	void progress(double pos, double audio_b, double video_b, int pass);
+	bool cancelled() const { return stopping_; }
+	void waitWhilePaused();
+
 public slots:
 	void stop();
+	void pause(const QString &reason = "Paused");
+	void resume();
 
 signals:
 	void statusUpdate(QString status);
 	void statusUpdate(double pos, double eta, double audio_b, double video_b, int pass);
 	void finished(int reason);
+	/* the result cache missed, the job waits for grant() */
+	void slotWanted();
 
 protected:
 	void run();
-	void processLine(const QString &);
+	void runInternal();
+	void runRemote();
+	void runRemux();
+	void runRetag();
+	void runSplit();
+	bool spawn(QProcess *, const QStringList &args, const QString &output);
+	void finish(int reason);
+	bool fetchCached();
+	bool waitForSlot();
+	int verify();
+	void tracePass(int pass);
+	double activeFraction() const;
+	void processLine(const QString &, bool audio_only = false);
+	void readLines(QProcess *, bool audio_only);
 
 protected slots:
 	void readyRead();
+	void audioReadyRead();
 	void procFinished(int, QProcess::ExitStatus);
 
 signals:
@@ -70,17 +147,40 @@ signals:
 private:
 	QString input_filename_;
 	QString output_filename_;
+	QString source_; /* where the input is read from, see stager.h */
 	QProcess proc_;
+	QProcess audio_proc_; /* for SPLIT, proc_ does the video */
 	Frontend *frontend_;
 	QStringList extra_args_;
 	QDateTime start_time_;
-	bool stopping_;
+	volatile bool stopping_;
+	Engine engine_;
+	QString worker_;
+	bool shared_fs_;
+	double duration_;
+	QString verification_;
+	Priority priority_;
+	QStringList cache_args_;
+	QByteArray cache_key_;
+	bool lookup_;
+	bool cached_;
+	bool granted_;
+	volatile bool withdrawn_;
+
+	volatile bool paused_;
+	QDateTime pause_start_;
+	int paused_secs_;
+	QMutex pause_mutex_;
+	QWaitCondition pause_cond_;
 
 	double position_;
 	double eta_;
 	double audio_b_;
 	double video_b_;
 	int pass_;
+	int proc_reason_;
+	int audio_reason_;
+	int traced_pass_;
 };
 
 #endif // H_TRANSCODER
@@ -0,0 +1,274 @@
+/*
+ * trimdetect.cpp - black and silence at the ends of inputs
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QRunnable>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+#include <cmath>
+#include <stdexcept>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "decoder.h"
+#include "trimdetect.h"
+
+#define SCAN_LENGTH 120.0 /* seconds at each end, at most */
+#define WIDTH 160 /* of the pictures looked at */
+#define HEIGHT 90
+#define BLACK_MEAN 24 /* luma levels; 16 is black */
+#define BLACK_MAX 64
+#define RATE 16000 /* of the mono sound looked at */
+#define WINDOW 320 /* samples, 20 ms */
+#define SILENCE 0.00316 /* RMS, -50 dBFS */
+#define MIN_TRIM 0.5 /* seconds, or it isn't worth it */
+
+/* The mean and the maximum of the luma, sixteen pixels at a time with
+ * SSE2: psadbw against zero sums them, pmaxub keeps the brightest.
+ */
+
+static bool
+black(const YuvFrame &frame)
+{
+	quint64 sum = 0;
+	int max = 0;
+	for (int y = 0; y < frame.height[0]; y++) {
+		const uchar *p = frame.plane[0] + y * frame.stride[0];
+		int x = 0, n = frame.width[0];
+#ifdef __SSE2__
+		__m128i zero = _mm_setzero_si128(), acc = zero, top = zero;
+		for (; x + 16 <= n; x += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)(p + x));
+			acc = _mm_add_epi64(acc, _mm_sad_epu8(v, zero));
+			top = _mm_max_epu8(top, v);
+		}
+		quint64 lanes[2];
+		uchar bytes[16];
+		_mm_storeu_si128((__m128i *)lanes, acc);
+		_mm_storeu_si128((__m128i *)bytes, top);
+		sum += lanes[0] + lanes[1];
+		for (int i = 0; i < 16; i++)
+			max = qMax(max, int(bytes[i]));
+#endif
+		for (; x < n; x++) {
+			sum += p[x];
+			max = qMax(max, int(p[x]));
+		}
+	}
+	qint64 pixels = qint64(frame.width[0]) * frame.height[0];
+	return pixels > 0 && sum <= quint64(BLACK_MEAN * pixels) && max <= BLACK_MAX;
+}
+
+/* four squares at a time with SSE */
+
+static double
+rms(const float *s, int n)
+{
+	float sum = 0;
+	int i = 0;
+#ifdef __SSE2__
+	__m128 acc = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4) {
+		__m128 v = _mm_loadu_ps(s + i);
+		acc = _mm_add_ps(acc, _mm_mul_ps(v, v));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, acc);
+	sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+	for (; i < n; i++)
+		sum += s[i] * s[i];
+	return n > 0 ? sqrt(sum / n) : 0;
+}
+
+/* one stream at one end; at the start, it stops at the first picture or
+ * window that isn't blank */
+
+class TrimDetector::Scan : public QRunnable
+{
+public:
+	Scan(const TrimDetector *detector, Decoder::Type type, int stream, double from, double length)
+		: first(-1), last(-1), detector_(detector), type_(type), stream_(stream),
+		from_(from), length_(length) { }
+
+	void run();
+	double from() const { return from_; }
+	bool head() const { return length_ > 0 && from_ == 0; }
+
+	double first; /* the start of the first thing that isn't blank */
+	double last; /* the end of the last one */
+	QString error;
+
+private:
+	void scanVideo(Decoder *);
+	void scanAudio(Decoder *);
+
+	const TrimDetector *detector_;
+	Decoder::Type type_;
+	int stream_;
+	double from_;
+	double length_;
+};
+
+void
+TrimDetector::Scan::run()
+{
+	try {
+		QStringList options, input_options;
+		if (stream_ >= 0)
+			options << "-map" << QString("0:%1").arg(stream_);
+		if (length_ > 0)
+			options << "-t" << QString::number(length_);
+		if (from_ > 0)
+			input_options << "-ss" << QString::number(from_);
+		Decoder dec;
+		if (type_ == Decoder::VIDEO) {
+			dec.open(type_, detector_->input_,
+				options << "-vf" << QString("scale=%1:%2").arg(WIDTH).arg(HEIGHT), input_options);
+			scanVideo(&dec);
+		} else {
+			dec.open(type_, detector_->input_,
+				options << "-ac" << "1" << "-ar" << QString::number(RATE), input_options);
+			scanAudio(&dec);
+		}
+		dec.close();
+	} catch (std::exception &x) {
+		error = x.what();
+	}
+}
+
+void
+TrimDetector::Scan::scanVideo(Decoder *dec)
+{
+	double fps = dec->videoFormat().fps();
+	YuvFrame frame;
+	for (qint64 n = 0; !detector_->stopping_ && dec->readFrame(&frame); n++) {
+		if (black(frame))
+			continue;
+		if (first < 0)
+			first = from_ + n / fps;
+		last = from_ + (n + 1) / fps;
+		if (head())
+			break;
+	}
+}
+
+void
+TrimDetector::Scan::scanAudio(Decoder *dec)
+{
+	QVector<float> samples(WINDOW);
+	qint64 done = 0;
+	int n;
+	while (!detector_->stopping_ && (n = dec->readSamples(samples.data(), WINDOW)) > 0) {
+		done += n;
+		if (rms(samples.data(), n) < SILENCE)
+			continue;
+		if (first < 0)
+			first = from_ + (done - n) / double(RATE);
+		last = from_ + done / double(RATE);
+		if (head())
+			break;
+	}
+}
+
+TrimDetector::TrimDetector(QObject *parent)
+	: QThread(parent), duration_(-1), video_(false), video_stream_(-1),
+	audio_(false), audio_stream_(-1), stopping_(false), start_(0), end_(-1)
+{
+}
+
+TrimDetector::~TrimDetector()
+{
+	stopping_ = true;
+	wait();
+}
+
+void
+TrimDetector::detect(const QString &input, double duration, bool video, int video_stream,
+	bool audio, int audio_stream)
+{
+	input_ = input;
+	duration_ = duration;
+	video_ = video;
+	video_stream_ = video_stream;
+	audio_ = audio;
+	audio_stream_ = audio_stream;
+	start();
+}
+
+/* The input starts where the first of its streams stops being blank and
+ * ends where the last one does; a stream blank all through the stretch
+ * looked at counts as starting after it, or ending before it.
+ */
+
+void
+TrimDetector::run()
+{
+	start_ = 0;
+	end_ = -1;
+	error_.clear();
+
+	double region = duration_ > 0 ? qMin(SCAN_LENGTH, duration_ / 2) : SCAN_LENGTH;
+	QList<Scan *> scans;
+	for (int head = 1; head >= 0; head--) {
+		if (!head && duration_ <= 0)
+			break;
+		double from = head ? 0 : duration_ - region, length = head ? region : -1;
+		if (video_)
+			scans << new Scan(this, Decoder::VIDEO, video_stream_, from, length);
+		if (audio_)
+			scans << new Scan(this, Decoder::AUDIO, audio_stream_, from, length);
+	}
+	QThreadPool pool;
+	pool.setMaxThreadCount(qMax(scans.size(), 1));
+	for (int i = 0; i < scans.size(); i++) {
+		scans[i]->setAutoDelete(false);
+		pool.start(scans[i]);
+	}
+	pool.waitForDone();
+
+	double start = -1, end = -1;
+	for (int i = 0; i < scans.size(); i++) {
+		const Scan *s = scans[i];
+		if (!s->error.isEmpty())
+			error_ = s->error;
+		else if (s->head()) {
+			double t = s->first >= 0 ? s->first : region;
+			start = start < 0 ? t : qMin(start, t);
+		} else {
+			double t = s->last >= 0 ? s->last : s->from();
+			end = qMax(end, t);
+		}
+		delete s;
+	}
+	if (!error_.isEmpty() || stopping_)
+		return;
+
+	if (start >= MIN_TRIM)
+		start_ = start;
+	if (end >= 0 && duration_ - end >= MIN_TRIM)
+		end_ = end;
+	/* blank all through what was looked at: better not to guess */
+	if (end_ >= 0 && end_ <= start_) {
+		start_ = 0;
+		end_ = -1;
+	}
+}
@@ -0,0 +1,75 @@
+/*
+ * trimdetect.h - black and silence at the ends of inputs
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_TRIMDETECT
+#define H_TRIMDETECT
+
+#include <QString>
+#include <QThread>
+
+/* Finds the leader and trailer of an input: black pictures (dark on
+ * average and nowhere bright) with silence under them. Only the first
+ * and the last two minutes at most are looked at, the pictures and the
+ * sound of each end decoded by processes of their own, all at once; at
+ * the start, decoding stops at the first thing that isn't blank.
+ */
+
+class TrimDetector : public QThread
+{
+	Q_OBJECT
+
+public:
+	TrimDetector(QObject *parent = NULL);
+	~TrimDetector();
+
+	/* streams are ids, -1 for the first one, or for none with the
+	 * corresponding flag off; duration -1 if unknown */
+	void detect(const QString &input, double duration, bool video, int video_stream,
+		bool audio, int audio_stream);
+	QString input() const { return input_; }
+
+	/* where the input stops being blank, 0 for right away */
+	double trimStart() const { return start_; }
+	/* where it becomes blank for good, -1 for never or unknown */
+	double trimEnd() const { return end_; }
+	/* empty if the input was scanned */
+	QString error() const { return error_; }
+
+protected:
+	void run();
+
+private:
+	class Scan;
+	friend class Scan;
+
+	QString input_;
+	double duration_;
+	bool video_;
+	int video_stream_;
+	bool audio_;
+	int audio_stream_;
+	volatile bool stopping_;
+	double start_;
+	double end_;
+	QString error_;
+};
+
+#endif // H_TRIMDETECT
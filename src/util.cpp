@@ -19,7 +19,18 @@
  *
  */
 
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QRegExp>
 #include <QStringList>
+#include <QThread>
+#include <QThreadStorage>
+#include <cmath>
+#include <cstdio>
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
 #include "util.h"
 
 static QString
@@ -50,3 +61,113 @@ parse_json_pair(QString input, QString *key, QString *value)
 	*value = unquote(sl[1]);
 	return true;
 }
+
+/* ffmpeg2theora options followed by a value */
+static const char * const value_options[] = {
+	"--starttime", "--endtime", "--audiostream", "--channels", "--samplerate",
+	"--audioquality", "--audiobitrate", "--videostream", "--videoquality",
+	"--videobitrate", "-v", "--width", "--height", "--aspect", "--croptop",
+	"--cropbottom", "--cropleft", "--cropright", "--inputfps", "--framerate",
+	"--contrast", "--brightness", "--gamma", "--saturation", "--keyint",
+	"--format", "--buf-delay", "--subtitles", "--subtitles-category",
+	"--subtitles-language", "--subtitles-encoding", "--artist", "--title",
+	"--date", "--location", "--organization", "--copyright", "--license",
+	"--contact", "--speedlevel", "--loudness"
+};
+
+static const struct {
+	const char *option;
+	const char *tag;
+} tag_options[] = {
+	{ "--artist", "ARTIST" },
+	{ "--title", "TITLE" },
+	{ "--date", "DATE" },
+	{ "--location", "LOCATION" },
+	{ "--organization", "ORGANIZATION" },
+	{ "--copyright", "COPYRIGHT" },
+	{ "--license", "LICENSE" },
+	{ "--contact", "CONTACT" }
+};
+
+#define LENGTH(x) int(sizeof(x) / sizeof(*x))
+
+bool
+option_takes_value(const QString &opt)
+{
+	for (int i = 0; i < LENGTH(value_options); i++)
+		if (opt == value_options[i])
+			return true;
+	return false;
+}
+
+const char *
+option_tag(const QString &opt)
+{
+	for (int i = 0; i < LENGTH(tag_options); i++)
+		if (opt == tag_options[i].option)
+			return tag_options[i].tag;
+	return NULL;
+}
+
+double
+parse_frame_rate(const QString &s)
+{
+	QStringList sl = s.split(QRegExp("[:/]"));
+	double num = sl.value(0).toDouble();
+	double den = sl.size() > 1 ? sl[1].toDouble() : 1;
+	return den > 0 ? num / den : 0;
+}
+
+/* eq's fixed point formula without gamma, its floating point table with it */
+
+bool
+eq_lut(uchar *lut, double contrast, double brightness, double gamma)
+{
+	if (contrast == 1.0 && brightness == 0.0 && gamma == 1.0)
+		return false;
+	if (gamma == 1.0 && fabs(contrast) < 7.9) {
+		int c = int(contrast * 256 * 16);
+		int b = (int(100.0 * brightness + 100.0) * 511) / 200 - 128 - c / 32;
+		for (int i = 0; i < 256; i++) {
+			int pel = ((i * c) >> 12) + b;
+			lut[i] = pel & ~255 ? uchar((-pel) >> 31) : uchar(pel);
+		}
+		return true;
+	}
+	double g = 1.0 / gamma;
+	for (int i = 0; i < 256; i++) {
+		double v = contrast * (i / 255.0 - 0.5) + 0.5 + brightness;
+		if (v <= 0.0)
+			lut[i] = 0;
+		else {
+			v = pow(v, g);
+			lut[i] = v >= 1.0 ? 255 : uchar(256.0 * v);
+		}
+	}
+	return true;
+}
+
+bool
+replace_file(const QString &part, const QString &filename)
+{
+#ifdef Q_OS_WIN
+	return MoveFileExW((LPCWSTR)part.utf16(), (LPCWSTR)filename.utf16(),
+		MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	return ::rename(QFile::encodeName(part).constData(), QFile::encodeName(filename).constData()) == 0;
+#endif
+}
+
+quint32
+random_serialno()
+{
+	static QThreadStorage<bool *> seeded;
+	if (!seeded.hasLocalData()) {
+		QDateTime now = QDateTime::currentDateTime();
+		qsrand(now.toTime_t() ^ now.time().msec() << 16 ^ QCoreApplication::applicationPid() ^
+			quint32(quintptr(QThread::currentThreadId())));
+		seeded.setLocalData(new bool(true));
+	}
+	/* RAND_MAX may be as small as 15 bits */
+	return quint32(qrand()) << 30 ^ quint32(qrand()) << 15 ^ quint32(qrand());
+}
@@ -26,4 +26,35 @@
 
 bool parse_json_pair(QString, QString *key, QString *value);
 
+/* what the ffmpeg2theora command line options are */
+bool option_takes_value(const QString &);
+/* the comment tag set by a metadata option, or NULL */
+const char *option_tag(const QString &);
+/* "25:1", "30000:1001" or just "25", 0 if it isn't a rate */
+double parse_frame_rate(const QString &);
+
+/* ffmpeg's eq filter as a table for one plane: luma takes all three
+ * values, chroma the saturation as its contrast. False if the table
+ * would change nothing. */
+bool eq_lut(uchar *, double contrast, double brightness = 0, double gamma = 1);
+
+/* part takes the place of filename in one step, as rename(2) does it;
+ * if that fails, filename is left as it was */
+bool replace_file(const QString &part, const QString &filename);
+
+/* an Ogg serial number that differs between runs and threads, as qrand()
+ * alone starts every thread from the same seed */
+quint32 random_serialno();
+
+/* callbacks from stages running inside the transcoder thread */
+
+class ProgressListener
+{
+public:
+	virtual ~ProgressListener() { }
+	virtual void progress(double pos, double audio_b = -1, double video_b = -1, int pass = -1) = 0;
+	virtual bool cancelled() const = 0;
+	virtual void waitWhilePaused() { }
+};
+
 #endif /* H_UTIL */
@@ -0,0 +1,135 @@
+/*
+ * verifier.cpp - checks of finished Ogg files
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QMap>
+#include "verifier.h"
+
+double
+OggReport::duration() const
+{
+	QMap<int, double> links;
+	for (int i = 0; i < streams.size(); i++) {
+		double d = streams[i].duration();
+		if (d > links.value(streams[i].link, 0))
+			links[streams[i].link] = d;
+	}
+	double ret = 0;
+	for (QMap<int, double>::const_iterator i = links.begin(); i != links.end(); ++i)
+		ret += i.value();
+	return ret;
+}
+
+QStringList
+OggReport::problems() const
+{
+	QStringList ret;
+	if (streams.isEmpty())
+		ret << "No Ogg streams found";
+	if (damaged > 0)
+		ret << QString("%1 bytes damaged or out of place from offset %2")
+			.arg(damaged).arg(first_damage);
+	for (int i = 0; i < streams.size(); i++) {
+		const OggStreamReport &s = streams[i];
+		if (s.lost_pages > 0)
+			ret << QString("%1 pages of stream %2 missing").arg(s.lost_pages).arg(s.info.serialno);
+		if (s.misplaced_pages > 0)
+			ret << QString("%1 pages of stream %2 duplicated or out of order")
+				.arg(s.misplaced_pages).arg(s.info.serialno);
+		if (!s.eos)
+			ret << QString("Stream %1 is cut short").arg(s.info.serialno);
+	}
+	return ret;
+}
+
+OggReport
+verify_ogg(const QString &filename)
+{
+	OggReport ret;
+	OggReader in;
+	in.open(filename);
+	ret.size = in.size();
+
+	QMap<quint32, int> index;
+	QMap<quint32, quint32> seqno;
+	int link = 0;
+	bool data = false;
+	qint64 expected = 0;
+	OggPage page;
+	while (in.readPage(&page, false)) {
+		if (page.offset != expected && ret.first_damage < 0)
+			ret.first_damage = expected;
+		expected = in.pos();
+
+		if (page.bos()) {
+			/* the first packet tells the codec, it's the only body we need */
+			in.seek(page.offset);
+			in.readPage(&page);
+			if (data) {
+				link++;
+				data = false;
+				index.clear();
+				seqno.clear();
+			}
+			OggStreamReport s;
+			OggPacketReader reader;
+			QByteArray packet;
+			reader.pageIn(page);
+			if (reader.packetOut(&packet))
+				s.info.identify(page.serialno, packet);
+			s.info.serialno = page.serialno;
+			s.link = link;
+			index[page.serialno] = ret.streams.size();
+			ret.streams << s;
+		} else
+			data = true;
+
+		if (!index.contains(page.serialno)) {
+			/* a stream without its first page */
+			OggStreamReport s;
+			s.info.serialno = page.serialno;
+			s.link = link;
+			s.lost_pages = 1;
+			index[page.serialno] = ret.streams.size();
+			ret.streams << s;
+		}
+		OggStreamReport &s = ret.streams[index[page.serialno]];
+		/* the highest so far, so a stray page doesn't count the
+		 * ones after it as lost */
+		if (!seqno.contains(page.serialno))
+			seqno[page.serialno] = page.seqno;
+		else if (page.seqno <= seqno[page.serialno])
+			s.misplaced_pages++;
+		else {
+			s.lost_pages += page.seqno - seqno[page.serialno] - 1;
+			seqno[page.serialno] = page.seqno;
+		}
+		s.pages++;
+		s.bytes += expected - page.offset;
+		if (page.granulepos >= 0)
+			s.last_granule = page.granulepos;
+		if (page.eos())
+			s.eos = true;
+	}
+	ret.damaged = in.skipped();
+	if (ret.damaged > 0 && ret.first_damage < 0)
+		ret.first_damage = expected;
+	return ret;
+}
@@ -0,0 +1,65 @@
+/*
+ * verifier.h - checks of finished Ogg files
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_VERIFIER
+#define H_VERIFIER
+
+#include <QList>
+#include <QStringList>
+#include "ogg.h"
+
+struct OggStreamReport
+{
+	OggStreamInfo info;
+	int link;           /* of a chained file */
+	qint64 pages;
+	qint64 bytes;
+	qint64 lost_pages;  /* by the gaps in the sequence numbers */
+	qint64 misplaced_pages; /* repeating a sequence number or going back */
+	qint64 last_granule;
+	bool eos;
+
+	OggStreamReport(): link(0), pages(0), bytes(0), lost_pages(0), misplaced_pages(0),
+		last_granule(-1), eos(false) { }
+	double duration() const { return info.time(last_granule); }
+};
+
+struct OggReport
+{
+	qint64 size;
+	qint64 damaged;       /* bytes outside any intact page */
+	qint64 first_damage;
+	QList<OggStreamReport> streams;
+
+	OggReport(): size(0), damaged(0), first_damage(-1) { }
+	/* the longest stream of each link, added up */
+	double duration() const;
+	/* what's wrong with the file, nothing if it's intact */
+	QStringList problems() const;
+};
+
+/* Walks all the pages of the file through the memory map, checking their
+ * CRCs without copying them. Throws if the file can't be read at all.
+ */
+
+OggReport verify_ogg(const QString &filename);
+
+#endif // H_VERIFIER
@@ -0,0 +1,266 @@
+/*
+ * watchdog.cpp - GUI thread stall detection
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QAbstractEventDispatcher>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QEvent>
+#include <QFile>
+#include <QSettings>
+#include <QTextStream>
+#include <cmath>
+#include <cstdio>
+#include "trace.h"
+#include "watchdog.h"
+
+#define CHECK_INTERVAL 20      /* ms */
+#define HEARTBEAT_INTERVAL 100 /* ms */
+#define DEFAULT_THRESHOLD 200  /* ms */
+#define BUCKETS_PER_OCTAVE 4
+#define BUCKETS (25 * BUCKETS_PER_OCTAVE + 1) /* up to 2^25 µs, about 30 s */
+#define STALL_LOG 100
+
+static const QEvent::Type HEARTBEAT = QEvent::Type(QEvent::User + 146);
+
+/* what the GUI thread was last given to handle, NULL once it went idle */
+static QMutex dispatch_mutex;
+static const char *dispatch_class = NULL;
+static int dispatch_type = 0;
+
+static QString
+event_name(int type)
+{
+	switch (type) {
+	case QEvent::MetaCall:
+		return "queued call";
+	case QEvent::Timer:
+		return "timer";
+	case QEvent::Paint:
+		return "paint";
+	case QEvent::Resize:
+		return "resize";
+	case QEvent::MouseButtonPress:
+	case QEvent::MouseButtonRelease:
+	case QEvent::MouseButtonDblClick:
+		return "mouse click";
+	case QEvent::KeyPress:
+	case QEvent::KeyRelease:
+		return "key";
+	case QEvent::SockAct:
+		return "socket";
+	case QEvent::DeferredDelete:
+		return "deferred delete";
+	default:
+		return QString("event %1").arg(type);
+	}
+}
+
+static int
+bucket(qint64 us)
+{
+	if (us < 1)
+		return 0;
+	int b = int(floor(log(double(us)) / log(2.0) * BUCKETS_PER_OCTAVE)) + 1;
+	return qMin(b, BUCKETS - 1);
+}
+
+/* the upper bound of a bucket, in µs */
+
+static qint64
+bucket_limit(int b)
+{
+	return qint64(ceil(pow(2.0, double(b) / BUCKETS_PER_OCTAVE)));
+}
+
+static QString
+ms(qint64 us)
+{
+	return QString::number(us / 1000.0, 'f', 1) + " ms";
+}
+
+Watchdog *
+Watchdog::instance()
+{
+	static Watchdog *watchdog = NULL;
+	if (watchdog == NULL)
+		watchdog = new Watchdog();
+	return watchdog;
+}
+
+Watchdog::Watchdog()
+	: QThread(NULL), stopping_(false), histogram_(BUCKETS), count_(0), max_(0),
+	stall_count_(0), posted_(-1)
+{
+	QSettings settings("QTheoraFrontend team", "QTheoraFrontend");
+	threshold_ = settings.value("watchdog_threshold", DEFAULT_THRESHOLD).toInt();
+}
+
+void
+Watchdog::watch()
+{
+	if (threshold_ <= 0 || isRunning())
+		return;
+	QCoreApplication::instance()->installEventFilter(this);
+	connect(QAbstractEventDispatcher::instance(), SIGNAL(aboutToBlock()), SLOT(idle()),
+		Qt::DirectConnection);
+	stopping_ = false;
+	start(QThread::HighPriority);
+}
+
+void
+Watchdog::stop()
+{
+	if (!isRunning())
+		return;
+	stopping_ = true;
+	wait();
+	QCoreApplication::instance()->removeEventFilter(this);
+	disconnect(QAbstractEventDispatcher::instance(), SIGNAL(aboutToBlock()), this, SLOT(idle()));
+}
+
+/* every event for an object on the GUI thread passes here first; the
+ * latest one, unless the loop has gone idle since, is the one it's in */
+
+bool
+Watchdog::eventFilter(QObject *receiver, QEvent *e)
+{
+	QMutexLocker locker(&dispatch_mutex);
+	dispatch_class = receiver->metaObject()->className();
+	dispatch_type = e->type();
+	return false;
+}
+
+void
+Watchdog::idle()
+{
+	QMutexLocker locker(&dispatch_mutex);
+	dispatch_class = NULL;
+}
+
+QString
+Watchdog::dispatching() const
+{
+	QMutexLocker locker(&dispatch_mutex);
+	if (dispatch_class == NULL)
+		return "idle";
+	return event_name(dispatch_type) + " for " + dispatch_class;
+}
+
+void
+Watchdog::run()
+{
+	Trace::threadName("watchdog");
+	qint64 last = 0;
+	while (!stopping_) {
+		msleep(CHECK_INTERVAL);
+		qint64 now = Trace::now();
+		QMutexLocker locker(&mutex_);
+		if (posted_ < 0 && now - last >= HEARTBEAT_INTERVAL * 1000) {
+			posted_ = last = now;
+			QCoreApplication::postEvent(this, new QEvent(HEARTBEAT), Qt::HighEventPriority);
+		} else if (posted_ >= 0 && now - posted_ > threshold_ * 1000 && stall_slot_.isNull()) {
+			/* while it's still stuck in there */
+			stall_slot_ = dispatching();
+		}
+	}
+}
+
+/* on the GUI thread, where the Watchdog object lives */
+
+bool
+Watchdog::event(QEvent *e)
+{
+	if (e->type() != HEARTBEAT)
+		return QThread::event(e);
+	qint64 now = Trace::now();
+	QMutexLocker locker(&mutex_);
+	qint64 latency = now - posted_;
+	histogram_[bucket(latency)]++;
+	count_++;
+	max_ = qMax(max_, latency);
+	if (latency > threshold_ * 1000) {
+		Stall s;
+		s.when = posted_;
+		s.latency = latency;
+		s.slot = stall_slot_.isNull() ? QString("unknown") : stall_slot_;
+		stalls_.push_back(s);
+		if (stalls_.size() > STALL_LOG)
+			stalls_.removeFirst();
+		stall_count_++;
+		Trace::complete("stall", posted_, s.slot);
+		fprintf(stderr, "GUI thread stalled for %s in %s\n", qPrintable(ms(latency)), qPrintable(s.slot));
+	}
+	stall_slot_ = QString();
+	posted_ = -1;
+	return true;
+}
+
+qint64
+Watchdog::percentile(double p) const
+{
+	qint64 need = qint64(ceil(p * count_)), seen = 0;
+	for (int i = 0; i < histogram_.size(); i++) {
+		seen += histogram_[i];
+		if (seen >= need && seen > 0)
+			return qMin(bucket_limit(i), max_);
+	}
+	return max_;
+}
+
+QString
+Watchdog::report() const
+{
+	QMutexLocker locker(&mutex_);
+	if (threshold_ <= 0)
+		return "The watchdog is off (watchdog_threshold is 0).";
+	QString ret;
+	QTextStream s(&ret);
+	s << "Event dispatch latency over " << count_ << " heartbeats: p50 " << ms(percentile(0.5))
+		<< ", p99 " << ms(percentile(0.99)) << ", max " << ms(max_) << "\n";
+	s << stall_count_ << " stalls over " << threshold_ << " ms";
+	if (!stalls_.isEmpty())
+		s << ", the latest:";
+	s << "\n";
+	qint64 now = Trace::now();
+	QDateTime wall = QDateTime::currentDateTime();
+	for (int i = stalls_.size() - 1; i >= 0; i--) {
+		const Stall &st = stalls_[i];
+		s << wall.addMSecs(-(now - st.when) / 1000).toString("hh:mm:ss") << "  "
+			<< ms(st.latency) << "  " << st.slot << "\n";
+	}
+	return ret;
+}
+
+bool
+Watchdog::dump(const QString &filename) const
+{
+	QFile f(filename);
+	if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+		return false;
+	QTextStream s(&f);
+	s << report() << "\nlatency_up_to_us,count\n";
+	QMutexLocker locker(&mutex_);
+	for (int i = 0; i < histogram_.size(); i++)
+		if (histogram_[i] > 0)
+			s << bucket_limit(i) << "," << histogram_[i] << "\n";
+	s.flush();
+	return f.error() == QFile::NoError;
+}
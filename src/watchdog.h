@@ -0,0 +1,86 @@
+/*
+ * watchdog.h - GUI thread stall detection
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_WATCHDOG
+#define H_WATCHDOG
+
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QVector>
+
+/* Measures how long events wait to be dispatched on the GUI thread: a
+ * thread of its own posts a heartbeat event every so often and the time
+ * until it's handled goes into a histogram. A heartbeat late by more than
+ * the threshold is a stall, logged with the event the GUI thread was
+ * handling at the time, as seen by an event filter on the application. In the frontend, Ctrl+Shift+L shows the numbers.
+ *
+ * Settings: watchdog_threshold (ms, 0 to turn it off).
+ */
+
+class Watchdog : public QThread
+{
+	Q_OBJECT
+
+public:
+	static Watchdog *instance();
+
+	/* from the GUI thread, once the application exists */
+	void watch();
+	void stop();
+
+	QString report() const;
+	bool dump(const QString &filename) const;
+
+protected:
+	void run();
+	bool event(QEvent *);
+	bool eventFilter(QObject *, QEvent *);
+
+private slots:
+	void idle();
+
+private:
+	struct Stall {
+		qint64 when;    /* µs, Trace::now() */
+		qint64 latency; /* µs */
+		QString slot;
+	};
+
+	Watchdog();
+	QString dispatching() const;
+	qint64 percentile(double p) const;
+
+	int threshold_; /* ms */
+	volatile bool stopping_;
+	mutable QMutex mutex_;
+	QVector<int> histogram_;
+	qint64 count_;
+	qint64 max_;
+	QList<Stall> stalls_;
+	qint64 stall_count_;
+	/* the heartbeat on its way, -1 if none */
+	qint64 posted_;
+	QString stall_slot_;
+};
+
+#endif // H_WATCHDOG
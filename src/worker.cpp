@@ -0,0 +1,554 @@
+/*
+ * worker.cpp - encoding worker daemon
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#include <QDir>
+#include <QFileInfo>
+#include <QHostInfo>
+#include <QLocalSocket>
+#include <QProcess>
+#include <QRegExp>
+#include <QSettings>
+#include <QTcpSocket>
+#include <QTemporaryFile>
+#include <stdexcept>
+#ifdef Q_OS_UNIX
+#include <sys/statvfs.h>
+#endif
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
+#include "worker.h"
+#include "fileinfo.h"
+#include "remote.h"
+#include "scheduler.h"
+#include "sniff.h"
+#include "transcoder.h"
+#include "util.h"
+
+#define CHUNK_SIZE 65536
+#define MAX_SUFFIX 16
+#define DEFAULT_MAX_UPLOAD 16384 /* MB */
+#define UPLOAD_HEADROOM (256 << 20) /* bytes left free for the output */
+
+/* what Frontend::arguments() may pass without a value; the ones with
+ * one are those of option_takes_value() */
+static const char * const flag_options[] = {
+	"--noaudio", "--novideo", "--sync", "--no-skeleton", "--two-pass",
+	"--soft-target", "--optimize", "--deinterlace", "--max-size",
+	"--no-upscaling", "--nosubtitles", "--subtitles-ignore-non-utf8",
+	"--nometadata", KEYFRAME_INDEX_OPTION, PREFILTER_OPTION,
+	AUDIO_PREFILTER_OPTION, SCENE_KEYFRAMES_OPTION
+};
+
+#define LENGTH(x) int(sizeof(x) / sizeof(*x))
+
+Worker::Worker(QObject *parent)
+	: QObject(parent)
+{
+	QSettings settings("QTheoraFrontend team", "QTheoraFrontend");
+	secret_ = settings.value("worker_secret").toString();
+	root_ = settings.value("worker_root").toString();
+	max_upload_ = settings.value("worker_max_upload", DEFAULT_MAX_UPLOAD).toLongLong() * 1024 * 1024;
+	connect(&tcp_, SIGNAL(newConnection()), this, SLOT(newTcpConnection()));
+	connect(&local_, SIGNAL(newConnection()), this, SLOT(newLocalConnection()));
+}
+
+/* "host:port" ("*:port" for all interfaces), a bare port to listen on
+ * the loopback interface only, or a local socket */
+
+bool
+Worker::listen(const QString &address)
+{
+	QString host;
+	quint16 port;
+	bool bare_port;
+	port = address.toUShort(&bare_port);
+	if (bare_port || is_tcp_address(address, &host, &port)) {
+		if (secret_.isEmpty()) {
+			error_ = "TCP needs a shared secret (--secret or the worker_secret setting)";
+			return false;
+		}
+		QHostAddress addr(host == "*" ? QHostAddress::Any : QHostAddress::LocalHost);
+		if (!host.isEmpty() && host != "*" && !addr.setAddress(host)) {
+			QList<QHostAddress> found = QHostInfo::fromName(host).addresses();
+			if (found.isEmpty()) {
+				error_ = "Unknown host " + host;
+				return false;
+			}
+			addr = found[0];
+		}
+		if (!tcp_.listen(addr, port)) {
+			error_ = tcp_.errorString();
+			return false;
+		}
+		return true;
+	}
+	/* a socket left over by a crashed worker */
+	QLocalServer::removeServer(address);
+	if (!local_.listen(address)) {
+		error_ = local_.errorString();
+		return false;
+	}
+	return true;
+}
+
+/* the same time for any guess, so that timing gives nothing away */
+
+bool
+Worker::checkSecret(const QString &s) const
+{
+	QByteArray a = s.toUtf8(), b = secret_.toUtf8();
+	int diff = a.size() ^ b.size();
+	for (int i = 0; i < b.size(); i++)
+		diff |= b[i] ^ (i < a.size() ? a[i] : 0);
+	return diff == 0;
+}
+
+/* Symbolic links are followed before the check, and an output, which
+ * need not exist yet, has its directory checked and may not be a link.
+ */
+
+QString
+Worker::confine(const QString &path, bool output) const
+{
+	if (root_.isEmpty())
+		throw std::runtime_error("This worker only takes uploaded files");
+	QString root = QFileInfo(root_).canonicalFilePath();
+	QFileInfo fi(QDir(root).filePath(path));
+	QString resolved, name = fi.fileName();
+	if (!output)
+		resolved = fi.canonicalFilePath();
+	else if (!name.isEmpty() && name != "." && name != ".." && !fi.isSymLink()) {
+		QString dir = QFileInfo(fi.absolutePath()).canonicalFilePath();
+		if (!dir.isEmpty())
+			resolved = QDir(dir).filePath(name);
+	}
+	if (root.isEmpty() || resolved.isEmpty() || !resolved.startsWith(root + "/"))
+		throw std::runtime_error(qPrintable("Not in the worker's directory: " + path));
+	return resolved;
+}
+
+/* bytes free in the directory, -1 if that can't be told */
+
+static qint64
+free_space(const QString &dir)
+{
+#ifdef Q_OS_UNIX
+	struct statvfs st;
+	if (statvfs(QFile::encodeName(dir).constData(), &st) == 0)
+		return qint64(st.f_bavail) * st.f_frsize;
+#elif defined(Q_OS_WIN)
+	ULARGE_INTEGER avail;
+	if (GetDiskFreeSpaceExW((LPCWSTR)dir.utf16(), &avail, NULL, NULL))
+		return qint64(avail.QuadPart);
+#else
+	Q_UNUSED(dir);
+#endif
+	return -1;
+}
+
+QString
+Worker::checkUpload(qint64 size) const
+{
+	if (size < 0)
+		return "Malformed UPLOAD command";
+	if (size > max_upload_)
+		return QString("Uploads are limited to %1 MB").arg(max_upload_ >> 20);
+	qint64 avail = free_space(QDir::tempPath());
+	if (avail >= 0 && size > avail - UPLOAD_HEADROOM)
+		return "Not enough space for the upload";
+	return QString();
+}
+
+void
+Worker::newTcpConnection()
+{
+	while (tcp_.hasPendingConnections())
+		new WorkerSession(tcp_.nextPendingConnection(), this);
+}
+
+void
+Worker::newLocalConnection()
+{
+	while (local_.hasPendingConnections())
+		new WorkerSession(local_.nextPendingConnection(), this);
+}
+
+/* the suffix only tells ffmpeg2theora the format: letters and digits */
+
+static QString
+temporary_name(const QString &suffix)
+{
+	QString name = "qtheorafrontend-XXXXXX";
+	QString clean = QString(suffix).remove(QRegExp("[^A-Za-z0-9]")).left(MAX_SUFFIX);
+	if (!clean.isEmpty())
+		name += "." + clean;
+	QTemporaryFile f(QDir::temp().filePath(name));
+	f.setAutoRemove(false);
+	if (!f.open())
+		throw std::runtime_error("Can't create a temporary file");
+	return f.fileName();
+}
+
+WorkerSession::WorkerSession(QIODevice *sock, Worker *parent)
+	: QObject(parent), worker_(parent), sock_(sock), authorized_(!parent->needsSecret()),
+	transcoder_(NULL), info_proc_(NULL), info_probe_(false), closing_(false),
+	reported_(false), reason_(Transcoder::FAILED), upload_left_(0)
+{
+	sock_->setParent(this);
+	connect(sock_, SIGNAL(readyRead()), this, SLOT(readyRead()));
+	connect(sock_, SIGNAL(bytesWritten(qint64)), this, SLOT(bytesWritten()));
+	connect(sock_, SIGNAL(disconnected()), this, SLOT(disconnected()));
+}
+
+WorkerSession::~WorkerSession()
+{
+	removeTemporary();
+}
+
+void
+WorkerSession::removeTemporary()
+{
+	upload_.close();
+	download_.close();
+	if (!uploaded_.isEmpty())
+		QFile::remove(uploaded_);
+	if (!output_.isEmpty())
+		QFile::remove(output_);
+	uploaded_ = output_ = QString();
+}
+
+void
+WorkerSession::send(const QStringList &message)
+{
+	if (!closing_)
+		sock_->write(encode_message(message));
+}
+
+void
+WorkerSession::readyRead()
+{
+	while (sock_->bytesAvailable() > 0) {
+		if (upload_left_ > 0) {
+			QByteArray data = sock_->read(qMin(upload_left_, qint64(CHUNK_SIZE)));
+			if (upload_.write(data) != data.size()) {
+				removeTemporary();
+				upload_left_ = 0;
+				send(QStringList() << "ERROR" << "Can't write the upload");
+				sock_->close();
+				return;
+			}
+			upload_left_ -= data.size();
+			if (upload_left_ == 0)
+				upload_.close();
+		} else if (sock_->canReadLine()) {
+			QStringList msg = decode_message(sock_->readLine());
+			if (!msg.isEmpty())
+				command(msg);
+		} else
+			break;
+	}
+}
+
+void
+WorkerSession::command(const QStringList &msg)
+{
+	try {
+		const QString &cmd = msg[0];
+		if (cmd == "AUTH") {
+			authorized_ = worker_->checkSecret(msg.value(1));
+			if (!authorized_) {
+				send(QStringList() << "ERROR" << "Wrong secret");
+				sock_->close();
+			}
+		} else if (!authorized_) {
+			send(QStringList() << "ERROR" << "Not authorized");
+			sock_->close();
+		} else if (cmd == "PROBE")
+			probe(worker_->confine(msg.value(1)));
+		else if (cmd == "INFO")
+			info(worker_->confine(msg.value(1)));
+		else if (cmd == "UPLOAD")
+			upload(msg.value(1).toLongLong(), msg.value(2));
+		else if (cmd == "ENCODE")
+			encode(msg.mid(1));
+		else if (cmd == "STOP") {
+			if (transcoder_ == NULL)
+				return;
+			if (Scheduler::instance()->remove(transcoder_)) {
+				finished(Transcoder::STOPPED);
+				transcoderDone();
+			} else
+				transcoder_->stop();
+		} else if (cmd == "PAUSE") {
+			if (transcoder_ != NULL)
+				Scheduler::instance()->pause(transcoder_);
+		} else if (cmd == "RESUME") {
+			if (transcoder_ != NULL)
+				Scheduler::instance()->resume(transcoder_);
+		} else
+			throw std::runtime_error(qPrintable("Unknown command " + cmd));
+	} catch (std::exception &x) {
+		send(QStringList() << "ERROR" << x.what());
+	}
+}
+
+/* probed here, sent in FileInfo's binary form */
+
+void
+WorkerSession::probe(const QString &filename)
+{
+	Sniff sniffed = sniff_file(filename);
+	if (sniffed.verdict == Sniff::JUNK)
+		throw std::runtime_error(std::string("Not audio or video: ") + sniffed.what);
+	startInfo(filename, true);
+}
+
+/* ffmpeg2theora's own output is relayed, FileInfo parses it on the other side */
+
+void
+WorkerSession::info(const QString &filename)
+{
+	startInfo(filename, false);
+}
+
+/* run without waiting, so that the other sessions and the jobs' progress
+ * go on meanwhile */
+
+void
+WorkerSession::startInfo(const QString &filename, bool probe)
+{
+	if (info_proc_ != NULL)
+		throw std::runtime_error("A probe is already running");
+	info_probe_ = probe;
+	info_lines_.clear();
+	info_proc_ = new QProcess(this);
+	connect(info_proc_, SIGNAL(readyReadStandardOutput()), this, SLOT(infoReadyRead()));
+	connect(info_proc_, SIGNAL(finished(int, QProcess::ExitStatus)),
+		this, SLOT(infoFinished(int, QProcess::ExitStatus)));
+	connect(info_proc_, SIGNAL(error(QProcess::ProcessError)),
+		this, SLOT(infoError(QProcess::ProcessError)));
+	info_proc_->start(Transcoder::ffmpeg2theora(), QStringList() << "--info" << filename);
+}
+
+/* at the end, what's left is the last line, without its newline */
+
+void
+WorkerSession::infoReadyRead()
+{
+	bool done = info_proc_->state() == QProcess::NotRunning;
+	while (info_proc_->canReadLine() || (done && !info_proc_->atEnd())) {
+		QByteArray line = info_proc_->readLine().trimmed();
+		if (info_probe_)
+			info_lines_ << line;
+		else
+			send(QStringList() << "LINE" << QString::fromUtf8(line));
+	}
+}
+
+void
+WorkerSession::infoFinished(int code, QProcess::ExitStatus status)
+{
+	infoReadyRead();
+	if (status != QProcess::NormalExit)
+		code = -1;
+	if (!info_probe_)
+		send(QStringList() << "END" << QString::number(code));
+	else if (code != 0)
+		send(QStringList() << "ERROR" << "Invalid input file");
+	else {
+		FileInfo fi;
+		fi.parse(info_lines_);
+		send(QStringList() << "FILEINFO" << QString::fromAscii(fi.serialize().toBase64()));
+	}
+	info_proc_->deleteLater();
+	info_proc_ = NULL;
+}
+
+void
+WorkerSession::infoError(QProcess::ProcessError error)
+{
+	if (error != QProcess::FailedToStart)
+		return;
+	send(QStringList() << "ERROR" << "Info retrieval failed to start");
+	info_proc_->deleteLater();
+	info_proc_ = NULL;
+}
+
+void
+WorkerSession::upload(qint64 size, const QString &suffix)
+{
+	/* the file's bytes would be taken for commands, the session ends */
+	QString refused = transcoder_ != NULL ? QString("A job is already running") :
+		worker_->checkUpload(size);
+	if (!refused.isEmpty()) {
+		send(QStringList() << "ERROR" << refused);
+		sock_->close();
+		return;
+	}
+	removeTemporary();
+	uploaded_ = temporary_name(suffix);
+	upload_.setFileName(uploaded_);
+	if (!upload_.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		throw std::runtime_error("Can't create a temporary file");
+	upload_left_ = size;
+	if (size == 0)
+		upload_.close();
+}
+
+void
+WorkerSession::encode(const QStringList &args)
+{
+	if (transcoder_ != NULL)
+		throw std::runtime_error("A job is already running");
+	if (args.size() < 3)
+		throw std::runtime_error("Malformed ENCODE command");
+	QString input = args[1];
+	QString output = args[2];
+	QStringList options = checkOptions(args.mid(3));
+	if (input == "-") {
+		if (uploaded_.isEmpty())
+			throw std::runtime_error("No input was uploaded");
+		input = uploaded_;
+	} else
+		input = worker_->confine(input);
+	if (output == "-")
+		output = output_ = temporary_name("ogv");
+	else
+		output = worker_->confine(output, true);
+
+	reported_ = false;
+	transcoder_ = new Transcoder(NULL);
+	transcoder_->setPriority(Transcoder::Priority(qBound(0, args[0].toInt(), int(Transcoder::URGENT))));
+	connect(transcoder_, SIGNAL(statusUpdate(QString)), this, SLOT(statusUpdate(QString)));
+	connect(transcoder_, SIGNAL(statusUpdate(double, double, double, double, int)),
+		this, SLOT(statusUpdate(double, double, double, double, int)));
+	connect(transcoder_, SIGNAL(finished(int)), this, SLOT(finished(int)));
+	connect(transcoder_, SIGNAL(finished()), this, SLOT(transcoderDone()));
+	Scheduler::instance()->submit(transcoder_, input, output, options);
+	if (Scheduler::instance()->isQueued(transcoder_))
+		send(QStringList() << "STATUS" << "Waiting for a free processor");
+}
+
+/* only options the frontend passes, files they name under the root */
+
+QStringList
+WorkerSession::checkOptions(const QStringList &args) const
+{
+	QStringList ret;
+	for (int i = 0; i < args.size(); i++) {
+		QString opt = args[i];
+		bool flag = false;
+		for (int j = 0; j < LENGTH(flag_options) && !flag; j++)
+			flag = opt == flag_options[j];
+		if (flag) {
+			ret << opt;
+			continue;
+		}
+		if (!option_takes_value(opt) || i + 1 >= args.size())
+			throw std::runtime_error(qPrintable("Option not allowed: " + opt));
+		QString v = args[++i];
+		if (opt == "--subtitles")
+			v = worker_->confine(v);
+		else if (opt == "--format" && v.contains(QRegExp("[^A-Za-z0-9_]")))
+			throw std::runtime_error(qPrintable("Invalid input format: " + v));
+		ret << opt << v;
+	}
+	return ret;
+}
+
+void
+WorkerSession::statusUpdate(QString status)
+{
+	send(QStringList() << "STATUS" << status);
+}
+
+void
+WorkerSession::statusUpdate(double pos, double eta, double audio_b, double video_b, int pass)
+{
+	send(QStringList() << "PROGRESS" << QString::number(pos) << QString::number(eta)
+		<< QString::number(audio_b) << QString::number(video_b) << QString::number(pass));
+}
+
+/* a streamed output goes back before FINISHED, in chunks as the socket drains */
+
+void
+WorkerSession::finished(int reason)
+{
+	reported_ = true;
+	reason_ = reason;
+	if (closing_)
+		return;
+	if (!output_.isEmpty()) {
+		download_.setFileName(output_);
+		if (download_.open(QIODevice::ReadOnly)) {
+			send(QStringList() << "OUTPUT" << QString::number(download_.size()));
+			bytesWritten();
+			return;
+		}
+	}
+	sendFinished();
+}
+
+void
+WorkerSession::bytesWritten()
+{
+	while (download_.isOpen() && sock_->bytesToWrite() < CHUNK_SIZE) {
+		if (download_.atEnd()) {
+			download_.close();
+			sendFinished();
+			break;
+		}
+		sock_->write(download_.read(CHUNK_SIZE));
+	}
+}
+
+void
+WorkerSession::sendFinished()
+{
+	send(QStringList() << "FINISHED" << QString::number(reason_));
+	removeTemporary();
+}
+
+/* the thread is over; a process that failed to start never says finished(int) */
+
+void
+WorkerSession::transcoderDone()
+{
+	if (!reported_)
+		finished(Transcoder::FAILED);
+	transcoder_->deleteLater();
+	transcoder_ = NULL;
+	if (closing_)
+		deleteLater();
+}
+
+void
+WorkerSession::disconnected()
+{
+	closing_ = true;
+	if (transcoder_ == NULL)
+		deleteLater();
+	else if (Scheduler::instance()->remove(transcoder_))
+		transcoderDone();
+	else
+		transcoder_->stop();
+}
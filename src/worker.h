@@ -0,0 +1,130 @@
+/*
+ * worker.h - encoding worker daemon declarations
+ * This file is part of QTheoraFrontend.
+ *
+ * Copyright (C) 2009  Anton Novikov <an146@ya.ru>
+ *
+ * The contents of this file can be redistributed and/or modified under the
+ * terms of the GNU General Public License as published by the Free
+ * Software Foundation, either version 3 of the License, or (at your
+ * option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+ * more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program. If not, see http://www.gnu.org/licenses/.
+ *
+ */
+
+#ifndef H_WORKER
+#define H_WORKER
+
+#include <QFile>
+#include <QLocalServer>
+#include <QList>
+#include <QObject>
+#include <QProcess>
+#include <QStringList>
+#include <QTcpServer>
+
+class QIODevice;
+class Transcoder;
+
+/* Serves the protocol described in remote.h, one session per
+ * connection. Encodes go through the local Scheduler, so the worker
+ * never runs more of them than it has processors.
+ *
+ * Clients have to know the shared secret (worker_secret), which TCP
+ * needs; files they name have to be under the root directory
+ * (worker_root), without which only uploads are taken; uploads have to
+ * fit under worker_max_upload (MB) and in the free space of the
+ * temporary directory; and only the options the frontend itself passes
+ * are accepted.
+ */
+
+class Worker : public QObject
+{
+	Q_OBJECT
+
+public:
+	Worker(QObject *parent = NULL);
+	void setSecret(const QString &s) { secret_ = s; }
+	void setRoot(const QString &r) { root_ = r; }
+	bool listen(const QString &address);
+	QString errorString() const { return error_; }
+
+	bool checkSecret(const QString &) const;
+	bool needsSecret() const { return !secret_.isEmpty(); }
+	/* the path resolved, if it is under the root; throws otherwise */
+	QString confine(const QString &path, bool output = false) const;
+	/* why an upload of size bytes is refused, empty if it isn't */
+	QString checkUpload(qint64 size) const;
+
+private slots:
+	void newTcpConnection();
+	void newLocalConnection();
+
+private:
+	QTcpServer tcp_;
+	QLocalServer local_;
+	QString error_;
+	QString secret_;
+	QString root_;
+	qint64 max_upload_;
+};
+
+class WorkerSession : public QObject
+{
+	Q_OBJECT
+
+public:
+	WorkerSession(QIODevice *, Worker *parent);
+	~WorkerSession();
+
+private slots:
+	void readyRead();
+	void bytesWritten();
+	void disconnected();
+	void statusUpdate(QString);
+	void statusUpdate(double pos, double eta, double audio_b, double video_b, int pass);
+	void finished(int reason);
+	void transcoderDone();
+	void infoReadyRead();
+	void infoFinished(int code, QProcess::ExitStatus);
+	void infoError(QProcess::ProcessError);
+
+private:
+	void command(const QStringList &);
+	void probe(const QString &filename);
+	void info(const QString &filename);
+	void startInfo(const QString &filename, bool probe);
+	void upload(qint64 size, const QString &suffix);
+	void encode(const QStringList &);
+	QStringList checkOptions(const QStringList &) const;
+	void send(const QStringList &);
+	void sendFinished();
+	void removeTemporary();
+
+	Worker *worker_;
+	QIODevice *sock_;
+	bool authorized_;
+	Transcoder *transcoder_;
+	/* ffmpeg2theora --info for INFO and PROBE, one at a time */
+	QProcess *info_proc_;
+	bool info_probe_;
+	QList<QByteArray> info_lines_;
+	bool closing_;
+	bool reported_;
+	int reason_;
+
+	QFile upload_;
+	qint64 upload_left_;
+	QString uploaded_;
+	QString output_;
+	QFile download_;
+};
+
+#endif // H_WORKER